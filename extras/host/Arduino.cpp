@@ -0,0 +1,26 @@
+#include "Arduino.h"
+
+#include <time.h>
+
+const String String::EMPTY;
+
+static uint64_t monotonicMicros() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+uint32_t millis() {
+  return static_cast<uint32_t>(monotonicMicros() / 1000);
+}
+
+uint32_t micros() {
+  return static_cast<uint32_t>(monotonicMicros());
+}
+
+void delay(uint32_t ms) {
+  struct timespec duration;
+  duration.tv_sec = ms / 1000;
+  duration.tv_nsec = (ms % 1000) * 1000000L;
+  nanosleep(&duration, nullptr);
+}
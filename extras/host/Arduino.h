@@ -0,0 +1,61 @@
+#pragma once
+
+// Minimal stand-in for the Arduino core, just what the library needs to build and run on a Linux host
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <array>
+#include <string>
+
+class String {
+ public:
+  static const String EMPTY;
+
+  String() {}
+  String(const char* str) : _str(str ? str : "") {}  // NOLINT(runtime/explicit)
+  String(const char* str, size_t len) : _str(str, len) {}
+  String(std::string const &str) : _str(str) {}  // NOLINT(runtime/explicit)
+
+  bool empty() const { return _str.empty(); }
+  size_t length() const { return _str.length(); }
+  const char* c_str() const { return _str.c_str(); }
+  const char* begin() const { return _str.data(); }
+  const char* end() const { return _str.data() + _str.length(); }
+  void clear() { _str.clear(); }
+
+  bool concat(const char* str) { _str.append(str); return true; }
+  bool concat(String const &str) { _str.append(str._str); return true; }
+  bool concat(unsigned long long value, unsigned char base) {  // NOLINT(runtime/int)
+    char buffer[8 * sizeof(value) + 1];
+    snprintf(buffer, sizeof(buffer), base == 16 ? "%llx" : "%llu", value);
+    _str.append(buffer);
+    return true;
+  }
+
+  bool operator==(String const &rhs) const { return _str == rhs._str; }
+  bool operator!=(String const &rhs) const { return _str != rhs._str; }
+  bool operator<(String const &rhs) const { return _str < rhs._str; }
+
+ private:
+  std::string _str;
+};
+
+class IPAddress {
+ public:
+  IPAddress() : _address{0, 0, 0, 0} {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address{a, b, c, d} {}
+
+  uint8_t operator[](int index) const { return _address[index]; }
+  uint8_t& operator[](int index) { return _address[index]; }
+  bool operator==(IPAddress const &rhs) const { return memcmp(_address, rhs._address, sizeof(_address)) == 0; }
+
+ private:
+  uint8_t _address[4];
+};
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
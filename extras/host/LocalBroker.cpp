@@ -0,0 +1,492 @@
+#include "LocalBroker.hpp"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+
+// Socket events fetched per epoll_wait call
+#ifndef LOCAL_BROKER_EVENTS
+#define LOCAL_BROKER_EVENTS 256
+#endif
+
+using AsyncMqttClientInternals::LocalBroker;
+
+struct LocalBroker::Session {
+  int fd;
+  size_t index;
+  bool connected;
+  bool closed;
+  bool dirty;
+  bool writing;
+  uint16_t nextPacketId;
+  std::string input;
+  size_t inputOffset;
+  std::string output;
+  size_t outputOffset;
+  std::vector<std::string> filters;
+};
+
+static uint16_t readUint16(const char* data) {
+  return (static_cast<uint8_t>(data[0]) << 8) | static_cast<uint8_t>(data[1]);
+}
+
+static size_t encodeRemainingLength(size_t length, char* encoded) {
+  size_t count = 0;
+  do {
+    uint8_t digit = length % 128;
+    length /= 128;
+    if (length > 0) digit |= 0x80;
+    encoded[count++] = digit;
+  } while (length > 0);
+  return count;
+}
+
+LocalBroker::LocalBroker()
+: _epollFd(-1)
+, _listenFd(-1)
+, _port(0)
+, _events(new struct epoll_event[LOCAL_BROKER_EVENTS])
+, _sessions()
+, _dirty()
+, _closing()
+, _subscribers()
+, _wildcardSubscribers() {
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+LocalBroker::~LocalBroker() {
+  end();
+  delete[] _events;
+}
+
+bool LocalBroker::begin(const char* address, uint16_t port) {
+  if (_listenFd >= 0) return false;
+
+  struct sockaddr_in bindAddress;
+  memset(&bindAddress, 0, sizeof(bindAddress));
+  bindAddress.sin_family = AF_INET;
+  bindAddress.sin_port = htons(port);
+  if (inet_pton(AF_INET, address, &bindAddress.sin_addr) != 1) return false;
+
+  _epollFd = epoll_create1(EPOLL_CLOEXEC);
+  _listenFd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (_epollFd < 0 || _listenFd < 0) {
+    end();
+    return false;
+  }
+
+  int reuse = 1;
+  setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (::bind(_listenFd, reinterpret_cast<struct sockaddr*>(&bindAddress), sizeof(bindAddress)) != 0 ||
+      ::listen(_listenFd, SOMAXCONN) != 0) {
+    end();
+    return false;
+  }
+
+  socklen_t length = sizeof(bindAddress);
+  getsockname(_listenFd, reinterpret_cast<struct sockaddr*>(&bindAddress), &length);
+  _port = ntohs(bindAddress.sin_port);
+
+  // the listening socket is the only entry without a session
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = nullptr;
+  epoll_ctl(_epollFd, EPOLL_CTL_ADD, _listenFd, &event);
+  return true;
+}
+
+void LocalBroker::end() {
+  for (Session* session : _sessions) {
+    if (!session->closed) ::close(session->fd);
+    delete session;
+  }
+  _sessions.clear();
+  _dirty.clear();
+  _closing.clear();
+  _subscribers.clear();
+  _wildcardSubscribers.clear();
+  _stats.sessions = 0;
+
+  if (_listenFd >= 0) ::close(_listenFd);
+  if (_epollFd >= 0) ::close(_epollFd);
+  _listenFd = -1;
+  _epollFd = -1;
+  _port = 0;
+}
+
+uint16_t LocalBroker::port() const {
+  return _port;
+}
+
+LocalBroker::Stats LocalBroker::stats() const {
+  return _stats;
+}
+
+void LocalBroker::loop(int timeout) {
+  if (_epollFd < 0) return;
+
+  int count = epoll_wait(_epollFd, _events, LOCAL_BROKER_EVENTS, timeout);
+  for (int i = 0; i < count; i++) {
+    Session* session = static_cast<Session*>(_events[i].data.ptr);
+    if (!session) {
+      _accept();
+      continue;
+    }
+    if (session->closed) continue;
+
+    uint32_t events = _events[i].events;
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) _read(session);
+    if (!session->closed && (events & EPOLLOUT)) _flush(session);
+  }
+
+  // output is batched per iteration, one send() per session however many messages it got
+  for (size_t i = 0; i < _dirty.size(); i++) {
+    Session* session = _dirty[i];
+    session->dirty = false;
+    if (!session->closed) _flush(session);
+  }
+  _dirty.clear();
+
+  for (Session* session : _closing) {
+    Session* last = _sessions.back();
+    _sessions[session->index] = last;
+    last->index = session->index;
+    _sessions.pop_back();
+    delete session;
+  }
+  _closing.clear();
+}
+
+void LocalBroker::_accept() {
+  while (true) {
+    int fd = accept4(_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    Session* session = new Session();
+    session->fd = fd;
+    session->index = _sessions.size();
+    session->connected = false;
+    session->closed = false;
+    session->dirty = false;
+    session->writing = false;
+    session->nextPacketId = 1;
+    session->inputOffset = 0;
+    session->outputOffset = 0;
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = session;
+    if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      ::close(fd);
+      delete session;
+      continue;
+    }
+    _sessions.push_back(session);
+    _stats.accepted++;
+    _stats.sessions++;
+  }
+}
+
+void LocalBroker::_read(Session* session) {
+  char buffer[16384];
+  ssize_t received = ::recv(session->fd, buffer, sizeof(buffer), 0);
+  if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+    _close(session);
+    return;
+  }
+  if (received < 0) return;
+  session->input.append(buffer, received);
+
+  while (!session->closed) {
+    size_t available = session->input.size() - session->inputOffset;
+    const char* data = session->input.data() + session->inputOffset;
+    if (available < 2) break;
+
+    size_t remainingLength = 0;
+    size_t multiplier = 1;
+    size_t headerLength = 1;
+    bool complete = false;
+    while (headerLength < available && headerLength <= 4) {
+      uint8_t digit = data[headerLength++];
+      remainingLength += (digit & 0x7F) * multiplier;
+      multiplier *= 128;
+      if ((digit & 0x80) == 0) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete) {
+      if (headerLength > 4) _close(session);
+      break;
+    }
+    if (available < headerLength + remainingLength) break;
+
+    session->inputOffset += headerLength + remainingLength;
+    if (!_handle(session, data[0], data + headerLength, remainingLength)) _close(session);
+  }
+  if (session->closed) return;
+
+  if (session->inputOffset == session->input.size()) {
+    session->input.clear();
+    session->inputOffset = 0;
+  } else if (session->inputOffset > sizeof(buffer)) {
+    session->input.erase(0, session->inputOffset);
+    session->inputOffset = 0;
+  }
+}
+
+bool LocalBroker::_handle(Session* session, uint8_t header, const char* body, size_t length) {
+  uint8_t type = header >> 4;
+  if (!session->connected && type != 1) return false;
+
+  switch (type) {
+    case 1: {  // CONNECT
+      if (session->connected) return false;
+      session->connected = true;
+      const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+      _write(session, connAck, sizeof(connAck));
+      return true;
+    }
+    case 3: {  // PUBLISH
+      uint8_t qos = (header >> 1) & 0x03;
+      if (length < 2) return false;
+      size_t topicLength = readUint16(body);
+      size_t position = 2 + topicLength;
+      if (position > length) return false;
+      const char* packetIdBytes = body + position;
+      if (qos > 0) {
+        if (position + 2 > length) return false;
+        position += 2;
+      }
+
+      _stats.published++;
+      _publish(body + 2, topicLength, qos, body + position, length - position);
+      if (qos > 0) {
+        const char ack[] = { static_cast<char>(qos == 1 ? 0x40 : 0x50), 0x02, packetIdBytes[0], packetIdBytes[1] };
+        _write(session, ack, sizeof(ack));
+      }
+      return true;
+    }
+    case 4:  // PUBACK
+    case 7:  // PUBCOMP
+      return true;
+    case 6: {  // PUBREL
+      if (length < 2) return false;
+      const char pubComp[] = { 0x70, 0x02, body[0], body[1] };
+      _write(session, pubComp, sizeof(pubComp));
+      return true;
+    }
+    case 8: {  // SUBSCRIBE
+      if (length < 2) return false;
+      std::string subAck;
+      size_t position = 2;
+      while (position + 2 <= length) {
+        size_t filterLength = readUint16(body + position);
+        position += 2;
+        if (position + filterLength + 1 > length) return false;
+        uint8_t qos = std::min<uint8_t>(body[position + filterLength] & 0x03, 1);
+        _subscribe(session, std::string(body + position, filterLength), qos);
+        subAck.push_back(qos);
+        position += filterLength + 1;
+      }
+
+      char fixedHeader[7];
+      fixedHeader[0] = static_cast<char>(0x90);
+      size_t headerLength = 1 + encodeRemainingLength(2 + subAck.size(), fixedHeader + 1);
+      fixedHeader[headerLength++] = body[0];
+      fixedHeader[headerLength++] = body[1];
+      _write(session, fixedHeader, headerLength);
+      _write(session, subAck.data(), subAck.size());
+      return true;
+    }
+    case 10: {  // UNSUBSCRIBE
+      if (length < 2) return false;
+      size_t position = 2;
+      while (position + 2 <= length) {
+        size_t filterLength = readUint16(body + position);
+        position += 2;
+        if (position + filterLength > length) return false;
+        _unsubscribe(session, std::string(body + position, filterLength));
+        position += filterLength;
+      }
+      const char unsubAck[] = { static_cast<char>(0xB0), 0x02, body[0], body[1] };
+      _write(session, unsubAck, sizeof(unsubAck));
+      return true;
+    }
+    case 12: {  // PINGREQ
+      const char pingResp[] = { static_cast<char>(0xD0), 0x00 };
+      _write(session, pingResp, sizeof(pingResp));
+      return true;
+    }
+    default:  // DISCONNECT, or anything a client should not send
+      return false;
+  }
+}
+
+void LocalBroker::_publish(const char* topic, size_t topicLength, uint8_t qos, const char* payload, size_t payloadLength) {
+  auto exact = _subscribers.find(std::string(topic, topicLength));
+  if (exact != _subscribers.end()) {
+    for (Subscriber const &subscriber : exact->second) {
+      _deliver(subscriber.session, std::min(qos, subscriber.qos), topic, topicLength, payload, payloadLength);
+    }
+  }
+  for (WildcardSubscriber const &subscriber : _wildcardSubscribers) {
+    if (!_matches(subscriber.filter, topic, topicLength)) continue;
+    _deliver(subscriber.session, std::min(qos, subscriber.qos), topic, topicLength, payload, payloadLength);
+  }
+}
+
+void LocalBroker::_deliver(Session* session, uint8_t qos, const char* topic, size_t topicLength, const char* payload, size_t payloadLength) {
+  if (session->closed) return;
+  if (session->output.size() - session->outputOffset > LOCAL_BROKER_MAX_PENDING) {
+    _stats.dropped++;
+    return;
+  }
+
+  char fixedHeader[5];
+  fixedHeader[0] = static_cast<char>(0x30 | (qos << 1));
+  size_t remainingLength = 2 + topicLength + (qos > 0 ? 2 : 0) + payloadLength;
+  size_t headerLength = 1 + encodeRemainingLength(remainingLength, fixedHeader + 1);
+  const char topicLengthBytes[] = { static_cast<char>(topicLength >> 8), static_cast<char>(topicLength & 0xFF) };
+
+  _write(session, fixedHeader, headerLength);
+  _write(session, topicLengthBytes, sizeof(topicLengthBytes));
+  _write(session, topic, topicLength);
+  if (qos > 0) {
+    uint16_t packetId = session->nextPacketId++;
+    if (session->nextPacketId == 0) session->nextPacketId = 1;
+    const char packetIdBytes[] = { static_cast<char>(packetId >> 8), static_cast<char>(packetId & 0xFF) };
+    _write(session, packetIdBytes, sizeof(packetIdBytes));
+  }
+  _write(session, payload, payloadLength);
+  _stats.delivered++;
+}
+
+void LocalBroker::_subscribe(Session* session, std::string const &filter, uint8_t qos) {
+  bool known = std::find(session->filters.begin(), session->filters.end(), filter) != session->filters.end();
+  if (!known) session->filters.push_back(filter);
+
+  if (filter.find_first_of("+#") != std::string::npos) {
+    for (WildcardSubscriber &subscriber : _wildcardSubscribers) {
+      if (subscriber.session != session || subscriber.filter != filter) continue;
+      subscriber.qos = qos;
+      return;
+    }
+    _wildcardSubscribers.push_back({ filter, session, qos });
+    return;
+  }
+
+  std::vector<Subscriber> &subscribers = _subscribers[filter];
+  for (Subscriber &subscriber : subscribers) {
+    if (subscriber.session != session) continue;
+    subscriber.qos = qos;
+    return;
+  }
+  subscribers.push_back({ session, qos });
+}
+
+void LocalBroker::_unsubscribe(Session* session, std::string const &filter) {
+  auto known = std::find(session->filters.begin(), session->filters.end(), filter);
+  if (known == session->filters.end()) return;
+  session->filters.erase(known);
+
+  if (filter.find_first_of("+#") != std::string::npos) {
+    _wildcardSubscribers.erase(std::remove_if(_wildcardSubscribers.begin(), _wildcardSubscribers.end(),
+      [&](WildcardSubscriber const &subscriber) { return subscriber.session == session && subscriber.filter == filter; }),
+      _wildcardSubscribers.end());
+    return;
+  }
+
+  auto exact = _subscribers.find(filter);
+  if (exact == _subscribers.end()) return;
+  std::vector<Subscriber> &subscribers = exact->second;
+  subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(),
+    [&](Subscriber const &subscriber) { return subscriber.session == session; }), subscribers.end());
+  if (subscribers.empty()) _subscribers.erase(exact);
+}
+
+void LocalBroker::_write(Session* session, const char* data, size_t length) {
+  session->output.append(data, length);
+  if (!session->dirty) {
+    session->dirty = true;
+    _dirty.push_back(session);
+  }
+}
+
+void LocalBroker::_flush(Session* session) {
+  while (session->outputOffset < session->output.size()) {
+    ssize_t sent = ::send(session->fd, session->output.data() + session->outputOffset,
+      session->output.size() - session->outputOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent > 0) {
+      session->outputOffset += sent;
+    } else if (sent < 0 && errno == EINTR) {
+      continue;
+    } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else {
+      _close(session);
+      return;
+    }
+  }
+
+  bool pending = session->outputOffset < session->output.size();
+  if (!pending) {
+    session->output.clear();
+    session->outputOffset = 0;
+  }
+  if (pending != session->writing) {
+    struct epoll_event event;
+    event.events = EPOLLIN | (pending ? EPOLLOUT : 0);
+    event.data.ptr = session;
+    epoll_ctl(_epollFd, EPOLL_CTL_MOD, session->fd, &event);
+    session->writing = pending;
+  }
+}
+
+void LocalBroker::_close(Session* session) {
+  if (session->closed) return;
+  session->closed = true;
+  ::close(session->fd);
+
+  std::vector<std::string> filters = session->filters;
+  for (std::string const &filter : filters) _unsubscribe(session, filter);
+  session->output.clear();
+  session->input.clear();
+  _closing.push_back(session);
+  _stats.sessions--;
+}
+
+bool LocalBroker::_matches(std::string const &filter, const char* topic, size_t topicLength) {
+  size_t f = 0;
+  size_t t = 0;
+  while (f < filter.size()) {
+    if (filter[f] == '#') return true;
+    // "a/#" also matches "a"
+    if (t == topicLength && filter.compare(f, std::string::npos, "/#") == 0) return true;
+    if (filter[f] == '+') {
+      while (t < topicLength && topic[t] != '/') t++;
+      f++;
+    } else {
+      if (t >= topicLength || filter[f] != topic[t]) return false;
+      f++;
+      t++;
+      continue;
+    }
+    if (f == filter.size()) return t == topicLength;
+    // past a '+' both must continue with a level separator
+    if (t >= topicLength || topic[t] != '/' || filter[f] != '/') return false;
+    f++;
+    t++;
+  }
+  return t == topicLength;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+// Minimal MQTT 3.1.1 broker for load testing on one machine, not a real broker:
+// no authentication, no retained messages, no persistence, QoS 2 is downgraded to QoS 1 on delivery.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Pending output past which messages to a slow subscriber are dropped
+#ifndef LOCAL_BROKER_MAX_PENDING
+#define LOCAL_BROKER_MAX_PENDING (1024 * 1024)
+#endif
+
+struct epoll_event;
+
+namespace AsyncMqttClientInternals {
+class LocalBroker {
+ public:
+  struct Stats {
+    uint64_t accepted;
+    uint64_t published;
+    uint64_t delivered;
+    uint64_t dropped;
+    uint32_t sessions;
+  };
+
+  LocalBroker();
+  ~LocalBroker();
+
+  LocalBroker(LocalBroker const &) = delete;
+  LocalBroker& operator=(LocalBroker const &) = delete;
+
+  // Listens on address:port, port 0 picks a free one, see port()
+  bool begin(const char* address = "127.0.0.1", uint16_t port = 0);
+  void end();
+  uint16_t port() const;
+
+  // Waits at most timeout milliseconds for socket events and serves them
+  void loop(int timeout);
+
+  Stats stats() const;
+
+ private:
+  struct Session;
+  struct Subscriber {
+    Session* session;
+    uint8_t qos;
+  };
+  struct WildcardSubscriber {
+    std::string filter;
+    Session* session;
+    uint8_t qos;
+  };
+
+  int _epollFd;
+  int _listenFd;
+  uint16_t _port;
+  struct epoll_event* _events;
+  std::vector<Session*> _sessions;
+  std::vector<Session*> _dirty;
+  std::vector<Session*> _closing;
+  std::unordered_map<std::string, std::vector<Subscriber>> _subscribers;
+  std::vector<WildcardSubscriber> _wildcardSubscribers;
+  Stats _stats;
+
+  void _accept();
+  void _read(Session* session);
+  bool _handle(Session* session, uint8_t header, const char* body, size_t length);
+  void _publish(const char* topic, size_t topicLength, uint8_t qos, const char* payload, size_t payloadLength);
+  void _deliver(Session* session, uint8_t qos, const char* topic, size_t topicLength, const char* payload, size_t payloadLength);
+  void _subscribe(Session* session, std::string const &filter, uint8_t qos);
+  void _unsubscribe(Session* session, std::string const &filter);
+  void _write(Session* session, const char* data, size_t length);
+  void _flush(Session* session);
+  void _close(Session* session);
+
+  static bool _matches(std::string const &filter, const char* topic, size_t topicLength);
+};
+}  // namespace AsyncMqttClientInternals
@@ -0,0 +1,313 @@
+// Aggregation: six sensors publish a QoS 1 reading each per second, 360 publishes a minute, over a link of 32 kB/s with
+// a round trip of 80 ms. Each TCP segment carries 40 bytes of TCP/IP headers and wakes the radio, which stays on 200 ms
+// after the last segment sent or received, as Wi-Fi power save does (a cellular modem stays on for seconds). Publishes
+// go out one by one, or gathered into batches by time window and byte budget, unpacked by the broker side with
+// BatchDecoder. Reports the bytes on the wire, the segments and the time the radio is on per minute, and the delay of
+// the readings, which must all arrive intact and in order.
+// usage: Aggregation
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <AsyncMqttClient.h>
+
+#if ASYNC_MQTT_AGGREGATION
+using AsyncMqttClientInternals::BatchDecoder;
+using AsyncMqttClientInternals::BatchRecord;
+using AsyncMqttClientInternals::LoopbackTransport;
+
+static const uint32_t RATE = 32;  // bytes per millisecond
+static const uint32_t ROUND_TRIP = 80;
+static const uint32_t DURATION = 600000;
+static const uint32_t MSS = 1460;
+static const uint32_t SEGMENT_HEADERS = 40;  // IPv4 and TCP
+static const uint32_t RADIO_TAIL = 200;
+static const char* const SENSORS[] = {
+  "home/kitchen/temperature", "home/kitchen/humidity", "home/living/temperature",
+  "home/living/co2", "home/garage/temperature", "home/garage/door"
+};
+static const size_t SENSOR_COUNT = sizeof(SENSORS) / sizeof(SENSORS[0]);
+
+struct Config {
+  const char* name;
+  size_t budget;  // 0 for no aggregation
+  uint32_t window;
+};
+
+struct Reading {
+  uint32_t time;
+  std::string topic;
+  std::string payload;
+};
+
+struct Result {
+  size_t wireBytes = 0;
+  size_t segments = 0;
+  uint32_t radioOn = 0;
+  size_t wakeUps = 0;
+  size_t received = 0;
+  bool intact = true;
+  size_t batchesAcked = 0;
+  std::vector<uint32_t> delays;
+  AsyncMqttClientAggregationStats stats = {};
+};
+
+static uint32_t simulatedMillis = 0;
+static uint32_t simulatedClock() { return simulatedMillis; }
+
+// the link and the broker: segments go out as the client writes, at the rate of the link, each acknowledged a round
+// trip after its last byte left, along with the PUBACKs it brought about; the radio is on around every segment
+class Link {
+ public:
+  Link(LoopbackTransport* transport, std::vector<Reading> const *readings, Config const &config, Result* result)
+  : _transport(transport)
+  , _readings(readings)
+  , _config(config)
+  , _result(result)
+  , _written(0)
+  , _transmitted(0)
+  , _segmentSent(0)
+  , _radioUntil(0) {
+  }
+
+  void connect(AsyncMqttClient* client) {
+    client->connect();
+    _transport->acknowledge(_transport->outboundLength());
+    const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+    _transport->deliver(connAck, sizeof(connAck));
+  }
+
+  // after the client's millisecond: what it wrote leaves in segments of at most MSS bytes
+  void written() {
+    size_t length = _transport->outboundLength() - _written;
+    if (length == 0) return;
+    _written += length;
+    for (size_t offset = 0; offset < length; offset += MSS) {
+      _segments.push_back(std::min<size_t>(MSS, length - offset));
+      _result->segments++;
+      _result->wireBytes += _segments.back() + SEGMENT_HEADERS;
+    }
+    _radio();
+  }
+
+  void tick() {
+    size_t length = std::min<size_t>(RATE, _written - _transmitted);
+    if (length > 0) {
+      _stream.append(_transport->outbound() + _transmitted, length);
+      _transmitted += length;
+      _segmentSent += length;
+      while (!_segments.empty() && _segmentSent >= _segments.front()) {
+        _segmentSent -= _segments.front();
+        _acks.push_back(std::make_pair(simulatedMillis + ROUND_TRIP, _segments.front()));
+        _segments.pop_front();
+      }
+      _decode();
+    }
+    bool received = false;
+    while (!_acks.empty() && _acks.front().first <= simulatedMillis) {
+      size_t acknowledged = _acks.front().second;
+      _acks.pop_front();
+      _transmitted -= acknowledged;
+      _written -= acknowledged;
+      _transport->acknowledge(acknowledged);
+      received = true;
+    }
+    std::string replies;
+    while (!_replies.empty() && _replies.front().first <= simulatedMillis) {
+      replies += _replies.front().second;
+      _replies.pop_front();
+    }
+    // the acks and replies of a millisecond come back in one segment
+    if (received || !replies.empty()) {
+      _result->segments++;
+      _result->wireBytes += replies.size() + SEGMENT_HEADERS;
+      _radio();
+    }
+    if (!replies.empty()) _transport->deliver(replies.data(), replies.size());
+  }
+
+ private:
+  LoopbackTransport* _transport;
+  std::vector<Reading> const *_readings;
+  Config _config;
+  Result* _result;
+  size_t _written;
+  size_t _transmitted;
+  size_t _segmentSent;  // of the first segment not yet whole on the link
+  uint32_t _radioUntil;
+  std::deque<size_t> _segments;
+  std::deque<std::pair<uint32_t, size_t>> _acks;
+  std::deque<std::pair<uint32_t, std::string>> _replies;
+  std::string _stream;
+
+  void _radio() {
+    if (simulatedMillis >= _radioUntil) {
+      _result->radioOn += RADIO_TAIL;
+      _result->wakeUps++;
+    } else {
+      _result->radioOn += simulatedMillis + RADIO_TAIL - _radioUntil;
+    }
+    _radioUntil = simulatedMillis + RADIO_TAIL;
+  }
+
+  // the next reading, checked against what was published; its publish time, or 0 past the end
+  uint32_t _reading(const char* topic, size_t topicLength, const char* payload, size_t length) {
+    if (_result->received >= _readings->size()) {
+      _result->intact = false;
+      return 0;
+    }
+    Reading const &expected = (*_readings)[_result->received++];
+    _result->intact &= expected.topic.compare(0, std::string::npos, topic, topicLength) == 0 &&
+      expected.payload.compare(0, std::string::npos, payload, length) == 0;
+    // arrives half a round trip after it went out
+    _result->delays.push_back(simulatedMillis + ROUND_TRIP / 2 - expected.time);
+    return expected.time;
+  }
+
+  void _decode() {
+    for (;;) {
+      if (_stream.size() < 2) return;
+      size_t remaining = 0;
+      size_t position = 1;
+      uint32_t multiplier = 1;
+      uint8_t byte;
+      do {
+        if (position >= _stream.size()) return;
+        byte = static_cast<uint8_t>(_stream[position++]);
+        remaining += (byte & 0x7F) * multiplier;
+        multiplier *= 128;
+      } while (byte & 0x80);
+      if (_stream.size() < position + remaining) return;
+
+      uint8_t header = static_cast<uint8_t>(_stream[0]);
+      std::string body = _stream.substr(position, remaining);
+      _stream.erase(0, position + remaining);
+      if (header >> 4 == 12) _replies.push_back(std::make_pair(simulatedMillis + ROUND_TRIP, std::string("\xD0\x00", 2)));
+      if (header >> 4 != 3) continue;
+
+      uint8_t qos = (header >> 1) & 0x03;
+      size_t topicLength = static_cast<uint8_t>(body[0]) << 8 | static_cast<uint8_t>(body[1]);
+      std::string topic = body.substr(2, topicLength);
+      std::string payload = body.substr(2 + topicLength + (qos != 0 ? 2 : 0));
+      if (qos == 1) {
+        const char pubAck[] = { 0x40, 0x02, body[2 + topicLength], body[3 + topicLength] };
+        _replies.push_back(std::make_pair(simulatedMillis + ROUND_TRIP, std::string(pubAck, sizeof(pubAck))));
+      }
+      if (_config.budget == 0) {
+        _reading(topic.data(), topic.size(), payload.data(), payload.size());
+        continue;
+      }
+      // the publish time and age of each record give the same time for the batch being sent
+      BatchDecoder decoder(payload.data(), payload.size());
+      BatchRecord record;
+      uint32_t sent = 0;
+      bool first = true;
+      while (decoder.next(&record)) {
+        uint32_t recordSent = _reading(record.topic, record.topicLength, record.payload, record.length) + record.age;
+        _result->intact &= first || recordSent == sent;
+        sent = recordSent;
+        first = false;
+      }
+      _result->intact &= !decoder.failed() && !first;
+    }
+  }
+};
+
+static Result simulate(Config const &config) {
+  LoopbackTransport transport;
+  AsyncMqttClient client(&transport);
+  client.setClock(simulatedClock);
+  client.setServer("localhost", 1883);
+  if (config.budget != 0) {
+    client.setAggregation("home/batch", config.budget, config.window);
+    client.addAggregatedTopics("home/+/+");
+  }
+
+  Result result;
+  // the PUBACK of a batch covers its records: publish() gave them no packet ID, onBatchSent() gives the batch's
+  std::vector<uint16_t> batchIds;
+  uint32_t batchedRecords = 0;
+  client.onBatchSent([&](uint16_t packetId, uint32_t records) {
+    batchIds.push_back(packetId);
+    batchedRecords += records;
+  });
+  client.onPublish([&](uint16_t packetId) {
+    if (std::find(batchIds.begin(), batchIds.end(), packetId) != batchIds.end()) result.batchesAcked++;
+  });
+  std::vector<Reading> readings;
+  Link link(&transport, &readings, config, &result);
+  simulatedMillis = 0;
+  link.connect(&client);
+
+  uint32_t counter = 0;
+  for (simulatedMillis = 1; simulatedMillis < DURATION; simulatedMillis++) {
+    link.tick();
+    if (simulatedMillis % 10 == 0) transport.poll();
+
+    // a reading per sensor per second, staggered
+    for (size_t sensor = 0; sensor < SENSOR_COUNT; sensor++) {
+      if (simulatedMillis % 1000 != sensor * 1000 / SENSOR_COUNT) continue;
+      counter = counter * 1103515245 + 12345;
+      char payload[16];
+      snprintf(payload, sizeof(payload), "%u.%02u", 15 + (counter >> 16) % 15, (counter >> 8) % 100);
+      if (client.publish(SENSORS[sensor], 1, false, payload, strlen(payload)) != 0) {
+        readings.push_back(Reading { simulatedMillis, SENSORS[sensor], payload });
+      }
+    }
+    link.written();
+  }
+  result.stats = client.aggregationStats();
+  // each batch announced once and acknowledged, but the ones still on the way
+  result.intact &= batchIds.size() == result.stats.batches && batchedRecords == result.stats.records - result.stats.pending;
+  result.intact &= result.batchesAcked + 2 >= batchIds.size() && std::find(batchIds.begin(), batchIds.end(), 0) == batchIds.end();
+  // readings still gathered or on the way at the end are not counted
+  result.intact &= result.received + result.stats.pending + 12 >= readings.size();
+  return result;
+}
+
+static uint32_t percentile(std::vector<uint32_t> values, double fraction) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  return values[std::min(values.size() - 1, static_cast<size_t>(fraction * values.size()))];
+}
+
+int main() {
+  const Config configs[] = {
+    { "one publish per reading", 0, 0 },
+    { "batches of 1 s", 1024, 1000 },
+    { "batches of 10 s", 1024, 10000 },
+    { "batches of 60 s, 1024 B budget", 1024, 60000 }
+  };
+  bool ok = true;
+  double minutes = DURATION / 60000.0;
+  printf("%zu sensors, a QoS 1 reading each per second, %u kB/s, %u ms round trip, radio on %u ms after a segment\n\n",
+    SENSOR_COUNT, RATE, ROUND_TRIP, RADIO_TAIL);
+  printf("%-32s %9s %10s %9s %9s %8s %8s %8s %9s\n", "", "readings", "wire/min", "segm/min", "wakes/min", "radio", "p50", "p99", "batches");
+  Result baseline;
+  for (Config const &config : configs) {
+    Result result = simulate(config);
+    char batches[32] = "-";
+    if (config.budget != 0) snprintf(batches, sizeof(batches), "%u+%u", result.stats.byWindow, result.stats.byBudget);
+    printf("%-32s %9zu %7.0f kB %9.0f %9.0f %7.1f%% %5u ms %5u ms %9s%s\n", config.name, result.received,
+      result.wireBytes / minutes / 1000, result.segments / minutes, result.wakeUps / minutes, result.radioOn * 100.0 / DURATION,
+      percentile(result.delays, 0.5), percentile(result.delays, 0.99), batches, result.intact ? "" : " NOT INTACT");
+    ok &= result.intact && result.received > DURATION / 1000 * SENSOR_COUNT * 9 / 10;
+    if (config.budget == 0) {
+      baseline = result;
+      continue;
+    }
+    // a reading waits for its window at most, then for the batch to cross the link
+    ok &= percentile(result.delays, 1) <= config.window + ROUND_TRIP / 2 + config.budget / RATE + 64;
+    ok &= result.wireBytes < baseline.wireBytes / 2 && result.radioOn < baseline.radioOn / 2;
+  }
+  printf("\n%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+#else
+int main() {
+  printf("built with ASYNC_MQTT_AGGREGATION 0\n");
+  return 0;
+}
+#endif
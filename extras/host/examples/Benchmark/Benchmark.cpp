@@ -0,0 +1,520 @@
+// Parser and encoder microbenchmarks over a loopback transport: synthetic inbound streams (or a captured one,
+// --stream, raw or exported from a FrameCapture) fed to the parser in TCP sized segments, one byte at a time or
+// as captured, and publish/subscribe encoding, some of them through a CaptureTransport to measure its overhead,
+// and a telemetry document published as a JSON String and with publishCbor().
+// Reports messages/s, bytes/s, ns, bytes and allocations per message, as a table or as JSON (--json), and compares
+// with the JSON of an earlier run (--baseline) to catch regressions between releases.
+// usage: Benchmark [--json] [--time MS] [--filter TEXT] [--stream FILE] [--baseline FILE] [--tolerance PERCENT]
+
+#include <getopt.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <AsyncMqttClient.h>
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* pointer = malloc(size);
+  if (!pointer) throw std::bad_alloc();
+  return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+  free(pointer);
+}
+
+void operator delete(void* pointer, size_t size) noexcept {
+  (void)size;
+  free(pointer);
+}
+
+// operator new, plus the blocks the client takes through its allocator hooks
+static size_t allocationCount() {
+  size_t count = allocations;
+  for (uint8_t tag = 0; tag < ASYNC_MQTT_MEMORY_TAGS; tag++) {
+    count += AsyncMqttClient::memoryStats(static_cast<AsyncMqttClientMemoryTag>(tag)).allocations;
+  }
+  return count;
+}
+
+static const size_t SEGMENT = 1460;  // a TCP segment
+static const size_t SMALL_PAYLOAD = 16;
+static const size_t LARGE_PAYLOAD = 4096;
+static const char TOPIC[] = "devices/benchmark/sensors/temperature";
+static const char TELEMETRY_TOPIC[] = "devices/benchmark/telemetry";
+static const float READINGS[] = { 21.5f, 21.75f, 22.0f, 21.25f, 20.5f, 20.75f, 21.0f, 21.5f };
+
+struct Options {
+  bool json = false;
+  uint32_t time = 200;
+  const char* filter = nullptr;
+  const char* stream = nullptr;
+  const char* baseline = nullptr;
+  double tolerance = 10;
+};
+
+struct Result {
+  std::string name;
+  uint64_t messages;
+  uint64_t bytes;
+  double seconds;
+  uint64_t allocations;
+  bool valid;
+
+  double nsPerMessage() const { return seconds * 1e9 / messages; }
+  double bytesPerMessage() const { return static_cast<double>(bytes) / messages; }
+  double allocationsPerMessage() const { return static_cast<double>(allocations) / messages; }
+};
+
+static void usage(const char* name) {
+  fprintf(stderr, "usage: %s [--json] [--time MS] [--filter TEXT] [--stream FILE] [--baseline FILE] [--tolerance PERCENT]\n", name);
+}
+
+static bool parseOptions(int argc, char** argv, Options* options) {
+  static const struct option longOptions[] = {
+    { "json", no_argument, nullptr, 'j' },
+    { "time", required_argument, nullptr, 't' },
+    { "filter", required_argument, nullptr, 'f' },
+    { "stream", required_argument, nullptr, 's' },
+    { "baseline", required_argument, nullptr, 'b' },
+    { "tolerance", required_argument, nullptr, 'T' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  int option;
+  while ((option = getopt_long(argc, argv, "", longOptions, nullptr)) != -1) {
+    switch (option) {
+      case 'j': options->json = true; break;
+      case 't': options->time = strtoul(optarg, nullptr, 10); break;
+      case 'f': options->filter = optarg; break;
+      case 's': options->stream = optarg; break;
+      case 'b': options->baseline = optarg; break;
+      case 'T': options->tolerance = strtod(optarg, nullptr); break;
+      default: return false;
+    }
+  }
+  return optind == argc && options->time > 0;
+}
+
+static void appendPacket(std::string* stream, uint8_t header, const std::string &body) {
+  char remainingLength[4];
+  stream->push_back(static_cast<char>(header));
+  stream->append(remainingLength, AsyncMqttClientInternals::Helpers::encodeRemainingLength(body.size(), remainingLength));
+  stream->append(body);
+}
+
+static std::string packetId(uint16_t id) {
+  return std::string(1, static_cast<char>(id >> 8)) + static_cast<char>(id & 0xFF);
+}
+
+// PUBLISH packets from the broker, each QoS 2 one followed by its PUBREL
+static std::string publishStream(uint8_t qos, size_t payloadLength, size_t count, size_t* packets) {
+  std::string stream;
+  std::string payload(payloadLength, 'x');
+  *packets = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint16_t id = 1 + i % 60000;
+    std::string body = packetId(sizeof(TOPIC) - 1) + TOPIC;
+    if (qos > 0) body += packetId(id);
+    appendPacket(&stream, 0x30 | qos << 1, body + payload);
+    (*packets)++;
+    if (qos == 2) {
+      appendPacket(&stream, 0x62, packetId(id));
+      (*packets)++;
+    }
+  }
+  return stream;
+}
+
+// acks of the client's own publishes, subscriptions and unsubscriptions
+static std::string ackStream(size_t count, size_t* packets) {
+  std::string stream;
+  for (size_t i = 0; i < count; i++) {
+    uint16_t id = 1 + i % 60000;
+    appendPacket(&stream, 0x40, packetId(id));
+    appendPacket(&stream, 0x50, packetId(id));
+    appendPacket(&stream, 0x70, packetId(id));
+    appendPacket(&stream, 0x90, packetId(id) + '\x01');
+    appendPacket(&stream, 0xB0, packetId(id));
+  }
+  *packets = count * 5;
+  return stream;
+}
+
+static bool readStream(const char* path, std::string* stream) {
+  FILE* file = fopen(path, "rb");
+  if (!file) return false;
+  char buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) stream->append(buffer, length);
+  fclose(file);
+  return true;
+}
+
+// whole packets at the start of a captured stream, with the number of them
+static size_t wholePackets(std::string const &stream, size_t* packets) {
+  size_t position = 0;
+  *packets = 0;
+  while (position < stream.size()) {
+    size_t cursor = position + 1;
+    uint32_t remainingLength = 0;
+    uint32_t multiplier = 1;
+    uint8_t byte;
+    do {
+      if (cursor >= stream.size()) return position;
+      byte = stream[cursor++];
+      remainingLength += (byte & 127) * multiplier;
+      multiplier *= 128;
+    } while ((byte & 128) && multiplier <= 128 * 128 * 128);
+    if (cursor + remainingLength > stream.size()) return position;
+    position = cursor + remainingLength;
+    (*packets)++;
+  }
+  return position;
+}
+
+// The inbound segments of the first connection of an exported capture, as delivered, without the CONNACK that
+// connect() answers already. False if the capture does not hold them whole, or holds none.
+static bool capturedSegments(std::string const &capture, std::string* stream, std::vector<size_t>* segments) {
+  AsyncMqttClientInternals::CaptureReader reader(reinterpret_cast<const uint8_t*>(capture.data()), capture.size());
+  AsyncMqttClientInternals::CaptureRecord record;
+  bool connected = false;
+  size_t connAck = 4;
+  while (reader.next(&record)) {
+    if (record.direction == AsyncMqttClientInternals::CaptureDirection::CONNECTED) {
+      if (connected) break;
+      connected = true;
+    } else if (record.direction == AsyncMqttClientInternals::CaptureDirection::DISCONNECTED) {
+      if (connected) break;
+    } else if (record.direction == AsyncMqttClientInternals::CaptureDirection::INBOUND && connected) {
+      if (record.captured != record.length) return false;
+      size_t skipped = connAck < record.length ? connAck : record.length;
+      connAck -= skipped;
+      if (record.length == skipped) continue;
+      stream->append(reinterpret_cast<const char*>(record.data) + skipped, record.length - skipped);
+      segments->push_back(record.length - skipped);
+    }
+  }
+  return !stream->empty();
+}
+
+static std::vector<size_t> fixedSegments(size_t length, size_t segment) {
+  std::vector<size_t> segments;
+  for (size_t position = 0; position < length; position += segment) segments.push_back(length - position < segment ? length - position : segment);
+  return segments;
+}
+
+static double elapsedSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool connect(AsyncMqttClient* client, AsyncMqttClientInternals::LoopbackTransport* broker) {
+  client->setServer("localhost", 1883);
+  client->connect();
+  broker->acknowledge(broker->outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker->deliver(connAck, sizeof(connAck));
+  // acks are acknowledged as soon as they are sent, the transport never fills up
+  broker->setAutoAcknowledge(true);
+  return client->connected();
+}
+
+// Runs the benchmark with a client on the loopback transport, or on a CaptureTransport over it given a capture
+template <typename Run>
+static Result withClient(AsyncMqttClientInternals::FrameCapture* capture, Run run) {
+  AsyncMqttClientInternals::LoopbackTransport broker(65536);
+  if (!capture) {
+    AsyncMqttClient client(&broker);
+    return run(&client, &broker);
+  }
+  AsyncMqttClientInternals::CaptureTransport captured(&broker, capture);
+  AsyncMqttClient client(&captured);
+  return run(&client, &broker);
+}
+
+// Feeds the stream to the parser, in the given segments, until the time is up.
+// expectedMessages are the PUBLISH packets per stream, checked against the onMessage calls.
+static Result parse(const char* name, std::string const &stream, std::vector<size_t> const &segments, size_t packets, size_t expectedMessages,
+  uint32_t time, AsyncMqttClientInternals::FrameCapture* capture = nullptr) {
+  return withClient(capture, [&](AsyncMqttClient* client, AsyncMqttClientInternals::LoopbackTransport* broker) {
+    client->setMaxTopicLength(256);
+    uint64_t received = 0;
+    client->onMessage([&received](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+      (void)topic;
+      (void)payload;
+      (void)properties;
+      (void)len;
+      (void)total;
+      if (index == 0) received++;
+    });
+    Result result = { name, 0, 0, 0, 0, connect(client, broker) };
+
+    size_t rounds = 0;
+    size_t before = allocationCount();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    do {
+      size_t position = 0;
+      for (size_t segment : segments) {
+        broker->deliver(stream.data() + position, segment);
+        position += segment;
+      }
+      rounds++;
+      result.seconds = elapsedSince(start);
+    } while (result.seconds * 1000 < time);
+    result.allocations = allocationCount() - before;
+    result.messages = rounds * packets;
+    result.bytes = rounds * stream.size();
+    result.valid = result.valid && client->connected() && received == rounds * expectedMessages;
+    return result;
+  });
+}
+
+// Calls encode (which returns false on a failure) 1000 times per round until the time is up
+template <typename Encode>
+static Result encode(const char* name, uint32_t time, Encode encodePacket, AsyncMqttClientInternals::FrameCapture* capture = nullptr) {
+  return withClient(capture, [&](AsyncMqttClient* client, AsyncMqttClientInternals::LoopbackTransport* broker) {
+    Result result = { name, 0, 0, 0, 0, connect(client, broker) };
+
+    // one packet, to measure its size
+    broker->setAutoAcknowledge(false);
+    result.valid = result.valid && encodePacket(client);
+    size_t packetSize = broker->outboundLength();
+    broker->acknowledge(packetSize);
+    broker->setAutoAcknowledge(true);
+
+    size_t before = allocationCount();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    do {
+      for (int i = 0; i < 1000; i++) result.valid = encodePacket(client) && result.valid;
+      result.messages += 1000;
+      result.seconds = elapsedSince(start);
+    } while (result.seconds * 1000 < time);
+    result.allocations = allocationCount() - before;
+    result.bytes = result.messages * packetSize;
+    return result;
+  });
+}
+
+// The same telemetry document built the usual way, a String grown field by field then copied into the transport,
+// and written into the transport as CBOR, sized in a first pass
+static bool publishJsonTelemetry(AsyncMqttClient* client) {
+  char number[16];
+  String json("{\"device\":\"sensor-0042\",\"time\":");
+  json.concat(1700000000ULL, 10);
+  json.concat(",\"battery\":");
+  json.concat(87ULL, 10);
+  json.concat(",\"ok\":true,\"temperature\":[");
+  for (size_t i = 0; i < sizeof(READINGS) / sizeof(READINGS[0]); i++) {
+    snprintf(number, sizeof(number), "%s%.2f", i == 0 ? "" : ",", READINGS[i]);
+    json.concat(number);
+  }
+  json.concat("]}");
+  return client->publish(TELEMETRY_TOPIC, 1, false, json.c_str(), json.length()) != 0;
+}
+
+static void cborTelemetry(AsyncMqttClientInternals::CborWriter& writer) {
+  writer.map(5);
+  writer.text("device").text("sensor-0042");
+  writer.text("time").integer(1700000000);
+  writer.text("battery").integer(87);
+  writer.text("ok").boolean(true);
+  writer.text("temperature").array(sizeof(READINGS) / sizeof(READINGS[0]));
+  for (float reading : READINGS) writer.number(reading);
+}
+
+// ns and allocations per message of each result of an earlier JSON output, one result per line
+static bool compare(const char* path, std::vector<Result> const &results, double tolerance) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    fprintf(stderr, "Cannot read %s\n", path);
+    return false;
+  }
+  bool ok = true;
+  char line[512];
+  while (fgets(line, sizeof(line), file)) {
+    const char* name = strstr(line, "\"name\": \"");
+    const char* ns = strstr(line, "\"ns_per_message\": ");
+    const char* allocated = strstr(line, "\"allocations_per_message\": ");
+    if (!name || !ns || !allocated) continue;
+    name += strlen("\"name\": \"");
+    std::string baselineName(name, strchr(name, '"') - name);
+    double baselineNs = strtod(ns + strlen("\"ns_per_message\": "), nullptr);
+    double baselineAllocations = strtod(allocated + strlen("\"allocations_per_message\": "), nullptr);
+    for (Result const &result : results) {
+      if (result.name != baselineName) continue;
+      if (result.nsPerMessage() > baselineNs * (1 + tolerance / 100)) {
+        fprintf(stderr, "Regression: %s takes %.1f ns per message, %.1f in the baseline\n", result.name.c_str(), result.nsPerMessage(), baselineNs);
+        ok = false;
+      }
+      if (result.allocationsPerMessage() > baselineAllocations + 0.005) {
+        fprintf(stderr, "Regression: %s makes %.2f allocations per message, %.2f in the baseline\n", result.name.c_str(),
+          result.allocationsPerMessage(), baselineAllocations);
+        ok = false;
+      }
+    }
+  }
+  fclose(file);
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<Result> results;
+  auto selected = [&options](const char* name) { return !options.filter || strstr(name, options.filter); };
+  auto addParse = [&](const char* name, uint8_t qos, size_t payloadLength, size_t segment) {
+    if (!selected(name)) return;
+    size_t packets;
+    std::string stream = publishStream(qos, payloadLength, payloadLength > SEGMENT ? 16 : 256, &packets);
+    results.push_back(parse(name, stream, fixedSegments(stream.size(), segment), packets, qos == 2 ? packets / 2 : packets, options.time));
+  };
+
+  addParse("parse/publish-qos0-small", 0, SMALL_PAYLOAD, SEGMENT);
+  addParse("parse/publish-qos1-small", 1, SMALL_PAYLOAD, SEGMENT);
+  addParse("parse/publish-qos2-small", 2, SMALL_PAYLOAD, SEGMENT);
+  addParse("parse/publish-qos0-large", 0, LARGE_PAYLOAD, SEGMENT);
+  addParse("parse/publish-qos1-large", 1, LARGE_PAYLOAD, SEGMENT);
+  addParse("parse/publish-qos2-large", 2, LARGE_PAYLOAD, SEGMENT);
+  addParse("parse/publish-qos1-one-byte-segments", 1, SMALL_PAYLOAD, 1);
+  if (selected("parse/ack-storm")) {
+    size_t packets;
+    std::string stream = ackStream(256, &packets);
+    results.push_back(parse("parse/ack-storm", stream, fixedSegments(stream.size(), SEGMENT), packets, 0, options.time));
+  }
+  // the capture overhead: every segment kept whole in a 64 KiB ring, or its first 16 bytes
+  static uint8_t ring[65536];
+  if (selected("parse/publish-qos1-small-captured")) {
+    size_t packets;
+    std::string stream = publishStream(1, SMALL_PAYLOAD, 256, &packets);
+    AsyncMqttClientInternals::FrameCapture capture(ring, sizeof(ring));
+    results.push_back(parse("parse/publish-qos1-small-captured", stream, fixedSegments(stream.size(), SEGMENT), packets, packets, options.time, &capture));
+  }
+  if (selected("parse/publish-qos1-small-captured-headers")) {
+    size_t packets;
+    std::string stream = publishStream(1, SMALL_PAYLOAD, 256, &packets);
+    AsyncMqttClientInternals::FrameCapture capture(ring, sizeof(ring), 16);
+    results.push_back(parse("parse/publish-qos1-small-captured-headers", stream, fixedSegments(stream.size(), SEGMENT), packets, packets, options.time,
+      &capture));
+  }
+  if (options.stream) {
+    std::string stream;
+    if (!readStream(options.stream, &stream)) {
+      fprintf(stderr, "Cannot read %s\n", options.stream);
+      return 2;
+    }
+    // an exported FrameCapture is fed as it was captured, a raw stream in TCP sized segments; either way its
+    // PUBLISH count is not known, the probe below counts them
+    std::vector<size_t> segments;
+    if (AsyncMqttClientInternals::CaptureReader(reinterpret_cast<const uint8_t*>(stream.data()), stream.size()).valid()) {
+      std::string capture;
+      capture.swap(stream);
+      if (!capturedSegments(capture, &stream, &segments)) {
+        fprintf(stderr, "No whole inbound segment in the capture in %s\n", options.stream);
+        return 2;
+      }
+    }
+    size_t packets;
+    size_t whole = wholePackets(stream, &packets);
+    if (segments.empty()) {
+      stream.resize(whole);
+      segments = fixedSegments(stream.size(), SEGMENT);
+    } else if (whole != stream.size()) {
+      fprintf(stderr, "The capture in %s ends within a packet\n", options.stream);
+      return 2;
+    }
+    if (packets == 0) {
+      fprintf(stderr, "No whole packet in %s\n", options.stream);
+      return 2;
+    }
+    AsyncMqttClientInternals::LoopbackTransport probe;
+    AsyncMqttClient client(&probe);
+    uint64_t messages = 0;
+    client.onMessage([&messages](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+      (void)topic;
+      (void)payload;
+      (void)properties;
+      (void)len;
+      (void)total;
+      if (index == 0) messages++;
+    });
+    connect(&client, &probe);
+    probe.deliver(stream.data(), stream.size());
+    results.push_back(parse("parse/captured", stream, segments, packets, messages, options.time));
+  }
+
+  std::string smallPayload(SMALL_PAYLOAD, 'x');
+  std::string largePayload(LARGE_PAYLOAD, 'x');
+  for (uint8_t qos = 0; qos <= 2; qos++) {
+    std::string name = "encode/publish-qos" + std::to_string(qos) + "-small";
+    if (selected(name.c_str())) {
+      results.push_back(encode(name.c_str(), options.time, [&smallPayload, qos](AsyncMqttClient* client) {
+        return client->publish(TOPIC, qos, false, smallPayload.data(), smallPayload.size()) != 0;
+      }));
+    }
+  }
+  if (selected("encode/publish-qos1-large")) {
+    results.push_back(encode("encode/publish-qos1-large", options.time, [&largePayload](AsyncMqttClient* client) {
+      return client->publish(TOPIC, 1, false, largePayload.data(), largePayload.size()) != 0;
+    }));
+  }
+  if (selected("encode/publish-qos1-small-captured")) {
+    AsyncMqttClientInternals::FrameCapture capture(ring, sizeof(ring));
+    results.push_back(encode("encode/publish-qos1-small-captured", options.time, [&smallPayload](AsyncMqttClient* client) {
+      return client->publish(TOPIC, 1, false, smallPayload.data(), smallPayload.size()) != 0;
+    }, &capture));
+  }
+  if (selected("encode/telemetry-json-string")) {
+    results.push_back(encode("encode/telemetry-json-string", options.time, publishJsonTelemetry));
+  }
+  if (selected("encode/telemetry-cbor")) {
+    results.push_back(encode("encode/telemetry-cbor", options.time, [](AsyncMqttClient* client) {
+      return client->publishCbor(TELEMETRY_TOPIC, 1, false, cborTelemetry) != 0;
+    }));
+  }
+  if (selected("encode/subscribe")) {
+    results.push_back(encode("encode/subscribe", options.time, [](AsyncMqttClient* client) {
+      return client->subscribe("devices/benchmark/commands/#", 1) != 0;
+    }));
+  }
+  if (selected("encode/unsubscribe")) {
+    results.push_back(encode("encode/unsubscribe", options.time, [](AsyncMqttClient* client) {
+      return client->unsubscribe("devices/benchmark/commands/#") != 0;
+    }));
+  }
+
+  bool valid = true;
+  for (Result const &result : results) valid = valid && result.valid;
+  if (options.json) {
+    printf("{\n  \"library\": \"AsyncMqttClient\",\n  \"valid\": %s,\n  \"results\": [\n", valid ? "true" : "false");
+    for (size_t i = 0; i < results.size(); i++) {
+      Result const &result = results[i];
+      printf("    {\"name\": \"%s\", \"messages\": %llu, \"bytes\": %llu, \"seconds\": %.6f, \"messages_per_s\": %.0f, \"bytes_per_s\": %.0f, "
+        "\"ns_per_message\": %.2f, \"bytes_per_message\": %.1f, \"allocations_per_message\": %.3f, \"valid\": %s}%s\n", result.name.c_str(),
+        static_cast<unsigned long long>(result.messages), static_cast<unsigned long long>(result.bytes), result.seconds,  // NOLINT(runtime/int)
+        result.messages / result.seconds, result.bytes / result.seconds, result.nsPerMessage(), result.bytesPerMessage(), result.allocationsPerMessage(),
+        result.valid ? "true" : "false", i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+  } else {
+    printf("%-42s %12s %12s %10s %13s %12s\n", "benchmark", "messages/s", "MB/s", "ns/message", "bytes/message", "allocations");
+    for (Result const &result : results) {
+      printf("%-42s %12.0f %12.1f %10.1f %13.1f %12.2f%s\n", result.name.c_str(), result.messages / result.seconds,
+        result.bytes / result.seconds / 1e6, result.nsPerMessage(), result.bytesPerMessage(), result.allocationsPerMessage(),
+        result.valid ? "" : "  FAILED");
+    }
+  }
+
+  bool ok = valid;
+  if (options.baseline) ok = compare(options.baseline, results, options.tolerance) && ok;
+  return ok ? 0 : 1;
+}
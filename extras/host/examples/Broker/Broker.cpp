@@ -0,0 +1,37 @@
+// Runs the local broker stand-in, for the load generator or any other client on this machine.
+// usage: Broker [port] [address]
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include <Arduino.h>
+#include <LocalBroker.hpp>
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int signal) {
+  (void)signal;
+  running = 0;
+}
+
+int main(int argc, char** argv) {
+  uint16_t port = argc > 1 ? atoi(argv[1]) : 1883;
+  const char* address = argc > 2 ? argv[2] : "127.0.0.1";
+
+  AsyncMqttClientInternals::LocalBroker broker;
+  if (!broker.begin(address, port)) {
+    fprintf(stderr, "Cannot listen on %s:%u\n", address, port);
+    return 1;
+  }
+  printf("Listening on %s:%u\n", address, broker.port());
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  while (running) broker.loop(100);
+
+  AsyncMqttClientInternals::LocalBroker::Stats stats = broker.stats();
+  printf("accepted %" PRIu64 ", published %" PRIu64 ", delivered %" PRIu64 ", dropped %" PRIu64 "\n",
+    stats.accepted, stats.published, stats.delivered, stats.dropped);
+  return 0;
+}
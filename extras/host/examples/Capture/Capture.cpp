@@ -0,0 +1,121 @@
+// Frame capture: a session recorded through a CaptureTransport, whole frames then headers only, with a ring small
+// enough to overwrite its oldest records. The export is read back with a CaptureReader and, given a path, written
+// to a file for the Replay tool: Capture capture.bin && Replay capture.bin
+// usage: Capture [FILE]
+
+#include <string>
+
+#include <AsyncMqttClient.h>
+
+using AsyncMqttClientInternals::CaptureDirection;
+using AsyncMqttClientInternals::CaptureReader;
+using AsyncMqttClientInternals::CaptureRecord;
+using AsyncMqttClientInternals::CaptureTransport;
+using AsyncMqttClientInternals::FrameCapture;
+using AsyncMqttClientInternals::LoopbackTransport;
+
+static uint32_t fakeTime = 0;
+static uint32_t fakeClock() { return fakeTime / 1000; }
+static uint32_t fakeMicros() { return fakeTime; }
+
+static const char* const DIRECTIONS[] = { "in", "out", "connected", "disconnected" };
+
+static void appendExport(const uint8_t* data, size_t length, void* context) {
+  static_cast<std::string*>(context)->append(reinterpret_cast<const char*>(data), length);
+}
+
+// a QoS 1 PUBLISH from the broker, delivered in segments of the given size
+static void publishFromBroker(LoopbackTransport* broker, uint16_t packetId, size_t segment) {
+  const char publish[] = { 0x32, 0x15, 0x00, 0x0B, 'd', 'e', 'v', 'i', 'c', 'e', 's', '/', 'l', 'e', 'd',
+    static_cast<char>(packetId >> 8), static_cast<char>(packetId & 0xFF), 'b', 'l', 'i', 'n', 'k', '!' };
+  for (size_t position = 0; position < sizeof(publish); position += segment) {
+    fakeTime += 150;
+    broker->deliver(publish + position, sizeof(publish) - position < segment ? sizeof(publish) - position : segment);
+  }
+}
+
+// connect, subscribe, 8 messages each way, disconnect
+static void session(FrameCapture* capture) {
+  LoopbackTransport broker;
+  broker.setAutoAcknowledge(true);
+  CaptureTransport captured(&broker, capture, fakeMicros);
+  AsyncMqttClient client(&captured);
+  client.setClock(fakeClock);
+  client.setClientId("capture");
+  client.setServer("localhost", 1883);
+
+  client.connect();
+  fakeTime += 20000;
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker.deliver(connAck, sizeof(connAck));
+  uint16_t packetId = client.subscribe("devices/#", 1);
+  fakeTime += 15000;
+  const char subAck[] = { static_cast<char>(0x90), 0x03, static_cast<char>(packetId >> 8), static_cast<char>(packetId & 0xFF), 0x01 };
+  broker.deliver(subAck, sizeof(subAck));
+
+  for (uint16_t i = 1; i <= 8; i++) {
+    // odd fragmentation: whole, then 7-byte segments, then single bytes
+    publishFromBroker(&broker, i, i <= 3 ? 64 : i <= 6 ? 7 : 1);
+    broker.poll();
+    fakeTime += 5000;
+    packetId = client.publish("devices/capture/temperature", 1, false, "21.5");
+    fakeTime += 12000;
+    const char pubAck[] = { 0x40, 0x02, static_cast<char>(packetId >> 8), static_cast<char>(packetId & 0xFF) };
+    broker.deliver(pubAck, sizeof(pubAck));
+  }
+  client.disconnect();
+}
+
+static size_t printRecords(std::string const &exported, bool print) {
+  CaptureReader reader(reinterpret_cast<const uint8_t*>(exported.data()), exported.size());
+  if (!reader.valid()) return 0;
+  CaptureRecord record;
+  size_t records = 0;
+  uint32_t first = 0;
+  while (reader.next(&record)) {
+    if (records++ == 0) first = record.time;
+    if (!print) continue;
+    printf("  %8.3f ms  %-12s %4u B", (record.time - first) / 1000.0, DIRECTIONS[static_cast<uint8_t>(record.direction) & 3], record.length);
+    for (uint16_t i = 0; i < record.captured && i < 8; i++) printf(" %02x", record.data[i]);
+    printf("%s\n", record.captured < record.length ? " ..." : "");
+  }
+  return records;
+}
+
+int main(int argc, char** argv) {
+  bool ok = true;
+
+  static uint8_t ring[8192];
+  FrameCapture whole(ring, sizeof(ring));
+  session(&whole);
+  std::string exported;
+  whole.exportTo(appendExport, &exported);
+  printf("whole frames: %zu records, %zu bytes exported\n", whole.records(), exported.size());
+  ok &= printRecords(exported, true) == whole.records() && exported.size() == whole.exportSize() && whole.overwritten() == 0;
+
+  if (argc > 1) {
+    FILE* file = fopen(argv[1], "wb");
+    ok &= file && fwrite(exported.data(), 1, exported.size(), file) == exported.size();
+    if (file) fclose(file);
+    printf("written to %s\n", argv[1]);
+  }
+
+  static uint8_t headersRing[2048];
+  FrameCapture headers(headersRing, sizeof(headersRing), 2);
+  session(&headers);
+  std::string headersExported;
+  headers.exportTo(appendExport, &headersExported);
+  printf("\nfirst 2 bytes of each: %zu records, %zu bytes exported\n", headers.records(), headersExported.size());
+  ok &= printRecords(headersExported, false) == whole.records() && headers.overwritten() == 0;
+
+  static uint8_t smallRing[256];
+  FrameCapture small(smallRing, sizeof(smallRing));
+  session(&small);
+  std::string smallExported;
+  small.exportTo(appendExport, &smallExported);
+  printf("256 byte ring: the last %zu records kept, %u overwritten\n", small.records(), small.overwritten());
+  ok &= printRecords(smallExported, false) == small.records() && small.records() + small.overwritten() == whole.records();
+
+  printf("\n%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+// CBOR payloads: the encodings of RFC 8949 appendix A, a telemetry document published with publishCbor()
+// and read back off the transport, and a writer that writes more the second time than the first, which
+// leaves the PUBLISH well formed and is reported. Then publishCbor() to compressed topics, which it refuses,
+// to aggregated ones, whose batch it writes into, and with priority lanes, where it never overtakes a waiting message.
+
+#include <string>
+
+#include <AsyncMqttClient.h>
+
+using AsyncMqttClientInternals::CborWriter;
+using AsyncMqttClientInternals::LoopbackTransport;
+
+// one item written to a transport, the bytes read back
+template <typename Write>
+static std::string encoded(Write write) {
+  CborWriter counter;
+  write(counter);
+  LoopbackTransport transport;
+  transport.connect("localhost", 1883, false);
+  CborWriter writer(&transport, counter.size());
+  write(writer);
+  writer.finish();
+  return std::string(transport.outbound(), transport.outboundLength());
+}
+
+static std::string hex(std::string const &data) {
+  std::string text;
+  char digits[3];
+  for (char byte : data) {
+    snprintf(digits, sizeof(digits), "%02x", static_cast<uint8_t>(byte));
+    text += digits;
+  }
+  return text;
+}
+
+template <typename Write>
+static bool vector(const char* what, Write write, const char* expected) {
+  std::string actual = hex(encoded(write));
+  if (actual == expected) return true;
+  printf("%s: %s, expected %s\n", what, actual.c_str(), expected);
+  return false;
+}
+
+#if ASYNC_MQTT_METRICS
+static uint32_t rejected(AsyncMqttClient const &client, AsyncMqttClientPublishRejection cause) {
+  return client.metrics().publishRejected[static_cast<uint8_t>(cause)];
+}
+#endif
+
+static bool connect(AsyncMqttClient* client, LoopbackTransport* broker) {
+  client->setServer("localhost", 1883);
+  client->connect();
+  broker->acknowledge(broker->outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker->deliver(connAck, sizeof(connAck));
+  return client->connected();
+}
+
+#if ASYNC_MQTT_COMPRESSION || ASYNC_MQTT_AGGREGATION || ASYNC_MQTT_PRIORITY_LANES
+static void reading(CborWriter& writer) {
+  writer.map(1).text("t").number(21.5f);
+}
+#endif
+
+#if ASYNC_MQTT_AGGREGATION
+// written straight into the batch, which carries the same payload as publish() would have
+static bool aggregated() {
+  LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  uint32_t records = 0;
+  client.onBatchSent([&records](uint16_t packetId, uint32_t count) {
+    (void)packetId;
+    records += count;
+  });
+  client.setAggregation("devices/42/batch", 256, 10000).addAggregatedTopics("devices/42/sensors/#");
+  bool ok = connect(&client, &broker);
+  std::string payload = encoded(reading);
+  ok &= client.publishCbor("devices/42/sensors/a", 0, false, reading) == 1 && broker.outboundLength() == 0;
+  ok &= client.publish("devices/42/sensors/a", 0, false, payload.data(), payload.size()) == 1 && broker.outboundLength() == 0;
+  ok &= client.flushAggregation() != 0 && records == 2;
+  std::string packet(broker.outbound(), broker.outboundLength());
+  broker.acknowledge(broker.outboundLength());
+  // the two records differ by their delay, 0 for both, and the topic: spelled out, then its number
+  size_t first = packet.find(payload);
+  ok &= first != std::string::npos && packet.find(payload, first + payload.size()) != std::string::npos;
+  printf("aggregated topic: %s\n", ok ? "written into the batch" : "WRONG");
+  return ok;
+}
+#endif
+
+#if ASYNC_MQTT_COMPRESSION
+static bool compressed() {
+  LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  client.addCompressedTopics("devices/+/config");
+  bool ok = connect(&client, &broker);
+  ok &= client.publishCbor("devices/42/config", 1, false, reading) == 0 && broker.outboundLength() == 0;
+  ok &= client.publishCbor("devices/42/state", 1, false, reading) != 0;
+#if ASYNC_MQTT_METRICS
+  ok &= rejected(client, AsyncMqttClientPublishRejection::COMPRESSED_TOPIC) == 1;
+#endif
+  printf("compressed topic: %s\n", ok ? "refused" : "WRONG");
+  return ok;
+}
+#endif
+
+#if ASYNC_MQTT_PRIORITY_LANES
+// the transport full, an alarm waits in its lane: a normal CBOR publish is refused until it went out
+static bool lanes() {
+  LoopbackTransport broker(256);
+  AsyncMqttClient client(&broker);
+  client.setPriorityLanes(1024, 1024, 1024).addTopicPriority("alarms/#", AsyncMqttClientPriority::HIGH)
+    .addTopicPriority("logs/#", AsyncMqttClientPriority::BULK).setBulkInFlight(32);
+  bool ok = connect(&client, &broker);
+  std::string filler(220, 'x');
+  ok &= client.publish("devices/42/filler", 0, false, filler.data(), filler.size()) != 0;
+  ok &= client.publish("alarms/42", 1, false, "smoke") != 0 && client.laneStats(AsyncMqttClientPriority::HIGH).queued == 1;
+  ok &= client.publishCbor("devices/42/state", 1, false, reading) == 0;
+  ok &= client.publishCbor("alarms/42", 1, false, reading) == 0;
+  // acked, the alarm goes out; then the normal publish, and the bulk one once the buffer holds less than the bytes in flight
+  broker.acknowledge(broker.outboundLength());
+  ok &= client.laneStats(AsyncMqttClientPriority::HIGH).queued == 0;
+  ok &= client.publishCbor("devices/42/state", 1, false, reading) != 0;
+  ok &= client.publishCbor("logs/42", 0, false, reading) == 0;
+  broker.acknowledge(broker.outboundLength());
+  ok &= client.publishCbor("logs/42", 0, false, reading) != 0;
+#if ASYNC_MQTT_METRICS
+  ok &= rejected(client, AsyncMqttClientPublishRejection::NO_SPACE) == 3;
+#endif
+  printf("priority lanes: %s\n", ok ? "never ahead of a waiting message" : "WRONG");
+  return ok;
+}
+#endif
+
+static void telemetry(CborWriter& writer) {
+  static const float readings[] = { 21.5f, 21.75f, 22.0f, 21.25f };
+  writer.map(5);
+  writer.text("device").text("sensor-0042");
+  writer.text("time").integer(1700000000);
+  writer.text("battery").integer(87);
+  writer.text("ok").boolean(true);
+  writer.text("temperature").array(4);
+  for (float reading : readings) writer.number(reading);
+}
+
+int main() {
+  bool ok = true;
+
+  ok &= vector("0", [](CborWriter& w) { w.integer(0); }, "00");
+  ok &= vector("23", [](CborWriter& w) { w.integer(23); }, "17");
+  ok &= vector("24", [](CborWriter& w) { w.integer(24); }, "1818");
+  ok &= vector("1000", [](CborWriter& w) { w.integer(1000); }, "1903e8");
+  ok &= vector("1000000", [](CborWriter& w) { w.integer(1000000); }, "1a000f4240");
+  ok &= vector("1000000000000", [](CborWriter& w) { w.integer(1000000000000LL); }, "1b000000e8d4a51000");
+  ok &= vector("-1", [](CborWriter& w) { w.integer(-1); }, "20");
+  ok &= vector("-1000", [](CborWriter& w) { w.integer(-1000); }, "3903e7");
+  ok &= vector("smallest", [](CborWriter& w) { w.integer(INT64_MIN); }, "3b7fffffffffffffff");
+  ok &= vector("100000.0f", [](CborWriter& w) { w.number(100000.0f); }, "fa47c35000");
+  ok &= vector("1.1", [](CborWriter& w) { w.number(1.1); }, "fb3ff199999999999a");
+  ok &= vector("false true null", [](CborWriter& w) { w.boolean(false).boolean(true).null(); }, "f4f5f6");
+  ok &= vector("\"IETF\"", [](CborWriter& w) { w.text("IETF"); }, "6449455446");
+  ok &= vector("h'01020304'", [](CborWriter& w) { w.bytes("\x01\x02\x03\x04", 4); }, "4401020304");
+  ok &= vector("[1, [2, 3], [4, 5]]", [](CborWriter& w) { w.array(3).integer(1).array(2).integer(2).integer(3).array(2).integer(4).integer(5); },
+    "8301820203820405");
+  ok &= vector("{\"a\": 1, \"b\": [2, 3]}", [](CborWriter& w) { w.map(2).text("a").integer(1).text("b").array(2).integer(2).integer(3); },
+    "a26161016162820203");
+  // past the staging buffer, a string goes to the transport from where it is
+  std::string large(300, 'x');
+  ok &= vector("300 byte string", [&large](CborWriter& w) { w.text(large.data(), large.size()); }, ("79012c" + hex(large)).c_str());
+
+  LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  ok &= connect(&client, &broker);
+
+  CborWriter counter;
+  telemetry(counter);
+  uint16_t packetId = client.publishCbor("devices/sensor-0042/telemetry", 1, false, telemetry);
+  std::string packet(broker.outbound(), broker.outboundLength());
+  broker.acknowledge(broker.outboundLength());
+  std::string payload = encoded(telemetry);
+  printf("telemetry: %zu byte payload, %zu byte PUBLISH\n", payload.size(), packet.size());
+  size_t headerLength = 2 + 2 + strlen("devices/sensor-0042/telemetry") + 2;
+  ok &= packetId != 0 && payload.size() == counter.size() && packet.size() == headerLength + payload.size() &&
+    static_cast<uint8_t>(packet[0]) == 0x32 && static_cast<size_t>(packet[1]) == packet.size() - 2 &&
+    packet.compare(headerLength, std::string::npos, payload) == 0;
+
+  // a writer that does not write the same twice: its payload is cut or padded to the size of the first pass, and reported
+  int calls = 0;
+  ok &= client.publishCbor("devices/sensor-0042/telemetry", 0, false, [&calls](CborWriter& writer) {
+    writer.array(calls == 0 ? 1 : 3).integer(1);
+    if (calls++ > 0) writer.integer(2).integer(3);
+  }) == 0;
+  packet.assign(broker.outbound(), broker.outboundLength());
+  ok &= hex(packet.substr(packet.size() - 2)) == "8301" && static_cast<size_t>(packet[1]) == packet.size() - 2;
+#if ASYNC_MQTT_METRICS
+  ok &= rejected(client, AsyncMqttClientPublishRejection::PAYLOAD_MISMATCH) == 1;
+#endif
+
+#if ASYNC_MQTT_COMPRESSION
+  ok &= compressed();
+#endif
+#if ASYNC_MQTT_AGGREGATION
+  ok &= aggregated();
+#endif
+#if ASYNC_MQTT_PRIORITY_LANES
+  ok &= lanes();
+#endif
+
+  printf("\n%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+// Payload compression: a 2 KB JSON document published by one client on a compressed topic, its PUBLISH fed
+// to another in odd segments, which hands the original payload to onMessage() piece by piece. Reports the
+// bytes on the wire and the time to encode and decode, and pins the encoding to the heatshrink format.
+
+#include <chrono>
+#include <string>
+
+#include <AsyncMqttClient.h>
+
+#if ASYNC_MQTT_COMPRESSION
+using AsyncMqttClientInternals::LoopbackTransport;
+using AsyncMqttClientInternals::PayloadDecoder;
+using AsyncMqttClientInternals::PayloadEncoder;
+
+struct Received {
+  std::string topic;
+  std::string payload;
+  size_t messages = 0;
+  size_t pieces = 0;
+  size_t total = 0;
+  bool ordered = true;
+};
+
+static std::string document() {
+  std::string json = "{\"device\":\"sensor-0042\",\"firmware\":\"2.4.1\",\"readings\":[";
+  for (int i = 0; json.size() < 2000; i++) {
+    char reading[96];
+    snprintf(reading, sizeof(reading), "%s{\"time\":%d,\"temperature\":%d.%d,\"humidity\":%d,\"status\":\"ok\"}",
+      i == 0 ? "" : ",", 1700000000 + i * 60, 20 + i % 3, i % 10, 40 + i % 7);
+    json += reading;
+  }
+  return json + "]}";
+}
+
+static void connect(AsyncMqttClient* client, LoopbackTransport* broker) {
+  client->setServer("localhost", 1883);
+  client->connect();
+  broker->acknowledge(broker->outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker->deliver(connAck, sizeof(connAck));
+}
+
+// what the client published, taken off its transport
+static std::string sent(LoopbackTransport* broker) {
+  std::string packet(broker->outbound(), broker->outboundLength());
+  broker->acknowledge(broker->outboundLength());
+  return packet;
+}
+
+static void deliverInSegments(LoopbackTransport* broker, std::string const &packet) {
+  static const size_t SEGMENTS[] = { 1, 7, 13, 64, 3, 250 };
+  size_t position = 0;
+  for (size_t i = 0; position < packet.size(); i++) {
+    size_t length = SEGMENTS[i % (sizeof(SEGMENTS) / sizeof(SEGMENTS[0]))];
+    if (length > packet.size() - position) length = packet.size() - position;
+    broker->deliver(packet.data() + position, length);
+    position += length;
+  }
+}
+
+static bool check(const char* what, bool ok) {
+  if (!ok) printf("%s: FAILED\n", what);
+  return ok;
+}
+
+static void appendOutput(const char* data, size_t length, size_t index, size_t total, void* context) {
+  (void)index;
+  (void)total;
+  static_cast<std::string*>(context)->append(data, length);
+}
+
+int main() {
+  bool ok = true;
+  std::string json = document();
+
+  LoopbackTransport publisherBroker(8192);
+  AsyncMqttClient publisher(&publisherBroker);
+  publisher.addCompressedTopics("telemetry/+/status").addCompressedTopics("config/#");
+  connect(&publisher, &publisherBroker);
+
+  LoopbackTransport subscriberBroker(8192);
+  AsyncMqttClient subscriber(&subscriberBroker);
+  subscriber.addCompressedTopics("config/#").addCompressedTopics("telemetry/+/status");
+  connect(&subscriber, &subscriberBroker);
+  Received received;
+  subscriber.onMessage([&received](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+    (void)properties;
+    if (index == 0) {
+      received.messages++;
+      received.topic = topic;
+      received.payload.clear();
+    }
+    received.ordered &= index == received.payload.size();
+    received.payload.append(payload ? payload : "", len);
+    received.total = total;
+    received.pieces++;
+  });
+
+  // the compressed topic
+  publisher.publish("telemetry/sensor-0042/status", 0, false, json.c_str(), json.size());
+  std::string packet = sent(&publisherBroker);
+  deliverInSegments(&subscriberBroker, packet);
+  size_t plainPacket = 2 + 2 + strlen("telemetry/sensor-0042/status") + json.size() + 1;
+  printf("%zu byte payload: %zu byte PUBLISH, %zu uncompressed, %.1f%% of the bytes on the wire\n", json.size(), packet.size(),
+    plainPacket, 100.0 * packet.size() / plainPacket);
+  printf("delivered in %zu pieces\n", received.pieces);
+  ok &= check("compressed round trip", received.messages == 1 && received.topic == "telemetry/sensor-0042/status" &&
+    received.payload == json && received.total == json.size() && received.ordered);
+  ok &= check("compressed on the wire", packet.size() < json.size() / 2);
+
+  // other topics go as they are
+  publisher.publish("telemetry/sensor-0042/alarm", 1, false, json.c_str(), json.size());
+  packet = sent(&publisherBroker);
+  ok &= check("uncompressed topic", packet.find(json) != std::string::npos);
+  deliverInSegments(&subscriberBroker, packet);
+  ok &= check("uncompressed round trip", received.messages == 2 && received.payload == json && received.ordered);
+
+  // an empty payload, a retained message cleared, is never compressed
+  publisher.publish("config/sensor-0042", 1, true, "", 0);
+  packet = sent(&publisherBroker);
+  deliverInSegments(&subscriberBroker, packet);
+  ok &= check("empty payload", received.messages == 3 && received.payload.empty() && received.total == 0);
+
+  // a payload that is not compressed on a compressed topic is dropped and counted
+  const char malformed[] = { 0x30, 0x0C, 0x00, 0x06, 'c', 'o', 'n', 'f', 'i', 'g', 0x21, 'o', 'f', 'f' };
+  subscriberBroker.deliver(malformed, sizeof(malformed));
+  ok &= check("malformed payload", received.messages == 3);
+#if ASYNC_MQTT_METRICS
+  ok &= check("decompression errors", subscriber.metrics().decompressionErrors == 1);
+#endif
+
+  // the heatshrink format: a literal, then a match 1 back and 9 long
+  PayloadEncoder pin("aaaaaaaaaa", 10);
+  char pinned[8];
+  size_t pinnedLength = pin.read(pinned, sizeof(pinned));
+  const char expected[] = { static_cast<char>(0x84), 0x0A, static_cast<char>(0xB0), static_cast<char>(0x80), 0x20 };
+  ok &= check("format", pinnedLength == sizeof(expected) && pin.size() == sizeof(expected) && memcmp(pinned, expected, sizeof(expected)) == 0);
+
+  // encode and decode times
+  const int runs = 200;
+  std::string encoded(PayloadEncoder(json.data(), json.size()).size(), '\0');
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int i = 0; i < runs; i++) {
+    PayloadEncoder encoder(json.data(), json.size());
+    size_t length = encoder.size();
+    size_t position = 0;
+    while (position < length) position += encoder.read(&encoded[position], 64);
+  }
+  double encodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / runs;
+  PayloadDecoder decoder;
+  std::string decoded;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < runs; i++) {
+    decoded.clear();
+    decoder.begin();
+    decoder.decode(encoded.data(), encoded.size(), appendOutput, &decoded);
+    decoder.finish(appendOutput, &decoded);
+  }
+  double decodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / runs;
+  ok &= check("decoded", decoded == json);
+  printf("encode %.1f us (both passes), decode %.1f us\n", encodeSeconds * 1e6, decodeSeconds * 1e6);
+
+  printf("\n%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+#else
+int main() {
+  printf("built with ASYNC_MQTT_COMPRESSION 0\n");
+  return 0;
+}
+#endif
@@ -0,0 +1,132 @@
+// Compares standalone clients with clients of an AsyncMqttClientManager, over in-memory brokers:
+// memory per connection (object and heap, through operator new and through the allocator hooks) and when each of them
+// sends its first keepalive ping.
+
+#include <malloc.h>
+#include <stdlib.h>
+
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <AsyncMqttClient.h>
+
+static size_t allocatedBytes = 0;
+
+// heap in use, as the allocator rounds it
+void* operator new(size_t size) {
+  void* pointer = malloc(size);
+  if (!pointer) throw std::bad_alloc();
+  allocatedBytes += malloc_usable_size(pointer);
+  return pointer;
+}
+
+// the replacement operator new above is malloc based
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void operator delete(void* pointer) noexcept {
+  if (!pointer) return;
+  allocatedBytes -= malloc_usable_size(pointer);
+  free(pointer);
+}
+
+void operator delete(void* pointer, size_t size) noexcept {
+  (void)size;
+  operator delete(pointer);
+}
+
+// what the allocator hooks hold, the clients of a manager among it; the default hooks are malloc based, apart from the above
+static size_t hookBytes() {
+  size_t live = 0;
+  for (uint8_t tag = 0; tag < ASYNC_MQTT_MEMORY_TAGS; tag++) live += AsyncMqttClient::memoryStats(static_cast<AsyncMqttClientMemoryTag>(tag)).live;
+  return live;
+}
+
+static size_t heapBytes() {
+  return allocatedBytes + hookBytes();
+}
+
+static uint32_t fakeTime = 0;
+static uint32_t fakeClock() { return fakeTime; }
+
+// CONNACK, then an inbound QoS 0 PUBLISH so that a topic buffer is needed
+static void handshake(AsyncMqttClientInternals::LoopbackTransport* broker) {
+  broker->acknowledge(broker->outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker->deliver(connAck, sizeof(connAck));
+  const char publish[] = { 0x30, 0x0A, 0x00, 0x05, 's', 't', 'a', 't', 'e', 'o', 'n', '!' };
+  broker->deliver(publish, sizeof(publish));
+}
+
+static void configure(AsyncMqttClient* client) {
+  client->setClock(fakeClock);
+  client->setKeepAlive(60);
+  client->setServer("localhost", 1883);
+}
+
+// first ping of each client, polling every 100 ms like the transports would
+static void recordPings(const char* name, std::vector<std::unique_ptr<AsyncMqttClientInternals::LoopbackTransport>> const &brokers,
+  AsyncMqttClientManager* manager, std::string* output) {
+  char line[32];
+  *output = name;
+  output->append(" first pings at:");
+  std::vector<bool> pinged(brokers.size(), false);
+  for (fakeTime = 0; fakeTime <= 60000; fakeTime += 100) {
+    if (manager) manager->poll();
+    for (size_t i = 0; i < brokers.size(); i++) {
+      if (!manager) brokers[i]->poll();
+      if (pinged[i] || brokers[i]->outboundLength() == 0) continue;
+      pinged[i] = true;
+      snprintf(line, sizeof(line), " %.1f s", fakeTime / 1000.0);
+      output->append(line);
+      brokers[i]->acknowledge(brokers[i]->outboundLength());
+    }
+  }
+}
+
+int main() {
+  printf("sizeof(AsyncMqttClient) %zu, sizeof(AsyncMqttClientManager) %zu, sizeof(DefaultTransport) %zu (for clients without a transport)\n\n",
+    sizeof(AsyncMqttClient), sizeof(AsyncMqttClientManager), sizeof(AsyncMqttClientInternals::DefaultTransport));
+  printf("clients  standalone B/conn  managed B/conn\n");
+
+  const size_t pingedClients = 4;
+  std::string standalonePings;
+  std::string managedPings;
+
+  for (size_t count : { 1, 2, 4, 8 }) {
+    std::vector<std::unique_ptr<AsyncMqttClientInternals::LoopbackTransport>> brokers;
+    for (size_t i = 0; i < count; i++) brokers.emplace_back(new AsyncMqttClientInternals::LoopbackTransport());
+
+    fakeTime = 0;
+    size_t before = heapBytes();
+    std::vector<std::unique_ptr<AsyncMqttClient>> clients;
+    for (size_t i = 0; i < count; i++) {
+      clients.emplace_back(new AsyncMqttClient(brokers[i].get()));
+      configure(clients.back().get());
+      clients.back()->connect();
+      handshake(brokers[i].get());
+    }
+    size_t standalone = (heapBytes() - before) / count;
+    if (count == pingedClients) recordPings("standalone", brokers, nullptr, &standalonePings);
+    clients.clear();
+
+    fakeTime = 0;
+    before = heapBytes();
+    std::unique_ptr<AsyncMqttClientManager> manager(new AsyncMqttClientManager());
+    manager->setClock(fakeClock);
+    for (size_t i = 0; i < count; i++) {
+      AsyncMqttClient& client = manager->addClient(brokers[i].get());
+      configure(&client);
+      client.connect();
+      handshake(brokers[i].get());
+    }
+    size_t managed = (heapBytes() - before) / count;
+    if (count == pingedClients) recordPings("managed   ", brokers, manager.get(), &managedPings);
+
+    printf("%7zu  %17zu  %14zu\n", count, standalone, managed);
+  }
+
+  printf("\n%s\n%s\n", standalonePings.c_str(), managedPings.c_str());
+  return 0;
+}
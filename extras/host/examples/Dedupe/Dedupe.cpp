@@ -0,0 +1,216 @@
+// Duplicate filter: a broker session of QoS 1 commands and telemetry replayed through clients with and without
+// a filter. Now and then the connection drops with messages in flight: those the client had handled, whose PUBACK
+// was lost, come again with the DUP flag, as do those lost on the way, which it never saw. Reports the redeliveries
+// dropped and the new messages dropped by mistake (false positives), for packet identifiers counting up and for
+// a broker reusing the lowest free one, with the memory of the filter and its time per message. Given a path,
+// the session is also written as a capture for the Replay tool: Dedupe session.bin && Replay --dedupe 10000 session.bin
+// usage: Dedupe [FILE]
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <AsyncMqttClient.h>
+
+#if ASYNC_MQTT_DUPLICATE_FILTER
+using AsyncMqttClientInternals::CaptureTransport;
+using AsyncMqttClientInternals::DuplicateFilter;
+using AsyncMqttClientInternals::FrameCapture;
+using AsyncMqttClientInternals::LoopbackTransport;
+using AsyncMqttClientInternals::Transport;
+
+struct Message {
+  std::string topic;
+  std::string payload;
+  uint16_t packetId;
+};
+
+struct Result {
+  size_t messages = 0;
+  size_t duplicates = 0;  // redeliveries of handled messages
+  size_t duplicatesDropped = 0;
+  size_t unseen = 0;  // redeliveries of messages lost on the way
+  size_t falsePositives = 0;
+};
+
+static uint32_t simulatedMillis = 0;
+static uint32_t simulatedClock() { return simulatedMillis; }
+static uint32_t simulatedMicros() { return simulatedMillis * 1000; }
+
+static const char* const COMMAND_TOPICS[] = { "devices/pump/set", "devices/valve/set", "devices/fan/set", "devices/heater/mode" };
+static const char* const COMMANDS[] = { "ON", "OFF", "1", "0", "auto" };
+
+static std::string publishPacket(Message const &message, bool dup) {
+  std::string body;
+  body.push_back(static_cast<char>(message.topic.size() >> 8));
+  body.push_back(static_cast<char>(message.topic.size() & 0xFF));
+  body += message.topic;
+  body.push_back(static_cast<char>(message.packetId >> 8));
+  body.push_back(static_cast<char>(message.packetId & 0xFF));
+  body += message.payload;
+  char remainingLength[4];
+  std::string packet(1, dup ? 0x3A : 0x32);
+  packet.append(remainingLength, AsyncMqttClientInternals::Helpers::encodeRemainingLength(body.size(), remainingLength));
+  return packet + body;
+}
+
+static void connect(AsyncMqttClient* client, LoopbackTransport* broker) {
+  client->connect();
+  broker->acknowledge(broker->outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker->deliver(connAck, sizeof(connAck));
+}
+
+static void appendExport(const uint8_t* data, size_t length, void* context) {
+  static_cast<std::string*>(context)->append(reinterpret_cast<const char*>(data), length);
+}
+
+// 20000 messages 100 ms apart, the connection dropping about every 200; recorded into capture if given
+static Result simulate(bool lowestFreeId, uint16_t entries, uint32_t window, FrameCapture* capture = nullptr) {
+  LoopbackTransport broker(65536);
+  broker.setAutoAcknowledge(true);
+  CaptureTransport captured(&broker, capture, simulatedMicros);
+  AsyncMqttClient client(capture ? static_cast<Transport*>(&captured) : &broker);
+  client.setClock(simulatedClock);
+  client.setServer("localhost", 1883);
+  if (entries > 0) client.setDuplicateFilter(entries, window);
+  size_t handled = 0;
+  client.onMessage([&handled](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+    (void)topic;
+    (void)payload;
+    (void)properties;
+    (void)len;
+    (void)total;
+    if (index == 0) handled++;
+  });
+  simulatedMillis = 0;
+  connect(&client, &broker);
+
+  std::mt19937 random(7);
+  Result result;
+  uint16_t nextId = 1;
+  int temperature = 200;
+  for (size_t i = 0; i < 20000; i++) {
+    // a group of messages in flight together, usually one
+    size_t inFlight = random() % 200 == 0 ? 1 + random() % 4 : 1;
+    std::vector<Message> group;
+    for (size_t j = 0; j < inFlight; j++) {
+      Message message;
+      if (random() % 10 < 7) {
+        message.topic = COMMAND_TOPICS[random() % 4];
+        message.payload = COMMANDS[random() % 5];
+      } else {
+        temperature += static_cast<int>(random() % 5) - 2;
+        message.topic = "devices/tank/temperature";
+        message.payload = std::to_string(temperature / 10) + "." + std::to_string(temperature % 10);
+      }
+      if (lowestFreeId) {
+        message.packetId = j + 1;
+      } else {
+        message.packetId = nextId;
+        nextId = nextId == 65535 ? 1 : nextId + 1;
+      }
+      group.push_back(message);
+    }
+
+    if (inFlight == 1) {
+      size_t before = handled;
+      std::string packet = publishPacket(group[0], false);
+      broker.deliver(packet.data(), packet.size());
+      result.messages++;
+      if (handled == before) result.falsePositives++;
+      simulatedMillis += 100;
+      continue;
+    }
+
+    // the first ones arrive and are handled, the others are lost with the connection, then all of them come again
+    size_t arrived = random() % (inFlight + 1);
+    for (size_t j = 0; j < arrived; j++) {
+      size_t before = handled;
+      std::string packet = publishPacket(group[j], false);
+      broker.deliver(packet.data(), packet.size());
+      result.messages++;
+      if (handled == before) result.falsePositives++;
+    }
+    broker.hangUp();
+    simulatedMillis += 1000 + random() % 9000;
+    connect(&client, &broker);
+    for (size_t j = 0; j < inFlight; j++) {
+      size_t before = handled;
+      std::string packet = publishPacket(group[j], true);
+      broker.deliver(packet.data(), packet.size());
+      bool dropped = handled == before;
+      if (j < arrived) {
+        result.duplicates++;
+        if (dropped) result.duplicatesDropped++;
+      } else {
+        result.unseen++;
+        result.messages++;
+        if (dropped) result.falsePositives++;
+      }
+    }
+    simulatedMillis += 100;
+  }
+  return result;
+}
+
+// nanoseconds per check() of a filter of entries
+static double checkTime(uint16_t entries) {
+  DuplicateFilter filter;
+  filter.begin(entries, 10000);
+  const size_t checks = 2000000;
+  size_t dropped = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < checks; i++) {
+    dropped += filter.check(static_cast<uint16_t>(i), (i & 7) == 0, "devices/pump/set", 16, "ON", 2, 2, static_cast<uint32_t>(i));
+  }
+  double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  return dropped == 0 ? elapsed / checks : 0;
+}
+
+int main(int argc, char** argv) {
+  bool ok = true;
+  printf("%-14s %7s %8s %7s  %-22s %s\n", "identifiers", "entries", "window", "memory", "duplicates dropped", "false positives");
+  for (bool lowestFreeId : { false, true }) {
+    for (uint16_t entries : { 0, 4, 16 }) {
+      for (uint32_t window : { 1000, 10000, 60000 }) {
+        if (entries == 0 && window != 1000) continue;
+        Result result = simulate(lowestFreeId, entries, window);
+        DuplicateFilter filter;
+        filter.begin(entries, window);
+        char dropped[32];
+        snprintf(dropped, sizeof(dropped), "%zu of %zu", result.duplicatesDropped, result.duplicates);
+        printf("%-14s %7u %6.0f s %5zu B  %-22s %zu of %zu messages (%zu redelivered unseen)\n", lowestFreeId ? "lowest free" : "counting up",
+          entries, entries > 0 ? window / 1000.0 : 0.0, filter.memory(), dropped, result.falsePositives, result.messages, result.unseen);
+        if (entries == 0) ok &= result.duplicatesDropped == 0 && result.falsePositives == 0;
+        // identifiers counting up tell messages apart: every redelivery within the window goes, nothing else
+        if (entries > 0 && !lowestFreeId && window >= 10000) ok &= result.duplicatesDropped == result.duplicates && result.falsePositives == 0;
+        if (entries > 0 && lowestFreeId && window >= 10000) ok &= result.duplicatesDropped == result.duplicates;
+      }
+    }
+  }
+
+  if (argc > 1) {
+    static uint8_t ring[4 << 20];
+    FrameCapture capture(ring, sizeof(ring));
+    simulate(true, 0, 0, &capture);
+    std::string exported;
+    capture.exportTo(appendExport, &exported);
+    FILE* file = fopen(argv[1], "wb");
+    ok &= file && fwrite(exported.data(), 1, exported.size(), file) == exported.size() && capture.overwritten() == 0;
+    if (file) fclose(file);
+    printf("\nsession with the lowest free identifiers written to %s\n", argv[1]);
+  }
+
+  printf("\ncheck():");
+  for (uint16_t entries : { 4, 16, 64 }) printf(" %u entries %.0f ns", entries, checkTime(entries));
+  printf("\n\n%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+#else
+int main() {
+  printf("built with ASYNC_MQTT_DUPLICATE_FILTER 0\n");
+  return 0;
+}
+#endif
@@ -0,0 +1,134 @@
+// Cost of the callbacks: a std::function built from std::bind, as the parser used to do for every packet,
+// against a Delegate built from a lambda, then the whole receive path of a PUBLISH through a loopback transport.
+
+#include <stdlib.h>
+
+#include <chrono>
+#include <functional>
+#include <new>
+
+#include <AsyncMqttClient.h>
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* pointer = malloc(size);
+  if (!pointer) throw std::bad_alloc();
+  return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+  free(pointer);
+}
+
+void operator delete(void* pointer, size_t size) noexcept {
+  (void)size;
+  free(pointer);
+}
+
+// operator new, plus the blocks the client takes through its allocator hooks
+static size_t allocationCount() {
+  size_t count = allocations;
+  for (uint8_t tag = 0; tag < ASYNC_MQTT_MEMORY_TAGS; tag++) {
+    count += AsyncMqttClient::memoryStats(static_cast<AsyncMqttClientMemoryTag>(tag)).allocations;
+  }
+  return count;
+}
+
+static const size_t ROUNDS = 2000000;
+
+class Receiver {
+ public:
+  Receiver() : bytes(0) {}
+
+  void onMessage(char const *topic, char const *payload, uint8_t qos, bool dup, bool retain, size_t len, size_t index, size_t total, uint16_t packetId) {
+    (void)topic;
+    (void)payload;
+    (void)qos;
+    (void)dup;
+    (void)retain;
+    (void)index;
+    (void)total;
+    (void)packetId;
+    bytes += len;
+  }
+
+  size_t bytes;
+};
+
+// keeps the compiler from optimizing the callback object away
+static void escape(void* pointer) {
+  asm volatile("" : : "g"(pointer) : "memory");
+}
+
+static double nanosecondsSince(std::chrono::steady_clock::time_point start, size_t rounds) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+}
+
+template <typename Callback, typename Make>
+static void measure(const char* name, Make make) {
+  size_t before = allocations;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ROUNDS; i++) {
+    Callback callback = make();
+    escape(&callback);
+    callback("topic", "payload", 1, false, false, 7, 0, 7, 1);
+  }
+  double buildAndCall = nanosecondsSince(start, ROUNDS);
+  double allocationsPerBuild = static_cast<double>(allocations - before) / ROUNDS;
+
+  Callback callback = make();
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ROUNDS; i++) {
+    escape(&callback);
+    callback("topic", "payload", 1, false, false, 7, 0, 7, 1);
+  }
+  double call = nanosecondsSince(start, ROUNDS);
+
+  printf("%-28s %6zu B  %9.1f ns  %10.2f  %7.1f ns\n", name, sizeof(Callback), buildAndCall, allocationsPerBuild, call);
+}
+
+int main() {
+  Receiver receiver;
+
+  printf("9 argument callback            size  build+call  allocations     call\n");
+  measure<std::function<void(char const *, char const *, uint8_t, bool, bool, size_t, size_t, size_t, uint16_t)>>("std::function of std::bind", [&receiver]() {
+    return std::bind(&Receiver::onMessage, &receiver, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3,
+      std::placeholders::_4, std::placeholders::_5, std::placeholders::_6, std::placeholders::_7, std::placeholders::_8, std::placeholders::_9);
+  });
+  measure<AsyncMqttClientInternals::OnMessageInternalCallback>("Delegate of a lambda", [&receiver]() {
+    Receiver* target = &receiver;
+    return [target](char const *topic, char const *payload, uint8_t qos, bool dup, bool retain, size_t len, size_t index, size_t total, uint16_t packetId) {
+      target->onMessage(topic, payload, qos, dup, retain, len, index, total, packetId);
+    };
+  });
+
+  // whole receive path: one QoS 0 PUBLISH per delivery, parsed into the onMessage handler
+  AsyncMqttClientInternals::LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  client.setServer("localhost", 1883);
+  size_t received = 0;
+  client.onMessage([&received](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+    (void)topic;
+    (void)payload;
+    (void)properties;
+    (void)len;
+    (void)index;
+    (void)total;
+    received++;
+  });
+  client.connect();
+  broker.acknowledge(broker.outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker.deliver(connAck, sizeof(connAck));
+
+  const char publish[] = { 0x30, 0x0E, 0x00, 0x05, 't', 'o', 'p', 'i', 'c', 'p', 'a', 'y', 'l', 'o', 'a', 'd' };
+  size_t before = allocationCount();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ROUNDS; i++) broker.deliver(publish, sizeof(publish));
+  double perPacket = nanosecondsSince(start, ROUNDS);
+  printf("\nreceived PUBLISH %zu: %.1f ns and %.2f allocations per packet\n", received, perPacket,
+    static_cast<double>(allocationCount() - before) / ROUNDS);
+  return received == ROUNDS ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+// Slow onMessage handlers (a sleep standing for a flash write) inline and on worker threads:
+// how long the network side is held up, the total time, the queueing statistics, and the order of the messages of each topic.
+// Then a handler that does not return: the network side waits ASYNC_MQTT_DISPATCH_TIMEOUT at most per message, and drops it.
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <AsyncMqttClient.h>
+
+static const size_t TOPICS = 8;
+static const size_t MESSAGES = 1600;
+static const uint32_t HANDLER_TIME = 200;  // microseconds
+static const uint16_t DEPTH = 32;
+
+static double elapsedSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void deliver(AsyncMqttClientInternals::LoopbackTransport* broker, size_t topicIndex, uint32_t sequence) {
+  char topic[16];
+  char payload[16];
+  size_t topicLength = snprintf(topic, sizeof(topic), "sensor/%zu", topicIndex);
+  size_t payloadLength = snprintf(payload, sizeof(payload), "%u", sequence);
+  char packet[40];
+  packet[0] = 0x30;
+  packet[1] = 2 + topicLength + payloadLength;
+  packet[2] = 0;
+  packet[3] = topicLength;
+  memcpy(packet + 4, topic, topicLength);
+  memcpy(packet + 4 + topicLength, payload, payloadLength);
+  broker->deliver(packet, 4 + topicLength + payloadLength);
+}
+
+static bool run(uint8_t workers) {
+  AsyncMqttClientInternals::LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  client.setServer("localhost", 1883);
+
+  // each topic is handled by one worker at a time, its entry needs no lock
+  std::vector<uint32_t> nextSequence(TOPICS, 0);
+  std::atomic<size_t> handled(0);
+  std::atomic<bool> ordered(true);
+  client.onMessage([&](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+    (void)properties;
+    (void)index;
+    (void)total;
+    size_t topicIndex = strtoul(topic + strlen("sensor/"), nullptr, 10);
+    uint32_t sequence = strtoul(std::string(payload, len).c_str(), nullptr, 10);
+    if (topicIndex >= TOPICS || sequence != nextSequence[topicIndex]) ordered = false;
+    if (topicIndex < TOPICS) nextSequence[topicIndex] = sequence + 1;
+    std::this_thread::sleep_for(std::chrono::microseconds(HANDLER_TIME));
+    handled++;
+  });
+  if (workers > 0) client.setMessageDispatch(workers, DEPTH);
+
+  client.connect();
+  broker.acknowledge(broker.outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker.deliver(connAck, sizeof(connAck));
+
+  std::vector<uint32_t> sequences(TOPICS, 0);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < MESSAGES; i++) {
+    size_t topicIndex = i % TOPICS;
+    deliver(&broker, topicIndex, sequences[topicIndex]++);
+  }
+  double network = elapsedSince(start);
+  while (handled < MESSAGES) std::this_thread::sleep_for(std::chrono::microseconds(100));
+  double totalTime = elapsedSince(start);
+
+  bool ok = ordered && handled == MESSAGES;
+  if (workers == 0) {
+    printf("inline      %10.1f  %8.1f                                        %s\n", network, totalTime, ok ? "ok" : "FAILED");
+  } else {
+    AsyncMqttClientDispatchStats stats = client.dispatchStats();
+    ok = ok && stats.dispatched == MESSAGES && stats.queued == 0;
+    printf("%u worker%s   %10.1f  %8.1f  %6u  %9u  %8u  %9u  %s\n", workers, workers > 1 ? "s" : " ", network, totalTime,
+      stats.stalls, stats.maxQueued, stats.delay, stats.maxDelay, ok ? "ok" : "FAILED");
+  }
+  return ok;
+}
+
+// one worker stuck in the handler: its queue fills, then each message waits for room and is dropped
+static bool overflow() {
+  const uint16_t depth = 4;
+  const size_t dropped = 3;
+  AsyncMqttClientInternals::LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  client.setServer("localhost", 1883);
+  std::atomic<bool> stuck(true);
+  std::atomic<size_t> handled(0);
+  client.onMessage([&](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+    (void)topic;
+    (void)payload;
+    (void)properties;
+    (void)len;
+    (void)index;
+    (void)total;
+    while (stuck) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    handled++;
+  });
+  client.setMessageDispatch(1, depth);
+
+  // set while the worker runs: ignored, the worker keeps its copy of the handler
+  std::atomic<bool> replaced(false);
+  client.onMessage([&](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+    (void)topic;
+    (void)payload;
+    (void)properties;
+    (void)len;
+    (void)index;
+    (void)total;
+    replaced = true;
+  });
+
+  client.connect();
+  broker.acknowledge(broker.outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker.deliver(connAck, sizeof(connAck));
+
+  // the first one is in the handler, the next ones fill the queue
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < 1 + depth + dropped; i++) deliver(&broker, 0, i);
+  double network = elapsedSince(start);
+  stuck = false;
+  while (handled < 1u + depth) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  AsyncMqttClientDispatchStats stats = client.dispatchStats();
+  bool ok = !replaced && stats.overflows == dropped && stats.dropped == dropped && stats.dispatched == 1u + depth &&
+    network >= dropped * ASYNC_MQTT_DISPATCH_TIMEOUT && network < (dropped + 1) * ASYNC_MQTT_DISPATCH_TIMEOUT + 100;
+  client.setMessageDispatch(0, 0);
+  ok &= handled == 1u + depth;
+  printf("\nstuck handler: %u dispatched, %u dropped after %.0f ms for %zu messages, a handler set meanwhile ignored  %s\n",
+    stats.dispatched, stats.overflows, network, dropped, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main() {
+  printf("%zu messages on %zu topics, %u us per message, queues of %u\n\n", MESSAGES, TOPICS, HANDLER_TIME, DEPTH);
+  printf("dispatch    network ms  total ms  stalls  max queue  delay us  max delay  order\n");
+  bool ok = true;
+  for (uint8_t workers : { 0, 1, 2, 4 }) ok &= run(workers);
+  ok &= overflow();
+  return ok ? 0 : 1;
+}
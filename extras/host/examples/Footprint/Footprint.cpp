@@ -0,0 +1,160 @@
+// Object sizes and heap of a client in the configuration this is built in, one "name<TAB>bytes" line each,
+// for scripts/footprint/footprint.sh to tabulate across configurations. The heap is what the client holds
+// beyond its object: blocks from operator new and from the allocator hooks, the transport's left out.
+// usage: Footprint
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <new>
+
+#include <AsyncMqttClient.h>
+
+using AsyncMqttClientInternals::LoopbackTransport;
+
+// operator new blocks carry their size in front, to follow the live bytes
+static const size_t HEADER = alignof(max_align_t);
+static size_t newLive = 0;
+
+void* operator new(size_t size) {
+  char* block = static_cast<char*>(malloc(HEADER + size));
+  if (!block) abort();
+  *reinterpret_cast<size_t*>(block) = size;
+  newLive += size;
+  return block + HEADER;
+}
+
+void operator delete(void* pointer) noexcept {
+  if (!pointer) return;
+  char* block = static_cast<char*>(pointer) - HEADER;
+  newLive -= *reinterpret_cast<size_t*>(block);
+  free(block);
+}
+
+void operator delete(void* pointer, size_t size) noexcept {
+  (void)size;
+  operator delete(pointer);
+}
+
+static size_t heapLive() {
+  size_t live = newLive;
+  for (uint8_t tag = 0; tag < ASYNC_MQTT_MEMORY_TAGS; tag++) {
+    live += AsyncMqttClient::memoryStats(static_cast<AsyncMqttClientMemoryTag>(tag)).live;
+  }
+  return live;
+}
+
+static void row(const char* name, size_t bytes) {
+  printf("%s\t%zu\n", name, bytes);
+}
+
+#define SIZE_OF(type) row("sizeof " #type, sizeof(AsyncMqttClientInternals::type))
+
+static void deliver(LoopbackTransport* broker, const char* data, size_t length) {
+  broker->acknowledge(broker->outboundLength());
+  broker->deliver(data, length);
+}
+
+// Heap of a client through its first connection: constructed, connected, after a subscription and
+// a QoS 1 message, and while that message is being parsed. False if the client leaks.
+template <typename Client>
+static bool connection(const char* name) {
+  char label[96];
+  LoopbackTransport broker;
+  size_t base = heapLive();
+  size_t parsing = 0;
+  {
+    Client client(&broker);
+    snprintf(label, sizeof(label), "heap %s constructed", name);
+    row(label, heapLive() - base);
+
+    client.onMessage([&parsing, base](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+      (void)topic;
+      (void)payload;
+      (void)properties;
+      (void)len;
+      (void)index;
+      (void)total;
+      parsing = heapLive() - base;
+    });
+    client.setClientId("footprint").setServer("broker.local", 1883).setCredentials("device", "secret");
+    client.connect();
+    const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+    deliver(&broker, connAck, sizeof(connAck));
+    snprintf(label, sizeof(label), "heap %s connected", name);
+    row(label, heapLive() - base);
+
+    uint16_t packetId = client.subscribe("devices/footprint/#", 1);
+    const char subAck[] = { static_cast<char>(0x90), 0x03, static_cast<char>(packetId >> 8), static_cast<char>(packetId & 0xFF), 0x01 };
+    deliver(&broker, subAck, sizeof(subAck));
+    const char publish[] = { 0x32, 0x17, 0x00, 0x11, 'd', 'e', 'v', 'i', 'c', 'e', 's', '/', 'f', 'o', 'o', 't', 'p', 'r', 'i', 'n', 't',
+      0x00, 0x01, 'o', 'n' };
+    deliver(&broker, publish, sizeof(publish));
+    broker.poll();
+    snprintf(label, sizeof(label), "heap %s parsing a message", name);
+    row(label, parsing);
+    snprintf(label, sizeof(label), "heap %s after a message", name);
+    row(label, heapLive() - base);
+  }
+  snprintf(label, sizeof(label), "heap %s leaked", name);
+  row(label, heapLive() - base);
+  return heapLive() == base;
+}
+
+int main() {
+  row("sizeof AsyncMqttClient", sizeof(AsyncMqttClient));
+  row("sizeof AsyncMqttClientT<AsyncMqttClientStaticConfig>", sizeof(AsyncMqttClientT<AsyncMqttClientStaticConfig>));
+  row("sizeof AsyncMqttClientManager", sizeof(AsyncMqttClientManager));
+  // allocated for a client constructed without a transport, in the object of an AsyncMqttClientT
+  SIZE_OF(DefaultTransport);
+  SIZE_OF(ConnAckPacket);
+  SIZE_OF(PingRespPacket);
+  SIZE_OF(SubAckPacket);
+  SIZE_OF(UnsubAckPacket);
+  SIZE_OF(PublishPacket);
+  SIZE_OF(PubRelPacket);
+  SIZE_OF(PubAckPacket);
+  SIZE_OF(PubRecPacket);
+  SIZE_OF(PubCompPacket);
+  SIZE_OF(PacketStorage);
+  SIZE_OF(ParsingInformation);
+  SIZE_OF(TimerWheel);
+  SIZE_OF(RttEstimator);
+  SIZE_OF(Metrics);
+#if ASYNC_MQTT_LATENCY
+  SIZE_OF(LatencyTracker);
+#endif
+#if ASYNC_MQTT_COMPRESSION
+  SIZE_OF(PayloadCompression);
+#endif
+#if ASYNC_MQTT_PAYLOAD_SINKS
+  SIZE_OF(PayloadSink);
+#endif
+#if ASYNC_MQTT_RETAINED_CACHE
+  SIZE_OF(RetainedCache);
+#endif
+#if ASYNC_MQTT_DUPLICATE_FILTER
+  SIZE_OF(DuplicateFilter);
+#endif
+#if ASYNC_MQTT_PRIORITY_LANES
+  SIZE_OF(PriorityLanes);
+#endif
+#if ASYNC_MQTT_RATE_CONTROL
+  SIZE_OF(RateController);
+#endif
+#if ASYNC_MQTT_AGGREGATION
+  SIZE_OF(Aggregator);
+#endif
+  SIZE_OF(OnMessageUserCallback);
+  SIZE_OF(PendingAck);
+  SIZE_OF(PendingPubRel);
+  SIZE_OF(CborWriter);
+  SIZE_OF(FrameCapture);
+  SIZE_OF(CaptureTransport);
+  SIZE_OF(LoopbackTransport);
+  SIZE_OF(PosixTcpTransport);
+
+  bool ok = connection<AsyncMqttClient>("AsyncMqttClient");
+  ok = connection<AsyncMqttClientT<AsyncMqttClientStaticConfig>>("AsyncMqttClientT<AsyncMqttClientStaticConfig>") && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,327 @@
+// Priority lanes: QoS 1 alarms published now and then while log uploads keep a slow link (128 kbit/s, 100 ms round
+// trip, a TCP send buffer of 5744 bytes as lwIP's) saturated. Without lanes an alarm publish() fails as long as the
+// buffer is full and the application retries it every 10 ms; with lanes the alarm waits in the high lane and goes out
+// ahead of the logs, of which only so many bytes wait in the buffer. Reports the time from the first publish() of an
+// alarm to its arrival at the broker, the publishes of alarms refused, and the throughput of the logs, which must arrive
+// in order and each upload as the one message it was published as. Then checks that messages waiting in the lanes when
+// the connection drops go out first on the next one, with their packet IDs.
+// usage: Lanes
+
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <AsyncMqttClient.h>
+
+#if ASYNC_MQTT_PRIORITY_LANES
+using AsyncMqttClientInternals::LoopbackTransport;
+
+static const size_t SEND_BUFFER = 5744;
+static const uint32_t RATE = 16;  // bytes per millisecond
+static const uint32_t ROUND_TRIP = 100;
+static const uint32_t DURATION = 120000;
+
+struct Config {
+  const char* name;
+  bool lanes;
+  size_t inFlight;
+  size_t logSize;
+};
+
+struct Result {
+  std::vector<uint32_t> latencies;
+  size_t refused = 0;
+  size_t logBytes = 0;
+  bool logsInOrder = true;
+  bool logsWhole = true;
+};
+
+static uint32_t simulatedMillis = 0;
+static uint32_t simulatedClock() { return simulatedMillis; }
+
+// the broker side of the link: what was sent, decoded packet by packet as it arrives
+class Broker {
+ public:
+  Broker(LoopbackTransport* transport, Result* result, std::vector<uint32_t> const *alarmTimes, std::string const *logs, size_t logSize)
+  : _transport(transport)
+  , _result(result)
+  , _alarmTimes(alarmTimes)
+  , _logs(logs)
+  , _logSize(logSize)
+  , _transmitted(0) {
+  }
+
+  // a millisecond of the link: bytes go out at the rate, acknowledged a round trip later
+  void tick() {
+    size_t length = std::min<size_t>(RATE, _transport->outboundLength() - _transmitted);
+    if (length > 0) {
+      _stream.append(_transport->outbound() + _transmitted, length);
+      _transmitted += length;
+      _inFlight.push_back(std::make_pair(simulatedMillis + ROUND_TRIP, length));
+      _decode();
+    }
+    while (!_inFlight.empty() && _inFlight.front().first <= simulatedMillis) {
+      size_t acknowledged = _inFlight.front().second;
+      _inFlight.pop_front();
+      _transmitted -= acknowledged;
+      _transport->acknowledge(acknowledged);
+    }
+  }
+
+  void connect(AsyncMqttClient* client) {
+    client->connect();
+    _transport->acknowledge(_transport->outboundLength());
+    const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+    _transport->deliver(connAck, sizeof(connAck));
+  }
+
+ private:
+  LoopbackTransport* _transport;
+  Result* _result;
+  std::vector<uint32_t> const *_alarmTimes;
+  std::string const *_logs;
+  size_t _logSize;
+  size_t _transmitted;
+  std::deque<std::pair<uint32_t, size_t>> _inFlight;
+  std::string _stream;
+
+  void _decode() {
+    for (;;) {
+      if (_stream.size() < 2) return;
+      size_t remaining = 0;
+      size_t position = 1;
+      uint32_t multiplier = 1;
+      uint8_t byte;
+      do {
+        if (position >= _stream.size()) return;
+        byte = static_cast<uint8_t>(_stream[position++]);
+        remaining += (byte & 0x7F) * multiplier;
+        multiplier *= 128;
+      } while (byte & 0x80);
+      if (_stream.size() < position + remaining) return;
+
+      uint8_t header = static_cast<uint8_t>(_stream[0]);
+      std::string body = _stream.substr(position, remaining);
+      _stream.erase(0, position + remaining);
+      if (header >> 4 == 12) {
+        const char pingResp[] = { static_cast<char>(0xD0), 0x00 };
+        _transport->deliver(pingResp, sizeof(pingResp));
+      }
+      if (header >> 4 != 3) continue;
+
+      uint8_t qos = (header >> 1) & 0x03;
+      size_t topicLength = static_cast<uint8_t>(body[0]) << 8 | static_cast<uint8_t>(body[1]);
+      std::string topic = body.substr(2, topicLength);
+      size_t payloadStart = 2 + topicLength + (qos != 0 ? 2 : 0);
+      std::string payload = body.substr(payloadStart);
+      if (qos == 1) {
+        const char pubAck[] = { 0x40, 0x02, body[2 + topicLength], body[3 + topicLength] };
+        _transport->deliver(pubAck, sizeof(pubAck));
+      }
+      // arrives half a round trip after it went out
+      if (topic.compare(0, 7, "alarms/") == 0) {
+        uint32_t sent = (*_alarmTimes)[strtoul(payload.c_str(), nullptr, 10)];
+        _result->latencies.push_back(simulatedMillis + ROUND_TRIP / 2 - sent);
+      } else {
+        _result->logsInOrder &= _logs->compare(_result->logBytes, payload.size(), payload) == 0;
+        _result->logsWhole &= payload.size() == _logSize;
+        _result->logBytes += payload.size();
+      }
+    }
+  }
+};
+
+static Result simulate(Config const &config) {
+  LoopbackTransport transport(SEND_BUFFER);
+  AsyncMqttClient client(&transport);
+  client.setClock(simulatedClock);
+  client.setServer("localhost", 1883);
+  if (config.lanes) {
+    client.setPriorityLanes(512, 1024, 32768);
+    client.addTopicPriority("alarms/#", AsyncMqttClientPriority::HIGH);
+    client.addTopicPriority("logs/#", AsyncMqttClientPriority::BULK);
+    client.setBulkInFlight(config.inFlight);
+  }
+
+  // a stream of log lines, uploaded in batches of logSize bytes
+  std::string logs;
+  std::mt19937 random(11);
+  while (logs.size() < DURATION * RATE) {
+    logs += "t=" + std::to_string(logs.size()) + " heap=" + std::to_string(20000 + random() % 10000) + " rssi=-" + std::to_string(50 + random() % 40) + "\n";
+  }
+
+  Result result;
+  std::vector<uint32_t> alarmTimes;
+  Broker broker(&transport, &result, &alarmTimes, &logs, config.logSize);
+  simulatedMillis = 0;
+  broker.connect(&client);
+
+  size_t logPosition = 0;
+  uint32_t nextAlarm = 1000;
+  bool alarmPending = false;
+  for (simulatedMillis = 1; simulatedMillis < DURATION; simulatedMillis++) {
+    broker.tick();
+    if (simulatedMillis % 10 == 0) transport.poll();
+
+    // the uploader publishes whatever is accepted
+    while (logPosition + config.logSize <= logs.size() &&
+      client.publish("logs/device", 0, false, logs.data() + logPosition, config.logSize) != 0) {
+      logPosition += config.logSize;
+    }
+
+    // an alarm every second or two, retried every 10 ms while refused
+    if (simulatedMillis == nextAlarm) {
+      alarmTimes.push_back(simulatedMillis);
+      alarmPending = true;
+      nextAlarm += 1000 + random() % 1000;
+    }
+    if (alarmPending && (simulatedMillis == alarmTimes.back() || simulatedMillis % 10 == 0)) {
+      std::string payload = std::to_string(alarmTimes.size() - 1);
+      if (client.publish("alarms/smoke", 1, false, payload.c_str(), payload.size()) != 0) {
+        alarmPending = false;
+      } else {
+        result.refused++;
+      }
+    }
+  }
+  // the uploads hold the link until the end: alarms still on the way are not counted
+  result.logsInOrder &= result.logBytes > 0;
+  return result;
+}
+
+static uint32_t percentile(std::vector<uint32_t> values, double fraction) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  return values[std::min(values.size() - 1, static_cast<size_t>(fraction * values.size()))];
+}
+
+// the connection drops with messages in every lane, each QoS 1 but one
+static bool reconnection() {
+  LoopbackTransport transport(1024);
+  AsyncMqttClient client(&transport);
+  client.setServer("localhost", 1883);
+  client.setPriorityLanes(512, 1024, 4096);
+  client.addTopicPriority("alarms/#", AsyncMqttClientPriority::HIGH);
+  client.addTopicPriority("logs/#", AsyncMqttClientPriority::BULK);
+  client.connect();
+  transport.acknowledge(transport.outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  transport.deliver(connAck, sizeof(connAck));
+
+  // the buffer fills with the first upload, the others wait
+  std::string upload(1000, 'u');
+  std::vector<uint16_t> queued;
+  queued.push_back(client.publish("logs/device", 1, false, upload.data(), upload.size()));
+  queued.push_back(client.publish("logs/device", 1, false, upload.data(), upload.size()));
+  queued.push_back(client.publish("status/device", 1, false, "online"));
+  queued.push_back(client.publish("alarms/smoke", 1, false, "1"));
+  client.publish("status/device", 0, false, "at most once");
+  size_t waiting = 0;
+  for (uint8_t lane = 0; lane < 3; lane++) waiting += client.laneStats(static_cast<AsyncMqttClientPriority>(lane)).queued;
+  bool ok = waiting == 4;
+
+  transport.hangUp();
+  transport.acknowledge(transport.outboundLength());
+  client.connect();
+  transport.acknowledge(transport.outboundLength());
+  transport.deliver(connAck, sizeof(connAck));
+  // then a new one, its identifier taken by none of those waiting
+  uint16_t next = client.publish("alarms/smoke", 1, false, "2");
+  for (uint16_t packetId : queued) ok &= packetId != next && packetId != 0;
+
+  // in priority order as soon as connected, the new one ahead of the upload still waiting for room
+  std::vector<std::pair<std::string, uint16_t>> sent;
+  for (size_t round = 0; round < 16 && sent.size() < 5; round++) {
+    std::string stream(transport.outbound(), transport.outboundLength());
+    transport.acknowledge(transport.outboundLength());
+    size_t position = 0;
+    while (position + 2 <= stream.size()) {
+      uint8_t header = static_cast<uint8_t>(stream[position]);
+      size_t remaining = 0;
+      size_t cursor = position + 1;
+      uint32_t multiplier = 1;
+      uint8_t byte;
+      do {
+        byte = static_cast<uint8_t>(stream[cursor++]);
+        remaining += (byte & 0x7F) * multiplier;
+        multiplier *= 128;
+      } while (byte & 0x80);
+      if (header >> 4 == 3) {
+        size_t topicLength = static_cast<uint8_t>(stream[cursor]) << 8 | static_cast<uint8_t>(stream[cursor + 1]);
+        uint16_t packetId = static_cast<uint8_t>(stream[cursor + 2 + topicLength]) << 8 | static_cast<uint8_t>(stream[cursor + 3 + topicLength]);
+        sent.push_back(std::make_pair(stream.substr(cursor + 2, topicLength), (header & 0x06) ? packetId : 0));
+      }
+      position = cursor + remaining;
+    }
+    transport.poll();
+  }
+  const std::pair<std::string, uint16_t> expected[] = {
+    { "alarms/smoke", queued[3] }, { "status/device", queued[2] }, { "status/device", 0 }, { "alarms/smoke", next },
+    { "logs/device", queued[1] }
+  };
+  ok &= sent.size() == 5 && std::equal(sent.begin(), sent.end(), expected);
+  printf("\nreconnection: %zu waiting, %zu sent first on the next connection, with their packet IDs  %s\n", waiting, sent.size(),
+    ok ? "ok" : "FAILED");
+  return ok;
+}
+
+// an upload larger than the send buffer: dropped from its lane rather than holding the others up
+static bool tooLarge() {
+  LoopbackTransport transport(1024);
+  AsyncMqttClient client(&transport);
+  client.setServer("localhost", 1883);
+  client.setPriorityLanes(512, 1024, 4096);
+  client.addTopicPriority("logs/#", AsyncMqttClientPriority::BULK);
+  client.connect();
+  transport.acknowledge(transport.outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  transport.deliver(connAck, sizeof(connAck));
+
+  std::string upload(2000, 'u');
+  bool ok = client.publish("logs/device", 0, false, upload.data(), upload.size()) != 0;
+  ok &= client.publish("logs/device", 0, false, "short") != 0 && transport.outboundLength() > 0;
+  AsyncMqttClientLaneStats stats = client.laneStats(AsyncMqttClientPriority::BULK);
+  ok &= stats.tooLarge == 1 && stats.queued == 0;
+  printf("too large for the send buffer: %u dropped, the next one sent  %s\n", stats.tooLarge, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main() {
+  const Config configs[] = {
+    { "no lanes", false, 0, 2048 },
+    { "lanes, 2048 B in flight", true, 2048, 2048 },
+    { "lanes, 1 KiB uploads, 1024 B in flight", true, 1024, 1024 },
+    { "lanes, 4 KiB uploads", true, 2048, 4096 }
+  };
+  bool ok = true;
+  printf("%u kbit/s, %u ms round trip, %zu byte send buffer, %u s of uploads\n\n", RATE * 8, ROUND_TRIP, SEND_BUFFER, DURATION / 1000);
+  printf("%-40s %7s %7s %7s %8s %10s\n", "", "alarms", "p50", "p99", "refused", "logs");
+  uint32_t withoutLanes = 0;
+  for (Config const &config : configs) {
+    Result result = simulate(config);
+    uint32_t p99 = percentile(result.latencies, 0.99);
+    printf("%-40s %7zu %4u ms %4u ms %8zu %5.1f kB/s%s\n", config.name, result.latencies.size(), percentile(result.latencies, 0.5),
+      p99, result.refused, result.logBytes / (DURATION / 1000.0) / 1000, result.logsInOrder ? "" : " OUT OF ORDER");
+    ok &= result.logsInOrder && result.logsWhole && result.latencies.size() > 50;
+    if (!config.lanes) {
+      withoutLanes = p99;
+      continue;
+    }
+    // an alarm waits behind the bytes in flight, an upload and the acks at most, then half a round trip
+    uint32_t bound = (config.inFlight + config.logSize + 64) / RATE + ROUND_TRIP / 2;
+    ok &= result.refused == 0 && *std::max_element(result.latencies.begin(), result.latencies.end()) <= bound;
+    if (config.logSize <= config.inFlight) ok &= p99 < withoutLanes;
+  }
+  ok &= reconnection();
+  ok &= tooLarge();
+  printf("\n%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+#else
+int main() {
+  printf("built with ASYNC_MQTT_PRIORITY_LANES 0\n");
+  return 0;
+}
+#endif
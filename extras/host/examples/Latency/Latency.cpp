@@ -0,0 +1,112 @@
+// Round trip latency histograms: QoS 1 and 2 publishes and subscriptions acknowledged after known delays,
+// then the publish histogram serialized and merged the way a fleet aggregator would.
+
+#include <AsyncMqttClient.h>
+
+using AsyncMqttClientInternals::LatencyHistogram;
+using AsyncMqttClientInternals::LoopbackTransport;
+
+static uint32_t fakeTime = 0;
+static uint32_t fakeClock() { return fakeTime; }
+
+static void acknowledge(LoopbackTransport* broker, uint8_t header, uint16_t packetId) {
+  const char packet[] = { static_cast<char>(header), 0x02, static_cast<char>(packetId >> 8), static_cast<char>(packetId & 0xFF) };
+  broker->deliver(packet, sizeof(packet));
+  broker->acknowledge(broker->outboundLength());
+}
+
+static void print(const char* name, LatencyHistogram const &histogram) {
+  printf("%-10s %5u samples  p50 %5u ms  p90 %5u ms  p99 %5u ms  max %5u ms\n", name, histogram.count(),
+    histogram.percentile(50), histogram.percentile(90), histogram.percentile(99), histogram.max());
+}
+
+static bool check(const char* what, uint32_t value, uint32_t expected) {
+  if (value == expected) return true;
+  printf("%s: %u, expected %u\n", what, value, expected);
+  return false;
+}
+
+int main() {
+  LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  client.setClock(fakeClock);
+  client.setServer("localhost", 1883);
+  client.connect();
+  broker.acknowledge(broker.outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker.deliver(connAck, sizeof(connAck));
+
+  // 100 QoS 1 publishes: 90 answered in 20 to 28 ms, 9 in 200 ms and one in 1500 ms.
+  // Percentiles are bucket upper bounds: the median of 24 ms reads 27, 200 ms reads 223.
+  for (uint32_t i = 0; i < 100; i++) {
+    uint16_t packetId = client.publish("devices/latency/temperature", 1, false, "21.5");
+    broker.acknowledge(broker.outboundLength());
+    fakeTime += i == 99 ? 1500 : i % 10 == 9 ? 200 : 20 + i % 10;
+    acknowledge(&broker, 0x40, packetId);
+  }
+
+  // QoS 2 completes on PUBCOMP, 40 ms after the PUBLISH
+  uint16_t packetId = client.publish("devices/latency/state", 2, false, "on");
+  broker.acknowledge(broker.outboundLength());
+  fakeTime += 10;
+  acknowledge(&broker, 0x50, packetId);
+  fakeTime += 30;
+  acknowledge(&broker, 0x70, packetId);
+
+  // a retransmission is not timed, nor are exchanges past the in-flight table
+  packetId = client.publish("devices/latency/state", 1, false, "on");
+  client.publish("devices/latency/state", 1, false, "on", 0, true, packetId);
+  broker.acknowledge(broker.outboundLength());
+  acknowledge(&broker, 0x40, packetId);
+  uint16_t first = 0;
+  for (int i = 0; i < ASYNC_MQTT_LATENCY_IN_FLIGHT + 4; i++) {
+    packetId = client.publish("devices/latency/burst", 1, false, "x");
+    if (i == 0) first = packetId;
+    broker.acknowledge(broker.outboundLength());
+  }
+  fakeTime += 5;
+  for (uint16_t id = first; id <= packetId; id++) acknowledge(&broker, 0x40, id);
+
+  packetId = client.subscribe("devices/latency/commands/#", 1);
+  broker.acknowledge(broker.outboundLength());
+  fakeTime += 35;
+  const char subAck[] = { static_cast<char>(0x90), 0x03, static_cast<char>(packetId >> 8), static_cast<char>(packetId & 0xFF), 0x01 };
+  broker.deliver(subAck, sizeof(subAck));
+  packetId = client.unsubscribe("devices/latency/commands/#");
+  broker.acknowledge(broker.outboundLength());
+  fakeTime += 45;
+  acknowledge(&broker, 0xB0, packetId);
+
+  LatencyHistogram const &publish = client.publishLatency();
+  LatencyHistogram const &subscribe = client.subscribeLatency();
+  print("publish", publish);
+  print("subscribe", subscribe);
+
+  bool ok = true;
+  ok &= check("publish samples", publish.count(), 100 + 1 + ASYNC_MQTT_LATENCY_IN_FLIGHT);
+  ok &= check("publish p50", publish.percentile(50), 27);
+  ok &= check("publish p90", publish.percentile(90), 31);
+  ok &= check("publish p99", publish.percentile(99), 223);
+  ok &= check("publish max", publish.max(), 1500);
+  ok &= check("subscribe samples", subscribe.count(), 2);
+  ok &= check("subscribe max", subscribe.max(), 45);
+
+  // a device serializes its histogram, the aggregator merges what the fleet sends
+  uint8_t serialized[LatencyHistogram::MAX_SERIALIZED_SIZE];
+  size_t length = publish.serialize(serialized, sizeof(serialized));
+  LatencyHistogram fleet;
+  ok &= fleet.merge(serialized, length);
+  ok &= fleet.merge(serialized, length);
+  ok &= !fleet.merge(serialized, length - 1);
+  printf("serialized in %zu bytes, %zu bytes of RAM per client\n", length, sizeof(AsyncMqttClientInternals::LatencyTracker));
+  print("fleet", fleet);
+  ok &= check("fleet samples", fleet.count(), 2 * publish.count());
+  ok &= check("fleet p99", fleet.percentile(99), publish.percentile(99));
+  ok &= check("fleet max", fleet.max(), publish.max());
+
+  client.resetLatency();
+  ok &= check("samples after a reset", client.publishLatency().count(), 0);
+
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,354 @@
+// Runs thousands of clients from one thread on an EpollLoop, against the local broker stand-in
+// (started in-process by default) or any broker given with --host, and reports throughput and latencies.
+// usage: LoadGenerator [--clients N] [--rate MSG_PER_S] [--qos Q] [--payload BYTES] [--fanout F]
+//                      [--duration S] [--connect-rate N_PER_S] [--keepalive S] [--host HOST] [--port PORT]
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <AsyncMqttClient.h>
+#include <LocalBroker.hpp>
+
+struct Options {
+  uint32_t clients = 100;
+  double rate = 1;
+  uint8_t qos = 0;
+  uint32_t payload = 64;
+  uint32_t fanout = 1;
+  uint32_t duration = 10;
+  uint32_t connectRate = 1000;
+  uint16_t keepAlive = 60;
+  const char* host = nullptr;
+  uint16_t port = 1883;
+};
+
+struct Device {
+  AsyncMqttClientInternals::PosixTcpTransport transport;
+  AsyncMqttClient client;
+  String topic;
+  uint32_t connectStart = 0;
+  uint32_t pendingSubscriptions = 0;
+  bool connected = false;
+  bool ready = false;
+  std::unordered_map<uint16_t, uint32_t> inFlight;
+
+  Device() : client(&transport) {}
+};
+
+struct Results {
+  uint32_t connected = 0;
+  uint32_t failed = 0;
+  uint32_t lost = 0;
+  uint32_t disconnected = 0;
+  uint64_t published = 0;
+  uint64_t refused = 0;
+  uint64_t acknowledged = 0;
+  uint64_t received = 0;
+  uint32_t firstConnect = 0;
+  uint32_t lastConnect = 0;
+  std::vector<uint32_t> connectLatencies;
+  std::vector<uint32_t> ackLatencies;
+  std::vector<uint32_t> endToEndLatencies;
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void interrupt(int signal) {
+  (void)signal;
+  interrupted = 1;
+}
+
+static void usage(const char* name) {
+  fprintf(stderr, "usage: %s [--clients N] [--rate MSG_PER_S] [--qos Q] [--payload BYTES] [--fanout F]\n"
+    "       [--duration S] [--connect-rate N_PER_S] [--keepalive S] [--host HOST] [--port PORT]\n", name);
+}
+
+static bool parseOptions(int argc, char** argv, Options* options) {
+  static const struct option longOptions[] = {
+    { "clients", required_argument, nullptr, 'c' },
+    { "rate", required_argument, nullptr, 'r' },
+    { "qos", required_argument, nullptr, 'q' },
+    { "payload", required_argument, nullptr, 's' },
+    { "fanout", required_argument, nullptr, 'f' },
+    { "duration", required_argument, nullptr, 'd' },
+    { "connect-rate", required_argument, nullptr, 'C' },
+    { "keepalive", required_argument, nullptr, 'k' },
+    { "host", required_argument, nullptr, 'h' },
+    { "port", required_argument, nullptr, 'p' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  int option;
+  while ((option = getopt_long(argc, argv, "", longOptions, nullptr)) != -1) {
+    switch (option) {
+      case 'c': options->clients = strtoul(optarg, nullptr, 10); break;
+      case 'r': options->rate = strtod(optarg, nullptr); break;
+      case 'q': options->qos = strtoul(optarg, nullptr, 10); break;
+      case 's': options->payload = strtoul(optarg, nullptr, 10); break;
+      case 'f': options->fanout = strtoul(optarg, nullptr, 10); break;
+      case 'd': options->duration = strtoul(optarg, nullptr, 10); break;
+      case 'C': options->connectRate = strtoul(optarg, nullptr, 10); break;
+      case 'k': options->keepAlive = strtoul(optarg, nullptr, 10); break;
+      case 'h': options->host = optarg; break;
+      case 'p': options->port = strtoul(optarg, nullptr, 10); break;
+      default: return false;
+    }
+  }
+  if (optind != argc || options->clients == 0 || options->qos > 2 || options->connectRate == 0) return false;
+
+  // the payload starts with the send time, as 8 hex digits
+  if (options->payload < 8) options->payload = 8;
+  if (options->fanout >= options->clients) options->fanout = options->clients - 1;
+  return true;
+}
+
+static bool resolve(const char* host, IPAddress* ip) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo* result = nullptr;
+  if (getaddrinfo(host, nullptr, &hints, &result) != 0 || !result) return false;
+  const uint8_t* address = reinterpret_cast<const uint8_t*>(
+    &reinterpret_cast<struct sockaddr_in*>(result->ai_addr)->sin_addr.s_addr);
+  *ip = IPAddress(address[0], address[1], address[2], address[3]);
+  freeaddrinfo(result);
+  return true;
+}
+
+static void raiseDescriptorLimit(uint32_t needed) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return;
+  if (limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  if (limit.rlim_cur < needed) {
+    fprintf(stderr, "Warning: %u file descriptors needed, the limit is %llu\n", needed,
+      static_cast<unsigned long long>(limit.rlim_cur));  // NOLINT(runtime/int)
+  }
+}
+
+static void printLatencies(const char* name, std::vector<uint32_t>* samples) {
+  if (samples->empty()) {
+    printf("  %-22s no samples\n", name);
+    return;
+  }
+  std::sort(samples->begin(), samples->end());
+  auto percentile = [&](double p) {
+    size_t index = static_cast<size_t>(p * (samples->size() - 1) + 0.5);
+    return (*samples)[index] / 1000.0;
+  };
+  printf("  %-22s p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f ms\n", name,
+    percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), samples->back() / 1000.0);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    usage(argv[0]);
+    return 2;
+  }
+  raiseDescriptorLimit(options.clients * (options.host ? 1 : 2) + 32);
+
+  AsyncMqttClientInternals::LocalBroker broker;
+  std::atomic<bool> brokerRunning(false);
+  std::thread brokerThread;
+  if (!options.host) {
+    if (!broker.begin("127.0.0.1", 0)) {
+      fprintf(stderr, "Cannot start the local broker\n");
+      return 1;
+    }
+    brokerRunning = true;
+    brokerThread = std::thread([&]() {
+      while (brokerRunning) broker.loop(10);
+    });
+  }
+
+  IPAddress ip;
+  if (!resolve(options.host ? options.host : "127.0.0.1", &ip)) {
+    fprintf(stderr, "Cannot resolve %s\n", options.host);
+    return 1;
+  }
+  uint16_t port = options.host ? options.port : broker.port();
+
+  printf("Load: %u clients, %.2f msg/s each, QoS %u, %u byte payload, fan-out %u, %u s against %s:%u\n",
+    options.clients, options.rate, options.qos, options.payload, options.fanout, options.duration,
+    options.host ? options.host : "local broker", port);
+
+  AsyncMqttClientInternals::EpollLoop loop;
+  std::vector<std::unique_ptr<Device>> devices;
+  Results results;
+  bool measuring = false;
+
+  devices.reserve(options.clients);
+  for (uint32_t i = 0; i < options.clients; i++) {
+    devices.emplace_back(new Device());
+    Device* device = devices.back().get();
+    loop.add(&device->transport);
+
+    String clientId("load-");
+    clientId.concat(i, 10);
+    device->topic = "load/";
+    device->topic.concat(i, 10);
+
+    device->client.setClientId(clientId);
+    device->client.setKeepAlive(options.keepAlive);
+    device->client.setServer(ip, port);
+    device->client.onConnect([&, device, i](bool sessionPresent) {
+      (void)sessionPresent;
+      uint32_t now = micros();
+      device->connected = true;
+      results.connected++;
+      results.lastConnect = now;
+      results.connectLatencies.push_back(now - device->connectStart);
+
+      for (uint32_t k = 1; k <= options.fanout; k++) {
+        String topic("load/");
+        topic.concat((i + k) % options.clients, 10);
+        if (device->client.subscribe(topic, options.qos) != 0) device->pendingSubscriptions++;
+      }
+      device->ready = device->pendingSubscriptions == 0;
+    });
+    device->client.onSubscribe([device](uint16_t packetId, uint8_t qos) {
+      (void)packetId;
+      (void)qos;
+      if (device->pendingSubscriptions > 0 && --device->pendingSubscriptions == 0) device->ready = true;
+    });
+    device->client.onMessage([&](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties,
+      size_t len, size_t index, size_t total) {
+      (void)topic;
+      (void)properties;
+      (void)total;
+      if (index != 0 || len < 8) return;
+      results.received++;
+      if (!measuring) return;
+      char sent[9];
+      memcpy(sent, payload, 8);
+      sent[8] = '\0';
+      results.endToEndLatencies.push_back(micros() - strtoul(sent, nullptr, 16));
+    });
+    device->client.onPublish([&, device](uint16_t packetId) {
+      auto pending = device->inFlight.find(packetId);
+      if (pending == device->inFlight.end()) return;
+      results.acknowledged++;
+      if (measuring) results.ackLatencies.push_back(micros() - pending->second);
+      device->inFlight.erase(pending);
+    });
+    device->client.onDisconnect([&, device](AsyncMqttClientDisconnectReason reason) {
+      (void)reason;
+      if (!device->connected) {
+        results.failed++;
+      } else if (measuring) {
+        results.lost++;
+      } else {
+        results.disconnected++;
+      }
+      device->connected = false;
+      device->ready = false;
+      device->inFlight.clear();
+    });
+  }
+
+  signal(SIGINT, interrupt);
+
+  // connect ramp, at the requested connect rate
+  uint32_t rampStart = micros();
+  results.firstConnect = rampStart;
+  uint32_t started = 0;
+  while (!interrupted && results.connected + results.failed < options.clients) {
+    uint64_t due = static_cast<uint64_t>(micros() - rampStart) * options.connectRate / 1000000 + 1;
+    for (; started < options.clients && started < due; started++) {
+      devices[started]->connectStart = micros();
+      devices[started]->client.connect();
+    }
+    loop.loop(1);
+    if (started == options.clients && micros() - devices.back()->connectStart > 30000000) break;
+  }
+
+  // wait for the subscriptions, then publish at the requested rate
+  uint32_t readyStart = millis();
+  while (!interrupted && millis() - readyStart < 10000) {
+    bool ready = true;
+    for (auto const &device : devices) ready = ready && (device->ready || !device->connected);
+    if (ready) break;
+    loop.loop(10);
+  }
+
+  std::string payload(options.payload, 'x');
+  uint64_t attempts = 0;
+  size_t cursor = 0;
+  measuring = true;
+  uint32_t measureStart = micros();
+  uint32_t measured = 0;
+  while (!interrupted && (measured = micros() - measureStart) < options.duration * 1000000) {
+    uint64_t target = static_cast<uint64_t>(options.rate * options.clients * measured / 1000000);
+    for (size_t scanned = 0; attempts < target && scanned < devices.size(); scanned++) {
+      Device* device = devices[cursor].get();
+      cursor = (cursor + 1) % devices.size();
+      if (!device->ready) continue;
+
+      attempts++;
+      uint32_t now = micros();
+      char sent[9];
+      snprintf(sent, sizeof(sent), "%08" PRIx32, now);
+      memcpy(&payload[0], sent, 8);
+      uint16_t packetId = device->client.publish(device->topic, options.qos, false, String(payload));
+      if (packetId == 0) {
+        results.refused++;
+        continue;
+      }
+      results.published++;
+      if (options.qos > 0) device->inFlight[packetId] = now;
+      scanned = 0;
+    }
+    loop.loop(1);
+  }
+
+  // let what is in flight arrive, then disconnect everyone
+  uint32_t drainStart = millis();
+  while (!interrupted && millis() - drainStart < 1000) loop.loop(10);
+  measuring = false;
+  for (auto const &device : devices) device->client.disconnect();
+  uint32_t disconnectStart = millis();
+  while (millis() - disconnectStart < 2000) {
+    bool connected = false;
+    for (auto const &device : devices) connected = connected || device->connected;
+    if (!connected) break;
+    loop.loop(10);
+  }
+
+  brokerRunning = false;
+  if (brokerThread.joinable()) brokerThread.join();
+
+  double measuredSeconds = measured / 1000000.0;
+  double connectSeconds = (results.lastConnect - results.firstConnect) / 1000000.0;
+  printf("Connect: %u connected, %u failed in %.2f s (%.1f connects/s), %u lost while measuring\n",
+    results.connected, results.failed, connectSeconds, connectSeconds > 0 ? results.connected / connectSeconds : 0.0,
+    results.lost);
+  printLatencies("connect latency", &results.connectLatencies);
+  printf("Publish: %" PRIu64 " sent (%.1f msg/s), %" PRIu64 " acknowledged, %" PRIu64 " refused\n",
+    results.published, results.published / measuredSeconds, results.acknowledged, results.refused);
+  if (options.qos > 0) printLatencies("ack latency", &results.ackLatencies);
+  printf("Receive: %" PRIu64 " messages (%.1f msg/s)\n", results.received, results.received / measuredSeconds);
+  printLatencies("end-to-end latency", &results.endToEndLatencies);
+  if (!options.host) {
+    AsyncMqttClientInternals::LocalBroker::Stats stats = broker.stats();
+    printf("Broker: %" PRIu64 " accepted, %" PRIu64 " published, %" PRIu64 " delivered, %" PRIu64 " dropped\n",
+      stats.accepted, stats.published, stats.delivered, stats.dropped);
+  }
+  return 0;
+}
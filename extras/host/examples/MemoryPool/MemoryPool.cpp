@@ -0,0 +1,246 @@
+// The allocator hooks: the same session (QoS 1 and 2 both ways, dispatch workers, submission queue) on the heap,
+// on a fixed-block pool, on a pool too small for the parser, and split over two regions by tag the way PSRAM
+// and internal RAM would be on an ESP32. Reports the statistics per tag and checks that nothing leaks.
+
+#include <atomic>
+#include <thread>
+
+#include <AsyncMqttClient.h>
+
+using AsyncMqttClientInternals::LoopbackTransport;
+using AsyncMqttClientInternals::MemoryPool;
+using AsyncMqttClientInternals::memoryTagBit;
+
+static const AsyncMqttClientMemoryTag TAGS[] = {
+  AsyncMqttClientMemoryTag::PARSER, AsyncMqttClientMemoryTag::TOPIC, AsyncMqttClientMemoryTag::QUEUE,
+  AsyncMqttClientMemoryTag::TLS, AsyncMqttClientMemoryTag::REASSEMBLY, AsyncMqttClientMemoryTag::SETTINGS,
+  AsyncMqttClientMemoryTag::TRANSPORT, AsyncMqttClientMemoryTag::CLIENT
+};
+
+static size_t publishPacket(char* packet, uint8_t header, const char* topic, uint16_t packetId, const char* payload) {
+  size_t topicLength = strlen(topic);
+  size_t payloadLength = strlen(payload);
+  size_t position = 0;
+  packet[position++] = header;
+  position += AsyncMqttClientInternals::Helpers::encodeRemainingLength(2 + topicLength + ((header & 0x06) ? 2 : 0) + payloadLength, packet + position);
+  packet[position++] = topicLength >> 8;
+  packet[position++] = topicLength & 0xFF;
+  memcpy(packet + position, topic, topicLength);
+  position += topicLength;
+  if (header & 0x06) {
+    packet[position++] = packetId >> 8;
+    packet[position++] = packetId & 0xFF;
+  }
+  memcpy(packet + position, payload, payloadLength);
+  return position + payloadLength;
+}
+
+static void acknowledge(LoopbackTransport* broker, uint8_t header, uint16_t packetId) {
+  const char packet[] = { static_cast<char>(header), 0x02, static_cast<char>(packetId >> 8), static_cast<char>(packetId & 0xFF) };
+  broker->deliver(packet, sizeof(packet));
+}
+
+static bool connect(AsyncMqttClient* client, LoopbackTransport* broker) {
+  client->connect();
+  broker->acknowledge(broker->outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker->deliver(connAck, sizeof(connAck));
+  return client->connected();
+}
+
+// QoS 1 and 2 both ways, messages handed to two dispatch workers, publishes submitted from another thread
+static bool session() {
+  LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  client.setClientId("pool-example");
+  client.setCredentials("user", "password");
+  client.setWill("devices/pool-example/status", 1, true, "offline");
+  client.setServer("localhost", 1883);
+  std::atomic<size_t> messages(0);
+  size_t published = 0;
+  client.onMessage([&messages](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+    (void)topic;
+    (void)payload;
+    (void)properties;
+    (void)len;
+    (void)index;
+    (void)total;
+    messages++;
+  });
+  client.onPublish([&published](uint16_t packetId) {
+    (void)packetId;
+    published++;
+  });
+  client.setMessageDispatch(2, 8);
+  client.setSubmissionQueue(8, 64);
+  if (!connect(&client, &broker)) return false;
+
+  uint16_t packetId = client.subscribe("devices/pool-example/#", 2);
+  broker.acknowledge(broker.outboundLength());
+  const char subAck[] = { static_cast<char>(0x90), 0x03, static_cast<char>(packetId >> 8), static_cast<char>(packetId & 0xFF), 0x02 };
+  broker.deliver(subAck, sizeof(subAck));
+
+  char packet[128];
+  for (uint16_t i = 0; i < 16; i++) {
+    size_t length = publishPacket(packet, i % 2 ? 0x32 : 0x34, "devices/pool-example/commands/led", 100 + i, "blink");
+    broker.deliver(packet, length);
+    if (i % 2 == 0) acknowledge(&broker, 0x62, 100 + i);
+  }
+  broker.acknowledge(broker.outboundLength());
+
+  packetId = client.publish("devices/pool-example/temperature", 1, false, "21.5");
+  acknowledge(&broker, 0x40, packetId);
+  packetId = client.publish("devices/pool-example/temperature", 2, false, "21.6");
+  acknowledge(&broker, 0x50, packetId);
+  acknowledge(&broker, 0x70, packetId);
+  broker.acknowledge(broker.outboundLength());
+
+  std::thread producer([&client]() {
+    for (int i = 0; i < 4; i++) client.submitPublish("devices/pool-example/log", 0, false, "from another thread");
+  });
+  producer.join();
+  broker.poll();
+  broker.acknowledge(broker.outboundLength());
+
+  // the workers handle what is queued before they stop
+  client.setMessageDispatch(0, 0);
+  client.disconnect();
+  return messages == 16 && published == 2;
+}
+
+static bool noLeak() {
+  for (AsyncMqttClientMemoryTag tag : TAGS) {
+    if (AsyncMqttClient::memoryStats(tag).live != 0) return false;
+  }
+  return true;
+}
+
+static void printStats(const char* title, AsyncMqttClientMemoryStats (&before)[8]) {
+  printf("%s\n  tag          allocations  peak B  failures\n", title);
+  for (size_t i = 0; i < 8; i++) {
+    AsyncMqttClientMemoryStats stats = AsyncMqttClient::memoryStats(TAGS[i]);
+    if (stats.allocations == before[i].allocations && stats.failures == before[i].failures) continue;
+    printf("  %-11s  %11u  %6u  %8u\n", AsyncMqttClientInternals::memoryTagName(TAGS[i]), stats.allocations - before[i].allocations,
+      stats.peak, stats.failures - before[i].failures);
+  }
+}
+
+static void snapshot(AsyncMqttClientMemoryStats (&stats)[8]) {
+  AsyncMqttClientInternals::resetMemoryPeaks();
+  for (size_t i = 0; i < 8; i++) stats[i] = AsyncMqttClient::memoryStats(TAGS[i]);
+}
+
+static void printPool(MemoryPool const &pool) {
+  printf("  block B  blocks  fewest free\n");
+  for (uint8_t i = 0; i < pool.sizes(); i++) {
+    AsyncMqttClientInternals::MemoryPoolStats stats = pool.stats(i);
+    printf("  %7zu  %6zu  %11zu\n", stats.blockSize, stats.blocks, stats.minFree);
+  }
+}
+
+static bool poolReleased(MemoryPool const &pool) {
+  for (uint8_t i = 0; i < pool.sizes(); i++) {
+    if (pool.stats(i).free != pool.stats(i).blocks) return false;
+  }
+  return true;
+}
+
+// two regions, the large and cold blocks in "PSRAM", falling back to "internal" RAM when it is full
+struct Placement {
+  MemoryPool* internal;
+  MemoryPool* psram;
+  uint32_t psramTags;
+  size_t internalBytes;
+  size_t psramBytes;
+};
+
+static void* placementAllocate(size_t size, AsyncMqttClientMemoryTag tag, void* context) {
+  Placement* placement = static_cast<Placement*>(context);
+  if (placement->psramTags & memoryTagBit(tag)) {
+    void* pointer = placement->psram->allocate(size);
+    if (pointer) {
+      placement->psramBytes += size;
+      return pointer;
+    }
+  }
+  void* pointer = placement->internal->allocate(size);
+  if (pointer) placement->internalBytes += size;
+  return pointer;
+}
+
+static void placementRelease(void* pointer, size_t size, AsyncMqttClientMemoryTag tag, void* context) {
+  (void)size;
+  (void)tag;
+  Placement* placement = static_cast<Placement*>(context);
+  if (placement->psram->owns(pointer)) {
+    placement->psram->release(pointer);
+  } else {
+    placement->internal->release(pointer);
+  }
+}
+
+alignas(8) static uint8_t arena[16384];
+alignas(8) static uint8_t psramArena[8192];
+
+int main() {
+  bool ok = true;
+  AsyncMqttClientMemoryStats before[8];
+
+  snapshot(before);
+  bool heapOk = session() && noLeak();
+  printStats("heap", before);
+  ok &= heapOk;
+
+  {
+    MemoryPool pool(arena, sizeof(arena), { { 32, 16 }, { 128, 16 }, { 256, 16 }, { 1024, 4 } });
+    ok &= AsyncMqttClient::setAllocator(pool.allocator());
+    snapshot(before);
+    bool poolOk = session() && noLeak() && poolReleased(pool);
+    printStats("\npool", before);
+    printPool(pool);
+    ok &= poolOk && AsyncMqttClient::setAllocator(AsyncMqttClientInternals::heapAllocator());
+  }
+
+  {
+    // enough for the client, then the blocks the parser would take are held elsewhere
+    MemoryPool pool(arena, sizeof(arena), { { 32, 8 }, { 256, 4 }, { 1024, 1 } });
+    ok &= AsyncMqttClient::setAllocator(pool.allocator());
+    snapshot(before);
+    bool exhaustedOk;
+    {
+      LoopbackTransport broker;
+      AsyncMqttClient client(&broker);
+      client.setServer("localhost", 1883);
+      AsyncMqttClientDisconnectReason reason = AsyncMqttClientDisconnectReason::TCP_DISCONNECTED;
+      client.onDisconnect([&reason](AsyncMqttClientDisconnectReason disconnectReason) { reason = disconnectReason; });
+      void* held[4];
+      size_t holding = 0;
+      while (holding < 4 && (held[holding] = pool.allocate(sizeof(AsyncMqttClientInternals::PacketStorage)))) holding++;
+
+      bool refused = !connect(&client, &broker) && reason == AsyncMqttClientDisconnectReason::CLIENT_OUT_OF_MEMORY;
+      for (size_t i = 0; i < holding; i++) pool.release(held[i]);
+      bool recovered = connect(&client, &broker);
+      client.disconnect(true);
+      exhaustedOk = refused && recovered && AsyncMqttClient::memoryStats(AsyncMqttClientMemoryTag::PARSER).failures == before[0].failures + 1;
+    }
+    exhaustedOk = exhaustedOk && noLeak() && poolReleased(pool);
+    printStats("\npool too small for the parser: the CONNACK is refused with CLIENT_OUT_OF_MEMORY, the next connection works", before);
+    ok &= exhaustedOk && AsyncMqttClient::setAllocator(AsyncMqttClientInternals::heapAllocator());
+  }
+
+  {
+    MemoryPool internal(arena, sizeof(arena), { { 32, 16 }, { 128, 16 }, { 256, 16 }, { 1024, 2 } });
+    MemoryPool psram(psramArena, sizeof(psramArena), { { 128, 16 }, { 1024, 2 }, { 2048, 1 } });
+    Placement placement = { &internal, &psram,
+      memoryTagBit(AsyncMqttClientMemoryTag::QUEUE) | memoryTagBit(AsyncMqttClientMemoryTag::REASSEMBLY), 0, 0 };
+    AsyncMqttClientAllocator allocator = { placementAllocate, placementRelease, &placement };
+    ok &= AsyncMqttClient::setAllocator(allocator);
+    snapshot(before);
+    bool placementOk = session() && noLeak() && poolReleased(internal) && poolReleased(psram);
+    printf("\nqueue and reassembly in \"PSRAM\": %zu B allocated there, %zu B in \"internal\" RAM\n", placement.psramBytes, placement.internalBytes);
+    ok &= placementOk && placement.psramBytes > 0 && AsyncMqttClient::setAllocator(AsyncMqttClientInternals::heapAllocator());
+  }
+
+  printf("\n%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
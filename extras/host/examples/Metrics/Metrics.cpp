@@ -0,0 +1,137 @@
+// The protocol counters over a session with a bit of everything: refused and accepted connections, publishes
+// rejected for each cause, acks held back by a full transport, a ping answered and one timed out, and a broker
+// sending garbage. Prints the counters the way a device would publish them to a telemetry topic.
+
+#include <AsyncMqttClient.h>
+
+using AsyncMqttClientInternals::LoopbackTransport;
+using AsyncMqttClientInternals::PacketType;
+
+static uint32_t fakeTime = 0;
+static uint32_t fakeClock() { return fakeTime; }
+
+static bool connect(AsyncMqttClient* client, LoopbackTransport* broker, char returnCode = 0) {
+  client->connect();
+  broker->acknowledge(broker->outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, returnCode };
+  broker->deliver(connAck, sizeof(connAck));
+  broker->acknowledge(broker->outboundLength());
+  return client->connected();
+}
+
+static void publishFromBroker(LoopbackTransport* broker, uint16_t packetId) {
+  const char publish[] = { 0x32, 0x0A, 0x00, 0x04, 'c', 'm', 'n', 'd', static_cast<char>(packetId >> 8), static_cast<char>(packetId & 0xFF), 'o', 'n' };
+  broker->deliver(publish, sizeof(publish));
+}
+
+// what a device would publish to its own telemetry topic, compact enough for a single small PUBLISH
+static size_t formatTelemetry(char* buffer, size_t size, AsyncMqttClientMetrics const &metrics) {
+  uint32_t rejected = 0;
+  for (uint32_t count : metrics.publishRejected) rejected += count;
+  return snprintf(buffer, size, "{\"in\":%u,\"out\":%u,\"pubRejected\":%u,\"ackPeak\":%u,\"connects\":%u,"
+    "\"pingRtt\":%u,\"pingMaxRtt\":%u,\"pingTimeouts\":%u,\"parserErrors\":%u}",
+    metrics.bytesIn[PacketType.PUBLISH], metrics.bytesOut[PacketType.PUBLISH], rejected, metrics.ackBacklogPeak,
+    metrics.connects, metrics.pingRtt, metrics.maxPingRtt, metrics.pingTimeouts,
+    metrics.unexpectedPackets + metrics.malformedLengths + metrics.parserOutOfMemory);
+}
+
+static bool check(const char* what, uint32_t value, uint32_t expected) {
+  if (value == expected) return true;
+  printf("%s: %u, expected %u\n", what, value, expected);
+  return false;
+}
+
+int main() {
+  // small enough to fill up
+  LoopbackTransport broker(64);
+  AsyncMqttClient client(&broker);
+  client.setClock(fakeClock);
+  client.setClientId("metrics");
+  client.setServer("localhost", 1883);
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+  client.setSubmissionQueue(4, 48);
+  client.submitPublish("devices/metrics/log", 0, false, "not connected yet");
+#endif
+  client.publish("devices/metrics/log", 0, false, "not connected yet");
+
+  bool ok = true;
+  ok &= !connect(&client, &broker, 5);
+  broker.hangUp();
+  ok &= connect(&client, &broker);
+
+  ok &= client.publish("devices/metrics/state", 1, false, "on") != 0;
+  broker.acknowledge(broker.outboundLength());
+  ok &= client.publish("devices/metrics/state", 0, false, std::string(64, 'x').c_str()) == 0;
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+  client.submitPublish("devices/metrics/log", 0, false, String(std::string(64, 'x').c_str()));
+#endif
+
+  // the transport is left with less room than an ack takes, three PUBACKs wait for it
+  ok &= client.publish("devices/metrics/state", 0, false, std::string(64 - 26 - 2, 'x').c_str()) != 0;
+  for (uint16_t packetId = 1; packetId <= 3; packetId++) publishFromBroker(&broker, packetId);
+  broker.poll();
+  broker.acknowledge(broker.outboundLength());
+  broker.poll();
+  broker.acknowledge(broker.outboundLength());
+
+  // one ping answered after 30 ms, the next one never
+  fakeTime += 15000;
+  broker.poll();
+  broker.acknowledge(broker.outboundLength());
+  fakeTime += 30;
+  const char pingResp[] = { static_cast<char>(0xD0), 0x00 };
+  broker.deliver(pingResp, sizeof(pingResp));
+  fakeTime += 15000;
+  broker.poll();
+  broker.acknowledge(broker.outboundLength());
+  fakeTime += 30000;
+  broker.poll();
+
+  // a remaining length of five bytes, then a CONNECT, each closes the connection
+  ok &= connect(&client, &broker);
+  const char malformed[] = { 0x30, static_cast<char>(0xFF), static_cast<char>(0xFF), static_cast<char>(0xFF), static_cast<char>(0xFF), 0x01 };
+  broker.deliver(malformed, sizeof(malformed));
+  ok &= !client.connected();
+  ok &= connect(&client, &broker);
+  const char connect[] = { 0x10, 0x00 };
+  broker.deliver(connect, sizeof(connect));
+  ok &= !client.connected();
+
+  AsyncMqttClientMetrics metrics = client.metrics();
+  char telemetry[256];
+  formatTelemetry(telemetry, sizeof(telemetry), metrics);
+  printf("%s\n", telemetry);
+
+  ok &= check("CONNECT out", metrics.packetsOut[PacketType.CONNECT], 4);
+  ok &= check("CONNACK in", metrics.packetsIn[PacketType.CONNACK], 4);
+  ok &= check("CONNACK bytes in", metrics.bytesIn[PacketType.CONNACK], 16);
+  ok &= check("PUBLISH out", metrics.packetsOut[PacketType.PUBLISH], 2);
+  ok &= check("PUBLISH in", metrics.packetsIn[PacketType.PUBLISH], 3);
+  ok &= check("PUBLISH bytes in", metrics.bytesIn[PacketType.PUBLISH], 36);
+  ok &= check("PUBACK out", metrics.packetsOut[PacketType.PUBACK], 3);
+  ok &= check("PINGREQ out", metrics.packetsOut[PacketType.PINGREQ], 2);
+  ok &= check("DISCONNECT out", metrics.packetsOut[PacketType.DISCONNECT], 1);
+  ok &= check("rejected, not connected", metrics.publishRejected[static_cast<uint8_t>(AsyncMqttClientPublishRejection::NOT_CONNECTED)], 1);
+  ok &= check("rejected, no space", metrics.publishRejected[static_cast<uint8_t>(AsyncMqttClientPublishRejection::NO_SPACE)], 1);
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+  ok &= check("rejected, queue closed", metrics.publishRejected[static_cast<uint8_t>(AsyncMqttClientPublishRejection::QUEUE_CLOSED)], 1);
+  ok &= check("rejected, queue full", metrics.publishRejected[static_cast<uint8_t>(AsyncMqttClientPublishRejection::QUEUE_FULL)], 1);
+#endif
+  ok &= check("ack backlog peak", metrics.ackBacklogPeak, 3);
+  ok &= check("acks deferred", metrics.acksDeferred > 0, 1);
+  ok &= check("connects", metrics.connects, 3);
+  ok &= check("refused, not authorized", metrics.disconnects[static_cast<uint8_t>(AsyncMqttClientDisconnectReason::MQTT_NOT_AUTHORIZED)], 1);
+  ok &= check("TCP disconnections", metrics.disconnects[static_cast<uint8_t>(AsyncMqttClientDisconnectReason::TCP_DISCONNECTED)], 2);
+  ok &= check("pings", metrics.pings, 2);
+  ok &= check("ping RTT", metrics.pingRtt, 30);
+  ok &= check("ping timeouts", metrics.pingTimeouts, 1);
+  ok &= check("malformed lengths", metrics.malformedLengths, 1);
+  ok &= check("unexpected packets", metrics.unexpectedPackets, 1);
+
+  client.resetMetrics();
+  metrics = client.metrics();
+  ok &= check("connects after a reset", metrics.connects, 0);
+
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+// Publishes one message to a broker over a real TCP connection.
+// usage: Publish <host> <port> <topic> <payload> [qos]
+
+#include <stdlib.h>
+
+#include <AsyncMqttClient.h>
+
+int main(int argc, char** argv) {
+  if (argc < 5) {
+    fprintf(stderr, "usage: %s <host> <port> <topic> <payload> [qos]\n", argv[0]);
+    return 2;
+  }
+
+  AsyncMqttClientInternals::PosixTcpTransport transport;
+  AsyncMqttClient mqttClient(&transport);
+
+  // the callbacks capture a single pointer, small enough for their delegates
+  struct {
+    AsyncMqttClient* client;
+    const char* topic;
+    const char* payload;
+    uint8_t qos;
+    bool done;
+    int status;
+  } state = { &mqttClient, argv[3], argv[4], static_cast<uint8_t>(argc > 5 ? atoi(argv[5]) : 0), false, 1 };
+
+  mqttClient.setServer(argv[1], atoi(argv[2]));
+  mqttClient.onConnect([&state](bool sessionPresent) {
+    (void)sessionPresent;
+    uint16_t packetId = state.client->publish(state.topic, state.qos, false, state.payload);
+    if (packetId == 0) {
+      state.done = true;
+    } else if (state.qos == 0) {
+      state.status = 0;
+      state.client->disconnect();
+    }
+  });
+  mqttClient.onPublish([&state](uint16_t packetId) {
+    (void)packetId;
+    state.status = 0;
+    state.client->disconnect();
+  });
+  mqttClient.onDisconnect([&state](AsyncMqttClientDisconnectReason reason) {
+    if (reason != AsyncMqttClientDisconnectReason::TCP_DISCONNECTED) fprintf(stderr, "Disconnected, reason: %d\n", static_cast<int>(reason));
+    state.done = true;
+  });
+
+  mqttClient.connect();
+  uint32_t start = millis();
+  while (!state.done && millis() - start < 10000) transport.loop(100);
+  return state.status;
+}
@@ -0,0 +1,280 @@
+// Rate control: QoS 1 telemetry offered at about 11 kB/s over a link that degrades from 32 kB/s and a 60 ms round trip
+// to 8 kB/s and 250 ms, then 2 kB/s and 600 ms, and recovers, behind a TCP send buffer of 5744 bytes as lwIP's.
+// Without the controller, publishes fill the buffer, wait behind it, and fail in bursts while it is full; with it,
+// they are paced to the link, refused one by one (RATE_LIMITED) or, with an application reading permittedRate(),
+// hardly at all. Reports for each phase of the link the rate permitted, the throughput, the time from publish() to
+// the broker, and the publishes refused with the longest run of them.
+// usage: RateControl
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <AsyncMqttClient.h>
+
+#if ASYNC_MQTT_RATE_CONTROL
+using AsyncMqttClientInternals::LoopbackTransport;
+
+static const size_t SEND_BUFFER = 5744;
+static const size_t PAYLOAD = 200;
+static const uint32_t INTERVAL = 20;  // ms between samples, 50 per second
+static const uint32_t SETTLING = 5000;  // ms into a phase after which its latencies count as settled
+
+struct Phase {
+  uint32_t end;  // ms
+  uint32_t rate;  // bytes per ms
+  uint32_t roundTrip;
+};
+
+static const Phase PHASES[] = {
+  { 40000, 32, 60 },
+  { 80000, 8, 250 },
+  { 120000, 2, 600 },
+  { 160000, 32, 60 }
+};
+static const size_t PHASE_COUNT = sizeof(PHASES) / sizeof(PHASES[0]);
+
+enum class Mode {
+  NONE,
+  PACED,
+  ADAPTIVE
+};
+
+struct PhaseResult {
+  std::vector<uint32_t> latencies;
+  std::vector<uint32_t> settled;
+  uint64_t rateSum = 0;
+  uint32_t rateSamples = 0;
+  size_t bytes = 0;
+  size_t refused = 0;
+  size_t longestRun = 0;
+};
+
+static uint32_t simulatedMillis = 0;
+static uint32_t simulatedClock() { return simulatedMillis; }
+
+static size_t phaseAt(uint32_t time) {
+  size_t phase = 0;
+  while (phase + 1 < PHASE_COUNT && time >= PHASES[phase].end) phase++;
+  return phase;
+}
+
+static uint32_t phaseStart(size_t phase) {
+  return phase == 0 ? 0 : PHASES[phase - 1].end;
+}
+
+// the link and the broker: bytes leave the send buffer at the rate of the moment and arrive half a round trip later;
+// TCP acknowledges them, and the broker's PUBACK and PINGRESP come back, a round trip after they left
+class Link {
+ public:
+  Link(LoopbackTransport* transport, std::vector<uint32_t> const *publishTimes, PhaseResult* results)
+  : _transport(transport)
+  , _publishTimes(publishTimes)
+  , _results(results)
+  , _transmitted(0)
+  , _written(0) {
+  }
+
+  void connect(AsyncMqttClient* client) {
+    client->connect();
+    _transport->acknowledge(_transport->outboundLength());
+    const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+    _transport->deliver(connAck, sizeof(connAck));
+  }
+
+  // after the client's millisecond: when what it wrote went into the send buffer, as a POSIX transport reports it
+  void written() {
+    size_t length = _transport->outboundLength();
+    if (length > _written) _writes.push_back(std::make_pair(simulatedMillis, length - _written));
+    _written = length;
+  }
+
+  void tick() {
+    Phase const &phase = PHASES[phaseAt(simulatedMillis)];
+    size_t length = std::min<size_t>(phase.rate, _transport->outboundLength() - _transmitted);
+    if (length > 0) {
+      _stream.append(_transport->outbound() + _transmitted, length);
+      _transmitted += length;
+      _acks.push_back(Ack { simulatedMillis + phase.roundTrip, length });
+      _decode(phase.roundTrip);
+    }
+
+    while (!_acks.empty() && _acks.front().time <= simulatedMillis) {
+      size_t acknowledged = _acks.front().length;
+      _acks.pop_front();
+      uint32_t oldest = _writes.front().first;
+      _consumeWrites(acknowledged);
+      _transmitted -= acknowledged;
+      _written -= acknowledged;
+      _transport->acknowledge(acknowledged, simulatedMillis - oldest);
+    }
+    while (!_replies.empty() && _replies.front().first <= simulatedMillis) {
+      std::string reply = _replies.front().second;
+      _replies.pop_front();
+      _transport->deliver(reply.data(), reply.size());
+    }
+  }
+
+ private:
+  struct Ack {
+    uint32_t time;
+    size_t length;
+  };
+
+  LoopbackTransport* _transport;
+  std::vector<uint32_t> const *_publishTimes;
+  PhaseResult* _results;
+  size_t _transmitted;
+  size_t _written;
+  std::deque<Ack> _acks;
+  std::deque<std::pair<uint32_t, size_t>> _writes;
+  std::deque<std::pair<uint32_t, std::string>> _replies;
+  std::string _stream;
+
+  void _consumeWrites(size_t length) {
+    while (length > 0) {
+      size_t taken = std::min(length, _writes.front().second);
+      _writes.front().second -= taken;
+      length -= taken;
+      if (_writes.front().second == 0) _writes.pop_front();
+    }
+  }
+
+  void _decode(uint32_t roundTrip) {
+    for (;;) {
+      if (_stream.size() < 2) return;
+      size_t remaining = 0;
+      size_t position = 1;
+      uint32_t multiplier = 1;
+      uint8_t byte;
+      do {
+        if (position >= _stream.size()) return;
+        byte = static_cast<uint8_t>(_stream[position++]);
+        remaining += (byte & 0x7F) * multiplier;
+        multiplier *= 128;
+      } while (byte & 0x80);
+      if (_stream.size() < position + remaining) return;
+
+      uint8_t header = static_cast<uint8_t>(_stream[0]);
+      std::string body = _stream.substr(position, remaining);
+      _stream.erase(0, position + remaining);
+      if (header >> 4 == 12) _replies.push_back(std::make_pair(simulatedMillis + roundTrip, std::string("\xD0\x00", 2)));
+      if (header >> 4 != 3) continue;
+
+      size_t topicLength = static_cast<uint8_t>(body[0]) << 8 | static_cast<uint8_t>(body[1]);
+      const char pubAck[] = { 0x40, 0x02, body[2 + topicLength], body[3 + topicLength] };
+      _replies.push_back(std::make_pair(simulatedMillis + roundTrip, std::string(pubAck, sizeof(pubAck))));
+      // the payload starts with the number of the sample
+      size_t sample = strtoul(body.c_str() + 4 + topicLength, nullptr, 10);
+      uint32_t published = (*_publishTimes)[sample];
+      size_t phase = phaseAt(published);
+      PhaseResult &result = _results[phase];
+      uint32_t latency = simulatedMillis + roundTrip / 2 - published;
+      result.latencies.push_back(latency);
+      if (published >= phaseStart(phase) + SETTLING) result.settled.push_back(latency);
+      result.bytes += position + remaining;
+    }
+  }
+};
+
+static void simulate(Mode mode, PhaseResult* results) {
+  LoopbackTransport transport(SEND_BUFFER);
+  AsyncMqttClient client(&transport);
+  client.setClock(simulatedClock);
+  client.setServer("localhost", 1883);
+  if (mode != Mode::NONE) client.setRateControl(1000, 64000);
+
+  std::vector<uint32_t> publishTimes;
+  Link link(&transport, &publishTimes, results);
+  simulatedMillis = 0;
+  link.connect(&client);
+
+  std::string payload(PAYLOAD, '.');
+  size_t run = 0;
+  uint32_t nextSample = INTERVAL;
+  for (simulatedMillis = 1; simulatedMillis < PHASES[PHASE_COUNT - 1].end; simulatedMillis++) {
+    link.tick();
+    if (simulatedMillis % 10 == 0) transport.poll();
+    PhaseResult &result = results[phaseAt(simulatedMillis)];
+    if (mode != Mode::NONE && simulatedMillis % 100 == 0) {
+      result.rateSum += client.permittedRate();
+      result.rateSamples++;
+    }
+
+    if (simulatedMillis >= nextSample) {
+      // an adaptive application samples no faster than the permitted rate carries
+      uint32_t interval = INTERVAL;
+      if (mode == Mode::ADAPTIVE) interval = std::max<uint32_t>(INTERVAL, (PAYLOAD + 30) * 1000 / std::max<uint32_t>(client.permittedRate(), 1));
+      nextSample = simulatedMillis + interval;
+
+      std::string number = std::to_string(publishTimes.size());
+      payload.replace(0, number.size(), number);
+      payload[number.size()] = ' ';
+      publishTimes.push_back(simulatedMillis);
+      if (client.publish("devices/pump/telemetry", 1, false, payload.data(), payload.size()) != 0) {
+        run = 0;
+      } else {
+        result.refused++;
+        result.longestRun = std::max(result.longestRun, ++run);
+      }
+    }
+    link.written();
+  }
+}
+
+static uint32_t percentile(std::vector<uint32_t> values, double fraction) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  return values[std::min(values.size() - 1, static_cast<size_t>(fraction * values.size()))];
+}
+
+int main() {
+  const char* const names[] = { "no control", "controller", "controller, application following permittedRate()" };
+  PhaseResult results[3][PHASE_COUNT];
+  bool ok = true;
+  printf("%zu B samples every %u ms, %zu byte send buffer\n", PAYLOAD, INTERVAL, SEND_BUFFER);
+  for (uint8_t mode = 0; mode < 3; mode++) {
+    simulate(static_cast<Mode>(mode), results[mode]);
+    printf("\n%s\n%-22s %9s %11s %8s %8s %8s %8s %12s\n", names[mode], "link", "permitted", "throughput", "p50", "p99",
+      "settled", "refused", "longest run");
+    for (size_t i = 0; i < PHASE_COUNT; i++) {
+      PhaseResult const &result = results[mode][i];
+      double seconds = (PHASES[i].end - phaseStart(i)) / 1000.0;
+      char link[32];
+      snprintf(link, sizeof(link), "%2u kB/s, %3u ms", PHASES[i].rate, PHASES[i].roundTrip);
+      char permitted[16] = "-";
+      if (result.rateSamples > 0) snprintf(permitted, sizeof(permitted), "%.1f kB/s", result.rateSum / result.rateSamples / 1000.0);
+      printf("%-22s %9s %6.1f kB/s %5u ms %5u ms %5u ms %8zu %12zu\n", link, permitted, result.bytes / seconds / 1000,
+        percentile(result.latencies, 0.5), percentile(result.latencies, 0.99), percentile(result.settled, 0.99),
+        result.refused, result.longestRun);
+    }
+  }
+
+  // once the degraded link settles, the controller keeps the delay within a round trip and a few times the target and
+  // carries most of what the link does, as AIMD does; what sat in the send buffer when the link dropped drains either way
+  size_t longestRuns[3] = { 0, 0, 0 };
+  for (size_t i = 1; i < 3; i++) {
+    uint32_t bound = PHASES[i].roundTrip * 2 + ASYNC_MQTT_RATE_TARGET_DELAY * 4;
+    for (uint8_t mode = 1; mode < 3; mode++) {
+      PhaseResult const &result = results[mode][i];
+      uint32_t settled = percentile(result.settled, 0.99);
+      ok &= settled <= bound && settled < percentile(results[0][i].settled, 0.99) * 2 / 3;
+      ok &= result.bytes >= results[0][i].bytes * 7 / 10;
+    }
+    ok &= results[2][i].refused < results[1][i].refused;
+    for (uint8_t mode = 0; mode < 3; mode++) longestRuns[mode] = std::max(longestRuns[mode], results[mode][i].longestRun);
+  }
+  // refusals come spread out rather than in the runs of a full buffer
+  ok &= longestRuns[1] < longestRuns[0] && longestRuns[2] < longestRuns[0];
+  // and gives the rate back once the link recovers
+  ok &= results[1][3].bytes >= results[0][3].bytes * 9 / 10 && results[2][3].bytes >= results[0][3].bytes * 9 / 10;
+  printf("\n%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+#else
+int main() {
+  printf("built with ASYNC_MQTT_RATE_CONTROL 0\n");
+  return 0;
+}
+#endif
@@ -0,0 +1,237 @@
+// Replays an exported FrameCapture through a client on a loopback transport: the inbound segments are delivered
+// as captured, split where they were split, and the client's clock follows the capture's timestamps (the wall clock
+// as well with --realtime) so its timeouts fire where they fired. Reports where the client parts ways with the
+// capture, closing a connection the capture kept open, and the parser's time per segment, the best of --repeat runs.
+// --dedupe drops QoS 1 redeliveries seen within WINDOW milliseconds, see setDuplicateFilter(), and counts them.
+// usage: Replay [--dump] [--realtime] [--repeat N] [--max-topic LENGTH] [--dedupe WINDOW] FILE
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+
+#include <AsyncMqttClient.h>
+
+using AsyncMqttClientInternals::CaptureDirection;
+using AsyncMqttClientInternals::CaptureReader;
+using AsyncMqttClientInternals::CaptureRecord;
+using AsyncMqttClientInternals::LoopbackTransport;
+
+struct Options {
+  bool dump = false;
+  bool realtime = false;
+  uint32_t repeat = 1;
+  uint16_t maxTopicLength = 256;
+  uint32_t dedupeWindow = 0;
+  const char* path = nullptr;
+};
+
+struct Run {
+  size_t segments = 0;
+  uint64_t bytes = 0;
+  uint64_t messages = 0;
+  uint32_t connections = 0;
+  uint32_t closedByClient = 0;
+  uint32_t duplicatesDropped = 0;
+  double seconds = 0;
+  bool diverged = false;
+};
+
+static const char* const DIRECTIONS[] = { "in", "out", "connected", "disconnected" };
+
+// the client's clock, in milliseconds, driven by the capture's microseconds
+static uint64_t replayMicros = 0;
+static uint32_t replayClock() { return static_cast<uint32_t>(replayMicros / 1000); }
+
+static void usage(const char* name) {
+  fprintf(stderr, "usage: %s [--dump] [--realtime] [--repeat N] [--max-topic LENGTH] [--dedupe WINDOW] FILE\n", name);
+}
+
+static bool parseOptions(int argc, char** argv, Options* options) {
+  static const struct option longOptions[] = {
+    { "dump", no_argument, nullptr, 'd' },
+    { "realtime", no_argument, nullptr, 'r' },
+    { "repeat", required_argument, nullptr, 'n' },
+    { "max-topic", required_argument, nullptr, 't' },
+    { "dedupe", required_argument, nullptr, 'u' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  int option;
+  while ((option = getopt_long(argc, argv, "", longOptions, nullptr)) != -1) {
+    switch (option) {
+      case 'd': options->dump = true; break;
+      case 'r': options->realtime = true; break;
+      case 'n': options->repeat = strtoul(optarg, nullptr, 10); break;
+      case 't': options->maxTopicLength = strtoul(optarg, nullptr, 10); break;
+      case 'u': options->dedupeWindow = strtoul(optarg, nullptr, 10); break;
+      default: return false;
+    }
+  }
+  if (optind + 1 != argc) return false;
+  options->path = argv[optind];
+  return options->repeat > 0;
+}
+
+static bool readFile(const char* path, std::string* data) {
+  FILE* file = fopen(path, "rb");
+  if (!file) return false;
+  char buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) data->append(buffer, length);
+  fclose(file);
+  return true;
+}
+
+static bool dump(std::string const &capture) {
+  CaptureReader reader(reinterpret_cast<const uint8_t*>(capture.data()), capture.size());
+  CaptureRecord record;
+  uint32_t first = 0;
+  size_t records = 0;
+  while (reader.next(&record)) {
+    if (records++ == 0) first = record.time;
+    printf("%6zu %10.3f ms  %-12s %6u B", records, static_cast<uint32_t>(record.time - first) / 1000.0,
+      DIRECTIONS[static_cast<uint8_t>(record.direction) & 3], record.length);
+    for (uint16_t i = 0; i < record.captured && i < 16; i++) printf(" %02x", record.data[i]);
+    printf("%s\n", record.captured < record.length ? " ..." : "");
+  }
+  return records > 0;
+}
+
+static Run replay(std::string const &capture, Options const &options, bool report) {
+  LoopbackTransport broker(65536);
+  broker.setAutoAcknowledge(true);
+  AsyncMqttClient client(&broker);
+  client.setClock(replayClock);
+  client.setMaxTopicLength(options.maxTopicLength);
+  client.setServer("localhost", 1883);
+#if ASYNC_MQTT_DUPLICATE_FILTER
+  if (options.dedupeWindow > 0) client.setDuplicateFilter(16, options.dedupeWindow);
+#endif
+
+  Run run;
+  bool hangingUp = false;
+  size_t number = 0;
+  client.onMessage([&run](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+    (void)topic;
+    (void)payload;
+    (void)properties;
+    (void)len;
+    (void)total;
+    if (index == 0) run.messages++;
+  });
+  client.onDisconnect([&](AsyncMqttClientDisconnectReason reason) {
+    if (hangingUp) return;
+    run.closedByClient++;
+    if (report) printf("record %zu: the client closed the connection, reason %d\n", number, static_cast<int>(reason));
+  });
+
+  CaptureReader reader(reinterpret_cast<const uint8_t*>(capture.data()), capture.size());
+  CaptureRecord record;
+  bool started = false;
+  uint32_t previous = 0;
+  replayMicros = 0;
+  while (reader.next(&record)) {
+    number++;
+    // what came before the first connection, the tail of an older one, has nothing to be fed to
+    if (!started && record.direction != CaptureDirection::CONNECTED) continue;
+    uint32_t elapsed = started ? record.time - previous : 0;
+    started = true;
+    previous = record.time;
+    replayMicros += elapsed;
+    if (options.realtime && elapsed > 0) usleep(elapsed);
+
+    switch (record.direction) {
+      case CaptureDirection::CONNECTED:
+        if (broker.connected()) {
+          hangingUp = true;
+          broker.hangUp();
+          hangingUp = false;
+        }
+        broker.acknowledge(broker.outboundLength());
+        run.connections++;
+        client.connect();
+        break;
+      case CaptureDirection::DISCONNECTED:
+        hangingUp = true;
+        broker.hangUp();
+        hangingUp = false;
+        break;
+      case CaptureDirection::INBOUND: {
+        if (!broker.connected()) {
+          // the capture's connection is still open: this is where the replay parts ways with it
+          if (report && !run.diverged) printf("record %zu: %u bytes for a connection the client closed\n", number, record.length);
+          run.diverged = true;
+          break;
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        broker.deliver(reinterpret_cast<const char*>(record.data), record.captured);
+        broker.poll();
+        run.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        run.segments++;
+        run.bytes += record.captured;
+        break;
+      }
+      default:
+        // the client writes its own frames, the captured ones only tell when
+        broker.poll();
+        break;
+    }
+  }
+  if (broker.connected()) {
+    hangingUp = true;
+    broker.hangUp();
+    hangingUp = false;
+  }
+#if ASYNC_MQTT_METRICS
+  run.duplicatesDropped = client.metrics().duplicatesDropped;
+#endif
+  return run;
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::string capture;
+  if (!readFile(options.path, &capture)) {
+    fprintf(stderr, "Cannot read %s\n", options.path);
+    return 2;
+  }
+  if (!CaptureReader(reinterpret_cast<const uint8_t*>(capture.data()), capture.size()).valid()) {
+    fprintf(stderr, "%s is not an exported capture\n", options.path);
+    return 2;
+  }
+  if (options.dump) return dump(capture) ? 0 : 1;
+
+  // the parser cannot be fed the first bytes of a segment alone: such a capture can only be dumped
+  CaptureReader reader(reinterpret_cast<const uint8_t*>(capture.data()), capture.size());
+  CaptureRecord record;
+  while (reader.next(&record)) {
+    if (record.direction == CaptureDirection::INBOUND && record.captured < record.length) {
+      fprintf(stderr, "%s holds the first bytes of each record only, it can be dumped (--dump) but not replayed\n", options.path);
+      return 2;
+    }
+  }
+
+  Run best = replay(capture, options, true);
+  for (uint32_t i = 1; i < options.repeat; i++) {
+    Run run = replay(capture, options, false);
+    if (run.seconds < best.seconds) best.seconds = run.seconds;
+  }
+
+  printf("%u connections, %zu inbound segments, %llu bytes, %llu messages, %u closed by the client\n", best.connections, best.segments,
+    static_cast<unsigned long long>(best.bytes), static_cast<unsigned long long>(best.messages), best.closedByClient);  // NOLINT(runtime/int)
+  if (best.segments > 0) {
+    printf("parser: %.1f ns per segment, %.1f MB/s%s\n", best.seconds * 1e9 / best.segments, best.bytes / best.seconds / 1e6,
+      options.repeat > 1 ? ", best run" : "");
+  }
+  if (options.dedupeWindow > 0) printf("%u QoS 1 redeliveries dropped\n", best.duplicatesDropped);
+  if (best.diverged) printf("the replay diverged from the capture\n");
+  return best.diverged ? 1 : 0;
+}
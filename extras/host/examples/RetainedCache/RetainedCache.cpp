@@ -0,0 +1,198 @@
+// Retained cache: config values received as retained messages and read back synchronously, replaced, cleared,
+// evicted under the memory budget, saved to a file and loaded into a new cache before any connection; then random
+// updates checked against a map, and the time of a read with few and many topics cached.
+// usage: RetainedCache [DIRECTORY]
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+
+#include <AsyncMqttClient.h>
+
+#if ASYNC_MQTT_RETAINED_CACHE
+using AsyncMqttClientInternals::LoopbackTransport;
+using AsyncMqttClientInternals::RetainedCache;
+
+static std::string publishPacket(const char* topic, std::string const &payload, bool retain) {
+  std::string body;
+  body.push_back(static_cast<char>(strlen(topic) >> 8));
+  body.push_back(static_cast<char>(strlen(topic) & 0xFF));
+  body += topic;
+  body += payload;
+  char remainingLength[4];
+  std::string packet(1, retain ? 0x31 : 0x30);
+  packet.append(remainingLength, AsyncMqttClientInternals::Helpers::encodeRemainingLength(body.size(), remainingLength));
+  return packet + body;
+}
+
+static void deliver(LoopbackTransport* broker, const char* topic, std::string const &payload, bool retain = true) {
+  std::string packet = publishPacket(topic, payload, retain);
+  // in odd segments, the payload reaches the cache in pieces
+  for (size_t position = 0; position < packet.size(); position += 7) {
+    broker->deliver(packet.data() + position, packet.size() - position < 7 ? packet.size() - position : 7);
+  }
+}
+
+static void connect(AsyncMqttClient* client, LoopbackTransport* broker) {
+  client->setServer("localhost", 1883);
+  client->connect();
+  broker->acknowledge(broker->outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker->deliver(connAck, sizeof(connAck));
+}
+
+static std::string value(RetainedCache const &cache, const char* topic) {
+  char buffer[256];
+  size_t length = cache.read(topic, buffer, sizeof(buffer));
+  return std::string(buffer, length < sizeof(buffer) ? length : sizeof(buffer));
+}
+
+static bool check(const char* what, bool ok) {
+  if (!ok) printf("%s: FAILED\n", what);
+  return ok;
+}
+
+static void writeFile(const uint8_t* data, size_t length, void* file) {
+  fwrite(data, 1, length, static_cast<FILE*>(file));
+}
+
+static size_t readFile(uint8_t* data, size_t length, void* file) {
+  return fread(data, 1, length, static_cast<FILE*>(file));
+}
+
+// random stores, replacements and clears of a small cache, which must hold the latest value of whatever it keeps
+static bool randomUpdates() {
+  static uint8_t buffer[1536];
+  RetainedCache cache(buffer, sizeof(buffer), 24);
+  cache.addTopics("#");
+  std::map<std::string, std::string> latest;
+  std::mt19937 random(42);
+  for (int i = 0; i < 200000; i++) {
+    char topic[32];
+    snprintf(topic, sizeof(topic), "config/%u", static_cast<unsigned>(random() % 40));
+    std::string payload(random() % 8 == 0 ? 0 : random() % 120 + 1, static_cast<char>('a' + i % 26));
+    cache.begin(topic, payload.size());
+    // now and then a message cut by a lost connection
+    if (random() % 50 == 0) {
+      cache.write(payload.data(), payload.size() / 2);
+      cache.abort();
+      continue;
+    }
+    for (size_t position = 0; position < payload.size(); position += 13) {
+      cache.write(payload.data() + position, payload.size() - position < 13 ? payload.size() - position : 13);
+    }
+    cache.end();
+    latest[topic] = payload;
+    if (cache.entries() > 24 || cache.used() > cache.capacity()) return false;
+  }
+  size_t held = 0;
+  for (std::pair<const std::string, std::string> const &entry : latest) {
+    if (!cache.contains(entry.first.c_str())) continue;
+    held++;
+    if (entry.second.empty() || value(cache, entry.first.c_str()) != entry.second) return false;
+  }
+  printf("random updates: %zu of %zu topics held, %u evictions\n", held, latest.size(), cache.evictions());
+  return held == cache.entries() && cache.evictions() > 0;
+}
+
+// nanoseconds per read() of a cache of count topics
+static double readTime(size_t count) {
+  static uint8_t buffer[1 << 20];
+  RetainedCache cache(buffer, sizeof(buffer), count);
+  cache.addTopics("#");
+  std::vector<std::string> topics;
+  for (size_t i = 0; i < count; i++) {
+    char topic[64];
+    snprintf(topic, sizeof(topic), "devices/sensor-%04zu/config/threshold", i);
+    topics.push_back(topic);
+    cache.begin(topic, 2);
+    cache.write("42", 2);
+    cache.end();
+  }
+  const size_t reads = 2000000;
+  char value[8];
+  size_t sum = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < reads; i++) sum += cache.read(topics[(i * 7919) % count].c_str(), value, sizeof(value));
+  double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  return sum == 2 * reads ? elapsed / reads : 0;
+}
+
+int main(int argc, char** argv) {
+  std::string path = std::string(argc > 1 ? argv[1] : "/tmp") + "/retained-cache.bin";
+  bool ok = true;
+
+  static uint8_t buffer[2048];
+  RetainedCache cache(buffer, sizeof(buffer), 16);
+  cache.addTopics("config/#");
+  LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  client.setRetainedCache(&cache);
+  std::string seen;
+  client.onMessage([&cache, &seen](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+    (void)payload;
+    (void)properties;
+    (void)len;
+    (void)total;
+    // the value is in the cache by the last piece
+    if (index + len == total) seen = std::string(topic) + "=" + value(cache, topic);
+  });
+  connect(&client, &broker);
+
+  deliver(&broker, "config/threshold", "21.5");
+  deliver(&broker, "config/mode", "eco");
+  deliver(&broker, "telemetry/temperature", "20.1", false);
+  ok &= check("cached", value(cache, "config/threshold") == "21.5" && value(cache, "config/mode") == "eco" &&
+    !cache.contains("telemetry/temperature") && seen == "telemetry/temperature=" && cache.entries() == 2);
+  deliver(&broker, "config/threshold", "23.0", false);
+  ok &= check("replaced", value(cache, "config/threshold") == "23.0" && seen == "config/threshold=23.0");
+  deliver(&broker, "config/mode", "");
+  ok &= check("cleared", !cache.contains("config/mode") && cache.entries() == 1);
+
+  // cut by a lost connection, the value before stays
+  std::string packet = publishPacket("config/threshold", "99.9", true);
+  broker.deliver(packet.data(), packet.size() - 2);
+  broker.hangUp();
+  ok &= check("interrupted", value(cache, "config/threshold") == "23.0");
+  connect(&client, &broker);
+
+  // values of 100 bytes in a budget for about a dozen: the ones updated longest ago go
+  for (int i = 0; i < 20; i++) {
+    char topic[32];
+    snprintf(topic, sizeof(topic), "config/zone/%d", i);
+    deliver(&broker, topic, std::string(100, static_cast<char>('a' + i)));
+  }
+  printf("budget: %zu entries, %zu of %zu bytes, %u evictions\n", cache.entries(), cache.used(), cache.capacity(), cache.evictions());
+  ok &= check("budget", cache.evictions() > 0 && cache.contains("config/zone/19") && !cache.contains("config/zone/0") &&
+    cache.used() <= cache.capacity());
+  deliver(&broker, "config/firmware", std::string(4096, 'x'));
+  ok &= check("too large", !cache.contains("config/firmware") && cache.rejected() == 1);
+
+  // saved, then loaded into the cache of a new client before it connects
+  FILE* file = fopen(path.c_str(), "wb");
+  cache.exportTo(writeFile, file);
+  fclose(file);
+  static uint8_t otherBuffer[2048];
+  RetainedCache warm(otherBuffer, sizeof(otherBuffer), 16);
+  file = fopen(path.c_str(), "rb");
+  bool loaded = warm.importFrom(readFile, file);
+  fclose(file);
+  remove(path.c_str());
+  printf("saved: %zu bytes, %zu entries loaded\n", cache.exportSize(), warm.entries());
+  ok &= check("persisted", loaded && warm.entries() == cache.entries() && value(warm, "config/zone/19") == std::string(100, 't') &&
+    value(warm, "config/threshold") == value(cache, "config/threshold"));
+
+  ok &= check("random updates", randomUpdates());
+
+  printf("\nread():");
+  for (size_t count : { 16, 256, 4096 }) printf(" %zu topics %.0f ns", count, readTime(count));
+  printf("\n\n%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+#else
+int main() {
+  printf("built with ASYNC_MQTT_RETAINED_CACHE 0\n");
+  return 0;
+}
+#endif
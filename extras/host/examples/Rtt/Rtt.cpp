@@ -0,0 +1,164 @@
+// The RTT estimator against the rules of RFC 6298, computed in floating point: the first sample sets SRTT to R and
+// RTTVAR to R/2, the next ones RTTVAR to 3/4 RTTVAR + 1/4 |SRTT - R| then SRTT to 7/8 SRTT + 1/8 R, and the
+// retransmission timeout is SRTT + 4 RTTVAR, at least ASYNC_MQTT_MIN_RTO. Then, on a client, that the estimate carries
+// over a reconnection to the same server and starts over once setServer() changed it, and that a PUBACK lost after the
+// watchdog pinged for it does not keep the next publishes from being timed.
+// usage: Rtt
+
+#include <math.h>
+
+#include <string>
+#include <vector>
+
+#include <AsyncMqttClient.h>
+
+using AsyncMqttClientInternals::LoopbackTransport;
+using AsyncMqttClientInternals::RttEstimator;
+
+struct Sequence {
+  const char* name;
+  std::vector<uint32_t> samples;
+};
+
+static uint32_t counter = 1;
+static uint32_t randomNumber() {
+  counter = counter * 1103515245 + 12345;
+  return counter >> 8;
+}
+
+// the fixed point estimator truncates, it stays within a couple of milliseconds of the exact values
+static bool check(Sequence const &sequence) {
+  RttEstimator estimator;
+  double srtt = 0;
+  double rttVar = 0;
+  double worst = 0;
+  bool ok = !estimator.valid() && estimator.rto() == ASYNC_MQTT_MIN_RTO;
+  for (size_t i = 0; i < sequence.samples.size(); i++) {
+    double r = sequence.samples[i];
+    if (i == 0) {
+      srtt = r;
+      rttVar = r / 2;
+    } else {
+      rttVar = 0.75 * rttVar + 0.25 * fabs(srtt - r);
+      srtt = 0.875 * srtt + 0.125 * r;
+    }
+    double rto = std::max<double>(srtt + 4 * rttVar, ASYNC_MQTT_MIN_RTO);
+    estimator.sample(sequence.samples[i]);
+    double error = std::max(fabs(estimator.smoothed() - srtt), fabs(estimator.variance() - rttVar));
+    worst = std::max(worst, error);
+    ok &= estimator.valid() && error <= 2 && fabs(estimator.rto() - rto) <= 8;
+  }
+  printf("%-28s %6zu samples  SRTT %7.1f ms (%5u)  RTTVAR %7.1f ms (%5u)  RTO %5u ms  worst error %.2f ms  %s\n",
+    sequence.name, sequence.samples.size(), srtt, estimator.smoothed(), rttVar, estimator.variance(), estimator.rto(),
+    worst, ok ? "ok" : "WRONG");
+  estimator.reset();
+  return ok && !estimator.valid() && estimator.smoothed() == 0;
+}
+
+static uint32_t simulatedMillis = 0;
+static uint32_t simulatedClock() { return simulatedMillis; }
+
+static bool connect(AsyncMqttClient* client, LoopbackTransport* broker) {
+  client->connect();
+  broker->acknowledge(broker->outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker->deliver(connAck, sizeof(connAck));
+  return client->connected();
+}
+
+// a QoS 1 publish answered rtt ms later
+static void probe(AsyncMqttClient* client, LoopbackTransport* broker, uint32_t rtt) {
+  uint16_t packetId = client->publish("devices/rtt", 1, false, "probe");
+  broker->acknowledge(broker->outboundLength());
+  simulatedMillis += rtt;
+  const char pubAck[] = { 0x40, 0x02, static_cast<char>(packetId >> 8), static_cast<char>(packetId & 0xFF) };
+  broker->deliver(pubAck, sizeof(pubAck));
+}
+
+static bool reconnections() {
+  LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  client.setClock(simulatedClock);
+  client.setServer("broker-a", 1883);
+  bool ok = connect(&client, &broker);
+  for (uint8_t i = 0; i < 8; i++) probe(&client, &broker, 300);
+  uint32_t measured = client.smoothedRtt();
+  ok &= measured == 300;
+
+  // same server, the estimate carries over
+  broker.hangUp();
+  client.setServer("broker-a", 1883);
+  ok &= connect(&client, &broker) && client.smoothedRtt() == measured;
+
+  // another server: kept while still connected to the first one, then starts over
+  client.setServer("broker-b", 1883);
+  ok &= client.smoothedRtt() == measured;
+  broker.hangUp();
+  ok &= connect(&client, &broker) && client.smoothedRtt() == 0;
+  probe(&client, &broker, 20);
+  ok &= client.smoothedRtt() == 20;
+
+  // another port, or an IP instead of a host name, is another server too
+  broker.hangUp();
+  client.setServer("broker-b", 8883);
+  ok &= connect(&client, &broker) && client.smoothedRtt() == 0;
+  probe(&client, &broker, 40);
+  broker.hangUp();
+  client.setServer(IPAddress(192, 168, 1, 10), 8883);
+  ok &= connect(&client, &broker) && client.smoothedRtt() == 0;
+  probe(&client, &broker, 60);
+  broker.hangUp();
+  client.setServer(IPAddress(192, 168, 1, 10), 8883);
+  ok &= connect(&client, &broker) && client.smoothedRtt() == 60;
+
+  printf("reconnections: %s\n", ok ? "kept for the same server, started over for another" : "WRONG");
+  return ok;
+}
+
+// the PUBACK of the timed publish never comes: once the watchdog's ping is answered, the next publish is timed instead
+static bool lostAck() {
+  LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  client.setClock(simulatedClock);
+  client.setServer("broker-a", 1883);
+  bool ok = connect(&client, &broker);
+  for (uint8_t i = 0; i < 8; i++) probe(&client, &broker, 300);
+
+  ok &= client.publish("devices/rtt", 1, false, "lost") != 0;
+  broker.acknowledge(broker.outboundLength());
+  simulatedMillis += 2 * 15 * 1000;
+  broker.poll();
+  std::string sent(broker.outbound(), broker.outboundLength());
+  ok &= sent.find(std::string("\xC0\x00", 2)) != std::string::npos;
+  broker.acknowledge(broker.outboundLength());
+  const char pingResp[] = { static_cast<char>(0xD0), 0x00 };
+  broker.deliver(pingResp, sizeof(pingResp));
+  ok &= client.connected();
+
+  uint32_t before = client.smoothedRtt();
+  probe(&client, &broker, 40);
+  ok &= client.smoothedRtt() < before;
+  printf("lost ack: %s\n", ok ? "the next publish timed" : "WRONG, no publish timed since");
+  return ok;
+}
+
+int main() {
+  std::vector<Sequence> sequences(5);
+  sequences[0].name = "steady 80 ms";
+  sequences[0].samples.assign(200, 80);
+  sequences[1].name = "jitter 50 to 150 ms";
+  for (size_t i = 0; i < 2000; i++) sequences[1].samples.push_back(50 + randomNumber() % 101);
+  sequences[2].name = "route change 40 to 600 ms";
+  for (size_t i = 0; i < 200; i++) sequences[2].samples.push_back(i < 100 ? 40 : 600);
+  sequences[3].name = "recovery 900 to 30 ms";
+  for (size_t i = 0; i < 200; i++) sequences[3].samples.push_back(i < 100 ? 900 : 30 + randomNumber() % 5);
+  sequences[4].name = "cellular, spikes to 20 s";
+  for (size_t i = 0; i < 2000; i++) sequences[4].samples.push_back(randomNumber() % 50 == 0 ? 20000 : 400 + randomNumber() % 400);
+
+  bool ok = true;
+  for (Sequence const &sequence : sequences) ok &= check(sequence);
+  ok &= reconnections();
+  ok &= lostAck();
+  printf("\n%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
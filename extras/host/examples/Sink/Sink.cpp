@@ -0,0 +1,216 @@
+// Payload sinks: a firmware image received as one QoS 1 message in TCP sized segments and written to a file by a
+// PayloadSink, checked against the SHA-256 of a manifest received before it; then a corrupted image, an image cut
+// by a lost connection, and the throughput of the sink against an onMessage() handler writing and hashing by hand.
+// usage: Sink [DIRECTORY]
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+
+#include <AsyncMqttClient.h>
+
+#if ASYNC_MQTT_PAYLOAD_SINKS
+using AsyncMqttClientInternals::Crc32;
+using AsyncMqttClientInternals::FileSinkStorage;
+using AsyncMqttClientInternals::LoopbackTransport;
+using AsyncMqttClientInternals::PayloadSink;
+using AsyncMqttClientInternals::Sha256;
+
+static const size_t SEGMENT = 1460;
+static const char* const ERRORS[] = { "none", "begin", "write", "interrupted", "checksum", "commit" };
+
+struct Completion {
+  size_t count = 0;
+  AsyncMqttClientSinkResult result;
+  std::string topic;
+};
+
+static std::string publishPacket(const char* topic, uint16_t packetId, std::string const &payload) {
+  std::string body;
+  body.push_back(static_cast<char>(strlen(topic) >> 8));
+  body.push_back(static_cast<char>(strlen(topic) & 0xFF));
+  body += topic;
+  body.push_back(static_cast<char>(packetId >> 8));
+  body.push_back(static_cast<char>(packetId & 0xFF));
+  body += payload;
+  char remainingLength[4];
+  std::string packet(1, 0x32);
+  packet.append(remainingLength, AsyncMqttClientInternals::Helpers::encodeRemainingLength(body.size(), remainingLength));
+  return packet + body;
+}
+
+static void deliver(LoopbackTransport* broker, std::string const &packet, size_t length) {
+  for (size_t position = 0; position < length; position += SEGMENT) {
+    broker->deliver(packet.data() + position, length - position < SEGMENT ? length - position : SEGMENT);
+  }
+  broker->acknowledge(broker->outboundLength());
+}
+
+static void connect(AsyncMqttClient* client, LoopbackTransport* broker) {
+  client->setServer("localhost", 1883);
+  client->connect();
+  broker->acknowledge(broker->outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker->deliver(connAck, sizeof(connAck));
+}
+
+static std::string image(size_t size, uint32_t seed) {
+  std::string data(size, '\0');
+  for (size_t i = 0; i < size; i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = static_cast<char>(seed >> 16);
+  }
+  return data;
+}
+
+static void sha256(std::string const &data, uint8_t digest[32]) {
+  Sha256 hash;
+  hash.update(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+  hash.finish(digest);
+}
+
+static bool readFile(std::string const &path, std::string* data) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) return false;
+  char buffer[65536];
+  size_t length;
+  data->clear();
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) data->append(buffer, length);
+  fclose(file);
+  return true;
+}
+
+static bool check(const char* what, bool ok) {
+  if (!ok) printf("%s: FAILED\n", what);
+  return ok;
+}
+
+// the known answers of CRC-32 and SHA-256
+static bool knownAnswers() {
+  Crc32 crc;
+  crc.update(reinterpret_cast<const uint8_t*>("123456789"), 9);
+  uint8_t digest[32];
+  sha256("abc", digest);
+  static const uint8_t abc[32] = { 0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+    0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad };
+  return crc.value() == 0xCBF43926 && memcmp(digest, abc, sizeof(abc)) == 0;
+}
+
+// MB/s of a 16 MiB image through the parser into a file: by the sink, or by an onMessage() handler writing each chunk
+static double throughput(std::string const &directory, bool useSink) {
+  std::string data = image(16 << 20, 7);
+  std::string packet = publishPacket("devices/sink/firmware", 1, data);
+  std::string path = directory + "/sink-throughput.bin";
+
+  LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  FileSinkStorage storage(path.c_str());
+  static uint8_t pages[2 * 4096];
+  PayloadSink sink(&storage, pages, sizeof(pages));
+  if (useSink) client.addPayloadSink("devices/+/firmware", &sink);
+  FILE* file = nullptr;
+  Crc32 crc;
+  Sha256 hash;
+  client.onMessage([&](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+    (void)topic;
+    (void)properties;
+    (void)total;
+    if (index == 0) file = fopen(path.c_str(), "wb");
+    fwrite(payload, 1, len, file);
+    crc.update(reinterpret_cast<const uint8_t*>(payload), len);
+    hash.update(reinterpret_cast<const uint8_t*>(payload), len);
+  });
+  connect(&client, &broker);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  deliver(&broker, packet, packet.size());
+  if (file) {
+    fflush(file);
+    fsync(fileno(file));
+    fclose(file);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  unlink(path.c_str());
+  return data.size() / seconds / 1e6;
+}
+
+int main(int argc, char** argv) {
+  bool ok = check("known answers", knownAnswers());
+  std::string directory = argc > 1 ? argv[1] : "/tmp";
+  std::string path = directory + "/sink-firmware.bin";
+  unlink(path.c_str());
+
+  LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  FileSinkStorage storage(path.c_str());
+  static uint8_t pages[2 * 1024];
+  PayloadSink sink(&storage, pages, sizeof(pages));
+  Completion completion;
+  sink.onComplete([&completion](char const *topic, AsyncMqttClientSinkResult const &result) {
+    completion.count++;
+    completion.result = result;
+    completion.topic = topic;
+  });
+  client.addPayloadSink("devices/+/firmware", &sink);
+  std::string manifest;
+  client.onMessage([&manifest, &sink](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+    (void)topic;
+    (void)properties;
+    (void)index;
+    (void)total;
+    // the manifest holds the SHA-256 of the image to come
+    manifest.assign(payload, len);
+    if (len == 32) sink.expectSha256(reinterpret_cast<const uint8_t*>(payload));
+  });
+  connect(&client, &broker);
+
+  // the manifest goes to onMessage(), the image to the sink
+  std::string firmware = image(300000, 1);
+  uint8_t digest[32];
+  sha256(firmware, digest);
+  std::string manifestPacket = publishPacket("devices/sink/manifest", 1, std::string(reinterpret_cast<char*>(digest), sizeof(digest)));
+  deliver(&broker, manifestPacket, manifestPacket.size());
+  std::string packet = publishPacket("devices/sink/firmware", 2, firmware);
+  deliver(&broker, packet, packet.size());
+  std::string stored;
+  printf("image: %s, %u of %u bytes, crc32 %08x\n", ERRORS[static_cast<uint8_t>(completion.result.error)], completion.result.size,
+    completion.result.total, static_cast<unsigned>(completion.result.crc32));
+  ok &= check("image", manifest.size() == 32 && completion.count == 1 && completion.topic == "devices/sink/firmware" &&
+    completion.result.error == AsyncMqttClientSinkError::NONE && completion.result.size == firmware.size() &&
+    memcmp(completion.result.sha256, digest, sizeof(digest)) == 0 && readFile(path, &stored) && stored == firmware);
+
+  // one byte flipped: discarded, the image before it stays
+  std::string corrupted = firmware;
+  corrupted[123456] ^= 0x01;
+  deliver(&broker, manifestPacket, manifestPacket.size());
+  packet = publishPacket("devices/sink/firmware", 3, corrupted);
+  deliver(&broker, packet, packet.size());
+  printf("corrupted image: %s\n", ERRORS[static_cast<uint8_t>(completion.result.error)]);
+  ok &= check("corrupted image", completion.count == 2 && completion.result.error == AsyncMqttClientSinkError::CHECKSUM &&
+    readFile(path, &stored) && stored == firmware && access((path + ".part").c_str(), F_OK) != 0);
+
+  // the connection lost within the image
+  packet = publishPacket("devices/sink/firmware", 4, image(100000, 2));
+  deliver(&broker, packet, packet.size() / 2);
+  broker.hangUp();
+  printf("interrupted image: %s after %u of %u bytes\n", ERRORS[static_cast<uint8_t>(completion.result.error)], completion.result.size,
+    completion.result.total);
+  ok &= check("interrupted image", completion.count == 3 && completion.result.error == AsyncMqttClientSinkError::INTERRUPTED &&
+    completion.result.size < completion.result.total && readFile(path, &stored) && stored == firmware);
+  unlink(path.c_str());
+
+  double bySink = throughput(directory, true);
+  double byHand = throughput(directory, false);
+  printf("\n16 MiB to %s: sink %.0f MB/s, onMessage() writing and hashing each chunk %.0f MB/s\n", directory.c_str(), bySink, byHand);
+
+  printf("\n%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+#else
+int main() {
+  printf("built with ASYNC_MQTT_PAYLOAD_SINKS 0\n");
+  return 0;
+}
+#endif
@@ -0,0 +1,221 @@
+// Runs the same session, over an in-memory broker, with an AsyncMqttClient and with an AsyncMqttClientT
+// holding fixed capacities, and counts the heap allocations from connect() on. The second one must not allocate.
+
+#include <stdlib.h>
+
+#include <new>
+
+#include <AsyncMqttClient.h>
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* pointer = malloc(size);
+  if (!pointer) throw std::bad_alloc();
+  return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+  free(pointer);
+}
+
+void operator delete(void* pointer, size_t size) noexcept {
+  (void)size;
+  free(pointer);
+}
+
+// operator new, plus the blocks the client takes through its allocator hooks
+static size_t allocationCount() {
+  size_t count = allocations;
+  for (uint8_t tag = 0; tag < ASYNC_MQTT_MEMORY_TAGS; tag++) {
+    count += AsyncMqttClient::memoryStats(static_cast<AsyncMqttClientMemoryTag>(tag)).allocations;
+  }
+  return count;
+}
+
+struct SensorConfig : AsyncMqttClientStaticConfig {
+  static const uint16_t MAX_TOPIC_LENGTH = 64;
+  static const uint16_t ACK_QUEUE_DEPTH = 8;
+  static const uint16_t INFLIGHT_WINDOW = 4;
+};
+
+static uint32_t fakeTime = 0;
+static uint32_t fakeClock() { return fakeTime; }
+
+struct Session {
+  size_t messages;
+  size_t messageBytes;
+  size_t published;
+  size_t subscribed;
+  size_t unsubscribed;
+  size_t sent[16];  // packets sent by the client, by type
+};
+
+// counts what the client sent, then acknowledges it
+static void drain(AsyncMqttClientInternals::LoopbackTransport* broker, Session* session) {
+  const char* data = broker->outbound();
+  size_t length = broker->outboundLength();
+  size_t position = 0;
+  while (position < length) {
+    session->sent[static_cast<uint8_t>(data[position]) >> 4]++;
+    uint32_t remainingLength = 0;
+    uint32_t multiplier = 1;
+    uint8_t byte;
+    do {
+      byte = data[++position];
+      remainingLength += (byte & 127) * multiplier;
+      multiplier *= 128;
+    } while (byte & 128);
+    position += 1 + remainingLength;
+  }
+  broker->acknowledge(length);
+}
+
+static size_t publishPacket(char* packet, uint8_t header, const char* topic, uint16_t packetId, const char* payload) {
+  size_t topicLength = strlen(topic);
+  size_t payloadLength = strlen(payload);
+  size_t remainingLength = 2 + topicLength + ((header & 0x06) ? 2 : 0) + payloadLength;
+  size_t position = 0;
+  packet[position++] = header;
+  position += AsyncMqttClientInternals::Helpers::encodeRemainingLength(remainingLength, packet + position);
+  packet[position++] = topicLength >> 8;
+  packet[position++] = topicLength & 0xFF;
+  memcpy(packet + position, topic, topicLength);
+  position += topicLength;
+  if (header & 0x06) {
+    packet[position++] = packetId >> 8;
+    packet[position++] = packetId & 0xFF;
+  }
+  memcpy(packet + position, payload, payloadLength);
+  return position + payloadLength;
+}
+
+static void acknowledge(AsyncMqttClientInternals::LoopbackTransport* broker, uint8_t header, uint16_t packetId) {
+  const char packet[] = { static_cast<char>(header), 0x02, static_cast<char>(packetId >> 8), static_cast<char>(packetId & 0xFF) };
+  broker->deliver(packet, sizeof(packet));
+}
+
+template <typename Client>
+static size_t run(const char* name, Session* session) {
+  AsyncMqttClientInternals::LoopbackTransport broker(512);
+  Client client(&broker);
+  memset(session, 0, sizeof(*session));
+
+  // setup: may allocate, e.g. the String arguments
+  client.setClock(fakeClock);
+  client.setKeepAlive(30);
+  client.setClientId("sensor-0001");
+  client.setCredentials("sensor-0001", "a password past the small string size");
+  client.setWill("devices/sensor-0001/status", 1, true, "offline");
+  client.setServer("broker.example.com", 1883);
+  client.onMessage([session](char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+    (void)topic;
+    (void)payload;
+    (void)properties;
+    (void)total;
+    if (index == 0) session->messages++;
+    session->messageBytes += len;
+  });
+  client.onPublish([session](uint16_t packetId) {
+    (void)packetId;
+    session->published++;
+  });
+  client.onSubscribe([session](uint16_t packetId, uint8_t qos) {
+    (void)packetId;
+    (void)qos;
+    session->subscribed++;
+  });
+  client.onUnsubscribe([session](uint16_t packetId) {
+    (void)packetId;
+    session->unsubscribed++;
+  });
+
+  size_t before = allocationCount();
+  for (int connection = 0; connection < 2; connection++) {
+    client.connect();
+    drain(&broker, session);
+    const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+    broker.deliver(connAck, sizeof(connAck));
+
+    uint16_t packetId = client.subscribe("devices/sensor-0001/commands/#", 1);
+    drain(&broker, session);
+    const char subAck[] = { static_cast<char>(0x90), 0x03, static_cast<char>(packetId >> 8), static_cast<char>(packetId & 0xFF), 0x01 };
+    broker.deliver(subAck, sizeof(subAck));
+
+    // outbound QoS 0, 1 and 2
+    client.publish("devices/sensor-0001/temperature", 0, false, "21.5");
+    packetId = client.publish("devices/sensor-0001/temperature", 1, false, "21.6");
+    drain(&broker, session);
+    acknowledge(&broker, 0x40, packetId);
+    packetId = client.publish("devices/sensor-0001/temperature", 2, false, "21.7");
+    drain(&broker, session);
+    acknowledge(&broker, 0x50, packetId);
+    drain(&broker, session);
+    acknowledge(&broker, 0x70, packetId);
+
+    // inbound QoS 0 in two segments, QoS 1, QoS 2 with a duplicate before the PUBREL
+    char packet[128];
+    size_t length = publishPacket(packet, 0x30, "devices/sensor-0001/commands/led", 0, "on");
+    broker.deliver(packet, 10);
+    broker.deliver(packet + 10, length - 10);
+    length = publishPacket(packet, 0x32, "devices/sensor-0001/commands/led", 11, "off");
+    broker.deliver(packet, length);
+    length = publishPacket(packet, 0x34, "devices/sensor-0001/commands/reboot", 12, "now");
+    broker.deliver(packet, length);
+    length = publishPacket(packet, 0x3C, "devices/sensor-0001/commands/reboot", 12, "now");
+    broker.deliver(packet, length);
+    drain(&broker, session);
+    acknowledge(&broker, 0x62, 12);
+    drain(&broker, session);
+
+    // a topic past the 64 characters of SensorConfig, ignored
+    length = publishPacket(packet, 0x30, "devices/sensor-0001/commands/a-topic-longer-than-the-sixty-four-characters", 0, "x");
+    broker.deliver(packet, length);
+
+    // keepalive
+    fakeTime += 30000;
+    broker.poll();
+    drain(&broker, session);
+    fakeTime += 20;
+    const char pingResp[] = { static_cast<char>(0xD0), 0x00 };
+    broker.deliver(pingResp, sizeof(pingResp));
+
+    packetId = client.unsubscribe("devices/sensor-0001/commands/#");
+    drain(&broker, session);
+    acknowledge(&broker, 0xB0, packetId);
+
+    // a burst of QoS 1 while the transport is full: the fixed ack queue holds 8 PUBACK
+    char fill[484] = { 0 };
+    client.publish("devices/sensor-0001/log", 0, false, fill, sizeof(fill));
+    for (uint16_t i = 0; i < 12; i++) {
+      length = publishPacket(packet, 0x32, "devices/sensor-0001/commands/led", 100 + i, "blink");
+      broker.deliver(packet, length);
+    }
+    drain(&broker, session);
+    broker.poll();
+    drain(&broker, session);
+
+    client.disconnect();
+    drain(&broker, session);
+  }
+  size_t allocated = allocationCount() - before;
+
+  printf("%-32s %6zu B  %11zu  %8zu  %9zu  %6zu  %6zu\n", name, sizeof(Client), allocated, session->messages,
+    session->published, session->sent[4], session->sent[5]);
+  return allocated;
+}
+
+int main() {
+  printf("2 connections                      size  allocations  messages  published  PUBACK  PUBREC\n");
+  Session dynamicSession;
+  Session staticSession;
+  run<AsyncMqttClient>("AsyncMqttClient", &dynamicSession);
+  size_t allocated = run<AsyncMqttClientT<SensorConfig>>("AsyncMqttClientT<SensorConfig>", &staticSession);
+
+  // per connection, the long topic is dropped and 4 PUBACK are lost to the full ack queue, the rest of the session is the same
+  bool same = staticSession.messages + 2 == dynamicSession.messages && staticSession.published == dynamicSession.published &&
+    staticSession.subscribed == 2 && staticSession.unsubscribed == 2 && staticSession.sent[4] + 2 * 4 == dynamicSession.sent[4];
+  printf("\n%s\n", allocated == 0 && same ? "ok" : "FAILED");
+  return allocated == 0 && same ? 0 : 1;
+}
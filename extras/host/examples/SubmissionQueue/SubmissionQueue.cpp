@@ -0,0 +1,264 @@
+// Submits from several std::thread producers while one thread plays the network task and the broker:
+// checks that every submission is sent once, in order per producer, and completes through onPublish,
+// compares the throughput with a mutex around publish(), then times the wake-up of the TCP transports. Also checks that
+// submissions still queued when the connection drops complete through onSubmissionFailed.
+// usage: SubmissionQueue [MESSAGES_PER_PRODUCER]
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <AsyncMqttClient.h>
+#include <LocalBroker.hpp>
+
+static const uint16_t QUEUE_DEPTH = 256;
+static const uint16_t ENTRY_SIZE = 64;
+static const size_t WAKE_ROUNDS = 200;
+
+struct Result {
+  double seconds;
+  uint64_t sent;
+  uint64_t completed;
+  bool ordered;
+};
+
+static double elapsedSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the client only adds whole packets, so the outbound data always ends on a packet boundary
+template <typename Handler>
+static size_t forEachPacket(const char* data, size_t length, Handler handle) {
+  size_t position = 0;
+  while (position < length) {
+    uint8_t header = data[position];
+    size_t remainingLength = 0;
+    size_t shift = 0;
+    size_t cursor = position + 1;
+    uint8_t digit;
+    do {
+      digit = data[cursor++];
+      remainingLength |= static_cast<size_t>(digit & 0x7F) << shift;
+      shift += 7;
+    } while (digit & 0x80);
+    handle(header, data + cursor, remainingLength);
+    position = cursor + remainingLength;
+  }
+  return position;
+}
+
+static Result run(size_t producers, uint32_t messages, uint8_t qos, bool locked) {
+  AsyncMqttClientInternals::LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  client.setSubmissionQueue(QUEUE_DEPTH, ENTRY_SIZE);
+  client.setServer("localhost", 1883);
+
+  Result result = { 0, 0, 0, true };
+  client.onPublish([&](uint16_t packetId) {
+    (void)packetId;
+    result.completed++;
+  });
+
+  client.connect();
+  broker.acknowledge(broker.outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker.deliver(connAck, sizeof(connAck));
+
+  const uint64_t total = static_cast<uint64_t>(producers) * messages;
+  std::vector<uint32_t> nextSequence(producers, 0);
+  std::mutex lock;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  // network task and broker: encodes the submissions, checks them and acknowledges them right away
+  std::thread network([&]() {
+    while (result.sent < total) {
+      std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+      if (locked) guard.lock();
+      broker.poll();
+      size_t consumed = forEachPacket(broker.outbound(), broker.outboundLength(), [&](uint8_t header, const char* body, size_t length) {
+        if (header >> 4 != AsyncMqttClientInternals::PacketType.PUBLISH) return;
+        size_t topicLength = static_cast<uint8_t>(body[0]) << 8 | static_cast<uint8_t>(body[1]);
+        size_t position = 2 + topicLength;
+        if (qos != 0) {
+          const char pubAck[] = { 0x40, 0x02, body[position], body[position + 1] };
+          broker.deliver(pubAck, sizeof(pubAck));
+          position += 2;
+        }
+        char payload[24];
+        size_t payloadLength = std::min(length - position, sizeof(payload) - 1);
+        memcpy(payload, body + position, payloadLength);
+        payload[payloadLength] = '\0';
+        char* separator;
+        unsigned long producer = strtoul(payload, &separator, 10);
+        unsigned long sequence = strtoul(separator + 1, nullptr, 10);
+        if (producer >= producers || sequence != nextSequence[producer]) result.ordered = false;
+        if (producer < producers) nextSequence[producer] = sequence + 1;
+        result.sent++;
+      });
+      broker.acknowledge(consumed);
+      if (guard.owns_lock()) guard.unlock();
+      // nothing submitted yet, let the producers run on a busy machine
+      if (consumed == 0) std::this_thread::yield();
+    }
+  });
+
+  std::vector<std::thread> threads;
+  for (size_t producer = 0; producer < producers; producer++) {
+    threads.emplace_back([&, producer]() {
+      String topic("bench/submit");
+      String payload;
+      char text[24];
+      for (uint32_t sequence = 0; sequence < messages;) {
+        snprintf(text, sizeof(text), "%zu:%u", producer, sequence);
+        payload = text;
+        uint16_t packetId;
+        if (locked) {
+          std::lock_guard<std::mutex> guard(lock);
+          packetId = client.publish(topic, qos, false, payload);
+        } else {
+          packetId = client.submitPublish(topic, qos, false, payload);
+        }
+        // full, the network task makes room
+        if (packetId == 0) {
+          std::this_thread::yield();
+          continue;
+        }
+        sequence++;
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  network.join();
+
+  result.seconds = elapsedSince(start);
+  return result;
+}
+
+// submitted, then the connection drops before the network task drained them
+static bool failures() {
+  AsyncMqttClientInternals::LoopbackTransport broker;
+  AsyncMqttClient client(&broker);
+  client.setSubmissionQueue(QUEUE_DEPTH, ENTRY_SIZE);
+  client.setServer("localhost", 1883);
+  std::vector<uint16_t> failed;
+  client.onSubmissionFailed([&](uint16_t packetId) { failed.push_back(packetId); });
+  client.connect();
+  broker.acknowledge(broker.outboundLength());
+  const char connAck[] = { 0x20, 0x02, 0x00, 0x00 };
+  broker.deliver(connAck, sizeof(connAck));
+
+  std::vector<uint16_t> submitted;
+  std::thread producer([&]() {
+    submitted.push_back(client.submitPublish("devices/1", 1, false, "one"));
+    client.submitPublish("devices/1", 0, false, "at most once");
+    submitted.push_back(client.submitSubscribe("commands/1", 1));
+    submitted.push_back(client.submitPublish("devices/1", 2, false, "two"));
+    submitted.push_back(client.submitUnsubscribe("commands/1"));
+  });
+  producer.join();
+  broker.hangUp();
+
+  // QoS 0 never completes, the others once
+  bool ok = failed == submitted && std::find(failed.begin(), failed.end(), 0) == failed.end();
+  printf("\nqueued when the connection dropped: %zu of %zu failed  %s\n", failed.size(), submitted.size(), ok ? "ok" : "FAILED");
+  return ok;
+}
+
+// round trip of one QoS 1 submission at a time: the transport must wake the network thread up at once
+static bool wakeLatency(const char* name, bool epoll, uint16_t port) {
+  AsyncMqttClientInternals::PosixTcpTransport transport;
+  AsyncMqttClientInternals::EpollLoop loop;
+  if (epoll) loop.add(&transport);
+
+  AsyncMqttClient client(&transport);
+  client.setSubmissionQueue(16, ENTRY_SIZE);
+  client.setServer(IPAddress(127, 0, 0, 1), port);
+  std::atomic<bool> connected(false);
+  std::atomic<uint32_t> completed(0);
+  std::atomic<bool> running(true);
+  client.onConnect([&](bool sessionPresent) {
+    (void)sessionPresent;
+    connected = true;
+  });
+  client.onPublish([&](uint16_t packetId) {
+    (void)packetId;
+    completed++;
+  });
+
+  std::thread network([&]() {
+    client.connect();
+    while (running) {
+      if (epoll) {
+        loop.loop(100);
+      } else {
+        transport.loop(100);
+      }
+    }
+    client.disconnect(true);
+  });
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  while (!connected && elapsedSince(start) < 2) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  std::vector<double> samples;
+  for (size_t round = 0; connected && round < WAKE_ROUNDS; round++) {
+    start = std::chrono::steady_clock::now();
+    if (client.submitPublish("bench/wake", 1, false, "ping") == 0) break;
+    while (completed <= round && elapsedSince(start) < 2) std::this_thread::yield();
+    if (completed <= round) break;
+    samples.push_back(elapsedSince(start) * 1e6);
+  }
+  running = false;
+  network.join();
+
+  if (samples.size() != WAKE_ROUNDS) {
+    printf("%-16s FAILED after %zu round trips\n", name, samples.size());
+    return false;
+  }
+  std::sort(samples.begin(), samples.end());
+  printf("%-16s p50 %7.1f us  p99 %7.1f us\n", name, samples[samples.size() / 2], samples[samples.size() * 99 / 100]);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  uint32_t messages = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+  bool failed = false;
+
+  printf("%u messages per producer, queue of %u entries\n\n", messages, QUEUE_DEPTH);
+  printf("producers  qos  submit msg/s  mutex msg/s  checked\n");
+  for (uint8_t qos : { 0, 1 }) {
+    for (size_t producers : { 1, 2, 4, 8 }) {
+      Result queued = run(producers, messages, qos, false);
+      Result locked = run(producers, messages, qos, true);
+      uint64_t total = static_cast<uint64_t>(producers) * messages;
+      bool ok = queued.ordered && queued.sent == total && (qos == 0 || queued.completed == total);
+      failed |= !ok;
+      printf("%9zu  %3u  %12.0f  %11.0f  %s\n", producers, qos, queued.sent / queued.seconds, locked.sent / locked.seconds, ok ? "ok" : "FAILED");
+    }
+  }
+
+  failed |= !failures();
+
+  AsyncMqttClientInternals::LocalBroker broker;
+  if (!broker.begin("127.0.0.1", 0)) {
+    printf("\nthe local broker could not listen\n");
+    return 1;
+  }
+  std::atomic<bool> brokerRunning(true);
+  std::thread brokerThread([&]() {
+    while (brokerRunning) broker.loop(10);
+  });
+
+  printf("\nwake-up, submit to onPublish over TCP\n");
+  failed |= !wakeLatency("standalone loop", false, broker.port());
+  failed |= !wakeLatency("epoll loop", true, broker.port());
+
+  brokerRunning = false;
+  brokerThread.join();
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,197 @@
+// The timer wheel: thousands of timers over all four levels, from a few milliseconds to past the range of the wheel,
+// on a clock that wraps around 2^32 during the run. Some are cancelled, some re-armed or cancel another from their
+// callback. Checks that each fires once, never before its delay and at most a tick and a clock step after it, that
+// cancelled ones never fire, and that a clock jumping past the whole wheel fires what was due. Then times schedule,
+// cancel and expiry on the host.
+// usage: TimerWheel
+
+#include <chrono>
+#include <memory>
+
+#include <AsyncMqttClient.h>
+
+using AsyncMqttClientInternals::Timer;
+using AsyncMqttClientInternals::TimerWheel;
+
+static const size_t TIMERS = 4096;
+static const uint32_t TICK = 1UL << ASYNC_MQTT_TIMER_TICK_SHIFT;
+static const uint32_t RANGE = TICK << 16;  // ms the four levels of 16 slots cover
+static const uint32_t MAX_STEP = 97;  // ms the clock moves between two advance()
+
+static uint32_t simulatedMillis = 0;
+static uint32_t simulatedClock() { return simulatedMillis; }
+
+static uint32_t counter = 1;
+static uint32_t randomNumber() {
+  counter = counter * 1103515245 + 12345;
+  return counter >> 8;
+}
+
+struct Entry {
+  Timer timer;
+  uint32_t deadline = 0;
+  size_t fired = 0;
+  size_t expected = 0;
+  bool rearm = false;
+  Entry* victim = nullptr;  // cancelled by this one's callback
+  uint32_t worstLate = 0;
+  bool early = false;
+};
+
+static TimerWheel* wheel = nullptr;
+static size_t cancelledByCallback = 0;
+
+static void fire(Entry* entry) {
+  entry->fired++;
+  int32_t late = static_cast<int32_t>(simulatedMillis - entry->deadline);
+  if (late < 0) entry->early = true;
+  else if (static_cast<uint32_t>(late) > entry->worstLate) entry->worstLate = late;
+  if (entry->rearm) {
+    entry->rearm = false;
+    uint32_t delay = randomNumber() % (RANGE / 4);
+    entry->deadline = simulatedMillis + delay;
+    entry->expected++;
+    wheel->schedule(&entry->timer, delay);
+  }
+  if (entry->victim && entry->victim->timer.armed()) {
+    wheel->cancel(&entry->victim->timer);
+    entry->victim->expected--;
+    cancelledByCallback++;
+  }
+}
+
+// a delay in the range of level 0, 1, 2 or 3, or past the wheel
+static uint32_t randomDelay(size_t i) {
+  switch (i % 5) {
+    case 0: return randomNumber() % (16 * TICK);
+    case 1: return randomNumber() % (256 * TICK);
+    case 2: return randomNumber() % (4096 * TICK);
+    case 3: return randomNumber() % RANGE;
+    default: return RANGE + randomNumber() % RANGE;
+  }
+}
+
+static bool correctness() {
+  // the clock wraps a tenth of the way in
+  simulatedMillis = 0xFFFFFFFF - RANGE / 5;
+  TimerWheel timers(simulatedClock);
+  wheel = &timers;
+  std::unique_ptr<Entry[]> entries(new Entry[TIMERS]);
+  uint32_t last = 0;
+  for (size_t i = 0; i < TIMERS; i++) {
+    Entry* entry = &entries[i];
+    entry->timer.setCallback([entry]() { fire(entry); });
+    entry->rearm = i % 7 == 0;
+    if (i % 11 == 0 && i + 1 < TIMERS) entry->victim = &entries[i + 1];
+    uint32_t delay = randomDelay(i);
+    entry->deadline = simulatedMillis + delay;
+    entry->expected = 1;
+    timers.schedule(&entry->timer, delay);
+    if (delay > last) last = delay;
+    // schedule at different points of a tick
+    simulatedMillis += randomNumber() % 3;
+    timers.advance();
+  }
+
+  size_t cancelled = 0;
+  uint32_t end = simulatedMillis + last + RANGE / 4 + 2 * TICK;
+  while (static_cast<int32_t>(end - simulatedMillis) > 0) {
+    simulatedMillis += 1 + randomNumber() % MAX_STEP;
+    timers.advance();
+    // now and then, cancel a timer or move it
+    if (randomNumber() % 8 == 0) {
+      Entry* entry = &entries[randomNumber() % TIMERS];
+      if (!entry->timer.armed()) continue;
+      if (randomNumber() % 2 == 0) {
+        timers.cancel(&entry->timer);
+        entry->expected--;
+        cancelled++;
+      } else {
+        uint32_t delay = randomDelay(randomNumber());
+        entry->deadline = simulatedMillis + delay;
+        timers.schedule(&entry->timer, delay);
+        if (static_cast<int32_t>(entry->deadline + 2 * TICK - end) > 0) end = entry->deadline + 2 * TICK;
+      }
+    }
+  }
+
+  bool ok = true;
+  size_t fired = 0;
+  uint32_t worstLate = 0;
+  for (size_t i = 0; i < TIMERS; i++) {
+    Entry const &entry = entries[i];
+    fired += entry.fired;
+    if (entry.worstLate > worstLate) worstLate = entry.worstLate;
+    if (entry.fired != entry.expected || entry.early || entry.worstLate >= TICK + MAX_STEP || entry.timer.armed()) {
+      printf("timer %zu: fired %zu times of %zu, %s, %u ms late\n", i, entry.fired, entry.expected,
+        entry.early ? "early" : "not early", entry.worstLate);
+      ok = false;
+    }
+  }
+  printf("%zu timers, %zu fired, %zu cancelled, %zu by a callback, at most %u ms late, clock wrapped: %s\n", TIMERS, fired,
+    cancelled, cancelledByCallback, worstLate, simulatedMillis < 0x80000000 ? "yes" : "no");
+  return ok && simulatedMillis < 0x80000000;
+}
+
+// the clock jumps past the whole wheel at once, as after a long sleep
+static bool jump() {
+  simulatedMillis = 0xFFFFF000;
+  TimerWheel timers(simulatedClock);
+  wheel = &timers;
+  std::unique_ptr<Entry[]> entries(new Entry[TIMERS]);
+  for (size_t i = 0; i < TIMERS; i++) {
+    Entry* entry = &entries[i];
+    entry->timer.setCallback([entry]() { fire(entry); });
+    uint32_t delay = randomNumber() % (2 * RANGE);
+    entry->deadline = simulatedMillis + delay;
+    timers.schedule(&entry->timer, delay);
+  }
+  simulatedMillis += RANGE + RANGE / 2;
+  timers.advance();
+  // what was due fired, the rest is still pending
+  bool ok = true;
+  for (size_t i = 0; i < TIMERS; i++) {
+    Entry const &entry = entries[i];
+    bool due = static_cast<int32_t>(simulatedMillis - entry.deadline) >= 0;
+    if (due && entry.fired != 1) ok = false;
+    if (!due && (entry.fired != 0 || !entry.timer.armed())) ok = false;
+  }
+  simulatedMillis += RANGE;
+  timers.advance();
+  for (size_t i = 0; i < TIMERS; i++) {
+    if (entries[i].fired != 1 || entries[i].early) ok = false;
+  }
+  printf("clock jump past the wheel: %s\n", ok ? "due timers fired, the others later" : "WRONG");
+  return ok;
+}
+
+static void benchmark() {
+  const size_t count = 65536;
+  simulatedMillis = 0;
+  TimerWheel timers(simulatedClock);
+  std::unique_ptr<Timer[]> entries(new Timer[count]);
+  size_t fired = 0;
+  for (size_t i = 0; i < count; i++) entries[i].setCallback([&fired]() { fired++; });
+
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < count; i++) timers.schedule(&entries[i], randomNumber() % RANGE);
+  Clock::time_point scheduled = Clock::now();
+  for (size_t i = 0; i < count; i += 2) timers.cancel(&entries[i]);
+  Clock::time_point cancelled = Clock::now();
+  for (; simulatedMillis < RANGE + TICK; simulatedMillis += 10) timers.advance();
+  Clock::time_point expired = Clock::now();
+
+  typedef std::chrono::duration<double, std::nano> Nanoseconds;
+  printf("%zu timers: schedule %.0f ns, cancel %.0f ns, %zu expired at %.0f ns each, cascades and idle ticks included\n", count,
+    Nanoseconds(scheduled - start).count() / count, Nanoseconds(cancelled - scheduled).count() / (count / 2), fired,
+    Nanoseconds(expired - cancelled).count() / fired);
+}
+
+int main() {
+  bool ok = correctness();
+  ok &= jump();
+  benchmark();
+  printf("\n%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+#!/bin/sh
+# Footprint of the library in several feature configurations, as one table to diff between releases:
+# object sizes and heap per connection (the Footprint host example), code size per translation unit and
+# static RAM (size(1) on the library objects). The builds are host builds, flagged like the ESP cores
+# (-Os, no exceptions, no RTTI), from the defaults of the library rather than HOST_FEATURES: absolute sizes differ
+# on the ESP, with its 32-bit pointers and Xtensa code, the differences between configurations and between releases
+# carry over.
+# usage: scripts/footprint/footprint.sh [BUILD_DIR] [NAME=FLAGS ...]
+#   scripts/footprint/footprint.sh _footprint minimal="-DASYNC_MQTT_METRICS=0 -DASYNC_MQTT_LATENCY=0"
+
+set -e
+
+BUILD=${1:-_host_build/footprint}
+[ $# -gt 0 ] && shift
+if [ $# -eq 0 ]; then
+  set -- "default=" \
+    "minimal=-DASYNC_MQTT_METRICS=0 -DASYNC_MQTT_LATENCY=0 -DASYNC_MQTT_SUBMISSION_QUEUE=0 -DASYNC_MQTT_MESSAGE_DISPATCH=0" \
+    "full=-DASYNC_MQTT_COMPRESSION=1 -DASYNC_MQTT_PAYLOAD_SINKS=2 -DASYNC_MQTT_RETAINED_CACHE=1 -DASYNC_MQTT_DUPLICATE_FILTER=1 -DASYNC_MQTT_PRIORITY_LANES=1 -DASYNC_MQTT_RATE_CONTROL=1 -DASYNC_MQTT_AGGREGATION=1" \
+    "no-metrics=-DASYNC_MQTT_METRICS=0" \
+    "no-latency=-DASYNC_MQTT_LATENCY=0" \
+    "std-function=-DASYNC_MQTT_STD_FUNCTION_CALLBACKS=1"
+fi
+MAKE=${MAKE:-make}
+SIZE=${SIZE:-size}
+FLAGS="-std=gnu++11 -Os -Wall -ffunction-sections -fdata-sections -fno-exceptions -fno-rtti -fno-asynchronous-unwind-tables"
+
+names=""
+for config in "$@"; do
+  name=${config%%=*}
+  flags=${config#*=}
+  names="$names $name"
+  echo "Building $name" >&2
+  $MAKE --no-print-directory -s "$BUILD/$name/examples/Footprint" HOST_BUILD="$BUILD/$name" HOST_CXXFLAGS="$FLAGS $flags" HOST_FEATURES= >&2
+  {
+    "$BUILD/$name/examples/Footprint"
+    # text holds the read-only data too; an inline function is counted in every translation unit emitting it
+    find "$BUILD/$name/src" -name '*.o' | sort | xargs $SIZE | awk -v prefix="$BUILD/$name/" '
+      NR > 1 {
+        source = substr($6, length(prefix) + 1)
+        sub(/\.o$/, ".cpp", source)
+        printf "code %s\t%d\n", source, $1
+        text += $1
+        data += $2
+        bss += $3
+      }
+      END {
+        printf "code total\t%d\n", text
+        printf "static RAM data\t%d\n", data
+        printf "static RAM bss\t%d\n", bss
+      }'
+  } > "$BUILD/$name.rows"
+done
+
+# one row per name, in the order they first appear, one column per configuration, "-" where a configuration has no such row
+for name in $names; do echo "$BUILD/$name.rows"; done | xargs awk -F '\t' -v names="$names" '
+  FNR == 1 { file++ }
+  {
+    if (!($1 in seen)) {
+      seen[$1] = 1
+      order[++rows] = $1
+      if (length($1) > width) width = length($1)
+    }
+    value[$1, file] = $2
+  }
+  END {
+    columns = split(names, name, " ")
+    format = "%-" width "s"
+    printf format, ""
+    for (column = 1; column <= columns; column++) printf " %14s", name[column]
+    printf "\n"
+    for (row = 1; row <= rows; row++) {
+      printf format, order[row]
+      for (column = 1; column <= columns; column++) printf " %14s", ((order[row], column) in value) ? value[order[row], column] : "-"
+      printf "\n"
+    }
+  }'
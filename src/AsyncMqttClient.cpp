@@ -1,64 +1,219 @@
 #include "AsyncMqttClient.hpp"
+#include "AsyncMqttClientManager.hpp"
+
+#include <new>
 
 #if ASYNC_TCP_SSL_ENABLED && ASYNC_TCP_SSL_BEARSSL
 #include "tcp_bearssl.h"
 #endif
 
+// prefix followed by the ID in hexadecimal
+static size_t formatClientId(char* buffer, const char* prefix, uint64_t id) {
+  size_t length = strlen(prefix);
+  memcpy(buffer, prefix, length);
+  char digits[16];
+  size_t count = 0;
+  do {
+    digits[count++] = "0123456789abcdef"[id & 0xF];
+    id >>= 4;
+  } while (id != 0);
+  while (count > 0) buffer[length++] = digits[--count];
+  buffer[length] = '\0';
+  return length;
+}
+
+// a standalone client cannot run without its timer wheel, out of memory aborts like a failed new without exceptions
+static AsyncMqttClientInternals::TimerWheel* createTimerWheel() {
+  AsyncMqttClientInternals::TimerWheel* timerWheel = AsyncMqttClientInternals::create<AsyncMqttClientInternals::TimerWheel>(AsyncMqttClientMemoryTag::CLIENT);
+  if (!timerWheel) abort();
+  return timerWheel;
+}
+
+// nor without its transport, in the storage of an AsyncMqttClientT or allocated
+static AsyncMqttClientInternals::DefaultTransport* createDefaultTransport(AsyncMqttClientInternals::ClientStorage const *storage) {
+  if (storage) return new (storage->defaultTransport) AsyncMqttClientInternals::DefaultTransport();
+  AsyncMqttClientInternals::DefaultTransport* transport = AsyncMqttClientInternals::create<AsyncMqttClientInternals::DefaultTransport>(AsyncMqttClientMemoryTag::CLIENT);
+  if (!transport) abort();
+  return transport;
+}
+
+#if ASYNC_MQTT_COMPRESSION
+// what the decoder's output of a message is delivered with
+struct DecompressedMessage {
+  AsyncMqttClient* client;
+  char const *topic;
+  AsyncMqttClientMessageProperties const *properties;
+};
+#endif
+
 AsyncMqttClient::AsyncMqttClient()
-: _connected(false)
+: AsyncMqttClient(nullptr, nullptr) {
+}
+
+AsyncMqttClient::AsyncMqttClient(AsyncMqttClientInternals::Transport* transport)
+: AsyncMqttClient(transport, nullptr) {
+}
+
+AsyncMqttClient::AsyncMqttClient(AsyncMqttClientInternals::Transport* transport, AsyncMqttClientInternals::ClientStorage const &storage)
+: AsyncMqttClient(transport, nullptr, &storage) {
+}
+
+AsyncMqttClient::AsyncMqttClient(AsyncMqttClientInternals::Transport* transport, AsyncMqttClientManager* manager,
+  AsyncMqttClientInternals::ClientStorage const *storage)
+: _defaultTransport(transport ? nullptr : createDefaultTransport(storage))
+, _transport(transport ? transport : _defaultTransport)
+, _manager(manager)
+, _fixedStorage(storage != nullptr)
+, _fixedMaxTopicLength(storage ? storage->maxTopicLength : 0)
+, _keepAlivePhase(0)
+, _connected(false)
 , _connectPacketNotEnoughSpace(false)
+, _outOfMemory(false)
 , _disconnectFlagged(false)
 , _lastClientActivity(0)
 , _lastServerActivity(0)
 , _lastPingRequestTime(0)
+, _timerWheel(storage ? storage->timerWheel : manager ? &manager->_timerWheel : createTimerWheel())
+, _keepAliveTimer([this]() { _onKeepAliveTimer(); })
+, _pingTimeoutTimer([this]() { _onPingTimeoutTimer(); })
+, _ackWatchdogTimer([this]() { _onAckWatchdogTimer(); })
+, _rttProbePacketId(0)
+, _rttProbeTime(0)
+, _rttProbeOverdue(false)
 #if ASYNC_TCP_SSL_ENABLED
 , _secure(false)
 #if ASYNC_TCP_SSL_AXTLS && SSL_VERIFY_BY_FINGERPRINT
 , _tlsVerifyFailed(false)
 #endif
+, _sslHandshakeStart(0)
+, _sslHandshakeDone(false)
+#if ASYNC_TCP_SSL_BEARSSL
+, _sslFragmentSupport(AsyncMqttClientInternals::SslFragmentSupport::UNKNOWN)
+, _sslFreeHeapBefore(0)
+#endif
+#endif
+#if ASYNC_MQTT_SSL_SESSION_RESUMPTION
+, _sslSessionOffered(false)
+#endif
+#if ASYNC_TCP_SSL_ENABLED || ASYNC_MQTT_SSL_SESSION_RESUMPTION
+, _sslStats()
 #endif
 , _port(0)
+, _serverChanged(false)
 , _keepAlive(15)
 , _cleanSession(true)
 , _willQos(0)
 , _willRetain(false)
+#if ASYNC_MQTT_COMPRESSION
+, _compression(nullptr)
+#endif
+#if ASYNC_MQTT_PAYLOAD_SINKS
+, _sinks()
+, _activeSink(nullptr)
+#endif
+#if ASYNC_MQTT_RETAINED_CACHE
+, _retainedCache(nullptr)
+, _caching(false)
+#endif
+#if ASYNC_MQTT_DUPLICATE_FILTER
+, _duplicateFilter()
+, _duplicate(false)
+#endif
+#if ASYNC_MQTT_PRIORITY_LANES
+, _lanes()
+, _bulkInFlight(ASYNC_MQTT_BULK_IN_FLIGHT)
+, _transportCapacity(0)
+, _pingDeferred(false)
+#endif
+#if ASYNC_MQTT_RATE_CONTROL
+, _rateControl()
+#endif
+#if ASYNC_MQTT_AGGREGATION
+, _aggregator()
+, _aggregationTimer([this]() { _onAggregationTimer(); })
+#endif
 , _parsingInformation { .bufferState = AsyncMqttClientInternals::BufferState::NONE }
 , _currentParsedPacket(nullptr)
+, _packetStorage(storage ? storage->packet : nullptr)
 , _remainingLengthBufferPosition(0)
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+, _submissions()
+, _submissionsOpen(false)
+#endif
 , _nextPacketId(1) {
-  _client.onConnect([](void* obj, AsyncClient* c) { (static_cast<AsyncMqttClient*>(obj))->_onConnect(c); }, this);
-  _client.onDisconnect([](void* obj, AsyncClient* c) { (static_cast<AsyncMqttClient*>(obj))->_onDisconnect(c); }, this);
-  _client.onError([](void* obj, AsyncClient* c, err_t error) { (static_cast<AsyncMqttClient*>(obj))->_onError(c, error); }, this);
-  _client.onTimeout([](void* obj, AsyncClient* c, uint32_t time) { (static_cast<AsyncMqttClient*>(obj))->_onTimeout(c, time); }, this);
-  _client.onAck([](void* obj, AsyncClient* c, size_t len, uint32_t time) { (static_cast<AsyncMqttClient*>(obj))->_onAck(c, len, time); }, this);
-  _client.onData([](void* obj, AsyncClient* c, void* data, size_t len) { (static_cast<AsyncMqttClient*>(obj))->_onData(c, static_cast<char*>(data), len); }, this);
-  _client.onPoll([](void* obj, AsyncClient* c) { (static_cast<AsyncMqttClient*>(obj))->_onPoll(c); }, this);
+  _transport->setListener(this);
+
+  // managed clients borrow a topic buffer from the manager pool while a PUBLISH is parsed
+  _parsingInformation.topicBuffer = nullptr;
+  if (storage) {
+    _parsingInformation.topicBuffer = storage->topicBuffer;
+    _toSendAcks.setStorage(storage->acks, storage->ackDepth);
+    _pendingPubRels.setStorage(storage->pubRels, storage->pubRelDepth);
+    _clientId.setStorage(storage->clientId, storage->clientIdCapacity);
+    _host.setStorage(storage->host, storage->hostCapacity);
+    _username.setStorage(storage->username, storage->usernameCapacity);
+    _password.setStorage(storage->password, storage->passwordCapacity);
+    _willTopic.setStorage(storage->willTopic, storage->willTopicCapacity);
+    _willPayload.setStorage(storage->willPayload, storage->willPayloadCapacity);
+  }
+
+#if ASYNC_MQTT_SSL_SESSION_RESUMPTION
+  _sslSession.length = 0;
+#endif
 
 #if ASYNC_TCP_SSL_ENABLED && ASYNC_TCP_SSL_BEARSSL
-  _client.setInBufSize(SSL_NEGOTIATE_BUF_SIZE_0);
-  _client.setOutBufSize(SSL_NEGOTIATE_BUF_SIZE_0);
-  _client.onSSLCertLookup([](void* obj, AsyncClient* c, void *dn_hash,
-    size_t dn_hash_len, uint8_t **buf) {
-      return (static_cast<AsyncMqttClient*>(obj))
-        ->_onSSLCertLookup(c, dn_hash, dn_hash_len, buf);
-    }, this);
+  // the TLS settings below are those of AsyncClient, a transport of the application sets up its own
+  if (_defaultTransport) {
+    AsyncClient& client = _defaultTransport->client();
+    client.setInBufSize(SSL_NEGOTIATE_BUF_SIZE_0);
+    client.setOutBufSize(SSL_NEGOTIATE_BUF_SIZE_0);
+    client.onSSLCertLookup([](void* obj, AsyncClient* c, void *dn_hash,
+      size_t dn_hash_len, uint8_t **buf) {
+        return (static_cast<AsyncMqttClient*>(obj))
+          ->_onSSLCertLookup(c, dn_hash, dn_hash_len, buf);
+      }, this);
+  }
 #endif
 
+  char clientId[32];
 #ifdef ESP32
-  _clientId.concat("ESP32-");
-  _clientId.concat(ESP.getEfuseMac(),16);
+  size_t clientIdLength = formatClientId(clientId, "ESP32-", ESP.getEfuseMac());
 #elif defined(ESP8266)
-  _clientId.concat("ESP8266-");
-  _clientId.concat(ESP.getChipId(),16);
+  size_t clientIdLength = formatClientId(clientId, "ESP8266-", ESP.getChipId());
+#else
+  size_t clientIdLength = formatClientId(clientId, "Host-", reinterpret_cast<uintptr_t>(this));
 #endif
+  _clientId.assign(clientId, clientIdLength);
 
-  setMaxTopicLength(128);
+  setMaxTopicLength(_manager ? _manager->_maxTopicLength : _fixedStorage ? _fixedMaxTopicLength : 128);
 }
 
 AsyncMqttClient::~AsyncMqttClient() {
+#if ASYNC_MQTT_MESSAGE_DISPATCH
+  _dispatcher.end();
+#endif
   disconnect(true);
-  delete _currentParsedPacket;
-  delete[] _parsingInformation.topicBuffer;
+  _transport->setListener(nullptr);
+  _timerWheel->cancel(&_keepAliveTimer);
+  _timerWheel->cancel(&_pingTimeoutTimer);
+  _timerWheel->cancel(&_ackWatchdogTimer);
+#if ASYNC_MQTT_AGGREGATION
+  _timerWheel->cancel(&_aggregationTimer);
+#endif
+  _freeCurrentParsedPacket();
+#if ASYNC_MQTT_COMPRESSION
+  AsyncMqttClientInternals::destroy(_compression, AsyncMqttClientMemoryTag::PARSER);
+#endif
+  if (!_manager && !_fixedStorage) {
+    AsyncMqttClientInternals::release(_parsingInformation.topicBuffer, _parsingInformation.maxTopicLength + 1, AsyncMqttClientMemoryTag::TOPIC);
+    AsyncMqttClientInternals::destroy(_timerWheel, AsyncMqttClientMemoryTag::CLIENT);
+  }
+  if (_fixedStorage && _defaultTransport) {
+    using AsyncMqttClientInternals::DefaultTransport;
+    _defaultTransport->~DefaultTransport();
+  } else {
+    AsyncMqttClientInternals::destroy(_defaultTransport, AsyncMqttClientMemoryTag::CLIENT);
+  }
 }
 
 AsyncMqttClient& AsyncMqttClient::setKeepAlive(uint16_t keepAlive) {
@@ -67,7 +222,7 @@ AsyncMqttClient& AsyncMqttClient::setKeepAlive(uint16_t keepAlive) {
 }
 
 AsyncMqttClient& AsyncMqttClient::setClientId(String const &clientId) {
-  _clientId = clientId;
+  _clientId.assign(clientId.begin(), clientId.length());
   return *this;
 }
 
@@ -77,39 +232,191 @@ AsyncMqttClient& AsyncMqttClient::setCleanSession(bool cleanSession) {
 }
 
 AsyncMqttClient& AsyncMqttClient::setMaxTopicLength(uint16_t maxTopicLength) {
-  _parsingInformation.maxTopicLength = maxTopicLength;
-  delete[] _parsingInformation.topicBuffer;
-  _parsingInformation.topicBuffer = new char[maxTopicLength + 1];
+  if (_manager) {
+    // bounded by the size of the pooled buffers
+    _parsingInformation.maxTopicLength = maxTopicLength < _manager->_maxTopicLength ? maxTopicLength : _manager->_maxTopicLength;
+    return *this;
+  }
+  if (_fixedStorage) {
+    // bounded by the buffer held in the object
+    _parsingInformation.maxTopicLength = maxTopicLength < _fixedMaxTopicLength ? maxTopicLength : _fixedMaxTopicLength;
+    return *this;
+  }
+  AsyncMqttClientInternals::release(_parsingInformation.topicBuffer, _parsingInformation.maxTopicLength + 1, AsyncMqttClientMemoryTag::TOPIC);
+  _parsingInformation.topicBuffer = static_cast<char*>(AsyncMqttClientInternals::allocate(maxTopicLength + 1, AsyncMqttClientMemoryTag::TOPIC));
+  // out of memory, every PUBLISH is ignored
+  _parsingInformation.maxTopicLength = _parsingInformation.topicBuffer ? maxTopicLength : 0;
   return *this;
 }
 
 AsyncMqttClient& AsyncMqttClient::setCredentials(String const &username, String const &password) {
-  _username = username;
-  _password = password;
+  _username.assign(username.begin(), username.length());
+  _password.assign(password.begin(), password.length());
   return *this;
 }
 
 AsyncMqttClient& AsyncMqttClient::setWill(String const &topic, uint8_t qos, bool retain, String const &payload) {
-  _willTopic = topic;
+  _willTopic.assign(topic.begin(), topic.length());
   _willQos = qos;
   _willRetain = retain;
-  _willPayload = payload;
+  _willPayload.assign(payload.begin(), payload.length());
   return *this;
 }
 
 AsyncMqttClient& AsyncMqttClient::setServer(IPAddress ip, uint16_t port) {
+  bool changed = !_host.empty() || !(ip == _ip) || port != _port;
   _host.clear();
   _ip = ip;
   _port = port;
+  if (changed) _onServerChanged();
   return *this;
 }
 
 AsyncMqttClient& AsyncMqttClient::setServer(String const &host, uint16_t port) {
-  _host = host;
+  bool changed = port != _port || host.length() != _host.length() ||
+    (host.length() != 0 && memcmp(host.begin(), _host.c_str(), host.length()) != 0);
+  _host.assign(host.begin(), host.length());
   _port = port;
+  if (changed) _onServerChanged();
+  return *this;
+}
+
+// what was learnt of the previous server: its round trip (once connect() is called), its TLS session and extensions
+void AsyncMqttClient::_onServerChanged() {
+  _serverChanged = true;
+#if ASYNC_MQTT_SSL_SESSION_RESUMPTION
+  _sslSession.length = 0;
+#endif
+#if ASYNC_TCP_SSL_ENABLED && ASYNC_TCP_SSL_BEARSSL
+  _sslFragmentSupport = AsyncMqttClientInternals::SslFragmentSupport::UNKNOWN;
+#endif
+}
+
+AsyncMqttClient& AsyncMqttClient::setClock(AsyncMqttClientInternals::ClockFunction clock) {
+  _timerWheel->setClock(clock);
+  return *this;
+}
+
+#if ASYNC_MQTT_COMPRESSION
+// past ASYNC_MQTT_COMPRESSION_FILTERS or out of memory, the filter is ignored and its topics go uncompressed
+AsyncMqttClient& AsyncMqttClient::addCompressedTopics(const char* filter) {
+  if (!_compression) _compression = AsyncMqttClientInternals::create<AsyncMqttClientInternals::PayloadCompression>(AsyncMqttClientMemoryTag::PARSER);
+  if (_compression) _compression->addFilter(filter);
+  return *this;
+}
+#endif
+
+#if ASYNC_MQTT_PAYLOAD_SINKS
+// past ASYNC_MQTT_PAYLOAD_SINKS or out of memory, the sink is ignored and its topics go to onMessage()
+AsyncMqttClient& AsyncMqttClient::addPayloadSink(const char* filter, AsyncMqttClientInternals::PayloadSink* sink) {
+  for (AsyncMqttClientInternals::PayloadSink* &slot : _sinks) {
+    if (slot) continue;
+    if (sink->setFilter(filter)) slot = sink;
+    break;
+  }
+  return *this;
+}
+#endif
+
+#if ASYNC_MQTT_RETAINED_CACHE
+AsyncMqttClient& AsyncMqttClient::setRetainedCache(AsyncMqttClientInternals::RetainedCache* cache) {
+  if (_caching) _retainedCache->abort();
+  _caching = false;
+  _retainedCache = cache;
+  return *this;
+}
+#endif
+
+#if ASYNC_MQTT_DUPLICATE_FILTER
+// out of memory, the filter stays off
+AsyncMqttClient& AsyncMqttClient::setDuplicateFilter(uint16_t entries, uint32_t window) {
+  _duplicateFilter.begin(entries, window);
+  _duplicate = false;
+  return *this;
+}
+#endif
+
+#if ASYNC_MQTT_PRIORITY_LANES
+// out of memory, or all 0, the lanes stay off and publish() writes to the transport or fails as without them
+AsyncMqttClient& AsyncMqttClient::setPriorityLanes(size_t high, size_t normal, size_t bulk) {
+  _lanes.begin(high, normal, bulk);
+  return *this;
+}
+
+// past ASYNC_MQTT_PRIORITY_FILTERS or out of memory, the filter is ignored and its topics are NORMAL
+AsyncMqttClient& AsyncMqttClient::addTopicPriority(const char* filter, AsyncMqttClientPriority priority) {
+  _lanes.addFilter(filter, priority);
+  return *this;
+}
+
+AsyncMqttClient& AsyncMqttClient::setBulkInFlight(size_t inFlight) {
+  _bulkInFlight = inFlight;
+  return *this;
+}
+
+AsyncMqttClientLaneStats AsyncMqttClient::laneStats(AsyncMqttClientPriority priority) const {
+  return _lanes.stats(priority);
+}
+#endif
+
+#if ASYNC_MQTT_RATE_CONTROL
+AsyncMqttClient& AsyncMqttClient::setRateControl(uint32_t minimum, uint32_t maximum, uint32_t targetDelay) {
+  _rateControl.begin(minimum, maximum, targetDelay, _timerWheel->now());
+  return *this;
+}
+
+uint32_t AsyncMqttClient::permittedRate() const {
+  return _rateControl.rate();
+}
+
+AsyncMqttClientRateStats AsyncMqttClient::rateStats() const {
+  return _rateControl.stats();
+}
+#endif
+
+#if ASYNC_MQTT_AGGREGATION
+// a batch being gathered is dropped
+AsyncMqttClient& AsyncMqttClient::setAggregation(const char* topic, size_t budget, uint32_t window) {
+  _timerWheel->cancel(&_aggregationTimer);
+  _aggregator.begin(topic, budget, window);
   return *this;
 }
 
+// past ASYNC_MQTT_AGGREGATION_FILTERS or out of memory, the filter is ignored
+AsyncMqttClient& AsyncMqttClient::addAggregatedTopics(const char* filter) {
+  _aggregator.addFilter(filter);
+  return *this;
+}
+
+AsyncMqttClient& AsyncMqttClient::onBatchSent(AsyncMqttClientInternals::OnBatchSentUserCallback const &callback) {
+  _onBatchSentUserCallback = callback;
+  return *this;
+}
+
+AsyncMqttClientAggregationStats AsyncMqttClient::aggregationStats() const {
+  return _aggregator.stats();
+}
+#endif
+
+#if ASYNC_TCP_SSL_ENABLED || ASYNC_MQTT_SSL_SESSION_RESUMPTION
+AsyncMqttClientSslStats const &AsyncMqttClient::sslStats() const {
+  return _sslStats;
+}
+#endif
+
+#if ASYNC_MQTT_SSL_SESSION_RESUMPTION
+void AsyncMqttClient::_sslKeepSession() {
+  AsyncMqttClientInternals::SslSession session;
+  session.length = _transport->sslSession(session.data, sizeof(session.data));
+  // the broker hands back the very same session when it accepted the resumption
+  if (_sslSessionOffered && session.length != 0 && session.length == _sslSession.length &&
+      memcmp(session.data, _sslSession.data, session.length) == 0) {
+    _sslStats.resumed++;
+  }
+  _sslSession = session;
+}
+#endif
+
 #if ASYNC_TCP_SSL_ENABLED
 AsyncMqttClient& AsyncMqttClient::setSecure(bool secure) {
   _secure = secure;
@@ -139,6 +446,67 @@ int AsyncMqttClient::_onSSLCertLookup(AsyncClient* client, void *dn_hash, size_t
   }
   return 0;
 }
+
+uint16_t AsyncMqttClient::_sslFragmentLength() const {
+  // a record should at least hold the CONNECT packet, or a SUBSCRIBE to the longest topic
+  uint32_t connectLength = 5 + 10 + 2 + _clientId.length();
+  if (!_willTopic.empty()) connectLength += 2 + _willTopic.length() + 2 + _willPayload.length();
+  if (!_username.empty()) connectLength += 2 + _username.length();
+  if (!_password.empty()) connectLength += 2 + _password.length();
+  uint32_t topicLength = 5 + 2 + 2 + _parsingInformation.maxTopicLength + 1;
+  uint32_t neededLength = connectLength > topicLength ? connectLength : topicLength;
+
+  for (uint32_t fragmentLength = 512; fragmentLength <= ASYNC_MQTT_SSL_MAX_FRAGMENT_LENGTH; fragmentLength <<= 1) {
+    if (fragmentLength >= neededLength) return fragmentLength;
+  }
+  return 0;
+}
+
+void AsyncMqttClient::_sslSetupBuffers() {
+  // BearSSL requests max_fragment_length when its buffers are smaller than a full record,
+  // so small buffers are the request, and full size buffers are the fallback
+  uint16_t fragmentLength = 0;
+  if (_sslFragmentSupport == AsyncMqttClientInternals::SslFragmentSupport::UNKNOWN ||
+      _sslFragmentSupport == AsyncMqttClientInternals::SslFragmentSupport::SUPPORTED) {
+    fragmentLength = _sslFragmentLength();
+  }
+
+  if (!_defaultTransport) fragmentLength = 0;
+  if (fragmentLength != 0) {
+    AsyncClient& client = _defaultTransport->client();
+    client.setInBufSize(fragmentLength + 325);  // BR_SSL_BUFSIZE_INPUT overhead
+    client.setOutBufSize(fragmentLength + 85);  // BR_SSL_BUFSIZE_OUTPUT overhead
+  } else if (_defaultTransport) {
+    AsyncClient& client = _defaultTransport->client();
+    client.setInBufSize(SSL_NEGOTIATE_BUF_SIZE_0);
+    client.setOutBufSize(SSL_NEGOTIATE_BUF_SIZE_0);
+  }
+  _sslStats.fragmentLength = fragmentLength;
+  _sslFreeHeapBefore = ESP.getFreeHeap();
+}
+
+void AsyncMqttClient::_sslUpdateFragmentSupport(bool handshakeDone) {
+  using AsyncMqttClientInternals::SslFragmentSupport;
+
+  if (handshakeDone) {
+    // the heap may have grown meanwhile, something else freed memory: nothing to charge the connection with
+    uint32_t freeHeap = ESP.getFreeHeap();
+    _sslStats.connectionHeap = _sslFreeHeapBefore > freeHeap ? _sslFreeHeapBefore - freeHeap : 0;
+    if (_sslStats.fragmentLength != 0) {
+      _sslFragmentSupport = SslFragmentSupport::SUPPORTED;
+    } else if (_sslFragmentSupport == SslFragmentSupport::PROBE_FAILED) {
+      // a full size handshake worked where the reduced one did not, stick to full size buffers
+      _sslFragmentSupport = SslFragmentSupport::UNSUPPORTED;
+    }
+  } else {
+    if (_sslStats.fragmentLength != 0) {
+      _sslFragmentSupport = SslFragmentSupport::PROBE_FAILED;
+    } else if (_sslFragmentSupport == SslFragmentSupport::PROBE_FAILED) {
+      // the full size handshake failed as well, the server was not the problem
+      _sslFragmentSupport = SslFragmentSupport::UNKNOWN;
+    }
+  }
+}
 #endif
 #endif
 
@@ -163,6 +531,10 @@ AsyncMqttClient& AsyncMqttClient::onUnsubscribe(AsyncMqttClientInternals::OnUnsu
 }
 
 AsyncMqttClient& AsyncMqttClient::onMessage(AsyncMqttClientInternals::OnMessageUserCallback const &callback) {
+#if ASYNC_MQTT_MESSAGE_DISPATCH
+  // the workers call their copy of the handler, it is not replaced under them
+  if (_dispatcher.started()) return *this;
+#endif
   _onMessageUserCallback = callback;
   return *this;
 }
@@ -172,46 +544,121 @@ AsyncMqttClient& AsyncMqttClient::onPublish(AsyncMqttClientInternals::OnPublishU
   return *this;
 }
 
+bool AsyncMqttClient::setAllocator(AsyncMqttClientAllocator const &allocator) {
+  return AsyncMqttClientInternals::setAllocator(allocator);
+}
+
+AsyncMqttClientMemoryStats AsyncMqttClient::memoryStats(AsyncMqttClientMemoryTag tag) {
+  return AsyncMqttClientInternals::memoryStats(tag);
+}
+
+#if ASYNC_MQTT_MESSAGE_DISPATCH
+AsyncMqttClient& AsyncMqttClient::setMessageDispatch(uint8_t workers, uint16_t depth) {
+  // the workers call a copy of the onMessage handler set so far; 0 workers, or out of memory for them, handles messages
+  // inline again
+  _dispatcher.begin(workers, depth, _onMessageUserCallback);
+  return *this;
+}
+
+AsyncMqttClientDispatchStats AsyncMqttClient::dispatchStats() const {
+  return _dispatcher.stats();
+}
+#endif
+
+template <typename PacketType, typename... Args>
+AsyncMqttClientInternals::Packet* AsyncMqttClient::_newPacket(Args... args) {
+  static_assert(sizeof(PacketType) <= sizeof(AsyncMqttClientInternals::PacketStorage), "PacketStorage misses a packet type");
+  // every packet type takes a block of the same size, a pool needs a single size for the parser
+  void* storage = _packetStorage ? static_cast<void*>(_packetStorage)
+    : AsyncMqttClientInternals::allocate(sizeof(AsyncMqttClientInternals::PacketStorage), AsyncMqttClientMemoryTag::PARSER);
+  if (!storage) {
+    _outOfMemory = true;
+    return nullptr;
+  }
+  return new (storage) PacketType(args...);
+}
+
 void AsyncMqttClient::_freeCurrentParsedPacket() {
-  delete _currentParsedPacket;
+  if (_currentParsedPacket) {
+    _currentParsedPacket->~Packet();
+    if (!_packetStorage) {
+      AsyncMqttClientInternals::release(_currentParsedPacket, sizeof(AsyncMqttClientInternals::PacketStorage), AsyncMqttClientMemoryTag::PARSER);
+    }
+  }
   _currentParsedPacket = nullptr;
+  if (_manager && _parsingInformation.topicBuffer) {
+    _manager->_releaseTopicBuffer(_parsingInformation.topicBuffer);
+    _parsingInformation.topicBuffer = nullptr;
+  }
 }
 
 void AsyncMqttClient::_clear() {
   _lastPingRequestTime = 0;
+  _timerWheel->cancel(&_keepAliveTimer);
+  _timerWheel->cancel(&_pingTimeoutTimer);
+  _timerWheel->cancel(&_ackWatchdogTimer);
+  _rttProbePacketId = 0;
+  _rttProbeOverdue = false;
+#if ASYNC_MQTT_LATENCY
+  _latency.clearInFlight();
+#endif
   _connected = false;
   _disconnectFlagged = false;
   _connectPacketNotEnoughSpace = false;
+  _outOfMemory = false;
 #if ASYNC_TCP_SSL_ENABLED
 #if ASYNC_TCP_SSL_AXTLS && SSL_VERIFY_BY_FINGERPRINT
   _tlsVerifyFailed = false;
 #endif
 #endif
   _freeCurrentParsedPacket();
+#if ASYNC_MQTT_PAYLOAD_SINKS
+  if (_activeSink) _activeSink->abort();
+  _activeSink = nullptr;
+#endif
+#if ASYNC_MQTT_RETAINED_CACHE
+  if (_caching) _retainedCache->abort();
+  _caching = false;
+#endif
 
   _pendingPubRels.clear();
-  _pendingPubRels.shrink_to_fit();
-
   _toSendAcks.clear();
-  _toSendAcks.shrink_to_fit();
+#if ASYNC_MQTT_PRIORITY_LANES
+  // the lanes wait for the next connection
+  _pingDeferred = false;
+#endif
+#if ASYNC_MQTT_AGGREGATION
+  // the batch being gathered waits for the next connection
+  _timerWheel->cancel(&_aggregationTimer);
+#endif
+
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+  _submissionsOpen = false;
+  _failSubmissions();
+#endif
 
+#if ASYNC_MQTT_PRIORITY_LANES
+  // messages waiting in the lanes keep their identifiers: the next ones must not take them again
+  if (!_lanes.waiting(AsyncMqttClientPriority::BULK)) _nextPacketId = 1;
+#else
   _nextPacketId = 1;
+#endif
   _parsingInformation.bufferState = AsyncMqttClientInternals::BufferState::NONE;
+  _remainingLengthBufferPosition = 0;
 }
 
 /* TCP */
-void AsyncMqttClient::_onConnect(AsyncClient* client) {
-  (void)client;
-
+void AsyncMqttClient::onTransportConnect() {
 #if ASYNC_TCP_SSL_ENABLED
   if (_secure) {
     //Serial.println("Secure connection established, verifying...");
-    SSL* clientSsl = _client.getSSL();
+    // only AsyncClient can be asked for the certificate: through another transport, no fingerprint matches
+    SSL* clientSsl = _defaultTransport ? _defaultTransport->client().getSSL() : nullptr;
 
 #if ASYNC_TCP_SSL_AXTLS && SSL_VERIFY_BY_FINGERPRINT
     bool sslFoundFingerprint = false;
     for (std::array<uint8_t, SHA1_SIZE> fingerprint : _secureServerFingerprints) {
-      if (ssl_match_fingerprint(clientSsl, fingerprint.data()) == SSL_OK) {
+      if (clientSsl && ssl_match_fingerprint(clientSsl, fingerprint.data()) == SSL_OK) {
         sslFoundFingerprint = true;
         break;
       }
@@ -219,13 +666,29 @@ void AsyncMqttClient::_onConnect(AsyncClient* client) {
 
     if (!sslFoundFingerprint) {
       _tlsVerifyFailed = true;
-      _client.close(true);
+#if ASYNC_MQTT_SSL_SESSION_RESUMPTION
+      _sslSession.length = 0;
+#endif
+      _transport->close(true);
       return;
     }
 #endif
     //Serial.println("Secure connection verified!");
+    (void)clientSsl;
+
+    _sslStats.lastHandshakeTime = _timerWheel->now() - _sslHandshakeStart;
+    _sslStats.totalHandshakeTime += _sslStats.lastHandshakeTime;
+    _sslStats.handshakes++;
+    _sslHandshakeDone = true;
+#if ASYNC_TCP_SSL_BEARSSL
+    _sslUpdateFragmentSupport(true);
+#endif
+
   }
 #endif
+#if ASYNC_MQTT_SSL_SESSION_RESUMPTION
+  _sslKeepSession();
+#endif
 
   char fixedHeader[5];
   fixedHeader[0] = AsyncMqttClientInternals::PacketType.CONNECT;
@@ -329,47 +792,52 @@ void AsyncMqttClient::_onConnect(AsyncClient* client) {
 
   neededSpace += 1 + headerRemainingLength;
 
-  if (_client.space() < neededSpace) {
+  if (_transport->space() < neededSpace) {
     _connectPacketNotEnoughSpace = true;
-    _client.close(true);
+    _transport->close(true);
     return;
   }
 
-  _client.add(fixedHeader, 1 + headerRemainingLength);
-  _client.add(protocolNameLengthBytes, sizeof(protocolNameLengthBytes));
-  _client.add("MQTT", protocolNameLength);
-  _client.add(protocolLevel, sizeof(protocolLevel));
-  _client.add(connectFlags, sizeof(connectFlags));
-  _client.add(keepAliveBytes, sizeof(keepAliveBytes));
-  _client.add(clientIdLengthBytes, sizeof(clientIdLengthBytes));
-  _client.add(_clientId.begin(), clientIdLength);
+  _transport->add(fixedHeader, 1 + headerRemainingLength);
+  _transport->add(protocolNameLengthBytes, sizeof(protocolNameLengthBytes));
+  _transport->add("MQTT", protocolNameLength);
+  _transport->add(protocolLevel, sizeof(protocolLevel));
+  _transport->add(connectFlags, sizeof(connectFlags));
+  _transport->add(keepAliveBytes, sizeof(keepAliveBytes));
+  _transport->add(clientIdLengthBytes, sizeof(clientIdLengthBytes));
+  _transport->add(_clientId.begin(), clientIdLength);
   if (!_willTopic.empty()) {
-    _client.add(willTopicLengthBytes, sizeof(willTopicLengthBytes));
-    _client.add(_willTopic.begin(), willTopicLength);
+    _transport->add(willTopicLengthBytes, sizeof(willTopicLengthBytes));
+    _transport->add(_willTopic.begin(), willTopicLength);
 
-    _client.add(willPayloadLengthBytes, sizeof(willPayloadLengthBytes));
-    if (!_willPayload.empty()) _client.add(_willPayload.begin(), willPayloadLength);
+    _transport->add(willPayloadLengthBytes, sizeof(willPayloadLengthBytes));
+    if (!_willPayload.empty()) _transport->add(_willPayload.begin(), willPayloadLength);
   }
   if (!_username.empty()) {
-    _client.add(usernameLengthBytes, sizeof(usernameLengthBytes));
-    _client.add(_username.begin(), usernameLength);
+    _transport->add(usernameLengthBytes, sizeof(usernameLengthBytes));
+    _transport->add(_username.begin(), usernameLength);
   }
   if (!_password.empty()) {
-    _client.add(passwordLengthBytes, sizeof(passwordLengthBytes));
-    _client.add(_password.begin(), passwordLength);
+    _transport->add(passwordLengthBytes, sizeof(passwordLengthBytes));
+    _transport->add(_password.begin(), passwordLength);
   }
 
-  _client.send();
-  _lastClientActivity = millis();
+  _transport->send();
+  _lastClientActivity = _timerWheel->now();
+  _metrics.packetOut(AsyncMqttClientInternals::PacketType.CONNECT, neededSpace);
 }
 
-void AsyncMqttClient::_onDisconnect(AsyncClient* client) {
-  (void)client;
+void AsyncMqttClient::onTransportDisconnect() {
+#if ASYNC_TCP_SSL_ENABLED && ASYNC_TCP_SSL_BEARSSL
+  if (_secure && !_sslHandshakeDone) _sslUpdateFragmentSupport(false);
+#endif
   if (!_disconnectFlagged) {
     AsyncMqttClientDisconnectReason reason;
 
     if (_connectPacketNotEnoughSpace) {
       reason = AsyncMqttClientDisconnectReason::ESP8266_NOT_ENOUGH_SPACE;
+    } else if (_outOfMemory) {
+      reason = AsyncMqttClientDisconnectReason::CLIENT_OUT_OF_MEMORY;
 #if ASYNC_TCP_SSL_ENABLED
 #if ASYNC_TCP_SSL_AXTLS && SSL_VERIFY_BY_FINGERPRINT
     } else if (_tlsVerifyFailed) {
@@ -379,13 +847,13 @@ void AsyncMqttClient::_onDisconnect(AsyncClient* client) {
     } else {
       reason = AsyncMqttClientDisconnectReason::TCP_DISCONNECTED;
     }
+    _metrics.disconnected(reason);
     if (_onDisconnectUserCallback) _onDisconnectUserCallback(reason);
   }
   _clear();
 }
 
-void AsyncMqttClient::_onError(AsyncClient* client, err_t error) {
-  (void)client;
+void AsyncMqttClient::onTransportError(int8_t error) {
   (void)error;
   //if (error > -100 && error < 0) {
   //  Serial.printf("Error: %s\n",
@@ -396,67 +864,107 @@ void AsyncMqttClient::_onError(AsyncClient* client, err_t error) {
   // _onDisconnect called anyway
 }
 
-void AsyncMqttClient::_onTimeout(AsyncClient* client, uint32_t time) {
-  (void)client;
+void AsyncMqttClient::onTransportTimeout(uint32_t time) {
   (void)time;
   // disconnection will be handled by ping/pong management
 }
 
-void AsyncMqttClient::_onAck(AsyncClient* client, size_t len, uint32_t time) {
-  (void)client;
+void AsyncMqttClient::onTransportAck(size_t len, uint32_t time) {
+#if ASYNC_MQTT_RATE_CONTROL
+  if (_connected && _rateControl.enabled()) _rateControl.acked(len, time, _transport->space(), _timerWheel->now());
+#else
   (void)len;
   (void)time;
+#endif
+#if ASYNC_MQTT_PRIORITY_LANES
+  // the room freed goes to the acks, then lane by lane
+  if (_connected && _lanes.enabled()) {
+    _sendAcks();
+    _drainLanes();
+  }
+#endif
+#if ASYNC_MQTT_AGGREGATION
+  // a batch whose window ended while the transport had no room
+  if (_connected && !_aggregator.empty() && _aggregator.remaining(_timerWheel->now()) == 0) {
+    _flushAggregate(AsyncMqttClientInternals::BatchTrigger::WINDOW);
+  }
+#endif
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+  // room again for what other tasks submitted
+  _drainSubmissions();
+#endif
 }
 
-void AsyncMqttClient::_onData(AsyncClient* client, char* data, size_t len) {
-  (void)client;
+void AsyncMqttClient::onTransportData(char* data, size_t len) {
   size_t currentBytePosition = 0;
-  char currentByte;
+  uint8_t currentByte;
   do {
     switch (_parsingInformation.bufferState) {
       case AsyncMqttClientInternals::BufferState::NONE:
         currentByte = data[currentBytePosition++];
         _parsingInformation.packetType = currentByte >> 4;
-        _parsingInformation.packetFlags = (currentByte << 4) >> 4;
+        _parsingInformation.packetFlags = currentByte & 0x0F;
         _parsingInformation.bufferState = AsyncMqttClientInternals::BufferState::REMAINING_LENGTH;
-        _lastServerActivity = millis();
+        _lastServerActivity = _timerWheel->now();
+        // an ignored PUBLISH never completes, drop it (and its topic buffer) before starting the next packet
+        _freeCurrentParsedPacket();
         switch (_parsingInformation.packetType) {
           case AsyncMqttClientInternals::PacketType.CONNACK:
-            _currentParsedPacket = new AsyncMqttClientInternals::ConnAckPacket(&_parsingInformation, std::bind(&AsyncMqttClient::_onConnAck, this, std::placeholders::_1, std::placeholders::_2));
+            _currentParsedPacket = _newPacket<AsyncMqttClientInternals::ConnAckPacket>(&_parsingInformation, [this](bool sessionPresent, uint8_t connectReturnCode) { _onConnAck(sessionPresent, connectReturnCode); });
             break;
           case AsyncMqttClientInternals::PacketType.PINGRESP:
-            _currentParsedPacket = new AsyncMqttClientInternals::PingRespPacket(&_parsingInformation, std::bind(&AsyncMqttClient::_onPingResp, this));
+            _currentParsedPacket = _newPacket<AsyncMqttClientInternals::PingRespPacket>(&_parsingInformation, [this]() { _onPingResp(); });
             break;
           case AsyncMqttClientInternals::PacketType.SUBACK:
-            _currentParsedPacket = new AsyncMqttClientInternals::SubAckPacket(&_parsingInformation, std::bind(&AsyncMqttClient::_onSubAck, this, std::placeholders::_1, std::placeholders::_2));
+            _currentParsedPacket = _newPacket<AsyncMqttClientInternals::SubAckPacket>(&_parsingInformation, [this](uint16_t packetId, char status) { _onSubAck(packetId, status); });
             break;
           case AsyncMqttClientInternals::PacketType.UNSUBACK:
-            _currentParsedPacket = new AsyncMqttClientInternals::UnsubAckPacket(&_parsingInformation, std::bind(&AsyncMqttClient::_onUnsubAck, this, std::placeholders::_1));
+            _currentParsedPacket = _newPacket<AsyncMqttClientInternals::UnsubAckPacket>(&_parsingInformation, [this](uint16_t packetId) { _onUnsubAck(packetId); });
             break;
           case AsyncMqttClientInternals::PacketType.PUBLISH:
-            _currentParsedPacket = new AsyncMqttClientInternals::PublishPacket(&_parsingInformation, std::bind(&AsyncMqttClient::_onMessage, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4, std::placeholders::_5, std::placeholders::_6, std::placeholders::_7, std::placeholders::_8, std::placeholders::_9), std::bind(&AsyncMqttClient::_onPublish, this, std::placeholders::_1, std::placeholders::_2));
+            if (_manager) _parsingInformation.topicBuffer = _manager->_acquireTopicBuffer();
+            _currentParsedPacket = _newPacket<AsyncMqttClientInternals::PublishPacket>(&_parsingInformation, [this](char const *topic, char const *payload, uint8_t qos, bool dup, bool retain, size_t len, size_t index, size_t total, uint16_t packetId) { _onMessage(topic, payload, qos, dup, retain, len, index, total, packetId); }, [this](uint16_t packetId, uint8_t qos) { _onPublish(packetId, qos); });
             break;
           case AsyncMqttClientInternals::PacketType.PUBREL:
-            _currentParsedPacket = new AsyncMqttClientInternals::PubRelPacket(&_parsingInformation, std::bind(&AsyncMqttClient::_onPubRel, this, std::placeholders::_1));
+            _currentParsedPacket = _newPacket<AsyncMqttClientInternals::PubRelPacket>(&_parsingInformation, [this](uint16_t packetId) { _onPubRel(packetId); });
             break;
           case AsyncMqttClientInternals::PacketType.PUBACK:
-            _currentParsedPacket = new AsyncMqttClientInternals::PubAckPacket(&_parsingInformation, std::bind(&AsyncMqttClient::_onPubAck, this, std::placeholders::_1));
+            _currentParsedPacket = _newPacket<AsyncMqttClientInternals::PubAckPacket>(&_parsingInformation, [this](uint16_t packetId) { _onPubAck(packetId); });
             break;
           case AsyncMqttClientInternals::PacketType.PUBREC:
-            _currentParsedPacket = new AsyncMqttClientInternals::PubRecPacket(&_parsingInformation, std::bind(&AsyncMqttClient::_onPubRec, this, std::placeholders::_1));
+            _currentParsedPacket = _newPacket<AsyncMqttClientInternals::PubRecPacket>(&_parsingInformation, [this](uint16_t packetId) { _onPubRec(packetId); });
             break;
           case AsyncMqttClientInternals::PacketType.PUBCOMP:
-            _currentParsedPacket = new AsyncMqttClientInternals::PubCompPacket(&_parsingInformation, std::bind(&AsyncMqttClient::_onPubComp, this, std::placeholders::_1));
+            _currentParsedPacket = _newPacket<AsyncMqttClientInternals::PubCompPacket>(&_parsingInformation, [this](uint16_t packetId) { _onPubComp(packetId); });
             break;
           default:
-            break;
+            // a packet only clients send, or a reserved type: the rest of the stream cannot be trusted
+            _metrics.unexpectedPacket();
+            _parsingInformation.bufferState = AsyncMqttClientInternals::BufferState::DISCARD;
+            _transport->close(true);
+            return;
+        }
+        if (_outOfMemory) {
+          // no parser for the packet, the rest of the stream cannot be followed
+          _metrics.parserOutOfMemory();
+          _parsingInformation.bufferState = AsyncMqttClientInternals::BufferState::DISCARD;
+          _transport->close(true);
+          return;
         }
         break;
       case AsyncMqttClientInternals::BufferState::REMAINING_LENGTH:
         currentByte = data[currentBytePosition++];
+        if (_remainingLengthBufferPosition == sizeof(_remainingLengthBuffer)) {
+          // a fifth length byte, the packet boundaries are lost
+          _metrics.malformedLength();
+          _parsingInformation.bufferState = AsyncMqttClientInternals::BufferState::DISCARD;
+          _transport->close(true);
+          return;
+        }
         _remainingLengthBuffer[_remainingLengthBufferPosition++] = currentByte;
         if (currentByte >> 7 == 0) {
           _parsingInformation.remainingLength = AsyncMqttClientInternals::Helpers::decodeRemainingLength(_remainingLengthBuffer);
+          _metrics.packetIn(_parsingInformation.packetType, 1 + _remainingLengthBufferPosition + _parsingInformation.remainingLength);
           _remainingLengthBufferPosition = 0;
           if (_parsingInformation.remainingLength > 0) {
             _parsingInformation.bufferState = AsyncMqttClientInternals::BufferState::VARIABLE_HEADER;
@@ -479,25 +987,39 @@ void AsyncMqttClient::_onData(AsyncClient* client, char* data, size_t len) {
   } while (currentBytePosition != len);
 }
 
-void AsyncMqttClient::_onPoll(AsyncClient* client) {
+void AsyncMqttClient::onTransportPoll() {
+  // a manager services all of its clients at once, from whichever transport polls
+  if (_manager) {
+    _manager->poll();
+    return;
+  }
   if (!_connected) return;
 
-  // if there is too much time the client has sent a ping request without a response, disconnect client to avoid half open connections
-  if (_lastPingRequestTime != 0 && (millis() - _lastPingRequestTime) >= (_keepAlive * 1000 * 2)) {
-    disconnect();
-    return;
-  // send ping to ensure the server will receive at least one message inside keepalive window
-  } else if (_lastPingRequestTime == 0 && (millis() - _lastClientActivity) >= (_keepAlive * 1000 * 0.7)) {
-    _sendPing();
+  // fire due keepalive and ping timeout timers
+  _timerWheel->advance();
+  _service();
+}
 
-  // send ping to verify if the server is still there (ensure this is not a half connection)
-  } else if (_connected && _lastPingRequestTime == 0 && (millis() - _lastServerActivity) >= (_keepAlive * 1000 * 0.7)) {
-    _sendPing();
-  }
+void AsyncMqttClient::_service() {
+  if (!_connected) return;
 
   // handle to send ack packets
   _sendAcks();
 
+#if ASYNC_MQTT_PRIORITY_LANES
+  _drainLanes();
+#endif
+
+#if ASYNC_MQTT_AGGREGATION
+  if (!_aggregator.empty() && _aggregator.remaining(_timerWheel->now()) == 0) {
+    _flushAggregate(AsyncMqttClientInternals::BatchTrigger::WINDOW);
+  }
+#endif
+
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+  _drainSubmissions();
+#endif
+
   // handle disconnect
 
   if (_disconnectFlagged) {
@@ -505,10 +1027,104 @@ void AsyncMqttClient::_onPoll(AsyncClient* client) {
   }
 }
 
+/* Timers */
+uint32_t AsyncMqttClient::_keepAliveInterval() const {
+  // clients of a manager ping up to 10% earlier, each by a different amount, so their pings do not line up
+  uint32_t stagger = static_cast<uint32_t>(_keepAlive) * 100 * _keepAlivePhase / 256;
+  if (!_rtt.valid()) return static_cast<uint32_t>(_keepAlive) * 700 - stagger;
+
+  // with a known RTT, only leave room for a couple of round trips before the keepalive deadline
+  uint32_t margin = _rtt.rto() * 2;
+  uint32_t minMargin = static_cast<uint32_t>(_keepAlive) * 100;
+  uint32_t maxMargin = static_cast<uint32_t>(_keepAlive) * 300;
+  if (margin < minMargin) margin = minMargin;
+  if (margin > maxMargin) margin = maxMargin;
+  return static_cast<uint32_t>(_keepAlive) * 1000 - margin - stagger;
+}
+
+uint32_t AsyncMqttClient::_deadLinkTimeout() const {
+  uint32_t limit = static_cast<uint32_t>(_keepAlive) * 1000 * 2;
+  if (!_rtt.valid()) return limit;
+
+  uint32_t timeout = _rtt.rto() * ASYNC_MQTT_DEAD_LINK_RTO_MULTIPLIER;
+  if (timeout < ASYNC_MQTT_MIN_DEAD_LINK_TIMEOUT) timeout = ASYNC_MQTT_MIN_DEAD_LINK_TIMEOUT;
+  return timeout < limit ? timeout : limit;
+}
+
+void AsyncMqttClient::_scheduleKeepAlive() {
+  if (_keepAlive == 0) return;
+  _timerWheel->schedule(&_keepAliveTimer, _keepAliveInterval());
+}
+
+void AsyncMqttClient::_onKeepAliveTimer() {
+  if (!_connected || _keepAlive == 0) return;
+
+  // send ping to ensure the server will receive at least one message inside keepalive window,
+  // and to verify if the server is still there (ensure this is not a half connection)
+  uint32_t now = _timerWheel->now();
+  uint32_t clientIdle = now - _lastClientActivity;
+  uint32_t serverIdle = now - _lastServerActivity;
+  uint32_t idle = clientIdle > serverIdle ? clientIdle : serverIdle;
+  uint32_t interval = _keepAliveInterval();
+  if (idle < interval) {
+    _timerWheel->schedule(&_keepAliveTimer, interval - idle);
+    return;
+  }
+
+  // keepalive is re-armed once the ping response arrives
+  if (_pingTimeoutTimer.armed()) return;
+  if (!_sendPing()) {
+#if ASYNC_MQTT_PRIORITY_LANES
+    _pingDeferred = true;
+#endif
+    _timerWheel->schedule(&_keepAliveTimer, 0);
+  }
+}
+
+void AsyncMqttClient::_onPingTimeoutTimer() {
+  // too much time since the client has sent a ping request without a response, disconnect client to avoid half open connections
+  _metrics.pingTimedOut();
+  disconnect();
+}
+
+void AsyncMqttClient::_onAckWatchdogTimer() {
+  if (!_connected || _keepAlive == 0 || _rttProbePacketId == 0) return;
+
+  // any traffic from the server proves the link is alive, only probe after a silence
+  uint32_t now = _timerWheel->now();
+  uint32_t serverIdle = now - _lastServerActivity;
+  uint32_t probeAge = now - _rttProbeTime;
+  uint32_t waited = serverIdle < probeAge ? serverIdle : probeAge;
+  uint32_t timeout = _deadLinkTimeout();
+  if (waited < timeout) {
+    _timerWheel->schedule(&_ackWatchdogTimer, timeout - waited);
+    return;
+  }
+
+  // the ack is overdue, ping right away instead of waiting for the keepalive
+  _rttProbeOverdue = true;
+  if (_pingTimeoutTimer.armed()) return;
+  if (!_sendPing()) _timerWheel->schedule(&_ackWatchdogTimer, 0);
+}
+
 /* MQTT */
 void AsyncMqttClient::_onPingResp() {
   _freeCurrentParsedPacket();
+  if (_pingTimeoutTimer.armed()) {
+    uint32_t rtt = _timerWheel->now() - _lastPingRequestTime;
+    _rtt.sample(rtt);
+    _metrics.pingAnswered(rtt);
+  }
   _lastPingRequestTime = 0;
+  _timerWheel->cancel(&_pingTimeoutTimer);
+  _scheduleKeepAlive();
+
+  // the link is alive but the ack the watchdog waited for is lost or late: no sample from it, the next publish probes
+  if (_rttProbeOverdue) {
+    _rttProbePacketId = 0;
+    _rttProbeOverdue = false;
+    _timerWheel->cancel(&_ackWatchdogTimer);
+  }
 }
 
 void AsyncMqttClient::_onConnAck(bool sessionPresent, uint8_t connectReturnCode) {
@@ -517,8 +1133,26 @@ void AsyncMqttClient::_onConnAck(bool sessionPresent, uint8_t connectReturnCode)
 
   if (connectReturnCode == 0) {
     _connected = true;
+    _metrics.connected();
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+    // what slipped in while the last connection went down carries identifiers of that session
+    _failSubmissions();
+    _submissionsOpen = true;
+#endif
+#if ASYNC_MQTT_RATE_CONTROL
+    if (_rateControl.enabled()) _rateControl.restart(_timerWheel->now());
+#endif
+#if ASYNC_MQTT_AGGREGATION
+    if (!_aggregator.empty()) _timerWheel->schedule(&_aggregationTimer, _aggregator.remaining(_timerWheel->now()));
+#endif
+#if ASYNC_MQTT_PRIORITY_LANES
+    // what waited over the reconnection goes first
+    _drainLanes();
+#endif
+    _scheduleKeepAlive();
     if (_onConnectUserCallback) _onConnectUserCallback(sessionPresent);
   } else {
+    _metrics.disconnected(static_cast<AsyncMqttClientDisconnectReason>(connectReturnCode));
     if (_onDisconnectUserCallback)
       _onDisconnectUserCallback(static_cast<AsyncMqttClientDisconnectReason>(connectReturnCode));
     _disconnectFlagged = true;
@@ -527,12 +1161,18 @@ void AsyncMqttClient::_onConnAck(bool sessionPresent, uint8_t connectReturnCode)
 
 void AsyncMqttClient::_onSubAck(uint16_t packetId, char status) {
   _freeCurrentParsedPacket();
+#if ASYNC_MQTT_LATENCY
+  _latency.completed(AsyncMqttClientInternals::LatencyKind::SUBSCRIBE, packetId, _timerWheel->now());
+#endif
 
   if (_onSubscribeUserCallback) _onSubscribeUserCallback(packetId, status);
 }
 
 void AsyncMqttClient::_onUnsubAck(uint16_t packetId) {
   _freeCurrentParsedPacket();
+#if ASYNC_MQTT_LATENCY
+  _latency.completed(AsyncMqttClientInternals::LatencyKind::UNSUBSCRIBE, packetId, _timerWheel->now());
+#endif
 
   if (_onUnsubscribeUserCallback) _onUnsubscribeUserCallback(packetId);
 }
@@ -549,29 +1189,95 @@ void AsyncMqttClient::_onMessage(char const *topic, char const *payload, uint8_t
     }
   }
 
+#if ASYNC_MQTT_DUPLICATE_FILTER
+  // before anything is handed to the handlers, the PUBACK goes out either way
+  if (index == 0) {
+    _duplicate = qos == 1 && _duplicateFilter.enabled() &&
+      _duplicateFilter.check(packetId, dup, topic, strlen(topic), payload, len, total, _timerWheel->now());
+    if (_duplicate) _metrics.duplicateDropped();
+  }
+  if (_duplicate) return;
+#endif
+
   if (notifyPublish) {
     AsyncMqttClientMessageProperties properties;
     properties.qos = qos;
     properties.dup = dup;
     properties.retain = retain;
 
-    if (_onMessageUserCallback) _onMessageUserCallback(topic, payload, properties, len, index, total);
+#if ASYNC_MQTT_COMPRESSION
+    // an empty payload is never compressed, it clears a retained message
+    if (_compression && index == 0) _compression->decoding = total > 0 && _compression->matches(topic, strlen(topic));
+    if (_compression && _compression->decoding) {
+      DecompressedMessage message = { this, topic, &properties };
+      if (index == 0) _compression->decoder.begin();
+      bool decoded = _compression->decoder.decode(payload, len, _onDecompressed, &message);
+      // the rest of a malformed payload is dropped, counted once at its end
+      if (index + len == total && !(decoded && _compression->decoder.finish(_onDecompressed, &message))) _metrics.decompressionError();
+      return;
+    }
+#endif
+    _deliverMessage(topic, payload, properties, len, index, total);
   }
 }
 
-void AsyncMqttClient::_onPublish(uint16_t packetId, uint8_t qos) {
-  AsyncMqttClientInternals::PendingAck pendingAck;
+void AsyncMqttClient::_deliverMessage(char const *topic, char const *payload, AsyncMqttClientMessageProperties const &properties, size_t len, size_t index, size_t total) {
+#if ASYNC_MQTT_PAYLOAD_SINKS
+  if (index == 0) {
+    _activeSink = nullptr;
+    for (AsyncMqttClientInternals::PayloadSink* sink : _sinks) {
+      if (sink && sink->matches(topic, strlen(topic))) {
+        _activeSink = sink;
+        _activeSink->begin(topic, total);
+        break;
+      }
+    }
+  }
+  if (_activeSink) {
+    _activeSink->write(payload, len);
+    if (index + len == total) {
+      AsyncMqttClientInternals::PayloadSink* sink = _activeSink;
+      _activeSink = nullptr;
+      sink->end();
+    }
+    return;
+  }
+#endif
+#if ASYNC_MQTT_RETAINED_CACHE
+  // the new value is in the cache by the time the handler gets the last piece
+  if (index == 0) {
+    _caching = _retainedCache && _retainedCache->matches(topic, strlen(topic));
+    if (_caching) _retainedCache->begin(topic, total);
+  }
+  if (_caching) {
+    _retainedCache->write(payload, len);
+    if (index + len == total) {
+      _caching = false;
+      _retainedCache->end();
+    }
+  }
+#endif
+#if ASYNC_MQTT_MESSAGE_DISPATCH
+  if (_dispatcher.started()) {
+    _dispatcher.dispatch(topic, payload, properties, len, index, total);
+    return;
+  }
+#endif
+  if (_onMessageUserCallback) _onMessageUserCallback(topic, payload, properties, len, index, total);
+}
+
+#if ASYNC_MQTT_COMPRESSION
+void AsyncMqttClient::_onDecompressed(const char* data, size_t length, size_t index, size_t total, void* context) {
+  DecompressedMessage* message = static_cast<DecompressedMessage*>(context);
+  message->client->_deliverMessage(message->topic, data, *message->properties, length, index, total);
+}
+#endif
 
+void AsyncMqttClient::_onPublish(uint16_t packetId, uint8_t qos) {
   if (qos == 1) {
-    pendingAck.packetType = AsyncMqttClientInternals::PacketType.PUBACK;
-    pendingAck.headerFlag = AsyncMqttClientInternals::HeaderFlag.PUBACK_RESERVED;
-    pendingAck.packetId = packetId;
-    _toSendAcks.push_back(pendingAck);
+    _queueAck(AsyncMqttClientInternals::PacketType.PUBACK, AsyncMqttClientInternals::HeaderFlag.PUBACK_RESERVED, packetId);
   } else if (qos == 2) {
-    pendingAck.packetType = AsyncMqttClientInternals::PacketType.PUBREC;
-    pendingAck.headerFlag = AsyncMqttClientInternals::HeaderFlag.PUBREC_RESERVED;
-    pendingAck.packetId = packetId;
-    _toSendAcks.push_back(pendingAck);
+    _queueAck(AsyncMqttClientInternals::PacketType.PUBREC, AsyncMqttClientInternals::HeaderFlag.PUBREC_RESERVED, packetId);
 
     bool pubRelAwaiting = false;
     for (AsyncMqttClientInternals::PendingPubRel pendingPubRel : _pendingPubRels) {
@@ -581,10 +1287,11 @@ void AsyncMqttClient::_onPublish(uint16_t packetId, uint8_t qos) {
       }
     }
 
+    // past the in-flight window of a fixed storage, a duplicate of this message would be delivered again
     if (!pubRelAwaiting) {
       AsyncMqttClientInternals::PendingPubRel pendingPubRel;
       pendingPubRel.packetId = packetId;
-      _pendingPubRels.push_back(pendingPubRel);
+      _pendingPubRels.push(pendingPubRel);
     }
 
     _sendAcks();
@@ -596,16 +1303,11 @@ void AsyncMqttClient::_onPublish(uint16_t packetId, uint8_t qos) {
 void AsyncMqttClient::_onPubRel(uint16_t packetId) {
   _freeCurrentParsedPacket();
 
-  AsyncMqttClientInternals::PendingAck pendingAck;
-  pendingAck.packetType = AsyncMqttClientInternals::PacketType.PUBCOMP;
-  pendingAck.headerFlag = AsyncMqttClientInternals::HeaderFlag.PUBCOMP_RESERVED;
-  pendingAck.packetId = packetId;
-  _toSendAcks.push_back(pendingAck);
+  _queueAck(AsyncMqttClientInternals::PacketType.PUBCOMP, AsyncMqttClientInternals::HeaderFlag.PUBCOMP_RESERVED, packetId);
 
   for (size_t i = 0; i < _pendingPubRels.size(); i++) {
     if (_pendingPubRels[i].packetId == packetId) {
-      _pendingPubRels.erase(_pendingPubRels.begin() + i);
-      _pendingPubRels.shrink_to_fit();
+      _pendingPubRels.erase(i);
     }
   }
 
@@ -615,23 +1317,35 @@ void AsyncMqttClient::_onPubRel(uint16_t packetId) {
 void AsyncMqttClient::_onPubAck(uint16_t packetId) {
   _freeCurrentParsedPacket();
 
+  if (_rttProbePacketId != 0 && packetId == _rttProbePacketId) {
+    _rtt.sample(_timerWheel->now() - _rttProbeTime);
+#if ASYNC_MQTT_RATE_CONTROL
+    if (_rateControl.enabled()) _rateControl.rttSample(_timerWheel->now() - _rttProbeTime, _timerWheel->now());
+#endif
+    _rttProbePacketId = 0;
+    _rttProbeOverdue = false;
+    _timerWheel->cancel(&_ackWatchdogTimer);
+  }
+#if ASYNC_MQTT_LATENCY
+  _latency.completed(AsyncMqttClientInternals::LatencyKind::PUBLISH, packetId, _timerWheel->now());
+#endif
+
   if (_onPublishUserCallback) _onPublishUserCallback(packetId);
 }
 
 void AsyncMqttClient::_onPubRec(uint16_t packetId) {
   _freeCurrentParsedPacket();
 
-  AsyncMqttClientInternals::PendingAck pendingAck;
-  pendingAck.packetType = AsyncMqttClientInternals::PacketType.PUBREL;
-  pendingAck.headerFlag = AsyncMqttClientInternals::HeaderFlag.PUBREL_RESERVED;
-  pendingAck.packetId = packetId;
-  _toSendAcks.push_back(pendingAck);
+  _queueAck(AsyncMqttClientInternals::PacketType.PUBREL, AsyncMqttClientInternals::HeaderFlag.PUBREL_RESERVED, packetId);
 
   _sendAcks();
 }
 
 void AsyncMqttClient::_onPubComp(uint16_t packetId) {
   _freeCurrentParsedPacket();
+#if ASYNC_MQTT_LATENCY
+  _latency.completed(AsyncMqttClientInternals::LatencyKind::PUBLISH, packetId, _timerWheel->now());
+#endif
 
   if (_onPublishUserCallback) _onPublishUserCallback(packetId);
 }
@@ -639,31 +1353,53 @@ void AsyncMqttClient::_onPubComp(uint16_t packetId) {
 bool AsyncMqttClient::_sendPing() {
   char fixedHeader[2];
   size_t neededSpace = sizeof(fixedHeader);
-  if (_client.space() < neededSpace) return false;
+  if (_transport->space() < neededSpace) return false;
 
   fixedHeader[0] = AsyncMqttClientInternals::PacketType.PINGREQ;
   fixedHeader[0] = fixedHeader[0] << 4;
   fixedHeader[0] = fixedHeader[0] | AsyncMqttClientInternals::HeaderFlag.PINGREQ_RESERVED;
   fixedHeader[1] = 0;
 
-  _client.add(fixedHeader, sizeof(fixedHeader));
-  _client.send();
+  _transport->add(fixedHeader, sizeof(fixedHeader));
+  _transport->send();
 
-  _lastClientActivity = millis();
-  _lastPingRequestTime = millis();
+  _lastClientActivity = _timerWheel->now();
+  _lastPingRequestTime = _lastClientActivity;
+  _metrics.pingSent();
+  _metrics.packetOut(AsyncMqttClientInternals::PacketType.PINGREQ, neededSpace);
+  _timerWheel->schedule(&_pingTimeoutTimer, _deadLinkTimeout());
 
   return true;
 }
 
+void AsyncMqttClient::_queueAck(uint8_t packetType, uint8_t headerFlag, uint16_t packetId) {
+  AsyncMqttClientInternals::PendingAck pendingAck;
+  pendingAck.packetType = packetType;
+  pendingAck.headerFlag = headerFlag;
+  pendingAck.packetId = packetId;
+
+  // a full fixed queue first sends what the transport takes, past that the ack is lost
+  // and the broker only repeats the exchange on the next connection
+  if (_toSendAcks.full()) _sendAcks();
+  if (_toSendAcks.push(pendingAck)) {
+    _metrics.ackBacklog(_toSendAcks.size());
+  } else {
+    _metrics.ackDropped();
+  }
+}
+
 void AsyncMqttClient::_sendAcks() {
   char fixedHeader[2];
   char packetIdBytes[2];
   uint8_t neededAckSpace = sizeof(fixedHeader) + sizeof(packetIdBytes);
 
-  for (size_t i = 0; i < _toSendAcks.size(); i++) {
-    if (_client.space() < neededAckSpace) break;
+  while (_toSendAcks.size() > 0) {
+    if (_transport->space() < neededAckSpace) {
+      _metrics.ackDeferred();
+      break;
+    }
 
-    AsyncMqttClientInternals::PendingAck pendingAck = _toSendAcks[i];
+    AsyncMqttClientInternals::PendingAck pendingAck = _toSendAcks[0];
 
     fixedHeader[0] = pendingAck.packetType;
     fixedHeader[0] = fixedHeader[0] << 4;
@@ -673,14 +1409,14 @@ void AsyncMqttClient::_sendAcks() {
     packetIdBytes[0] = pendingAck.packetId >> 8;
     packetIdBytes[1] = pendingAck.packetId & 0xFF;
 
-    _client.add(fixedHeader, sizeof(fixedHeader));
-    _client.add(packetIdBytes, sizeof(packetIdBytes));
-    _client.send();
+    _transport->add(fixedHeader, sizeof(fixedHeader));
+    _transport->add(packetIdBytes, sizeof(packetIdBytes));
+    _transport->send();
 
-    _toSendAcks.erase(_toSendAcks.begin() + i);
-    _toSendAcks.shrink_to_fit();
+    _toSendAcks.erase(0);
 
-    _lastClientActivity = millis();
+    _lastClientActivity = _timerWheel->now();
+    _metrics.packetOut(pendingAck.packetType, neededAckSpace);
   }
 }
 
@@ -689,55 +1425,115 @@ bool AsyncMqttClient::_sendDisconnect() {
 
   char fixedHeader[2];
   const uint8_t neededSpace = sizeof(fixedHeader);
-  if (_client.space() < neededSpace) return false;
+  if (_transport->space() < neededSpace) return false;
 
   fixedHeader[0] = AsyncMqttClientInternals::PacketType.DISCONNECT;
   fixedHeader[0] = fixedHeader[0] << 4;
   fixedHeader[0] = fixedHeader[0] | AsyncMqttClientInternals::HeaderFlag.DISCONNECT_RESERVED;
   fixedHeader[1] = 0;
 
-  _client.add(fixedHeader, sizeof(fixedHeader));
-  _client.send();
-  _client.close(true);
+  _transport->add(fixedHeader, sizeof(fixedHeader));
+  _transport->send();
+  _metrics.packetOut(AsyncMqttClientInternals::PacketType.DISCONNECT, neededSpace);
+  _transport->close(true);
 
   _disconnectFlagged = false;
   return true;
 }
 
 uint16_t AsyncMqttClient::_getNextPacketId() {
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+  uint16_t nextPacketId;
+  do {
+    nextPacketId = _nextPacketId.fetch_add(1, std::memory_order_relaxed);
+  } while (nextPacketId == 0);  // 0 is forbidden
+
+  return nextPacketId;
+#else
   uint16_t nextPacketId = _nextPacketId;
 
   if (_nextPacketId == 65535) _nextPacketId = 0;  // 0 is forbidden
   _nextPacketId++;
 
   return nextPacketId;
+#endif
 }
 
 bool AsyncMqttClient::connected() const {
   return _connected;
 }
 
+uint32_t AsyncMqttClient::smoothedRtt() const {
+  return _rtt.smoothed();
+}
+
+uint32_t AsyncMqttClient::rttVariance() const {
+  return _rtt.variance();
+}
+
+#if ASYNC_MQTT_METRICS
+AsyncMqttClientMetrics AsyncMqttClient::metrics() const {
+  return _metrics.snapshot();
+}
+
+void AsyncMqttClient::resetMetrics() {
+  _metrics.reset();
+}
+#endif
+
+#if ASYNC_MQTT_LATENCY
+AsyncMqttClientInternals::LatencyHistogram const &AsyncMqttClient::publishLatency() const {
+  return _latency.publish();
+}
+
+AsyncMqttClientInternals::LatencyHistogram const &AsyncMqttClient::subscribeLatency() const {
+  return _latency.subscribe();
+}
+
+void AsyncMqttClient::resetLatency() {
+  _latency.reset();
+}
+#endif
+
 void AsyncMqttClient::connect() {
   if (_connected) return;
 
-  if (_host.empty()) {
+  // the round trip measured to the previous server says nothing of the path to this one
+  if (_serverChanged) {
+    _rtt.reset();
+    _serverChanged = false;
+  }
+
 #if ASYNC_TCP_SSL_ENABLED
-    _client.connect(_ip, _port, _secure);
-#else
-    _client.connect(_ip, _port);
+  if (_secure) {
+    _sslHandshakeStart = _timerWheel->now();
+    _sslHandshakeDone = false;
+#if ASYNC_TCP_SSL_BEARSSL
+    _sslSetupBuffers();
 #endif
-  } else {
+  }
+#endif
+#if ASYNC_MQTT_SSL_SESSION_RESUMPTION
+  // offer the last session, the broker falls back to a full handshake if it does not know it anymore
+  _transport->setSslSession(_sslSession.data, _sslSession.length);
+  _sslSessionOffered = _sslSession.length != 0;
+#endif
+
 #if ASYNC_TCP_SSL_ENABLED
-    _client.connect(_host.c_str(), _port, _secure);
+  bool secure = _secure;
 #else
-    _client.connect(_host.c_str(), _port);
+  bool secure = false;
 #endif
+  if (_host.empty()) {
+    _transport->connect(_ip, _port, secure);
+  } else {
+    _transport->connect(_host.c_str(), _port, secure);
   }
 }
 
 void AsyncMqttClient::disconnect(bool force) {
   if (force) {
-    _client.close(true);
+    _transport->close(true);
     return;
   }
   if (_connected) {
@@ -748,7 +1544,15 @@ void AsyncMqttClient::disconnect(bool force) {
 
 uint16_t AsyncMqttClient::subscribe(String const &topic, uint8_t qos) {
   if (!_connected) return 0;
+  return _subscribe(topic.begin(), topic.length(), qos, 0);
+}
+
+uint16_t AsyncMqttClient::subscribe(const char* topic, uint8_t qos) {
+  if (!_connected) return 0;
+  return _subscribe(topic, strlen(topic), qos, 0);
+}
 
+uint16_t AsyncMqttClient::_subscribe(const char* topic, uint16_t topicLength, uint8_t qos, uint16_t packetId) {
   char fixedHeader[5];
   fixedHeader[0] = AsyncMqttClientInternals::PacketType.SUBSCRIBE;
   fixedHeader[0] = fixedHeader[0] << 4;
@@ -756,7 +1560,6 @@ uint16_t AsyncMqttClient::subscribe(String const &topic, uint8_t qos) {
 
   char packetIdBytes[2];
 
-  uint16_t topicLength = topic.length();
   char topicLengthBytes[2];
   topicLengthBytes[0] = topicLength >> 8;
   topicLengthBytes[1] = topicLength & 0xFF;
@@ -773,26 +1576,38 @@ uint16_t AsyncMqttClient::subscribe(String const &topic, uint8_t qos) {
   uint8_t headerRemainingLength = AsyncMqttClientInternals::Helpers::encodeRemainingLength(neededSpace, fixedHeader + 1);
 
   neededSpace += 1 + headerRemainingLength;
-  if (_client.space() < neededSpace) return 0;
+  if (_transport->space() < neededSpace) return 0;
 
-  uint16_t packetId = _getNextPacketId();
+  if (packetId == 0) packetId = _getNextPacketId();
   packetIdBytes[0] = packetId >> 8;
   packetIdBytes[1] = packetId & 0xFF;
 
-  _client.add(fixedHeader, 1 + headerRemainingLength);
-  _client.add(packetIdBytes, sizeof(packetIdBytes));
-  _client.add(topicLengthBytes, sizeof(topicLengthBytes));
-  _client.add(topic.begin(), topicLength);
-  _client.add(qosByte, sizeof(qosByte));
-  _client.send();
-  _lastClientActivity = millis();
+  _transport->add(fixedHeader, 1 + headerRemainingLength);
+  _transport->add(packetIdBytes, sizeof(packetIdBytes));
+  _transport->add(topicLengthBytes, sizeof(topicLengthBytes));
+  _transport->add(topic, topicLength);
+  _transport->add(qosByte, sizeof(qosByte));
+  _transport->send();
+  _lastClientActivity = _timerWheel->now();
+  _metrics.packetOut(AsyncMqttClientInternals::PacketType.SUBSCRIBE, neededSpace);
+#if ASYNC_MQTT_LATENCY
+  _latency.sent(AsyncMqttClientInternals::LatencyKind::SUBSCRIBE, packetId, _lastClientActivity);
+#endif
 
   return packetId;
 }
 
 uint16_t AsyncMqttClient::unsubscribe(String const &topic) {
   if (!_connected) return 0;
+  return _unsubscribe(topic.begin(), topic.length(), 0);
+}
+
+uint16_t AsyncMqttClient::unsubscribe(const char* topic) {
+  if (!_connected) return 0;
+  return _unsubscribe(topic, strlen(topic), 0);
+}
 
+uint16_t AsyncMqttClient::_unsubscribe(const char* topic, uint16_t topicLength, uint16_t packetId) {
   char fixedHeader[5];
   fixedHeader[0] = AsyncMqttClientInternals::PacketType.UNSUBSCRIBE;
   fixedHeader[0] = fixedHeader[0] << 4;
@@ -800,7 +1615,6 @@ uint16_t AsyncMqttClient::unsubscribe(String const &topic) {
 
   char packetIdBytes[2];
 
-  uint16_t topicLength = topic.length();
   char topicLengthBytes[2];
   topicLengthBytes[0] = topicLength >> 8;
   topicLengthBytes[1] = topicLength & 0xFF;
@@ -813,25 +1627,143 @@ uint16_t AsyncMqttClient::unsubscribe(String const &topic) {
   uint8_t headerRemainingLength = AsyncMqttClientInternals::Helpers::encodeRemainingLength(neededSpace, fixedHeader + 1);
 
   neededSpace += 1 + headerRemainingLength;
-  if (_client.space() < neededSpace) return 0;
+  if (_transport->space() < neededSpace) return 0;
 
-  uint16_t packetId = _getNextPacketId();
+  if (packetId == 0) packetId = _getNextPacketId();
   packetIdBytes[0] = packetId >> 8;
   packetIdBytes[1] = packetId & 0xFF;
 
-  _client.add(fixedHeader, 1 + headerRemainingLength);
-  _client.add(packetIdBytes, sizeof(packetIdBytes));
-  _client.add(topicLengthBytes, sizeof(topicLengthBytes));
-  _client.add(topic.begin(), topicLength);
-  _client.send();
-  _lastClientActivity = millis();
+  _transport->add(fixedHeader, 1 + headerRemainingLength);
+  _transport->add(packetIdBytes, sizeof(packetIdBytes));
+  _transport->add(topicLengthBytes, sizeof(topicLengthBytes));
+  _transport->add(topic, topicLength);
+  _transport->send();
+  _lastClientActivity = _timerWheel->now();
+  _metrics.packetOut(AsyncMqttClientInternals::PacketType.UNSUBSCRIBE, neededSpace);
+#if ASYNC_MQTT_LATENCY
+  _latency.sent(AsyncMqttClientInternals::LatencyKind::UNSUBSCRIBE, packetId, _lastClientActivity);
+#endif
 
   return packetId;
 }
 
 uint16_t AsyncMqttClient::publish(String const &topic, uint8_t qos, bool retain, String const &payload, bool dup, uint16_t message_id) {
-  if (!_connected) return 0;
+  if (!_connected) {
+    _metrics.publishRejected(AsyncMqttClientPublishRejection::NOT_CONNECTED);
+    return 0;
+  }
+  return _publishOrQueue(topic.begin(), topic.length(), qos, retain, payload.begin(), payload.length(), dup, dup ? message_id : 0);
+}
+
+uint16_t AsyncMqttClient::publish(const char* topic, uint8_t qos, bool retain, const char* payload, size_t length, bool dup, uint16_t message_id) {
+  if (!_connected) {
+    _metrics.publishRejected(AsyncMqttClientPublishRejection::NOT_CONNECTED);
+    return 0;
+  }
+  if (payload && length == 0) length = strlen(payload);
+  return _publishOrQueue(topic, strlen(topic), qos, retain, payload, length, dup, dup ? message_id : 0);
+}
+
+// as _publishOrQueue(), but a message that cannot go out at once is refused: the payload is never held whole to wait
+uint16_t AsyncMqttClient::publishCbor(const char* topic, uint8_t qos, bool retain, AsyncMqttClientInternals::CborPayloadCallback const &payload) {
+  if (!_connected) {
+    _metrics.publishRejected(AsyncMqttClientPublishRejection::NOT_CONNECTED);
+    return 0;
+  }
+  uint16_t topicLength = strlen(topic);
+#if ASYNC_MQTT_COMPRESSION
+  // the encoder takes the whole payload, and a receiver would take this one for compressed
+  if (_compression && _compression->matches(topic, topicLength)) {
+    _metrics.publishRejected(AsyncMqttClientPublishRejection::COMPRESSED_TOPIC);
+    return 0;
+  }
+#endif
+
+  // sized in a first pass, written into the transport or the batch in a second
+  AsyncMqttClientInternals::CborWriter counter;
+  if (payload) payload(counter);
+  size_t payloadLength = counter.size();
+
+#if ASYNC_MQTT_AGGREGATION
+  if (_aggregator.matches(topic, topicLength, qos, retain, payloadLength)) {
+    uint8_t* record = _aggregateRecord(topic, topicLength, qos, payloadLength);
+    if (!record) return 0;
+    AsyncMqttClientInternals::CborWriter writer(record, payloadLength);
+    if (payload) payload(writer);
+    if (!writer.finish()) {
+      _metrics.publishRejected(AsyncMqttClientPublishRejection::PAYLOAD_MISMATCH);
+      return 0;
+    }
+    return 1;
+  }
+#endif
+
+  bool urgent = false;
+#if ASYNC_MQTT_PRIORITY_LANES
+  // never ahead of a message waiting in its lane or above it, nor bulk past the bytes in flight
+  if (_lanes.enabled()) {
+    AsyncMqttClientPriority priority = _lanes.classify(topic, topicLength);
+    size_t space = _transport->space();
+    if (space > _transportCapacity) _transportCapacity = space;
+    if (_lanes.waiting(priority) || (priority == AsyncMqttClientPriority::BULK && _bulkInFlight != 0 &&
+      _transportCapacity - space >= _bulkInFlight)) {
+      _metrics.publishRejected(AsyncMqttClientPublishRejection::NO_SPACE);
+      return 0;
+    }
+    urgent = priority == AsyncMqttClientPriority::HIGH;
+  }
+#endif
+  if (_paced(urgent)) {
+    _metrics.publishRejected(AsyncMqttClientPublishRejection::RATE_LIMITED);
+    return 0;
+  }
+
+  uint16_t packetId = 0;
+  size_t packetLength;
+  if (!_beginPublish(topic, topicLength, qos, retain, payloadLength, false, &packetId, &packetLength)) {
+    _metrics.publishRejected(AsyncMqttClientPublishRejection::NO_SPACE);
+    return 0;
+  }
+  AsyncMqttClientInternals::CborWriter writer(_transport, payloadLength);
+  if (payload) payload(writer);
+  bool complete = writer.finish();
+  packetId = _endPublish(qos, false, packetId, packetLength);
+  if (!complete) {
+    // the packet is out, with another payload than the callback meant
+    _metrics.publishRejected(AsyncMqttClientPublishRejection::PAYLOAD_MISMATCH);
+    return 0;
+  }
+  return packetId;
+}
+
+uint16_t AsyncMqttClient::_publish(const char* topic, uint16_t topicLength, uint8_t qos, bool retain,
+  const char* payload, uint32_t payloadLength, bool dup, uint16_t packetId) {
+#if ASYNC_MQTT_COMPRESSION
+  // sized in a first pass, encoded straight into the transport in a second
+  bool compressed = _compression && payloadLength != 0 && _compression->matches(topic, topicLength);
+  AsyncMqttClientInternals::PayloadEncoder encoder(payload, compressed ? payloadLength : 0);
+  if (compressed) payloadLength = encoder.size();
+#endif
 
+  size_t packetLength;
+  if (!_beginPublish(topic, topicLength, qos, retain, payloadLength, dup, &packetId, &packetLength)) return 0;
+#if ASYNC_MQTT_COMPRESSION
+  if (compressed) {
+    char chunk[64];
+    size_t length;
+    while ((length = encoder.read(chunk, sizeof(chunk))) > 0) _transport->add(chunk, length);
+  } else if (payloadLength != 0) {
+    _transport->add(payload, payloadLength);
+  }
+#else
+  if (payloadLength != 0) _transport->add(payload, payloadLength);
+#endif
+  return _endPublish(qos, dup, packetId, packetLength);
+}
+
+// the fixed header, topic and packet identifier of a PUBLISH, the payload is for the caller to add
+bool AsyncMqttClient::_beginPublish(const char* topic, uint16_t topicLength, uint8_t qos, bool retain, size_t payloadLength, bool dup,
+  uint16_t* packetId, size_t* packetLength) {
   char fixedHeader[5];
   fixedHeader[0] = AsyncMqttClientInternals::PacketType.PUBLISH;
   fixedHeader[0] = fixedHeader[0] << 4;
@@ -849,7 +1781,6 @@ uint16_t AsyncMqttClient::publish(String const &topic, uint8_t qos, bool retain,
       break;
   }
 
-  uint16_t topicLength = topic.length();
   char topicLengthBytes[2];
   topicLengthBytes[0] = topicLength >> 8;
   topicLengthBytes[1] = topicLength & 0xFF;
@@ -860,37 +1791,295 @@ uint16_t AsyncMqttClient::publish(String const &topic, uint8_t qos, bool retain,
   neededSpace += sizeof(topicLengthBytes);
   neededSpace += topicLength;
   if (qos != 0) neededSpace += sizeof(packetIdBytes);
-  uint32_t payloadLength = payload.length();
   neededSpace += payloadLength;
 
   uint8_t headerRemainingLength = AsyncMqttClientInternals::Helpers::encodeRemainingLength(neededSpace, fixedHeader + 1);
 
   neededSpace += 1 + headerRemainingLength;
-  if (_client.space() < neededSpace) return 0;
+  if (_transport->space() < neededSpace) {
+#if ASYNC_MQTT_RATE_CONTROL
+    if (_rateControl.enabled()) _rateControl.full(_timerWheel->now());
+#endif
+    return false;
+  }
+
+  // a retransmission or a submission comes with its identifier
+  if (qos == 0) {
+    *packetId = 0;
+  } else {
+    if (*packetId == 0) *packetId = _getNextPacketId();
+
+    packetIdBytes[0] = *packetId >> 8;
+    packetIdBytes[1] = *packetId & 0xFF;
+  }
+
+  _transport->add(fixedHeader, 1 + headerRemainingLength);
+  _transport->add(topicLengthBytes, sizeof(topicLengthBytes));
+  _transport->add(topic, topicLength);
+  if (qos != 0) _transport->add(packetIdBytes, sizeof(packetIdBytes));
+  *packetLength = neededSpace;
+  return true;
+}
+
+uint16_t AsyncMqttClient::_endPublish(uint8_t qos, bool dup, uint16_t packetId, size_t packetLength) {
+  _transport->send();
+  _lastClientActivity = _timerWheel->now();
+  _metrics.packetOut(AsyncMqttClientInternals::PacketType.PUBLISH, packetLength);
+#if ASYNC_MQTT_RATE_CONTROL
+  if (_rateControl.enabled()) _rateControl.sent(packetLength);
+#endif
+
+  // time one QoS 1 exchange at a time, never a retransmission (Karn's algorithm)
+  if (qos == 1 && !dup && _rttProbePacketId == 0) {
+    _rttProbePacketId = packetId;
+    _rttProbeTime = _lastClientActivity;
+    _rttProbeOverdue = false;
+    if (_keepAlive != 0) _timerWheel->schedule(&_ackWatchdogTimer, _deadLinkTimeout());
+  }
+
+#if ASYNC_MQTT_LATENCY
+  // a retransmission leaves the round trip ambiguous, as for the RTT
+  if (dup) {
+    _latency.forget(packetId);
+  } else if (qos != 0) {
+    _latency.sent(AsyncMqttClientInternals::LatencyKind::PUBLISH, packetId, _lastClientActivity);
+  }
+#endif
 
-  uint16_t packetId = 0;
   if (qos != 0) {
-    if (dup && message_id > 0) {
-      packetId = message_id;
+    return packetId;
+  } else {
+    return 1;
+  }
+}
+
+// whether the rate controller holds a publish back; an urgent one goes all the same, and counts
+bool AsyncMqttClient::_paced(bool urgent) {
+#if ASYNC_MQTT_RATE_CONTROL
+  return _rateControl.enabled() && !urgent && !_rateControl.permits(_timerWheel->now());
+#else
+  (void)urgent;
+  return false;
+#endif
+}
+
+// with priority lanes, a message goes straight to the transport only when nothing waits in its lane or above it
+// and the rate permits, else it waits in its lane; bulk always goes through its lane, held back by the bytes in flight
+uint16_t AsyncMqttClient::_publishOrQueue(const char* topic, uint16_t topicLength, uint8_t qos, bool retain,
+  const char* payload, uint32_t payloadLength, bool dup, uint16_t packetId) {
+#if ASYNC_MQTT_AGGREGATION
+  if (!dup && _aggregator.matches(topic, topicLength, qos, retain, payloadLength)) {
+    return _aggregate(topic, topicLength, qos, payload, payloadLength);
+  }
+#endif
+#if ASYNC_MQTT_PRIORITY_LANES
+  // a retransmission keeps its identifier and goes straight out
+  if (_lanes.enabled() && !dup) {
+    AsyncMqttClientPriority priority = _lanes.classify(topic, topicLength);
+    if (priority != AsyncMqttClientPriority::BULK && !_lanes.waiting(priority) && !_paced(priority == AsyncMqttClientPriority::HIGH)) {
+      packetId = _publish(topic, topicLength, qos, retain, payload, payloadLength, false, 0);
+      if (packetId != 0) return packetId;
+    }
+    if (qos != 0) packetId = _getNextPacketId();
+    if (!_lanes.push(priority, qos, retain, packetId, topic, topicLength, payload, payloadLength)) {
+      _metrics.publishRejected(AsyncMqttClientPublishRejection::NO_SPACE);
+      return 0;
+    }
+    _drainLanes();
+
+    if (packetId != 0) {
+      return packetId;
+    } else {
+      return 1;
+    }
+  }
+#endif
+
+  // a retransmission is never held back
+  if (_paced(dup)) {
+    _metrics.publishRejected(AsyncMqttClientPublishRejection::RATE_LIMITED);
+    return 0;
+  }
+  packetId = _publish(topic, topicLength, qos, retain, payload, payloadLength, dup, packetId);
+  if (packetId == 0) _metrics.publishRejected(AsyncMqttClientPublishRejection::NO_SPACE);
+  return packetId;
+}
+
+#if ASYNC_MQTT_PRIORITY_LANES
+void AsyncMqttClient::_drainLanes() {
+  if (!_connected) return;
+  size_t space = _transport->space();
+  if (space > _transportCapacity) _transportCapacity = space;
+
+  // a keepalive ping left waiting goes first
+  if (_pingDeferred) {
+    if (_pingTimeoutTimer.armed()) {
+      _pingDeferred = false;
+    } else if (_sendPing()) {
+      _pingDeferred = false;
     } else {
-      packetId = _getNextPacketId();
+      return;
     }
+  }
 
-    packetIdBytes[0] = packetId >> 8;
-    packetIdBytes[1] = packetId & 0xFF;
+  // lane by lane, until the transport is full: a lane below waits as long as one above does
+  for (uint8_t lane = 0; lane < AsyncMqttClientInternals::PRIORITY_LANES; lane++) {
+    AsyncMqttClientPriority priority = static_cast<AsyncMqttClientPriority>(lane);
+    AsyncMqttClientInternals::LaneEntry* entry;
+    while ((entry = _lanes.front(priority)) != nullptr) {
+      if (_paced(priority == AsyncMqttClientPriority::HIGH)) return;
+      // what a message of a lane above may have to wait behind: the bytes held by the transport, then one bulk message
+      if (priority == AsyncMqttClientPriority::BULK && _bulkInFlight != 0 &&
+        _transportCapacity - _transport->space() >= _bulkInFlight) return;
+      // always whole, with the identifier publish() returned
+      if (_publish(entry->topic(), entry->topicLength, entry->qos, entry->retain, entry->payload(), entry->payloadLength, false, entry->packetId) == 0) {
+        // not even into an empty transport: it never will, the lanes below are not held up for it
+        if (_transport->space() < _transportCapacity) return;
+        _lanes.drop(priority);
+        continue;
+      }
+      _lanes.pop(priority);
+    }
   }
+}
+#endif
 
-  _client.add(fixedHeader, 1 + headerRemainingLength);
-  _client.add(topicLengthBytes, sizeof(topicLengthBytes));
-  _client.add(topic.begin(), topicLength);
-  if (qos != 0) _client.add(packetIdBytes, sizeof(packetIdBytes));
-  if (!payload.empty()) _client.add(payload.begin(), payloadLength);
-  _client.send();
-  _lastClientActivity = millis();
+#if ASYNC_MQTT_AGGREGATION
+uint16_t AsyncMqttClient::flushAggregation() {
+  return _flushAggregate(AsyncMqttClientInternals::BatchTrigger::FLUSH);
+}
 
-  if (qos != 0) {
+// a gathered publish returns 1 whatever its QoS, which is no packet identifier: the batch that carries it has one of its
+// own, given to onBatchSent()
+uint16_t AsyncMqttClient::_aggregate(const char* topic, uint16_t topicLength, uint8_t qos, const char* payload, uint32_t payloadLength) {
+  uint8_t* record = _aggregateRecord(topic, topicLength, qos, payloadLength);
+  if (!record) return 0;
+  if (payloadLength != 0) memcpy(record, payload, payloadLength);
+  return 1;
+}
+
+// room for the payload of a record in the batch, for the caller to write
+uint8_t* AsyncMqttClient::_aggregateRecord(const char* topic, uint16_t topicLength, uint8_t qos, uint32_t payloadLength) {
+  uint32_t now = _timerWheel->now();
+  uint8_t* record = _aggregator.reserve(topic, topicLength, qos, payloadLength, now);
+  if (!record) {
+    // the batch is full: it goes first, the record starts the next one
+    if (_flushAggregate(AsyncMqttClientInternals::BatchTrigger::BUDGET) == 0 ||
+      (record = _aggregator.reserve(topic, topicLength, qos, payloadLength, now)) == nullptr) {
+      _metrics.publishRejected(AsyncMqttClientPublishRejection::NO_SPACE);
+      return nullptr;
+    }
+  }
+  if (!_aggregationTimer.armed()) _timerWheel->schedule(&_aggregationTimer, _aggregator.remaining(now));
+  return record;
+}
+
+// with lanes, the batch waits in the lane of its topic; without, it stays gathered until the transport takes it
+uint16_t AsyncMqttClient::_flushAggregate(AsyncMqttClientInternals::BatchTrigger trigger) {
+  if (!_connected || _aggregator.empty()) return 0;
+  size_t length;
+  const char* payload = _aggregator.payload(_timerWheel->now(), &length);
+  bool lanes = false;
+#if ASYNC_MQTT_PRIORITY_LANES
+  lanes = _lanes.enabled();
+#endif
+  uint16_t packetId = 0;
+  if (lanes) {
+    packetId = _publishOrQueue(_aggregator.topic(), _aggregator.topicLength(), _aggregator.qos(), false, payload, length, false, 0);
+  } else if (!_paced(false)) {
+    packetId = _publish(_aggregator.topic(), _aggregator.topicLength(), _aggregator.qos(), false, payload, length, false, 0);
+  }
+  if (packetId == 0) return 0;
+  uint16_t batchId = _aggregator.qos() != 0 ? packetId : 0;
+  uint32_t records = _aggregator.stats().pending;
+  _aggregator.sent(batchId, trigger);
+  _timerWheel->cancel(&_aggregationTimer);
+  if (_onBatchSentUserCallback) _onBatchSentUserCallback(batchId, records);
+  return packetId;
+}
+
+void AsyncMqttClient::_onAggregationTimer() {
+  // no room in the transport: tried again as acks come in
+  _flushAggregate(AsyncMqttClientInternals::BatchTrigger::WINDOW);
+}
+#endif
+
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+AsyncMqttClient& AsyncMqttClient::setSubmissionQueue(uint16_t depth, uint16_t entrySize) {
+  _submissions.allocate(depth, entrySize);
+  return *this;
+}
+
+uint16_t AsyncMqttClient::submitSubscribe(String const &topic, uint8_t qos) {
+  return _submit(AsyncMqttClientInternals::SubmissionType::SUBSCRIBE, qos, false, topic, String::EMPTY);
+}
+
+uint16_t AsyncMqttClient::submitUnsubscribe(String const &topic) {
+  return _submit(AsyncMqttClientInternals::SubmissionType::UNSUBSCRIBE, 0, false, topic, String::EMPTY);
+}
+
+uint16_t AsyncMqttClient::submitPublish(String const &topic, uint8_t qos, bool retain, String const &payload) {
+  return _submit(AsyncMqttClientInternals::SubmissionType::PUBLISH, qos, retain, topic, payload);
+}
+
+AsyncMqttClient& AsyncMqttClient::onSubmissionFailed(AsyncMqttClientInternals::OnSubmissionFailedUserCallback const &callback) {
+  _onSubmissionFailedUserCallback = callback;
+  return *this;
+}
+
+uint16_t AsyncMqttClient::_submit(AsyncMqttClientInternals::SubmissionType type, uint8_t qos, bool retain, String const &topic, String const &payload) {
+  // any task: only the queue and the packet identifier are touched here, the network task does the rest
+  bool isPublish = type == AsyncMqttClientInternals::SubmissionType::PUBLISH;
+  if (!_submissionsOpen.load(std::memory_order_acquire)) {
+    if (isPublish) _metrics.submissionRejected(AsyncMqttClientPublishRejection::QUEUE_CLOSED);
+    return 0;
+  }
+
+  uint16_t packetId = 0;
+  if (!isPublish || qos != 0) packetId = _getNextPacketId();
+  if (!_submissions.push(type, qos, retain, packetId, topic.begin(), topic.length(), payload.begin(), payload.length())) {
+    if (isPublish) _metrics.submissionRejected(AsyncMqttClientPublishRejection::QUEUE_FULL);
+    return 0;
+  }
+  _transport->wake();
+
+  if (packetId != 0) {
     return packetId;
   } else {
     return 1;
   }
 }
+
+void AsyncMqttClient::_drainSubmissions() {
+  // in submission order, until the transport is full
+  AsyncMqttClientInternals::Submission* submission;
+  while (_connected && (submission = _submissions.front()) != nullptr) {
+    uint16_t packetId = 0;
+    switch (submission->type) {
+      case AsyncMqttClientInternals::SubmissionType::PUBLISH:
+        if (_paced(false)) return;
+        packetId = _publish(submission->topic(), submission->topicLength, submission->qos, submission->retain,
+          submission->payload(), submission->payloadLength, false, submission->packetId);
+        break;
+      case AsyncMqttClientInternals::SubmissionType::SUBSCRIBE:
+        packetId = _subscribe(submission->topic(), submission->topicLength, submission->qos, submission->packetId);
+        break;
+      case AsyncMqttClientInternals::SubmissionType::UNSUBSCRIBE:
+        packetId = _unsubscribe(submission->topic(), submission->topicLength, submission->packetId);
+        break;
+    }
+    if (packetId == 0) return;
+    _submissions.pop();
+  }
+}
+
+void AsyncMqttClient::_failSubmissions() {
+  // never sent: the ones that would have completed through a callback complete with a failure, in submission order
+  AsyncMqttClientInternals::Submission* submission;
+  while ((submission = _submissions.front()) != nullptr) {
+    uint16_t packetId = submission->packetId;
+    _submissions.pop();
+    if (packetId != 0 && _onSubmissionFailedUserCallback) _onSubmissionFailedUserCallback(packetId);
+  }
+}
+#endif
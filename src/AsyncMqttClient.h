@@ -2,5 +2,7 @@
 #define SRC_ASYNCMQTTCLIENT_H_
 
 #include "AsyncMqttClient.hpp"
+#include "AsyncMqttClientManager.hpp"
+#include "AsyncMqttClientStatic.hpp"
 
 #endif  // SRC_ASYNCMQTTCLIENT_H_
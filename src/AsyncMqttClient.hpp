@@ -9,7 +9,7 @@
 #include <AsyncTCP.h>
 #elif defined(ESP8266)
 #include <ESPAsyncTCP.h>
-#else
+#elif !defined(__linux__)
 #error Platform not supported
 #endif
 
@@ -34,7 +34,37 @@
 #include "AsyncMqttClient/Helpers.hpp"
 #include "AsyncMqttClient/Callbacks.hpp"
 #include "AsyncMqttClient/DisconnectReasons.hpp"
+#include "AsyncMqttClient/Memory.hpp"
+#include "AsyncMqttClient/MemoryPool.hpp"
 #include "AsyncMqttClient/Storage.hpp"
+#include "AsyncMqttClient/BoundedString.hpp"
+#include "AsyncMqttClient/TimerWheel.hpp"
+#include "AsyncMqttClient/RttEstimator.hpp"
+#include "AsyncMqttClient/SubmissionQueue.hpp"
+#include "AsyncMqttClient/MessageDispatcher.hpp"
+#include "AsyncMqttClient/Metrics.hpp"
+#include "AsyncMqttClient/LatencyHistogram.hpp"
+#include "AsyncMqttClient/FrameCapture.hpp"
+#include "AsyncMqttClient/TopicFilter.hpp"
+#include "AsyncMqttClient/Compression.hpp"
+#include "AsyncMqttClient/CborWriter.hpp"
+#include "AsyncMqttClient/Integrity.hpp"
+#include "AsyncMqttClient/PayloadSink.hpp"
+#include "AsyncMqttClient/RetainedCache.hpp"
+#include "AsyncMqttClient/DuplicateFilter.hpp"
+#include "AsyncMqttClient/PriorityLanes.hpp"
+#include "AsyncMqttClient/RateController.hpp"
+#include "AsyncMqttClient/Aggregator.hpp"
+#include "AsyncMqttClient/SslSession.hpp"
+#include "AsyncMqttClient/Transport.hpp"
+#include "AsyncMqttClient/Transports/AsyncTcpTransport.hpp"
+#include "AsyncMqttClient/Transports/PosixTcpTransport.hpp"
+#include "AsyncMqttClient/Transports/EpollLoop.hpp"
+#include "AsyncMqttClient/Transports/LoopbackTransport.hpp"
+#include "AsyncMqttClient/Transports/CaptureTransport.hpp"
+#include "AsyncMqttClient/Transports/DefaultTransport.hpp"
+#include "AsyncMqttClient/Sinks/FileSinkStorage.hpp"
+#include "AsyncMqttClient/Sinks/UpdateSinkStorage.hpp"
 
 #include "AsyncMqttClient/Packets/Packet.hpp"
 #include "AsyncMqttClient/Packets/ConnAckPacket.hpp"
@@ -46,10 +76,26 @@
 #include "AsyncMqttClient/Packets/PubAckPacket.hpp"
 #include "AsyncMqttClient/Packets/PubRecPacket.hpp"
 #include "AsyncMqttClient/Packets/PubCompPacket.hpp"
+#include "AsyncMqttClient/StaticStorage.hpp"
+
+// Without an answer for this many RTOs, the link is considered dead
+#ifndef ASYNC_MQTT_DEAD_LINK_RTO_MULTIPLIER
+#define ASYNC_MQTT_DEAD_LINK_RTO_MULTIPLIER 4
+#endif
+
+// Lower bound of the RTT based dead link timeout, in milliseconds
+#ifndef ASYNC_MQTT_MIN_DEAD_LINK_TIMEOUT
+#define ASYNC_MQTT_MIN_DEAD_LINK_TIMEOUT 2000
+#endif
+
+class AsyncMqttClientManager;
+
+class AsyncMqttClient : private AsyncMqttClientInternals::TransportListener {
+  friend class AsyncMqttClientManager;
 
-class AsyncMqttClient {
  public:
   AsyncMqttClient();
+  explicit AsyncMqttClient(AsyncMqttClientInternals::Transport* transport);
   ~AsyncMqttClient();
 
   AsyncMqttClient& setKeepAlive(uint16_t keepAlive);
@@ -60,6 +106,32 @@ class AsyncMqttClient {
   AsyncMqttClient& setWill(String const &topic, uint8_t qos, bool retain, String const &payload = String::EMPTY);
   AsyncMqttClient& setServer(IPAddress ip, uint16_t port);
   AsyncMqttClient& setServer(String const &host, uint16_t port);
+  AsyncMqttClient& setClock(AsyncMqttClientInternals::ClockFunction clock);
+#if ASYNC_MQTT_COMPRESSION
+  AsyncMqttClient& addCompressedTopics(const char* filter);
+#endif
+#if ASYNC_MQTT_PAYLOAD_SINKS
+  AsyncMqttClient& addPayloadSink(const char* filter, AsyncMqttClientInternals::PayloadSink* sink);
+#endif
+#if ASYNC_MQTT_RETAINED_CACHE
+  AsyncMqttClient& setRetainedCache(AsyncMqttClientInternals::RetainedCache* cache);
+#endif
+#if ASYNC_MQTT_DUPLICATE_FILTER
+  AsyncMqttClient& setDuplicateFilter(uint16_t entries, uint32_t window);
+#endif
+#if ASYNC_MQTT_PRIORITY_LANES
+  AsyncMqttClient& setPriorityLanes(size_t high, size_t normal, size_t bulk);
+  AsyncMqttClient& addTopicPriority(const char* filter, AsyncMqttClientPriority priority);
+  AsyncMqttClient& setBulkInFlight(size_t inFlight);
+#endif
+#if ASYNC_MQTT_RATE_CONTROL
+  AsyncMqttClient& setRateControl(uint32_t minimum, uint32_t maximum, uint32_t targetDelay = ASYNC_MQTT_RATE_TARGET_DELAY);
+#endif
+#if ASYNC_MQTT_AGGREGATION
+  AsyncMqttClient& setAggregation(const char* topic, size_t budget, uint32_t window);
+  AsyncMqttClient& addAggregatedTopics(const char* filter);
+  AsyncMqttClient& onBatchSent(AsyncMqttClientInternals::OnBatchSentUserCallback const &callback);
+#endif
 #if ASYNC_TCP_SSL_ENABLED
   AsyncMqttClient& setSecure(bool secure);
 #if ASYNC_TCP_SSL_AXTLS && SSL_VERIFY_BY_FINGERPRINT
@@ -68,6 +140,9 @@ class AsyncMqttClient {
 #if ASYNC_TCP_SSL_BEARSSL
   AsyncMqttClient& onSSLCertLookup(AsyncMqttClientInternals::OnSSLCertLookupCallback const &callback);
 #endif
+#endif
+#if ASYNC_TCP_SSL_ENABLED || ASYNC_MQTT_SSL_SESSION_RESUMPTION
+  AsyncMqttClientSslStats const &sslStats() const;
 #endif
 
   AsyncMqttClient& onConnect(AsyncMqttClientInternals::OnConnectUserCallback const &callback);
@@ -76,53 +151,144 @@ class AsyncMqttClient {
   AsyncMqttClient& onUnsubscribe(AsyncMqttClientInternals::OnUnsubscribeUserCallback const &callback);
   AsyncMqttClient& onMessage(AsyncMqttClientInternals::OnMessageUserCallback const &callback);
   AsyncMqttClient& onPublish(AsyncMqttClientInternals::OnPublishUserCallback const &callback);
+#if ASYNC_MQTT_MESSAGE_DISPATCH
+  AsyncMqttClient& setMessageDispatch(uint8_t workers, uint16_t depth);
+  AsyncMqttClientDispatchStats dispatchStats() const;
+#endif
+#if ASYNC_MQTT_PRIORITY_LANES
+  AsyncMqttClientLaneStats laneStats(AsyncMqttClientPriority priority) const;
+#endif
+#if ASYNC_MQTT_RATE_CONTROL
+  uint32_t permittedRate() const;
+  AsyncMqttClientRateStats rateStats() const;
+#endif
+#if ASYNC_MQTT_AGGREGATION
+  AsyncMqttClientAggregationStats aggregationStats() const;
+#endif
 
   bool connected() const;
+  uint32_t smoothedRtt() const;
+  uint32_t rttVariance() const;
+#if ASYNC_MQTT_METRICS
+  AsyncMqttClientMetrics metrics() const;
+  void resetMetrics();
+#endif
+#if ASYNC_MQTT_LATENCY
+  AsyncMqttClientInternals::LatencyHistogram const &publishLatency() const;
+  AsyncMqttClientInternals::LatencyHistogram const &subscribeLatency() const;
+  void resetLatency();
+#endif
   void connect();
   void disconnect(bool force = false);
   uint16_t subscribe(String const &topic, uint8_t qos);
+  uint16_t subscribe(const char* topic, uint8_t qos);
   uint16_t unsubscribe(String const &topic);
+  uint16_t unsubscribe(const char* topic);
   uint16_t publish(String const &topic, uint8_t qos, bool retain, String const &payload = String::EMPTY,
     bool dup = false, uint16_t message_id = 0);
+  uint16_t publish(const char* topic, uint8_t qos, bool retain, const char* payload = nullptr, size_t length = 0,
+    bool dup = false, uint16_t message_id = 0);
+  uint16_t publishCbor(const char* topic, uint8_t qos, bool retain, AsyncMqttClientInternals::CborPayloadCallback const &payload);
+#if ASYNC_MQTT_AGGREGATION
+  uint16_t flushAggregation();
+#endif
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+  AsyncMqttClient& setSubmissionQueue(uint16_t depth, uint16_t entrySize);
+  uint16_t submitSubscribe(String const &topic, uint8_t qos);
+  uint16_t submitUnsubscribe(String const &topic);
+  uint16_t submitPublish(String const &topic, uint8_t qos, bool retain, String const &payload = String::EMPTY);
+  AsyncMqttClient& onSubmissionFailed(AsyncMqttClientInternals::OnSubmissionFailedUserCallback const &callback);
+#endif
+
+  // Hooks of every allocation of every client, see docs
+  static bool setAllocator(AsyncMqttClientAllocator const &allocator);
+  static AsyncMqttClientMemoryStats memoryStats(AsyncMqttClientMemoryTag tag);
+
+ protected:
+  // AsyncMqttClientT, the storage outlives the client
+  AsyncMqttClient(AsyncMqttClientInternals::Transport* transport, AsyncMqttClientInternals::ClientStorage const &storage);
 
  private:
-  AsyncClient _client;
+  // only for a client constructed without a transport
+  AsyncMqttClientInternals::DefaultTransport* _defaultTransport;
+  AsyncMqttClientInternals::Transport* _transport;
+  AsyncMqttClientManager* _manager;
+  // set for an AsyncMqttClientT, nothing is allocated then
+  bool _fixedStorage;
+  uint16_t _fixedMaxTopicLength;
+  uint8_t _keepAlivePhase;
 
   bool _connected;
   bool _connectPacketNotEnoughSpace;
+  bool _outOfMemory;
   bool _disconnectFlagged;
   uint32_t _lastClientActivity;
   uint32_t _lastServerActivity;
   uint32_t _lastPingRequestTime;
 
+  AsyncMqttClientInternals::TimerWheel* _timerWheel;
+  AsyncMqttClientInternals::Timer _keepAliveTimer;
+  AsyncMqttClientInternals::Timer _pingTimeoutTimer;
+  AsyncMqttClientInternals::Timer _ackWatchdogTimer;
+
+  AsyncMqttClientInternals::RttEstimator _rtt;
+  AsyncMqttClientInternals::Metrics _metrics;
+#if ASYNC_MQTT_LATENCY
+  AsyncMqttClientInternals::LatencyTracker _latency;
+#endif
+  uint16_t _rttProbePacketId;
+  uint32_t _rttProbeTime;
+  bool _rttProbeOverdue;  // the watchdog found its ack overdue
+
   IPAddress _ip;
-  String _host;
+  AsyncMqttClientInternals::BoundedString _host;
 #if ASYNC_TCP_SSL_ENABLED
   bool _secure;
 #if ASYNC_TCP_SSL_AXTLS && SSL_VERIFY_BY_FINGERPRINT
   bool _tlsVerifyFailed;
 #endif
+  uint32_t _sslHandshakeStart;
+  bool _sslHandshakeDone;
+#if ASYNC_TCP_SSL_BEARSSL
+  AsyncMqttClientInternals::SslFragmentSupport _sslFragmentSupport;
+  uint32_t _sslFreeHeapBefore;
+#endif
+#endif
+#if ASYNC_MQTT_SSL_SESSION_RESUMPTION
+  AsyncMqttClientInternals::SslSession _sslSession;
+  bool _sslSessionOffered;
+#endif
+#if ASYNC_TCP_SSL_ENABLED || ASYNC_MQTT_SSL_SESSION_RESUMPTION
+  AsyncMqttClientSslStats _sslStats;
 #endif
   uint16_t _port;
+  bool _serverChanged;
   uint16_t _keepAlive;
   bool _cleanSession;
-  String _clientId;
-  String _username;
-  String _password;
-  String _willTopic;
-  String _willPayload;
+  AsyncMqttClientInternals::BoundedString _clientId;
+  AsyncMqttClientInternals::BoundedString _username;
+  AsyncMqttClientInternals::BoundedString _password;
+  AsyncMqttClientInternals::BoundedString _willTopic;
+  AsyncMqttClientInternals::BoundedString _willPayload;
   uint8_t _willQos;
   bool _willRetain;
 
 #if ASYNC_TCP_SSL_ENABLED
 #if ASYNC_TCP_SSL_AXTLS && SSL_VERIFY_BY_FINGERPRINT
-  std::vector<std::array<uint8_t, SHA1_SIZE>> _secureServerFingerprints;
+  std::vector<std::array<uint8_t, SHA1_SIZE>, AsyncMqttClientInternals::TaggedAllocator<std::array<uint8_t, SHA1_SIZE>, AsyncMqttClientMemoryTag::TLS>> _secureServerFingerprints;
 #endif
 #if ASYNC_TCP_SSL_BEARSSL
   AsyncMqttClientInternals::OnSSLCertLookupCallback _onSSLCertLookupCallback;
   int _onSSLCertLookup(AsyncClient* client, void *dn_hash, size_t dn_hash_len, uint8_t **buf);
+  uint16_t _sslFragmentLength() const;
+  void _sslSetupBuffers();
+  void _sslUpdateFragmentSupport(bool handshakeDone);
+#endif
 #endif
+#if ASYNC_MQTT_SSL_SESSION_RESUMPTION
+  void _sslKeepSession();
 #endif
+  void _onServerChanged();
 
   AsyncMqttClientInternals::OnConnectUserCallback _onConnectUserCallback;
   AsyncMqttClientInternals::OnDisconnectUserCallback _onDisconnectUserCallback;
@@ -130,28 +296,83 @@ class AsyncMqttClient {
   AsyncMqttClientInternals::OnUnsubscribeUserCallback _onUnsubscribeUserCallback;
   AsyncMqttClientInternals::OnMessageUserCallback _onMessageUserCallback;
   AsyncMqttClientInternals::OnPublishUserCallback _onPublishUserCallback;
+#if ASYNC_MQTT_MESSAGE_DISPATCH
+  AsyncMqttClientInternals::MessageDispatcher _dispatcher;
+#endif
+#if ASYNC_MQTT_COMPRESSION
+  // created by the first addCompressedTopics()
+  AsyncMqttClientInternals::PayloadCompression* _compression;
+#endif
+#if ASYNC_MQTT_PAYLOAD_SINKS
+  AsyncMqttClientInternals::PayloadSink* _sinks[ASYNC_MQTT_PAYLOAD_SINKS];
+  // the sink of the message being received
+  AsyncMqttClientInternals::PayloadSink* _activeSink;
+#endif
+#if ASYNC_MQTT_RETAINED_CACHE
+  AsyncMqttClientInternals::RetainedCache* _retainedCache;
+  // the message being received goes to the cache
+  bool _caching;
+#endif
+#if ASYNC_MQTT_DUPLICATE_FILTER
+  AsyncMqttClientInternals::DuplicateFilter _duplicateFilter;
+  // the message being received is a redelivery, dropped
+  bool _duplicate;
+#endif
+#if ASYNC_MQTT_PRIORITY_LANES
+  AsyncMqttClientInternals::PriorityLanes _lanes;
+  uint32_t _bulkInFlight;
+  // the most room the transport has offered: what it holds is this minus space()
+  size_t _transportCapacity;
+  // a keepalive ping found no room, it goes before the lanes
+  bool _pingDeferred;
+#endif
+#if ASYNC_MQTT_RATE_CONTROL
+  AsyncMqttClientInternals::RateController _rateControl;
+#endif
+#if ASYNC_MQTT_AGGREGATION
+  AsyncMqttClientInternals::Aggregator _aggregator;
+  // the window of the batch being gathered
+  AsyncMqttClientInternals::Timer _aggregationTimer;
+  AsyncMqttClientInternals::OnBatchSentUserCallback _onBatchSentUserCallback;
+#endif
 
   AsyncMqttClientInternals::ParsingInformation _parsingInformation;
   AsyncMqttClientInternals::Packet* _currentParsedPacket;
+  AsyncMqttClientInternals::PacketStorage* _packetStorage;
   uint8_t _remainingLengthBufferPosition;
   char _remainingLengthBuffer[4];
 
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+  AsyncMqttClientInternals::SubmissionQueue _submissions;
+  std::atomic<bool> _submissionsOpen;
+  AsyncMqttClientInternals::OnSubmissionFailedUserCallback _onSubmissionFailedUserCallback;
+  // taken by submitting tasks as well
+  std::atomic<uint16_t> _nextPacketId;
+#else
   uint16_t _nextPacketId;
+#endif
 
-  std::vector<AsyncMqttClientInternals::PendingPubRel> _pendingPubRels;
-  std::vector<AsyncMqttClientInternals::PendingAck> _toSendAcks;
+  AsyncMqttClientInternals::PendingList<AsyncMqttClientInternals::PendingPubRel> _pendingPubRels;
+  AsyncMqttClientInternals::PendingList<AsyncMqttClientInternals::PendingAck> _toSendAcks;
+
+  AsyncMqttClient(AsyncMqttClientInternals::Transport* transport, AsyncMqttClientManager* manager,
+    AsyncMqttClientInternals::ClientStorage const *storage = nullptr);
 
   void _clear();
+  template <typename PacketType, typename... Args>
+  AsyncMqttClientInternals::Packet* _newPacket(Args... args);
   void _freeCurrentParsedPacket();
+  void _queueAck(uint8_t packetType, uint8_t headerFlag, uint16_t packetId);
+  void _service();
 
-  // TCP
-  void _onConnect(AsyncClient* client);
-  void _onDisconnect(AsyncClient* client);
-  static void _onError(AsyncClient* client, err_t error);
-  void _onTimeout(AsyncClient* client, uint32_t time);
-  static void _onAck(AsyncClient* client, size_t len, uint32_t time);
-  void _onData(AsyncClient* client, char* data, size_t len);
-  void _onPoll(AsyncClient* client);
+  // Transport
+  void onTransportConnect();
+  void onTransportDisconnect();
+  void onTransportError(int8_t error);
+  void onTransportTimeout(uint32_t time);
+  void onTransportAck(size_t len, uint32_t time);
+  void onTransportData(char* data, size_t len);
+  void onTransportPoll();
 
   // MQTT
   void _onPingResp();
@@ -159,15 +380,51 @@ class AsyncMqttClient {
   void _onSubAck(uint16_t packetId, char status);
   void _onUnsubAck(uint16_t packetId);
   void _onMessage(char const *topic, char const *payload, uint8_t qos, bool dup, bool retain, size_t len, size_t index, size_t total, uint16_t packetId);
+  void _deliverMessage(char const *topic, char const *payload, AsyncMqttClientMessageProperties const &properties, size_t len, size_t index, size_t total);
+#if ASYNC_MQTT_COMPRESSION
+  static void _onDecompressed(const char* data, size_t length, size_t index, size_t total, void* context);
+#endif
   void _onPublish(uint16_t packetId, uint8_t qos);
   void _onPubRel(uint16_t packetId);
   void _onPubAck(uint16_t packetId);
   void _onPubRec(uint16_t packetId);
   void _onPubComp(uint16_t packetId);
 
+  // Timers
+  void _scheduleKeepAlive();
+  void _onKeepAliveTimer();
+  void _onPingTimeoutTimer();
+  void _onAckWatchdogTimer();
+  uint32_t _keepAliveInterval() const;
+  uint32_t _deadLinkTimeout() const;
+
   bool _sendPing();
   void _sendAcks();
   bool _sendDisconnect();
+  uint16_t _subscribe(const char* topic, uint16_t topicLength, uint8_t qos, uint16_t packetId);
+  uint16_t _unsubscribe(const char* topic, uint16_t topicLength, uint16_t packetId);
+  uint16_t _publish(const char* topic, uint16_t topicLength, uint8_t qos, bool retain,
+    const char* payload, uint32_t payloadLength, bool dup, uint16_t packetId);
+  bool _beginPublish(const char* topic, uint16_t topicLength, uint8_t qos, bool retain, size_t payloadLength, bool dup,
+    uint16_t* packetId, size_t* packetLength);
+  uint16_t _endPublish(uint8_t qos, bool dup, uint16_t packetId, size_t packetLength);
+  bool _paced(bool urgent);
+  uint16_t _publishOrQueue(const char* topic, uint16_t topicLength, uint8_t qos, bool retain,
+    const char* payload, uint32_t payloadLength, bool dup, uint16_t packetId);
+#if ASYNC_MQTT_PRIORITY_LANES
+  void _drainLanes();
+#endif
+#if ASYNC_MQTT_AGGREGATION
+  uint16_t _aggregate(const char* topic, uint16_t topicLength, uint8_t qos, const char* payload, uint32_t payloadLength);
+  uint8_t* _aggregateRecord(const char* topic, uint16_t topicLength, uint8_t qos, uint32_t payloadLength);
+  uint16_t _flushAggregate(AsyncMqttClientInternals::BatchTrigger trigger);
+  void _onAggregationTimer();
+#endif
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+  uint16_t _submit(AsyncMqttClientInternals::SubmissionType type, uint8_t qos, bool retain, String const &topic, String const &payload);
+  void _drainSubmissions();
+  void _failSubmissions();
+#endif
 
   uint16_t _getNextPacketId();
 };
@@ -0,0 +1,255 @@
+#include "Aggregator.hpp"
+
+#if ASYNC_MQTT_AGGREGATION
+
+#include <string.h>
+
+#include "Memory.hpp"
+#include "TopicFilter.hpp"
+
+using AsyncMqttClientInternals::Aggregator;
+using AsyncMqttClientInternals::BatchDecoder;
+using AsyncMqttClientInternals::BatchRecord;
+
+// the version byte and the longest varint, written in front of the records once the batch goes out
+static const uint32_t HEADER_ROOM = 6;
+
+static uint8_t varintLength(uint32_t value) {
+  uint8_t length = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    length++;
+  }
+  return length;
+}
+
+static uint8_t* putVarint(uint8_t* output, uint32_t value) {
+  while (value >= 0x80) {
+    *output++ = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  *output++ = static_cast<uint8_t>(value);
+  return output;
+}
+
+Aggregator::Aggregator()
+: _buffer(nullptr)
+, _size(0)
+, _length(0)
+, _window(0)
+, _first(0)
+, _last(0)
+, _qos(0)
+, _topicCount(0)
+, _topicOffsets()
+, _topicLengths()
+, _topic()
+, _filters()
+, _stats() {
+}
+
+Aggregator::~Aggregator() {
+  _release();
+}
+
+bool Aggregator::begin(const char* topic, size_t budget, uint32_t window) {
+  _release();
+  if (budget == 0) return true;
+  if (!_topic.assign(topic, strlen(topic))) return false;
+  _buffer = static_cast<uint8_t*>(allocate(HEADER_ROOM + budget, AsyncMqttClientMemoryTag::QUEUE));
+  if (!_buffer) return false;
+  _size = HEADER_ROOM + budget;
+  _window = window;
+  return true;
+}
+
+bool Aggregator::enabled() const {
+  return _buffer != nullptr;
+}
+
+bool Aggregator::addFilter(const char* filter) {
+  for (BoundedString &slot : _filters) {
+    if (slot.empty()) return slot.assign(filter, strlen(filter));
+  }
+  return false;
+}
+
+bool Aggregator::matches(const char* topic, size_t topicLength, uint8_t qos, bool retain, size_t length) const {
+  if (!_buffer || qos > 1 || retain) return false;
+  // the longest a record takes: the delay, a new topic and the payload length
+  if (5 + 1 + varintLength(topicLength) + topicLength + varintLength(length) + length > _size - HEADER_ROOM) return false;
+  if (topicLength == _topic.length() && memcmp(topic, _topic.c_str(), topicLength) == 0) return false;
+  for (BoundedString const &filter : _filters) {
+    if (filter.empty()) break;
+    if (topicMatches(filter.c_str(), topic, topicLength)) return true;
+  }
+  return false;
+}
+
+uint8_t* Aggregator::reserve(const char* topic, uint16_t topicLength, uint8_t qos, uint32_t length, uint32_t now) {
+  uint8_t number = 0;
+  for (uint8_t i = 0; i < _topicCount; i++) {
+    if (_topicLengths[i] == topicLength && memcmp(_buffer + _topicOffsets[i], topic, topicLength) == 0) {
+      number = i + 1;
+      break;
+    }
+  }
+
+  uint32_t delay = _length == 0 ? 0 : now - _last;
+  size_t needed = varintLength(delay) + varintLength(number) + varintLength(length) + length;
+  if (number == 0) needed += varintLength(topicLength) + topicLength;
+  if (HEADER_ROOM + _length + needed > _size) return nullptr;
+
+  uint8_t* output = putVarint(_buffer + HEADER_ROOM + _length, delay);
+  output = putVarint(output, number);
+  if (number == 0) {
+    output = putVarint(output, topicLength);
+    if (_topicCount < BATCH_TOPICS) {
+      _topicOffsets[_topicCount] = output - _buffer;
+      _topicLengths[_topicCount] = topicLength;
+      _topicCount++;
+    }
+    memcpy(output, topic, topicLength);
+    output += topicLength;
+  }
+  output = putVarint(output, length);
+
+  if (_length == 0) _first = now;
+  _last = now;
+  _length = output + length - _buffer - HEADER_ROOM;
+  if (qos > _qos) _qos = qos;
+  _stats.records++;
+  _stats.pending++;
+  return output;
+}
+
+bool Aggregator::empty() const {
+  return _length == 0;
+}
+
+uint32_t Aggregator::remaining(uint32_t now) const {
+  uint32_t elapsed = now - _first;
+  return elapsed < _window ? _window - elapsed : 0;
+}
+
+const char* Aggregator::topic() const {
+  return _topic.c_str();
+}
+
+uint16_t Aggregator::topicLength() const {
+  return _topic.length();
+}
+
+uint8_t Aggregator::qos() const {
+  return _qos;
+}
+
+const char* Aggregator::payload(uint32_t now, size_t* length) {
+  uint32_t span = now - _first;
+  uint8_t* header = _buffer + HEADER_ROOM - 1 - varintLength(span);
+  header[0] = BATCH_VERSION;
+  putVarint(header + 1, span);
+  *length = _buffer + HEADER_ROOM + _length - header;
+  return reinterpret_cast<const char*>(header);
+}
+
+void Aggregator::sent(uint16_t packetId, BatchTrigger trigger) {
+  _stats.batches++;
+  if (trigger == BatchTrigger::WINDOW) _stats.byWindow++;
+  if (trigger == BatchTrigger::BUDGET) _stats.byBudget++;
+  _stats.lastPacketId = packetId;
+  _stats.pending = 0;
+  _length = 0;
+  _qos = 0;
+  _topicCount = 0;
+}
+
+AsyncMqttClientAggregationStats Aggregator::stats() const {
+  AsyncMqttClientAggregationStats stats = _stats;
+  stats.pendingBytes = _length;
+  return stats;
+}
+
+void Aggregator::_release() {
+  if (_buffer) release(_buffer, _size, AsyncMqttClientMemoryTag::QUEUE);
+  _buffer = nullptr;
+  _size = 0;
+  _length = 0;
+  _qos = 0;
+  _topicCount = 0;
+  _stats.pending = 0;
+}
+
+BatchDecoder::BatchDecoder(const char* payload, size_t length)
+: _data(reinterpret_cast<const uint8_t*>(payload))
+, _length(length)
+, _position(1)
+, _age(0)
+, _topicCount(0)
+, _topicOffsets()
+, _topicLengths()
+, _failed(length == 0 || _data[0] != BATCH_VERSION) {
+  if (!_failed) _failed = !_varint(&_age);
+}
+
+bool BatchDecoder::next(BatchRecord* record) {
+  if (_failed || _position == _length) return false;
+
+  uint32_t delay;
+  uint32_t number;
+  if (!_varint(&delay) || !_varint(&number) || delay > _age) {
+    _failed = true;
+    return false;
+  }
+  _age -= delay;
+
+  if (number == 0) {
+    uint32_t topicLength;
+    if (!_varint(&topicLength) || topicLength > 0xFFFF || topicLength > _length - _position) {
+      _failed = true;
+      return false;
+    }
+    record->topic = reinterpret_cast<const char*>(_data + _position);
+    record->topicLength = topicLength;
+    if (_topicCount < BATCH_TOPICS) {
+      _topicOffsets[_topicCount] = _position;
+      _topicLengths[_topicCount] = topicLength;
+      _topicCount++;
+    }
+    _position += topicLength;
+  } else if (number <= _topicCount) {
+    record->topic = reinterpret_cast<const char*>(_data + _topicOffsets[number - 1]);
+    record->topicLength = _topicLengths[number - 1];
+  } else {
+    _failed = true;
+    return false;
+  }
+
+  uint32_t length;
+  if (!_varint(&length) || length > _length - _position) {
+    _failed = true;
+    return false;
+  }
+  record->payload = reinterpret_cast<const char*>(_data + _position);
+  record->length = length;
+  record->age = _age;
+  _position += length;
+  return true;
+}
+
+bool BatchDecoder::failed() const {
+  return _failed;
+}
+
+bool BatchDecoder::_varint(uint32_t* value) {
+  *value = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    if (_position == _length) return false;
+    uint8_t byte = _data[_position++];
+    *value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+#endif
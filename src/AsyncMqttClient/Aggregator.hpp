@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "BoundedString.hpp"
+
+// Publishes of the topics given to addAggregatedTopics() are gathered into batches, see setAggregation(). Off by default, 1 compiles it in
+#ifndef ASYNC_MQTT_AGGREGATION
+#define ASYNC_MQTT_AGGREGATION 0
+#endif
+
+#ifndef ASYNC_MQTT_AGGREGATION_FILTERS
+#define ASYNC_MQTT_AGGREGATION_FILTERS 4
+#endif
+
+struct AsyncMqttClientAggregationStats {
+  uint32_t records;  // publishes gathered
+  uint32_t batches;  // sent
+  uint32_t byWindow;  // of them, sent as their window ended
+  uint32_t byBudget;  // sent as the next record did not fit, the others by flushAggregation()
+  uint32_t pending;  // records in the batch being gathered
+  uint32_t pendingBytes;
+  uint16_t lastPacketId;  // of the last batch sent, 0 at QoS 0
+};
+
+#if ASYNC_MQTT_AGGREGATION
+
+namespace AsyncMqttClientInternals {
+const uint8_t BATCH_VERSION = 1;
+// Topics numbered in a batch, the others are written out each time
+const uint8_t BATCH_TOPICS = 16;
+
+// What sent a batch
+enum class BatchTrigger : uint8_t {
+  WINDOW,
+  BUDGET,
+  FLUSH
+};
+
+// A batch is the version byte, the milliseconds from its first record to when it was sent, then its records in the order
+// they were published: the milliseconds since the record before (0 for the first), the topic, the payload length and the
+// payload. A topic is 0, its length and its bytes the first time it appears, then its number, counting from 1 in the order
+// of first appearance, for the first BATCH_TOPICS topics of the batch. Numbers are unsigned varints: 7 bits per byte, the
+// least significant first, the high bit set on all bytes but the last.
+class Aggregator {
+ public:
+  Aggregator();
+  ~Aggregator();
+
+  Aggregator(Aggregator const &) = delete;
+  Aggregator& operator=(Aggregator const &) = delete;
+
+  // A batch of at most budget payload bytes, from the allocator hooks (QUEUE), published to topic once window ms passed
+  // since its first record; false when out of memory, aggregation is off then. A budget of 0 turns it off
+  bool begin(const char* topic, size_t budget, uint32_t window);
+  bool enabled() const;
+  // Past ASYNC_MQTT_AGGREGATION_FILTERS filters, or out of memory, false
+  bool addFilter(const char* filter);
+  // QoS 0 and 1 publishes not retained, to a topic of the filters other than the batch topic, small enough for a batch
+  bool matches(const char* topic, size_t topicLength, uint8_t qos, bool retain, size_t length) const;
+
+  // Adds a record and returns where the caller writes its length bytes of payload; nullptr when it does not fit in what is
+  // left of the budget
+  uint8_t* reserve(const char* topic, uint16_t topicLength, uint8_t qos, uint32_t length, uint32_t now);
+  bool empty() const;
+  // ms before the window of the batch ends, 0 once it has
+  uint32_t remaining(uint32_t now) const;
+
+  const char* topic() const;
+  uint16_t topicLength() const;
+  // the highest QoS of the records
+  uint8_t qos() const;
+  // The batch as a payload, its header written in front of the records
+  const char* payload(uint32_t now, size_t* length);
+  // the batch went out, the next one starts empty
+  void sent(uint16_t packetId, BatchTrigger trigger);
+
+  AsyncMqttClientAggregationStats stats() const;
+
+ private:
+  uint8_t* _buffer;
+  uint32_t _size;
+  uint32_t _length;  // of the records, which start after room for the header
+  uint32_t _window;
+  uint32_t _first;
+  uint32_t _last;
+  uint8_t _qos;
+  uint8_t _topicCount;
+  uint32_t _topicOffsets[BATCH_TOPICS];
+  uint16_t _topicLengths[BATCH_TOPICS];
+  BoundedString _topic;
+  BoundedString _filters[ASYNC_MQTT_AGGREGATION_FILTERS];
+  AsyncMqttClientAggregationStats _stats;
+
+  void _release();
+};
+
+struct BatchRecord {
+  const char* topic;
+  uint16_t topicLength;
+  const char* payload;
+  uint32_t length;
+  uint32_t age;  // ms from its publish() to the batch being sent
+};
+
+// Unpacks a batch received whole, in place: topics and payloads point into it
+class BatchDecoder {
+ public:
+  BatchDecoder(const char* payload, size_t length);
+
+  // The next record, false at the end of the batch or once it is found malformed
+  bool next(BatchRecord* record);
+  bool failed() const;
+
+ private:
+  const uint8_t* _data;
+  size_t _length;
+  size_t _position;
+  uint32_t _age;
+  uint8_t _topicCount;
+  uint32_t _topicOffsets[BATCH_TOPICS];
+  uint16_t _topicLengths[BATCH_TOPICS];
+  bool _failed;
+
+  bool _varint(uint32_t* value);
+};
+}  // namespace AsyncMqttClientInternals
+
+#endif
@@ -0,0 +1,74 @@
+#include "BoundedString.hpp"
+
+#include <string.h>
+
+#include "Memory.hpp"
+
+using AsyncMqttClientInternals::BoundedString;
+
+static char EMPTY_STRING[1] = { '\0' };
+
+BoundedString::BoundedString()
+: _data(EMPTY_STRING)
+, _length(0)
+, _capacity(0)
+, _fixed(false) {
+}
+
+BoundedString::~BoundedString() {
+  if (!_fixed) clear();
+}
+
+void BoundedString::setStorage(char* buffer, size_t capacity) {
+  if (!_fixed) clear();
+  _data = buffer;
+  _data[0] = '\0';
+  _length = 0;
+  _capacity = capacity;
+  _fixed = true;
+}
+
+bool BoundedString::assign(const char* data, size_t length) {
+  if (_fixed) {
+    if (length > _capacity) {
+      clear();
+      return false;
+    }
+  } else {
+    clear();
+    if (length == 0) return true;
+    char* buffer = static_cast<char*>(allocate(length + 1, AsyncMqttClientMemoryTag::SETTINGS));
+    if (!buffer) return false;
+    _data = buffer;
+  }
+  if (length != 0) memcpy(_data, data, length);
+  _data[length] = '\0';
+  _length = length;
+  return true;
+}
+
+void BoundedString::clear() {
+  if (_fixed) {
+    _data[0] = '\0';
+  } else if (_data != EMPTY_STRING) {
+    release(_data, _length + 1, AsyncMqttClientMemoryTag::SETTINGS);
+    _data = EMPTY_STRING;
+  }
+  _length = 0;
+}
+
+bool BoundedString::empty() const {
+  return _length == 0;
+}
+
+size_t BoundedString::length() const {
+  return _length;
+}
+
+const char* BoundedString::begin() const {
+  return _data;
+}
+
+const char* BoundedString::c_str() const {
+  return _data;
+}
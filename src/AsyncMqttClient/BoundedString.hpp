@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace AsyncMqttClientInternals {
+// Zero terminated setting (client ID, credentials, will, host). Reallocated through the allocator hooks (SETTINGS) on each assign(),
+// or copied into a fixed buffer handed with setStorage(), where a value longer than the capacity is refused.
+class BoundedString {
+ public:
+  BoundedString();
+  ~BoundedString();
+
+  BoundedString(BoundedString const &) = delete;
+  BoundedString& operator=(BoundedString const &) = delete;
+
+  // capacity excludes the terminating zero, the buffer holds capacity + 1 bytes
+  void setStorage(char* buffer, size_t capacity);
+
+  // False when the value does not fit the fixed buffer or memory is short, the string is then left empty
+  bool assign(const char* data, size_t length);
+  void clear();
+
+  bool empty() const;
+  size_t length() const;
+  const char* begin() const;
+  const char* c_str() const;
+
+ private:
+  char* _data;
+  size_t _length;
+  size_t _capacity;
+  bool _fixed;
+};
+}  // namespace AsyncMqttClientInternals
@@ -4,31 +4,48 @@
 
 #include "DisconnectReasons.hpp"
 #include "MessageProperties.hpp"
+#include "Delegate.hpp"
+
+// User callbacks as std::function, as before delegates, for code relying on the std::function interface
+#ifndef ASYNC_MQTT_STD_FUNCTION_CALLBACKS
+#define ASYNC_MQTT_STD_FUNCTION_CALLBACKS 0
+#endif
 
 namespace AsyncMqttClientInternals {
+#if ASYNC_MQTT_STD_FUNCTION_CALLBACKS
+template <typename Signature>
+using UserCallback = std::function<Signature>;
+#else
+template <typename Signature>
+using UserCallback = Delegate<Signature>;
+#endif
+
 // user callbacks
-typedef std::function<void(bool sessionPresent)> OnConnectUserCallback;
-typedef std::function<void(AsyncMqttClientDisconnectReason reason)> OnDisconnectUserCallback;
-typedef std::function<void(uint16_t packetId, uint8_t qos)> OnSubscribeUserCallback;
-typedef std::function<void(uint16_t packetId)> OnUnsubscribeUserCallback;
-typedef std::function<void(char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)> OnMessageUserCallback;
-typedef std::function<void(uint16_t packetId)> OnPublishUserCallback;
+typedef UserCallback<void(bool sessionPresent)> OnConnectUserCallback;
+typedef UserCallback<void(AsyncMqttClientDisconnectReason reason)> OnDisconnectUserCallback;
+typedef UserCallback<void(uint16_t packetId, uint8_t qos)> OnSubscribeUserCallback;
+typedef UserCallback<void(uint16_t packetId)> OnUnsubscribeUserCallback;
+typedef UserCallback<void(char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)> OnMessageUserCallback;
+typedef UserCallback<void(uint16_t packetId)> OnPublishUserCallback;
+typedef UserCallback<void(uint16_t packetId)> OnSubmissionFailedUserCallback;
+typedef UserCallback<void(uint16_t packetId, uint32_t records)> OnBatchSentUserCallback;
 
 #if ASYNC_TCP_SSL_ENABLED
 #if ASYNC_TCP_SSL_BEARSSL
-typedef std::function<int(void *dn_hash, size_t dn_hash_len, uint8_t **buf)> OnSSLCertLookupCallback;
+typedef UserCallback<int(void *dn_hash, size_t dn_hash_len, uint8_t **buf)> OnSSLCertLookupCallback;
 #endif
 #endif
 
 // internal callbacks
-typedef std::function<void(bool sessionPresent, uint8_t connectReturnCode)> OnConnAckInternalCallback;
-typedef std::function<void()> OnPingRespInternalCallback;
-typedef std::function<void(uint16_t packetId, char status)> OnSubAckInternalCallback;
-typedef std::function<void(uint16_t packetId)> OnUnsubAckInternalCallback;
-typedef std::function<void(char const *topic, char const *payload, uint8_t qos, bool dup, bool retain, size_t len, size_t index, size_t total, uint16_t packetId)> OnMessageInternalCallback;
-typedef std::function<void(uint16_t packetId, uint8_t qos)> OnPublishInternalCallback;
-typedef std::function<void(uint16_t packetId)> OnPubRelInternalCallback;
-typedef std::function<void(uint16_t packetId)> OnPubAckInternalCallback;
-typedef std::function<void(uint16_t packetId)> OnPubRecInternalCallback;
-typedef std::function<void(uint16_t packetId)> OnPubCompInternalCallback;
+typedef Delegate<void(bool sessionPresent, uint8_t connectReturnCode)> OnConnAckInternalCallback;
+typedef Delegate<void()> OnPingRespInternalCallback;
+typedef Delegate<void(uint16_t packetId, char status)> OnSubAckInternalCallback;
+typedef Delegate<void(uint16_t packetId)> OnUnsubAckInternalCallback;
+typedef Delegate<void(char const *topic, char const *payload, uint8_t qos, bool dup, bool retain, size_t len, size_t index, size_t total, uint16_t packetId)> OnMessageInternalCallback;
+typedef Delegate<void(uint16_t packetId, uint8_t qos)> OnPublishInternalCallback;
+typedef Delegate<void(uint16_t packetId)> OnPubRelInternalCallback;
+typedef Delegate<void(uint16_t packetId)> OnPubAckInternalCallback;
+typedef Delegate<void(uint16_t packetId)> OnPubRecInternalCallback;
+typedef Delegate<void(uint16_t packetId)> OnPubCompInternalCallback;
+typedef Delegate<void()> OnTimerInternalCallback;
 }  // namespace AsyncMqttClientInternals
@@ -0,0 +1,174 @@
+#include "CborWriter.hpp"
+
+#include <string.h>
+
+using AsyncMqttClientInternals::CborWriter;
+
+// major types
+static const uint8_t MAJOR_UNSIGNED = 0;
+static const uint8_t MAJOR_NEGATIVE = 1;
+static const uint8_t MAJOR_BYTES = 2;
+static const uint8_t MAJOR_TEXT = 3;
+static const uint8_t MAJOR_ARRAY = 4;
+static const uint8_t MAJOR_MAP = 5;
+static const uint8_t MAJOR_SIMPLE = 7;
+
+// simple values and floats of major type 7
+static const uint8_t SIMPLE_FALSE = 20;
+static const uint8_t SIMPLE_TRUE = 21;
+static const uint8_t SIMPLE_NULL = 22;
+static const uint8_t SIMPLE_FLOAT32 = 26;
+static const uint8_t SIMPLE_FLOAT64 = 27;
+
+CborWriter::CborWriter()
+: CborWriter(static_cast<Transport*>(nullptr), 0) {
+}
+
+CborWriter::CborWriter(Transport* transport, size_t size)
+: _transport(transport)
+, _output(nullptr)
+, _limit(size)
+, _size(0)
+, _buffered(0)
+, _overflowed(false)
+, _buffer() {
+}
+
+CborWriter::CborWriter(uint8_t* output, size_t size)
+: _transport(nullptr)
+, _output(output)
+, _limit(size)
+, _size(0)
+, _buffered(0)
+, _overflowed(false)
+, _buffer() {
+}
+
+CborWriter& CborWriter::map(size_t pairs) {
+  _head(MAJOR_MAP, pairs);
+  return *this;
+}
+
+CborWriter& CborWriter::array(size_t items) {
+  _head(MAJOR_ARRAY, items);
+  return *this;
+}
+
+CborWriter& CborWriter::text(const char* text) {
+  return this->text(text, strlen(text));
+}
+
+CborWriter& CborWriter::text(const char* text, size_t length) {
+  _head(MAJOR_TEXT, length);
+  _put(reinterpret_cast<const uint8_t*>(text), length);
+  return *this;
+}
+
+CborWriter& CborWriter::bytes(const void* data, size_t length) {
+  _head(MAJOR_BYTES, length);
+  _put(static_cast<const uint8_t*>(data), length);
+  return *this;
+}
+
+CborWriter& CborWriter::integer(int64_t value) {
+  // -1 - value, without overflowing on the smallest one
+  if (value < 0) {
+    _head(MAJOR_NEGATIVE, ~static_cast<uint64_t>(value));
+  } else {
+    _head(MAJOR_UNSIGNED, value);
+  }
+  return *this;
+}
+
+CborWriter& CborWriter::number(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint8_t encoded[5] = { MAJOR_SIMPLE << 5 | SIMPLE_FLOAT32, static_cast<uint8_t>(bits >> 24), static_cast<uint8_t>(bits >> 16),
+    static_cast<uint8_t>(bits >> 8), static_cast<uint8_t>(bits) };
+  _put(encoded, sizeof(encoded));
+  return *this;
+}
+
+CborWriter& CborWriter::number(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint8_t encoded[9];
+  encoded[0] = MAJOR_SIMPLE << 5 | SIMPLE_FLOAT64;
+  for (uint8_t i = 0; i < 8; i++) encoded[1 + i] = bits >> (56 - 8 * i);
+  _put(encoded, sizeof(encoded));
+  return *this;
+}
+
+CborWriter& CborWriter::boolean(bool value) {
+  uint8_t encoded = MAJOR_SIMPLE << 5 | (value ? SIMPLE_TRUE : SIMPLE_FALSE);
+  _put(&encoded, 1);
+  return *this;
+}
+
+CborWriter& CborWriter::null() {
+  uint8_t encoded = MAJOR_SIMPLE << 5 | SIMPLE_NULL;
+  _put(&encoded, 1);
+  return *this;
+}
+
+size_t CborWriter::size() const {
+  return _size;
+}
+
+bool CborWriter::finish() {
+  if (!_transport && !_output) return true;
+  bool complete = !_overflowed && _size == _limit;
+  static const uint8_t zeros[16] = {};
+  while (_size < _limit) _put(zeros, _limit - _size < sizeof(zeros) ? _limit - _size : sizeof(zeros));
+  _flush();
+  return complete;
+}
+
+// the initial byte, and the argument in the fewest bytes that hold it
+void CborWriter::_head(uint8_t major, uint64_t argument) {
+  uint8_t encoded[9];
+  uint8_t length;
+  if (argument < 24) {
+    encoded[0] = major << 5 | argument;
+    length = 1;
+  } else {
+    uint8_t argumentLength = argument <= 0xFF ? 1 : argument <= 0xFFFF ? 2 : argument <= 0xFFFFFFFF ? 4 : 8;
+    // 24, 25, 26, 27: 1, 2, 4, 8 bytes follow
+    encoded[0] = major << 5 | (argumentLength == 1 ? 24 : argumentLength == 2 ? 25 : argumentLength == 4 ? 26 : 27);
+    for (uint8_t i = 0; i < argumentLength; i++) encoded[1 + i] = argument >> (8 * (argumentLength - 1 - i));
+    length = 1 + argumentLength;
+  }
+  _put(encoded, length);
+}
+
+void CborWriter::_put(const uint8_t* data, size_t length) {
+  if (!_transport && !_output) {
+    _size += length;
+    return;
+  }
+  if (length > _limit - _size) {
+    length = _limit - _size;
+    _overflowed = true;
+  }
+  if (_output) {
+    memcpy(_output + _size, data, length);
+    _size += length;
+    return;
+  }
+  _size += length;
+  if (length > sizeof(_buffer) - _buffered) {
+    _flush();
+    if (length >= sizeof(_buffer)) {
+      _transport->add(reinterpret_cast<const char*>(data), length);
+      return;
+    }
+  }
+  memcpy(_buffer + _buffered, data, length);
+  _buffered += length;
+}
+
+void CborWriter::_flush() {
+  if (_buffered == 0 || !_transport) return;
+  _transport->add(reinterpret_cast<const char*>(_buffer), _buffered);
+  _buffered = 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Callbacks.hpp"
+#include "Transport.hpp"
+
+namespace AsyncMqttClientInternals {
+// Encodes CBOR (RFC 8949) items, definite lengths only. Without an output it only counts the bytes,
+// with a transport it stages them in a small buffer and adds them to the transport, strings and byte strings
+// past the buffer straight from the caller's memory; with memory it writes them there.
+// A writer bound to an output takes exactly the bytes it was given: past them its output is dropped,
+// short of them finish() pads with zeros, so the packet around the payload stays well formed.
+class CborWriter {
+ public:
+  CborWriter();
+  CborWriter(Transport* transport, size_t size);
+  CborWriter(uint8_t* output, size_t size);
+
+  CborWriter(CborWriter const &) = delete;
+  CborWriter& operator=(CborWriter const &) = delete;
+
+  // a map is followed by its pairs, key then value, an array by its items
+  CborWriter& map(size_t pairs);
+  CborWriter& array(size_t items);
+  CborWriter& text(const char* text);
+  CborWriter& text(const char* text, size_t length);
+  CborWriter& bytes(const void* data, size_t length);
+  CborWriter& integer(int64_t value);
+  CborWriter& number(float value);
+  CborWriter& number(double value);
+  CborWriter& boolean(bool value);
+  CborWriter& null();
+
+  // bytes written or counted so far
+  size_t size() const;
+  // false if the bytes written were not the bytes given
+  bool finish();
+
+ private:
+  Transport* _transport;
+  uint8_t* _output;
+  size_t _limit;
+  size_t _size;
+  uint8_t _buffered;
+  bool _overflowed;
+  uint8_t _buffer[64];
+
+  void _head(uint8_t major, uint64_t argument);
+  void _put(const uint8_t* data, size_t length);
+  void _flush();
+};
+
+// Writes the payload of publishCbor(): called twice, to size the payload and to write it, it must write the same both times
+typedef UserCallback<void(CborWriter& writer)> CborPayloadCallback;
+}  // namespace AsyncMqttClientInternals
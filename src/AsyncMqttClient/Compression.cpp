@@ -0,0 +1,252 @@
+#include "Compression.hpp"
+
+#if ASYNC_MQTT_COMPRESSION
+
+#include <string.h>
+
+#include "TopicFilter.hpp"
+
+using AsyncMqttClientInternals::PayloadCompression;
+using AsyncMqttClientInternals::PayloadDecoder;
+using AsyncMqttClientInternals::PayloadEncoder;
+
+static const uint8_t WINDOW_BITS = ASYNC_MQTT_COMPRESSION_WINDOW_BITS;
+static const uint8_t LOOKAHEAD_BITS = ASYNC_MQTT_COMPRESSION_LOOKAHEAD_BITS;
+static const size_t WINDOW_SIZE = 1 << WINDOW_BITS;
+static const uint8_t LITERAL_BITS = 1 + 8;
+static const uint8_t MATCH_BITS = 1 + WINDOW_BITS + LOOKAHEAD_BITS;
+
+static_assert(WINDOW_BITS >= 4 && WINDOW_BITS <= 15, "ASYNC_MQTT_COMPRESSION_WINDOW_BITS must be 4 to 15");
+static_assert(LOOKAHEAD_BITS >= 3 && LOOKAHEAD_BITS < WINDOW_BITS, "ASYNC_MQTT_COMPRESSION_LOOKAHEAD_BITS must be 3 or more, and less than the window bits");
+
+PayloadEncoder::PayloadEncoder(const char* payload, size_t length)
+: _payload(reinterpret_cast<const uint8_t*>(payload))
+, _length(length)
+, _header()
+, _headerLength(0)
+, _headerPosition(0)
+, _position(0)
+, _bits(0)
+, _bitCount(0) {
+  _header[0] = WINDOW_BITS << 4 | LOOKAHEAD_BITS;
+  _headerLength = 1;
+  size_t remaining = length;
+  do {
+    uint8_t byte = remaining % 128;
+    remaining /= 128;
+    if (remaining > 0) byte |= 128;
+    _header[_headerLength++] = byte;
+  } while (remaining > 0 && _headerLength < sizeof(_header));
+}
+
+size_t PayloadEncoder::size() const {
+  uint64_t bits = 0;
+  size_t position = 0;
+  while (position < _length) {
+    size_t distance, length;
+    _match(position, &distance, &length);
+    if (_isMatch(length)) {
+      bits += MATCH_BITS;
+      position += length;
+    } else {
+      bits += LITERAL_BITS;
+      position++;
+    }
+  }
+  return _headerLength + (bits + 7) / 8;
+}
+
+size_t PayloadEncoder::read(char* output, size_t size) {
+  size_t written = 0;
+  while (written < size && _headerPosition < _headerLength) output[written++] = _header[_headerPosition++];
+
+  while (written < size) {
+    if (_bitCount >= 8) {
+      _bitCount -= 8;
+      output[written++] = _bits >> _bitCount;
+      continue;
+    }
+    if (_position == _length) {
+      // the last bits, padded with zeros
+      if (_bitCount > 0) {
+        output[written++] = _bits << (8 - _bitCount);
+        _bitCount = 0;
+      }
+      break;
+    }
+
+    size_t distance, length;
+    _match(_position, &distance, &length);
+    if (_isMatch(length)) {
+      _bits = _bits << MATCH_BITS | static_cast<uint64_t>(distance - 1) << LOOKAHEAD_BITS | (length - 1);
+      _bitCount += MATCH_BITS;
+      _position += length;
+    } else {
+      _bits = _bits << LITERAL_BITS | 0x100 | _payload[_position];
+      _bitCount += LITERAL_BITS;
+      _position++;
+    }
+    _bits &= (static_cast<uint64_t>(1) << _bitCount) - 1;
+  }
+  return written;
+}
+
+// The longest match within the window, the nearest of them
+void PayloadEncoder::_match(size_t position, size_t* distance, size_t* length) const {
+  size_t longest = _length - position;
+  if (longest > static_cast<size_t>(1) << LOOKAHEAD_BITS) longest = static_cast<size_t>(1) << LOOKAHEAD_BITS;
+  size_t start = position > WINDOW_SIZE ? position - WINDOW_SIZE : 0;
+  *distance = 0;
+  *length = 0;
+  for (size_t candidate = position; candidate-- > start;) {
+    if (_payload[candidate] != _payload[position]) continue;
+    size_t matched = 1;
+    while (matched < longest && _payload[candidate + matched] == _payload[position + matched]) matched++;
+    if (matched > *length) {
+      *distance = position - candidate;
+      *length = matched;
+      if (matched == longest) return;
+    }
+  }
+}
+
+// a match is worth its bits past the break-even length, as heatshrink has it
+bool PayloadEncoder::_isMatch(size_t length) const {
+  return length > MATCH_BITS / 8;
+}
+
+PayloadDecoder::PayloadDecoder()
+: _window()
+, _state(State::HEADER)
+, _windowBits(0)
+, _lookaheadBits(0)
+, _lengthBytes(0)
+, _total(0)
+, _produced(0)
+, _delivered(0)
+, _head(0)
+, _pending(0)
+, _distance(0)
+, _bits(0)
+, _bitCount(0) {
+}
+
+void PayloadDecoder::begin() {
+  // matches reaching before the start of the payload read zeros, as with heatshrink
+  memset(_window, 0, sizeof(_window));
+  _state = State::HEADER;
+  _lengthBytes = 0;
+  _total = 0;
+  _produced = 0;
+  _delivered = 0;
+  _head = 0;
+  _pending = 0;
+  _bits = 0;
+  _bitCount = 0;
+}
+
+bool PayloadDecoder::decode(const char* data, size_t length, Sink sink, void* context) {
+  const uint8_t* input = reinterpret_cast<const uint8_t*>(data);
+  size_t position = 0;
+
+  if (_state == State::HEADER && position < length) {
+    _windowBits = input[position] >> 4;
+    _lookaheadBits = input[position] & 0x0F;
+    position++;
+    bool supported = _windowBits >= 4 && _windowBits <= WINDOW_BITS && _lookaheadBits >= 3 && _lookaheadBits < _windowBits;
+    _state = supported ? State::LENGTH : State::FAILED;
+  }
+  while (_state == State::LENGTH && position < length) {
+    uint8_t byte = input[position++];
+    _total |= static_cast<uint32_t>(byte & 127) << (7 * _lengthBytes++);
+    if ((byte & 128) == 0) {
+      _state = State::TAG;
+    } else if (_lengthBytes == 4) {
+      _state = State::FAILED;
+    }
+  }
+
+  while (_state != State::FAILED && _state != State::HEADER && _state != State::LENGTH) {
+    uint8_t needed = _state == State::TAG ? 1 : _state == State::LITERAL ? 8 : _state == State::DISTANCE ? _windowBits : _lookaheadBits;
+    while (_bitCount < needed && position < length) {
+      _bits = _bits << 8 | input[position++];
+      _bitCount += 8;
+    }
+    if (_bitCount < needed) break;
+    _bitCount -= needed;
+    uint16_t value = (_bits >> _bitCount) & ((1u << needed) - 1);
+    _bits &= (1u << _bitCount) - 1;
+
+    switch (_state) {
+      case State::TAG:
+        _state = value ? State::LITERAL : State::DISTANCE;
+        break;
+      case State::LITERAL:
+        _state = _put(value, sink, context) ? State::TAG : State::FAILED;
+        break;
+      case State::DISTANCE:
+        _distance = value + 1;
+        _state = State::COUNT;
+        break;
+      default:
+        _state = State::TAG;
+        for (uint16_t copied = 0; copied <= value; copied++) {
+          if (!_put(_window[(_head - _distance) & (WINDOW_SIZE - 1)], sink, context)) {
+            _state = State::FAILED;
+            break;
+          }
+        }
+        break;
+    }
+  }
+
+  _flush(_head, sink, context);
+  return _state != State::FAILED;
+}
+
+bool PayloadDecoder::finish(Sink sink, void* context) {
+  if (_state == State::FAILED || _state == State::HEADER || _state == State::LENGTH || _produced != _total) return false;
+  // an empty payload is delivered once all the same
+  if (_total == 0) sink(nullptr, 0, 0, 0, context);
+  return true;
+}
+
+bool PayloadDecoder::_put(uint8_t byte, Sink sink, void* context) {
+  if (_produced == _total) return false;
+  _window[_head] = byte;
+  _produced++;
+  _head = (_head + 1) & (WINDOW_SIZE - 1);
+  if (_head == 0) _flush(WINDOW_SIZE, sink, context);
+  return true;
+}
+
+void PayloadDecoder::_flush(size_t end, Sink sink, void* context) {
+  if (end > _pending) {
+    sink(reinterpret_cast<const char*>(_window + _pending), end - _pending, _delivered, _total, context);
+    _delivered += end - _pending;
+  }
+  _pending = end & (WINDOW_SIZE - 1);
+}
+
+PayloadCompression::PayloadCompression()
+: decoding(false)
+, decoder()
+, _filters() {
+}
+
+bool PayloadCompression::addFilter(const char* filter) {
+  for (BoundedString &slot : _filters) {
+    if (slot.empty()) return slot.assign(filter, strlen(filter));
+  }
+  return false;
+}
+
+bool PayloadCompression::matches(const char* topic, size_t topicLength) const {
+  for (BoundedString const &filter : _filters) {
+    if (filter.empty()) break;
+    if (topicMatches(filter.c_str(), topic, topicLength)) return true;
+  }
+  return false;
+}
+
+#endif
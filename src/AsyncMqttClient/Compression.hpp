@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "BoundedString.hpp"
+
+// Payloads of the topics given to addCompressedTopics() are sent and received compressed. Off by default, 1 compiles it in
+#ifndef ASYNC_MQTT_COMPRESSION
+#define ASYNC_MQTT_COMPRESSION 0
+#endif
+
+// LZSS window of 2^bits bytes: the decoder's buffer, and how far back the encoder looks for matches.
+// A client decodes the payloads of any window up to its own, the fleet shares one.
+#ifndef ASYNC_MQTT_COMPRESSION_WINDOW_BITS
+#define ASYNC_MQTT_COMPRESSION_WINDOW_BITS 8
+#endif
+
+// Longest match, 2^bits bytes
+#ifndef ASYNC_MQTT_COMPRESSION_LOOKAHEAD_BITS
+#define ASYNC_MQTT_COMPRESSION_LOOKAHEAD_BITS 4
+#endif
+
+#ifndef ASYNC_MQTT_COMPRESSION_FILTERS
+#define ASYNC_MQTT_COMPRESSION_FILTERS 4
+#endif
+
+#if ASYNC_MQTT_COMPRESSION
+
+namespace AsyncMqttClientInternals {
+// A compressed payload is a byte holding the window and lookahead bits (window << 4 | lookahead), the length of the
+// payload as a remaining length is encoded, then an LZSS stream in the heatshrink format: most significant bit first,
+// a 1 and 8 bits for a literal, a 0, the distance minus 1 on window bits and the length minus 1 on lookahead bits for
+// a match, the last byte padded with zeros.
+// The encoder reads a payload held in memory, twice: once for the size of its encoding, once to write it out in pieces.
+class PayloadEncoder {
+ public:
+  PayloadEncoder(const char* payload, size_t length);
+
+  size_t size() const;
+  // The next bytes of the encoding, 0 past its end
+  size_t read(char* output, size_t size);
+
+ private:
+  const uint8_t* _payload;
+  size_t _length;
+  uint8_t _header[5];
+  uint8_t _headerLength;
+  uint8_t _headerPosition;
+  size_t _position;
+  uint64_t _bits;
+  uint8_t _bitCount;
+
+  void _match(size_t position, size_t* distance, size_t* length) const;
+  bool _isMatch(size_t length) const;
+};
+
+// Decodes a payload as it arrives, handing the output to the sink each time its window fills up and at the end of each piece
+class PayloadDecoder {
+ public:
+  typedef void (*Sink)(const char* data, size_t length, size_t index, size_t total, void* context);
+
+  PayloadDecoder();
+
+  void begin();
+  // False once the payload is found malformed, the rest of it is ignored then
+  bool decode(const char* data, size_t length, Sink sink, void* context);
+  // False unless the payload decoded to exactly the announced length
+  bool finish(Sink sink, void* context);
+
+ private:
+  enum class State : uint8_t {
+    HEADER,
+    LENGTH,
+    TAG,
+    LITERAL,
+    DISTANCE,
+    COUNT,
+    FAILED
+  };
+
+  uint8_t _window[1 << ASYNC_MQTT_COMPRESSION_WINDOW_BITS];
+  State _state;
+  uint8_t _windowBits;
+  uint8_t _lookaheadBits;
+  uint8_t _lengthBytes;
+  uint32_t _total;
+  uint32_t _produced;
+  uint32_t _delivered;
+  size_t _head;
+  size_t _pending;
+  uint16_t _distance;
+  uint32_t _bits;
+  uint8_t _bitCount;
+
+  bool _put(uint8_t byte, Sink sink, void* context);
+  void _flush(size_t end, Sink sink, void* context);
+};
+
+// Filters of the compressed topics, and the decoder of the message being received
+class PayloadCompression {
+ public:
+  PayloadCompression();
+
+  PayloadCompression(PayloadCompression const &) = delete;
+  PayloadCompression& operator=(PayloadCompression const &) = delete;
+
+  bool addFilter(const char* filter);
+  bool matches(const char* topic, size_t topicLength) const;
+
+  // set at the start of each message: whether it is being decoded
+  bool decoding;
+  PayloadDecoder decoder;
+
+ private:
+  BoundedString _filters[ASYNC_MQTT_COMPRESSION_FILTERS];
+};
+}  // namespace AsyncMqttClientInternals
+
+#endif
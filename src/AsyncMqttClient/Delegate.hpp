@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Room for the callable of a Delegate: a lambda capturing up to four pointers, a std::bind to a member, or a std::function
+#ifndef ASYNC_MQTT_DELEGATE_SIZE
+#define ASYNC_MQTT_DELEGATE_SIZE (4 * sizeof(void*))
+#endif
+
+namespace AsyncMqttClientInternals {
+template <typename Signature>
+class Delegate;
+
+// Callable stored in place, never on the heap: a function pointer, a lambda or any function object that fits
+// ASYNC_MQTT_DELEGATE_SIZE. A larger one does not compile, wrap it in a std::function (which allocates) to pass it anyway.
+// Lambdas capturing by reference ([&]) take a pointer per variable used.
+// Calling an empty delegate is undefined, test it first.
+template <typename R, typename... Args>
+class Delegate<R(Args...)> {
+ public:
+  Delegate() : _invoke(nullptr), _manage(nullptr) {}
+  Delegate(std::nullptr_t) : Delegate() {}  // NOLINT(runtime/explicit)
+
+  template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Delegate>::value>::type>
+  Delegate(F&& callable)  // NOLINT(runtime/explicit)
+  : Delegate() {
+    typedef typename std::decay<F>::type Callable;
+    static_assert(sizeof(Callable) <= sizeof(Storage), "callable too large for a Delegate: capture less, wrap it in a std::function, raise ASYNC_MQTT_DELEGATE_SIZE or build with ASYNC_MQTT_STD_FUNCTION_CALLBACKS");
+    static_assert(alignof(Callable) <= alignof(Storage), "callable too aligned for a Delegate");
+    Callable* stored = new (&_storage) Callable(std::forward<F>(callable));
+    // a null function pointer or an empty std::function makes an empty delegate
+    if (_empty(*stored)) {
+      stored->~Callable();
+      return;
+    }
+    _invoke = &_call<Callable>;
+    _manage = &_handle<Callable>;
+  }
+
+  Delegate(Delegate const &other) : Delegate() {
+    _assign(other);
+  }
+
+  ~Delegate() {
+    _reset();
+  }
+
+  Delegate& operator=(Delegate const &other) {
+    if (this != &other) {
+      _reset();
+      _assign(other);
+    }
+    return *this;
+  }
+
+  Delegate& operator=(std::nullptr_t) {
+    _reset();
+    return *this;
+  }
+
+  explicit operator bool() const { return _invoke != nullptr; }
+
+  R operator()(Args... args) const {
+    return _invoke(const_cast<Storage*>(&_storage), std::forward<Args>(args)...);
+  }
+
+ private:
+  union Storage {
+    void* pointer;
+    void (*function)();
+    long long integer;
+    double real;
+    char bytes[ASYNC_MQTT_DELEGATE_SIZE];
+  };
+  enum class Operation : uint8_t { COPY, DESTROY };
+
+  Storage _storage;
+  R (*_invoke)(Storage* storage, Args... args);
+  void (*_manage)(Operation operation, Storage* storage, Storage const *source);
+
+  template <typename Callable>
+  static R _call(Storage* storage, Args... args) {
+    return (*reinterpret_cast<Callable*>(storage))(std::forward<Args>(args)...);
+  }
+
+  template <typename Callable>
+  static void _handle(Operation operation, Storage* storage, Storage const *source) {
+    if (operation == Operation::COPY) {
+      new (storage) Callable(*reinterpret_cast<Callable const *>(source));
+    } else {
+      reinterpret_cast<Callable*>(storage)->~Callable();
+    }
+  }
+
+  template <typename F>
+  static bool _empty(F const &callable) { (void)callable; return false; }
+  template <typename F>
+  static bool _empty(F* callable) { return callable == nullptr; }
+  template <typename Signature>
+  static bool _empty(std::function<Signature> const &callable) { return !callable; }
+
+  void _assign(Delegate const &other) {
+    if (!other._invoke) return;
+    other._manage(Operation::COPY, &_storage, &other._storage);
+    _invoke = other._invoke;
+    _manage = other._manage;
+  }
+
+  void _reset() {
+    if (_manage) _manage(Operation::DESTROY, &_storage, nullptr);
+    _invoke = nullptr;
+    _manage = nullptr;
+  }
+};
+}  // namespace AsyncMqttClientInternals
@@ -16,4 +16,6 @@ enum class AsyncMqttClientDisconnectReason : int8_t {
   TLS_VERIFY_FAILED = 7,
 #endif
 #endif
+
+  CLIENT_OUT_OF_MEMORY = 8,
 };
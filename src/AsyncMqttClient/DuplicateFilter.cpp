@@ -0,0 +1,81 @@
+#include "DuplicateFilter.hpp"
+
+#if ASYNC_MQTT_DUPLICATE_FILTER
+
+#include "Memory.hpp"
+
+using AsyncMqttClientInternals::DuplicateFilter;
+
+// FNV-1a
+static uint32_t hashBytes(uint32_t hash, const char* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+DuplicateFilter::DuplicateFilter()
+: _entries(nullptr)
+, _size(0)
+, _window(0) {
+}
+
+DuplicateFilter::~DuplicateFilter() {
+  begin(0, 0);
+}
+
+bool DuplicateFilter::begin(uint16_t entries, uint32_t window) {
+  if (_entries) release(_entries, _size * sizeof(Entry), AsyncMqttClientMemoryTag::QUEUE);
+  _entries = nullptr;
+  _size = 0;
+  _window = window;
+  if (entries == 0) return true;
+
+  _entries = createArray<Entry>(entries, AsyncMqttClientMemoryTag::QUEUE);
+  if (!_entries) return false;
+  _size = entries;
+  clear();
+  return true;
+}
+
+bool DuplicateFilter::enabled() const {
+  return _entries != nullptr;
+}
+
+size_t DuplicateFilter::memory() const {
+  return _size * sizeof(Entry);
+}
+
+void DuplicateFilter::clear() {
+  for (uint16_t i = 0; i < _size; i++) _entries[i].used = false;
+}
+
+bool DuplicateFilter::check(uint16_t packetId, bool dup, const char* topic, size_t topicLength, const char* payload, size_t length, size_t total, uint32_t now) {
+  uint32_t key = hashBytes(2166136261u, topic, topicLength);
+  key = hashBytes(key, reinterpret_cast<const char*>(&total), sizeof(total));
+  bool whole = length == total;
+  uint32_t payloadHash = whole ? hashBytes(2166136261u, payload, length) : 0;
+
+  // the entry of this identifier, or else a free one, or else the oldest
+  Entry* entry = nullptr;
+  for (uint16_t i = 0; i < _size; i++) {
+    Entry &candidate = _entries[i];
+    if (candidate.used && candidate.packetId == packetId) {
+      if (dup && now - candidate.time <= _window && candidate.key == key &&
+        (!whole || !candidate.whole || candidate.payload == payloadHash)) return true;
+      entry = &candidate;
+      break;
+    }
+    if (!entry || (entry->used && (!candidate.used || now - candidate.time > now - entry->time))) entry = &candidate;
+  }
+  entry->time = now;
+  entry->key = key;
+  entry->payload = payloadHash;
+  entry->packetId = packetId;
+  entry->whole = whole;
+  entry->used = true;
+  return false;
+}
+
+#endif
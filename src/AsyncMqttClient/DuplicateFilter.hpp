@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Suppression of redelivered QoS 1 messages, see setDuplicateFilter(). Off by default, 1 compiles it in
+#ifndef ASYNC_MQTT_DUPLICATE_FILTER
+#define ASYNC_MQTT_DUPLICATE_FILTER 0
+#endif
+
+#if ASYNC_MQTT_DUPLICATE_FILTER
+
+namespace AsyncMqttClientInternals {
+// The QoS 1 messages received lately, by packet identifier, topic, length and payload hash, in a fixed number of entries.
+// A message with the DUP flag matching one received within the window is a redelivery: its PUBACK was lost, not the
+// message. The broker reuses an identifier only once the message before it is acknowledged, so a new message takes
+// the entry of its identifier, or else the oldest entry. The payload is hashed when it arrives in one piece.
+class DuplicateFilter {
+ public:
+  DuplicateFilter();
+  ~DuplicateFilter();
+
+  DuplicateFilter(DuplicateFilter const &) = delete;
+  DuplicateFilter& operator=(DuplicateFilter const &) = delete;
+
+  // The entries come from the allocator hooks (QUEUE), false when out of memory. 0 entries turns the filter off
+  bool begin(uint16_t entries, uint32_t window);
+  bool enabled() const;
+  // bytes taken by the entries
+  size_t memory() const;
+  void clear();
+
+  // For the first piece of each QoS 1 message: true if it repeats one received within the window
+  bool check(uint16_t packetId, bool dup, const char* topic, size_t topicLength, const char* payload, size_t length, size_t total, uint32_t now);
+
+ private:
+  struct Entry {
+    uint32_t time;
+    uint32_t key;  // topic and total length
+    uint32_t payload;  // hash of the payload, when whole
+    uint16_t packetId;
+    bool whole;
+    bool used;
+  };
+
+  Entry* _entries;
+  uint16_t _size;
+  uint32_t _window;
+};
+}  // namespace AsyncMqttClientInternals
+
+#endif
@@ -0,0 +1,188 @@
+#include "FrameCapture.hpp"
+
+#include <string.h>
+
+using AsyncMqttClientInternals::CaptureDirection;
+using AsyncMqttClientInternals::CaptureReader;
+using AsyncMqttClientInternals::CaptureRecord;
+using AsyncMqttClientInternals::FrameCapture;
+
+static const uint8_t EXPORT_MAGIC[4] = { 'A', 'M', 'Q', 'C' };
+static const uint8_t EXPORT_FORMAT = 1;
+
+static void putUint32(uint8_t* data, uint32_t value) {
+  data[0] = value;
+  data[1] = value >> 8;
+  data[2] = value >> 16;
+  data[3] = value >> 24;
+}
+
+static uint32_t getUint32(const uint8_t* data) {
+  return data[0] | data[1] << 8 | data[2] << 16 | static_cast<uint32_t>(data[3]) << 24;
+}
+
+FrameCapture::FrameCapture(void* buffer, size_t size, uint16_t snapLength)
+: _buffer(static_cast<uint8_t*>(buffer))
+, _size(size)
+, _snapLength(snapLength)
+, _head(0)
+, _used(0)
+, _records(0)
+, _overwritten(0)
+, _open(false)
+, _openStart(0)
+, _openTime(0)
+, _openDirection(CaptureDirection::INBOUND)
+, _openLength(0)
+, _openCaptured(0)
+, _openLimit(0) {
+}
+
+void FrameCapture::record(CaptureDirection direction, uint32_t time, const char* data, size_t length) {
+  begin(direction, time);
+  append(data, length);
+  end();
+}
+
+void FrameCapture::begin(CaptureDirection direction, uint32_t time) {
+  end();
+  if (_size < RECORD_HEADER_SIZE || !_makeRoom(RECORD_HEADER_SIZE)) return;
+
+  // the header is written once the length is known
+  _openStart = _wrap(_head + _used);
+  _used += RECORD_HEADER_SIZE;
+  _open = true;
+  _openTime = time;
+  _openDirection = direction;
+  _openLength = 0;
+  _openCaptured = 0;
+  _openLimit = _snapLength != 0 ? _snapLength : UINT16_MAX;
+}
+
+void FrameCapture::append(const char* data, size_t length) {
+  if (!_open) return;
+  _openLength += length;
+
+  size_t kept = _openLimit - _openCaptured;
+  if (kept > length) kept = length;
+  if (kept == 0) return;
+  // a record larger than the ring keeps what fits once every older record is gone
+  if (kept > _size - _used) {
+    _makeRoom(kept);
+    if (kept > _size - _used) kept = _size - _used;
+  }
+  _write(_wrap(_head + _used), reinterpret_cast<const uint8_t*>(data), kept);
+  _used += kept;
+  _openCaptured += kept;
+}
+
+void FrameCapture::end() {
+  if (!_open) return;
+  uint8_t header[RECORD_HEADER_SIZE];
+  putUint32(header, _openTime);
+  header[4] = static_cast<uint8_t>(_openDirection);
+  putUint32(header + 5, _openLength);
+  header[9] = _openCaptured;
+  header[10] = _openCaptured >> 8;
+  _write(_openStart, header, sizeof(header));
+  _records++;
+  _open = false;
+}
+
+bool FrameCapture::recording() const {
+  return _open;
+}
+
+void FrameCapture::clear() {
+  _head = 0;
+  _used = 0;
+  _records = 0;
+  _overwritten = 0;
+  _open = false;
+}
+
+size_t FrameCapture::records() const {
+  return _records;
+}
+
+uint32_t FrameCapture::overwritten() const {
+  return _overwritten;
+}
+
+size_t FrameCapture::exportSize() const {
+  size_t openBytes = _open ? RECORD_HEADER_SIZE + _openCaptured : 0;
+  return EXPORT_HEADER_SIZE + _used - openBytes;
+}
+
+void FrameCapture::exportTo(CaptureWriter writer, void* context) const {
+  uint8_t header[EXPORT_HEADER_SIZE];
+  memcpy(header, EXPORT_MAGIC, sizeof(EXPORT_MAGIC));
+  header[4] = EXPORT_FORMAT;
+  writer(header, sizeof(header), context);
+
+  // the record being added, if any, is the newest one
+  size_t length = exportSize() - EXPORT_HEADER_SIZE;
+  size_t first = _size - _head < length ? _size - _head : length;
+  if (first > 0) writer(_buffer + _head, first, context);
+  if (length > first) writer(_buffer, length - first, context);
+}
+
+bool FrameCapture::_makeRoom(size_t length) {
+  while (_size - _used < length && _records > 0) {
+    uint8_t header[RECORD_HEADER_SIZE];
+    _read(_head, header, sizeof(header));
+    size_t recordSize = RECORD_HEADER_SIZE + (header[9] | header[10] << 8);
+    _head = _wrap(_head + recordSize);
+    _used -= recordSize;
+    _records--;
+    _overwritten++;
+  }
+  return _size - _used >= length;
+}
+
+// offsets stay under twice the size, a subtraction is enough (and much cheaper than a division on every add())
+size_t FrameCapture::_wrap(size_t offset) const {
+  return offset >= _size ? offset - _size : offset;
+}
+
+void FrameCapture::_write(size_t offset, const uint8_t* data, size_t length) {
+  if (_size - offset >= length) {
+    memcpy(_buffer + offset, data, length);
+    return;
+  }
+  size_t first = _size - offset;
+  memcpy(_buffer + offset, data, first);
+  memcpy(_buffer, data + first, length - first);
+}
+
+void FrameCapture::_read(size_t offset, uint8_t* data, size_t length) const {
+  size_t first = _size - offset < length ? _size - offset : length;
+  memcpy(data, _buffer + offset, first);
+  memcpy(data + first, _buffer, length - first);
+}
+
+CaptureReader::CaptureReader(const uint8_t* data, size_t length)
+: _data(data)
+, _length(length)
+, _position(FrameCapture::EXPORT_HEADER_SIZE)
+, _valid(length >= FrameCapture::EXPORT_HEADER_SIZE && memcmp(data, EXPORT_MAGIC, sizeof(EXPORT_MAGIC)) == 0 && data[4] == EXPORT_FORMAT) {
+}
+
+bool CaptureReader::valid() const {
+  return _valid;
+}
+
+bool CaptureReader::next(CaptureRecord* record) {
+  if (!_valid || _length - _position < FrameCapture::RECORD_HEADER_SIZE) return false;
+  const uint8_t* header = _data + _position;
+  uint16_t captured = header[9] | header[10] << 8;
+  if (_length - _position - FrameCapture::RECORD_HEADER_SIZE < captured) return false;
+
+  record->time = getUint32(header);
+  record->direction = static_cast<CaptureDirection>(header[4]);
+  record->length = getUint32(header + 5);
+  record->captured = captured;
+  record->data = header + FrameCapture::RECORD_HEADER_SIZE;
+  _position += FrameCapture::RECORD_HEADER_SIZE + captured;
+  return true;
+}
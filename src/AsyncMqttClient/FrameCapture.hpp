@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace AsyncMqttClientInternals {
+enum class CaptureDirection : uint8_t {
+  INBOUND = 0,
+  OUTBOUND = 1,
+  CONNECTED = 2,
+  DISCONNECTED = 3
+};
+
+struct CaptureRecord {
+  uint32_t time;  // microseconds, wrapping around
+  CaptureDirection direction;
+  uint32_t length;  // bytes of the segment or frame
+  uint16_t captured;  // bytes kept, fewer than length past the snap length
+  const uint8_t* data;
+};
+
+typedef void (*CaptureWriter)(const uint8_t* data, size_t length, void* context);
+
+// Inbound segments as the transport delivered them and outbound frames as they were sent, with the connection events,
+// in a ring over a buffer handed by the caller: the oldest records make room for new ones, nothing is allocated.
+// A snap length keeps only the first bytes of each record, enough for the fixed headers. Fed from the TCP task,
+// see CaptureTransport; export from there as well.
+class FrameCapture {
+ public:
+  // time, direction, length and captured bytes, little endian
+  static const size_t RECORD_HEADER_SIZE = 11;
+  // "AMQC" and the format version, then the records
+  static const size_t EXPORT_HEADER_SIZE = 5;
+
+  // snapLength 0 keeps whole records, up to 65535 bytes each
+  FrameCapture(void* buffer, size_t size, uint16_t snapLength = 0);
+
+  FrameCapture(FrameCapture const &) = delete;
+  FrameCapture& operator=(FrameCapture const &) = delete;
+
+  void record(CaptureDirection direction, uint32_t time, const char* data, size_t length);
+  // A record added in pieces, for frames written to the transport in several add() calls
+  void begin(CaptureDirection direction, uint32_t time);
+  void append(const char* data, size_t length);
+  void end();
+  bool recording() const;
+
+  void clear();
+  size_t records() const;
+  uint32_t overwritten() const;
+
+  // The complete records, oldest first, in the format CaptureReader reads
+  size_t exportSize() const;
+  void exportTo(CaptureWriter writer, void* context) const;
+
+ private:
+  uint8_t* _buffer;
+  size_t _size;
+  uint16_t _snapLength;
+  size_t _head;
+  size_t _used;
+  size_t _records;
+  uint32_t _overwritten;
+
+  bool _open;
+  size_t _openStart;
+  uint32_t _openTime;
+  CaptureDirection _openDirection;
+  uint32_t _openLength;
+  uint16_t _openCaptured;
+  uint16_t _openLimit;
+
+  bool _makeRoom(size_t length);
+  size_t _wrap(size_t offset) const;
+  void _write(size_t offset, const uint8_t* data, size_t length);
+  void _read(size_t offset, uint8_t* data, size_t length) const;
+};
+
+// Records of an exported capture, oldest first
+class CaptureReader {
+ public:
+  CaptureReader(const uint8_t* data, size_t length);
+
+  bool valid() const;
+  // False past the last complete record
+  bool next(CaptureRecord* record);
+
+ private:
+  const uint8_t* _data;
+  size_t _length;
+  size_t _position;
+  bool _valid;
+};
+}  // namespace AsyncMqttClientInternals
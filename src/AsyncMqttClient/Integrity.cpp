@@ -0,0 +1,115 @@
+#include "Integrity.hpp"
+
+#include <string.h>
+
+using AsyncMqttClientInternals::Crc32;
+using AsyncMqttClientInternals::Sha256;
+
+static const uint32_t CRC32_NIBBLES[16] = {
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+Crc32::Crc32()
+: _crc(0xFFFFFFFF) {
+}
+
+void Crc32::update(const uint8_t* data, size_t length) {
+  uint32_t crc = _crc;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ CRC32_NIBBLES[crc & 0x0F];
+    crc = (crc >> 4) ^ CRC32_NIBBLES[crc & 0x0F];
+  }
+  _crc = crc;
+}
+
+uint32_t Crc32::value() const {
+  return _crc ^ 0xFFFFFFFF;
+}
+
+static const uint32_t SHA256_K[64] = {
+  0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+  0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+  0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+  0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+  0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+  0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+  0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+  0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static inline uint32_t rotateRight(uint32_t value, uint8_t bits) {
+  return (value >> bits) | (value << (32 - bits));
+}
+
+Sha256::Sha256()
+: _state { 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 }
+, _length(0)
+, _block()
+, _blockLength(0) {
+}
+
+void Sha256::update(const uint8_t* data, size_t length) {
+  _length += length;
+  if (_blockLength > 0) {
+    size_t taken = 64u - _blockLength < length ? 64u - _blockLength : length;
+    memcpy(_block + _blockLength, data, taken);
+    _blockLength += taken;
+    data += taken;
+    length -= taken;
+    if (_blockLength < 64) return;
+    _compress(_block);
+    _blockLength = 0;
+  }
+  // whole blocks straight from the input
+  for (; length >= 64; data += 64, length -= 64) _compress(data);
+  memcpy(_block, data, length);
+  _blockLength = length;
+}
+
+void Sha256::finish(uint8_t digest[32]) {
+  uint64_t bits = _length * 8;
+  static const uint8_t padding[64] = { 0x80 };
+  update(padding, _blockLength < 56 ? 56 - _blockLength : 120 - _blockLength);
+  uint8_t length[8];
+  for (uint8_t i = 0; i < 8; i++) length[i] = bits >> (56 - 8 * i);
+  update(length, sizeof(length));
+  for (uint8_t i = 0; i < 32; i++) digest[i] = _state[i / 4] >> (24 - 8 * (i % 4));
+}
+
+void Sha256::_compress(const uint8_t* block) {
+  uint32_t w[64];
+  for (uint8_t i = 0; i < 16; i++) {
+    w[i] = static_cast<uint32_t>(block[4 * i]) << 24 | static_cast<uint32_t>(block[4 * i + 1]) << 16 |
+      static_cast<uint32_t>(block[4 * i + 2]) << 8 | block[4 * i + 3];
+  }
+  for (uint8_t i = 16; i < 64; i++) {
+    uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+  uint32_t e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+  for (uint8_t i = 0; i < 64; i++) {
+    uint32_t t1 = h + (rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+    uint32_t t2 = (rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  _state[0] += a;
+  _state[1] += b;
+  _state[2] += c;
+  _state[3] += d;
+  _state[4] += e;
+  _state[5] += f;
+  _state[6] += g;
+  _state[7] += h;
+}
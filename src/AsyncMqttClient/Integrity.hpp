@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace AsyncMqttClientInternals {
+// CRC-32 of zlib and Ethernet (reflected 0x04C11DB7), a nibble at a time: its table is 64 bytes, RAM on the ESP8266
+class Crc32 {
+ public:
+  Crc32();
+
+  void update(const uint8_t* data, size_t length);
+  uint32_t value() const;
+
+ private:
+  uint32_t _crc;
+};
+
+// SHA-256 (FIPS 180-4) fed in pieces of any length
+class Sha256 {
+ public:
+  Sha256();
+
+  void update(const uint8_t* data, size_t length);
+  // the hash of everything given since construction, after which the object is spent
+  void finish(uint8_t digest[32]);
+
+ private:
+  uint32_t _state[8];
+  uint64_t _length;
+  uint8_t _block[64];
+  uint8_t _blockLength;
+
+  void _compress(const uint8_t* block);
+};
+}  // namespace AsyncMqttClientInternals
@@ -0,0 +1,203 @@
+#include "LatencyHistogram.hpp"
+
+#include <string.h>
+
+using AsyncMqttClientInternals::LatencyHistogram;
+using AsyncMqttClientInternals::LatencyKind;
+using AsyncMqttClientInternals::LatencyTracker;
+
+static const uint8_t SERIALIZED_FORMAT = 1;
+static const uint32_t LAST_BUCKET_LATENCY = 65535;
+
+static size_t writeVarint(uint8_t* buffer, uint32_t value) {
+  size_t length = 0;
+  while (value >= 0x80) {
+    buffer[length++] = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  buffer[length++] = static_cast<uint8_t>(value);
+  return length;
+}
+
+static bool readVarint(const uint8_t* data, size_t length, size_t* position, uint32_t* value) {
+  *value = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    if (*position >= length) return false;
+    uint8_t byte = data[(*position)++];
+    *value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+LatencyHistogram::LatencyHistogram() {
+  reset();
+}
+
+uint8_t LatencyHistogram::bucketOf(uint32_t latency) {
+  if (latency > LAST_BUCKET_LATENCY) latency = LAST_BUCKET_LATENCY;
+  if (latency < (1 << SUB_BUCKET_BITS)) return latency;
+  uint8_t msb = 31 - __builtin_clz(latency);
+  return ((msb - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) | ((latency >> (msb - SUB_BUCKET_BITS)) & ((1 << SUB_BUCKET_BITS) - 1));
+}
+
+uint32_t LatencyHistogram::bucketHigh(uint8_t bucket) {
+  if (bucket < (1 << SUB_BUCKET_BITS)) return bucket;
+  uint8_t shift = (bucket >> SUB_BUCKET_BITS) - 1;
+  uint32_t low = static_cast<uint32_t>((1 << SUB_BUCKET_BITS) | (bucket & ((1 << SUB_BUCKET_BITS) - 1))) << shift;
+  return low + (1UL << shift) - 1;
+}
+
+void LatencyHistogram::record(uint32_t latency) {
+  _counts[bucketOf(latency)]++;
+  _count++;
+  if (latency > _max) _max = latency;
+}
+
+void LatencyHistogram::reset() {
+  memset(_counts, 0, sizeof(_counts));
+  _count = 0;
+  _max = 0;
+}
+
+uint32_t LatencyHistogram::count() const {
+  return _count;
+}
+
+uint32_t LatencyHistogram::max() const {
+  return _max;
+}
+
+uint32_t LatencyHistogram::percentile(uint8_t percent) const {
+  if (_count == 0) return 0;
+  if (percent > 100) percent = 100;
+  // the smallest latency at or above percent % of the samples
+  uint64_t rank = (static_cast<uint64_t>(_count) * percent + 99) / 100;
+  if (rank == 0) rank = 1;
+  uint64_t seen = 0;
+  for (uint8_t bucket = 0; bucket < BUCKETS; bucket++) {
+    seen += _counts[bucket];
+    if (seen < rank) continue;
+    if (bucket == BUCKETS - 1) return _max;
+    uint32_t high = bucketHigh(bucket);
+    return high < _max ? high : _max;
+  }
+  return _max;
+}
+
+size_t LatencyHistogram::serialize(uint8_t* buffer, size_t size) const {
+  uint8_t data[MAX_SERIALIZED_SIZE];
+  size_t length = 0;
+  data[length++] = SERIALIZED_FORMAT;
+  data[length++] = SUB_BUCKET_BITS;
+  data[length++] = BUCKETS;
+  length += writeVarint(data + length, _max);
+
+  uint8_t nonEmpty = 0;
+  for (uint32_t count : _counts) {
+    if (count != 0) nonEmpty++;
+  }
+  data[length++] = nonEmpty;
+  int16_t previous = -1;
+  for (uint8_t bucket = 0; bucket < BUCKETS; bucket++) {
+    if (_counts[bucket] == 0) continue;
+    length += writeVarint(data + length, bucket - previous - 1);
+    length += writeVarint(data + length, _counts[bucket]);
+    previous = bucket;
+  }
+
+  if (length > size) return 0;
+  memcpy(buffer, data, length);
+  return length;
+}
+
+void LatencyHistogram::merge(LatencyHistogram const &other) {
+  for (uint8_t bucket = 0; bucket < BUCKETS; bucket++) _counts[bucket] += other._counts[bucket];
+  _count += other._count;
+  if (other._max > _max) _max = other._max;
+}
+
+bool LatencyHistogram::merge(const uint8_t* data, size_t length) {
+  // checked whole before anything is added
+  if (!_parse(data, length, false)) return false;
+  _parse(data, length, true);
+  return true;
+}
+
+bool LatencyHistogram::_parse(const uint8_t* data, size_t length, bool apply) {
+  if (length < 3 || data[0] != SERIALIZED_FORMAT || data[1] != SUB_BUCKET_BITS || data[2] != BUCKETS) return false;
+  size_t position = 3;
+  uint32_t max;
+  if (!readVarint(data, length, &position, &max)) return false;
+  if (position >= length) return false;
+  uint8_t nonEmpty = data[position++];
+
+  uint32_t bucket = 0;
+  for (uint8_t i = 0; i < nonEmpty; i++) {
+    uint32_t gap;
+    uint32_t count;
+    if (!readVarint(data, length, &position, &gap) || !readVarint(data, length, &position, &count)) return false;
+    bucket += gap;
+    if (bucket >= BUCKETS) return false;
+    if (apply) {
+      _counts[bucket] += count;
+      _count += count;
+    }
+    bucket++;
+  }
+  if (position != length) return false;
+  if (apply && max > _max) _max = max;
+  return true;
+}
+
+LatencyTracker::LatencyTracker()
+: _inFlight()
+, _inFlightCount(0) {
+}
+
+void LatencyTracker::sent(LatencyKind kind, uint16_t packetId, uint32_t now) {
+  if (_inFlightCount == ASYNC_MQTT_LATENCY_IN_FLIGHT) return;
+  InFlight &inFlight = _inFlight[_inFlightCount++];
+  inFlight.sentAt = now;
+  inFlight.packetId = packetId;
+  inFlight.kind = kind;
+}
+
+void LatencyTracker::completed(LatencyKind kind, uint16_t packetId, uint32_t now) {
+  for (uint8_t i = 0; i < _inFlightCount; i++) {
+    InFlight &inFlight = _inFlight[i];
+    if (inFlight.packetId != packetId || inFlight.kind != kind) continue;
+    if (kind == LatencyKind::PUBLISH) {
+      _publish.record(now - inFlight.sentAt);
+    } else {
+      _subscribe.record(now - inFlight.sentAt);
+    }
+    inFlight = _inFlight[--_inFlightCount];
+    return;
+  }
+}
+
+void LatencyTracker::forget(uint16_t packetId) {
+  for (uint8_t i = 0; i < _inFlightCount; i++) {
+    if (_inFlight[i].packetId != packetId) continue;
+    _inFlight[i] = _inFlight[--_inFlightCount];
+    return;
+  }
+}
+
+void LatencyTracker::clearInFlight() {
+  _inFlightCount = 0;
+}
+
+void LatencyTracker::reset() {
+  _publish.reset();
+  _subscribe.reset();
+}
+
+LatencyHistogram const &LatencyTracker::publish() const {
+  return _publish;
+}
+
+LatencyHistogram const &LatencyTracker::subscribe() const {
+  return _subscribe;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Round trip latency histograms of QoS 1/2 publishes and of subscriptions, see AsyncMqttClient::publishLatency()
+#ifndef ASYNC_MQTT_LATENCY
+#ifdef ESP8266
+#define ASYNC_MQTT_LATENCY 0
+#else
+#define ASYNC_MQTT_LATENCY 1
+#endif
+#endif
+
+// Exchanges timed at once, the ones sent while the table is full are not timed
+#ifndef ASYNC_MQTT_LATENCY_IN_FLIGHT
+#define ASYNC_MQTT_LATENCY_IN_FLIGHT 16
+#endif
+
+namespace AsyncMqttClientInternals {
+// Log-linear histogram of millisecond latencies: exact up to 7 ms, then four buckets per power of two, so a
+// percentile is off by 25 % at most. Latencies from 65535 ms up share the last bucket, max() stays exact.
+// The serialized form is portable and merges into any histogram, to aggregate the histograms of a fleet.
+class LatencyHistogram {
+ public:
+  static const uint8_t SUB_BUCKET_BITS = 2;
+  static const uint8_t BUCKETS = 60;
+  // format, sub-bucket bits, buckets, max, bucket count, then a (index gap, count) pair per non-empty bucket, as varints
+  static const size_t MAX_SERIALIZED_SIZE = 3 + 5 + 1 + BUCKETS * (1 + 5);
+
+  LatencyHistogram();
+
+  void record(uint32_t latency);
+  void reset();
+
+  uint32_t count() const;
+  uint32_t max() const;
+  // Upper bound of the bucket holding the percentile, never above max(), 0 when empty
+  uint32_t percentile(uint8_t percent) const;
+
+  // Bytes written, 0 if the buffer is too small
+  size_t serialize(uint8_t* buffer, size_t size) const;
+  void merge(LatencyHistogram const &other);
+  // False, leaving the histogram as it was, if the data is not a serialized histogram of the same layout
+  bool merge(const uint8_t* data, size_t length);
+
+  static uint8_t bucketOf(uint32_t latency);
+  static uint32_t bucketHigh(uint8_t bucket);
+
+ private:
+  uint32_t _counts[BUCKETS];
+  uint32_t _count;
+  uint32_t _max;
+
+  bool _parse(const uint8_t* data, size_t length, bool apply);
+};
+
+enum class LatencyKind : uint8_t {
+  PUBLISH,
+  SUBSCRIBE,
+  UNSUBSCRIBE
+};
+
+// Send times of the exchanges waiting for their ack, by packet identifier. Acks complete them into the publish or
+// the subscription (SUBACK and UNSUBACK) histogram.
+class LatencyTracker {
+ public:
+  LatencyTracker();
+
+  void sent(LatencyKind kind, uint16_t packetId, uint32_t now);
+  void completed(LatencyKind kind, uint16_t packetId, uint32_t now);
+  // a retransmission or a lost connection, the round trip cannot be told anymore
+  void forget(uint16_t packetId);
+  void clearInFlight();
+  void reset();
+
+  LatencyHistogram const &publish() const;
+  LatencyHistogram const &subscribe() const;
+
+ private:
+  struct InFlight {
+    uint32_t sentAt;
+    uint16_t packetId;
+    LatencyKind kind;
+  };
+
+  InFlight _inFlight[ASYNC_MQTT_LATENCY_IN_FLIGHT];
+  uint8_t _inFlightCount;
+  LatencyHistogram _publish;
+  LatencyHistogram _subscribe;
+};
+}  // namespace AsyncMqttClientInternals
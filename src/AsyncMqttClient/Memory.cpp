@@ -0,0 +1,123 @@
+#include "Memory.hpp"
+
+#ifdef ESP32
+#include <esp_heap_caps.h>
+#endif
+
+#ifndef ESP8266
+#include <atomic>
+#endif
+
+namespace AsyncMqttClientInternals {
+// blocks are released from the dispatch workers and the submitting tasks, except on ESP8266 where everything runs in one task
+#ifdef ESP8266
+typedef uint32_t MemoryCounter;
+#else
+typedef std::atomic<uint32_t> MemoryCounter;
+#endif
+
+struct MemoryTagCounters {
+  MemoryCounter live;
+  MemoryCounter peak;
+  MemoryCounter allocations;
+  MemoryCounter failures;
+};
+}  // namespace AsyncMqttClientInternals
+
+using AsyncMqttClientInternals::MemoryTagCounters;
+
+static void* heapAllocate(size_t size, AsyncMqttClientMemoryTag tag, void* context) {
+  (void)tag;
+  (void)context;
+  return malloc(size);
+}
+
+static void heapRelease(void* pointer, size_t size, AsyncMqttClientMemoryTag tag, void* context) {
+  (void)size;
+  (void)tag;
+  (void)context;
+  free(pointer);
+}
+
+// constant initialized, so in place before the constructors of clients declared at file scope
+static AsyncMqttClientAllocator currentAllocator = { heapAllocate, heapRelease, nullptr };
+static MemoryTagCounters counters[ASYNC_MQTT_MEMORY_TAGS];
+
+static const char* const TAG_NAMES[ASYNC_MQTT_MEMORY_TAGS] = { "parser", "topic", "queue", "tls", "reassembly", "settings", "transport", "client" };
+
+bool AsyncMqttClientInternals::setAllocator(AsyncMqttClientAllocator const &allocator) {
+  for (MemoryTagCounters const &tagCounters : counters) {
+    if (tagCounters.live != 0) return false;
+  }
+  currentAllocator = allocator.allocate && allocator.release ? allocator : heapAllocator();
+  return true;
+}
+
+AsyncMqttClientAllocator AsyncMqttClientInternals::heapAllocator() {
+  AsyncMqttClientAllocator allocator = { heapAllocate, heapRelease, nullptr };
+  return allocator;
+}
+
+AsyncMqttClientMemoryStats AsyncMqttClientInternals::memoryStats(AsyncMqttClientMemoryTag tag) {
+  MemoryTagCounters const &tagCounters = counters[static_cast<uint8_t>(tag)];
+  AsyncMqttClientMemoryStats stats;
+  stats.live = tagCounters.live;
+  stats.peak = tagCounters.peak;
+  stats.allocations = tagCounters.allocations;
+  stats.failures = tagCounters.failures;
+  return stats;
+}
+
+void AsyncMqttClientInternals::resetMemoryPeaks() {
+  for (MemoryTagCounters &tagCounters : counters) {
+    uint32_t live = tagCounters.live;
+    tagCounters.peak = live;
+  }
+}
+
+const char* AsyncMqttClientInternals::memoryTagName(AsyncMqttClientMemoryTag tag) {
+  return static_cast<uint8_t>(tag) < ASYNC_MQTT_MEMORY_TAGS ? TAG_NAMES[static_cast<uint8_t>(tag)] : "unknown";
+}
+
+void* AsyncMqttClientInternals::allocate(size_t size, AsyncMqttClientMemoryTag tag) {
+  MemoryTagCounters &tagCounters = counters[static_cast<uint8_t>(tag)];
+  void* pointer = currentAllocator.allocate(size, tag, currentAllocator.context);
+  if (!pointer) {
+    tagCounters.failures += 1;
+    return nullptr;
+  }
+  tagCounters.allocations += 1;
+  // a peak raised by two tasks at once may keep the lower value
+  uint32_t live = (tagCounters.live += size);
+  if (live > tagCounters.peak) tagCounters.peak = live;
+  return pointer;
+}
+
+void AsyncMqttClientInternals::release(void* pointer, size_t size, AsyncMqttClientMemoryTag tag) {
+  if (!pointer) return;
+  counters[static_cast<uint8_t>(tag)].live -= size;
+  currentAllocator.release(pointer, size, tag, currentAllocator.context);
+}
+
+#ifdef ESP32
+static void* capsAllocate(size_t size, AsyncMqttClientMemoryTag tag, void* context) {
+  uint32_t spiramTags = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(context));
+  if (spiramTags & AsyncMqttClientInternals::memoryTagBit(tag)) {
+    void* pointer = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (pointer) return pointer;
+  }
+  return heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+}
+
+static void capsRelease(void* pointer, size_t size, AsyncMqttClientMemoryTag tag, void* context) {
+  (void)size;
+  (void)tag;
+  (void)context;
+  heap_caps_free(pointer);
+}
+
+AsyncMqttClientAllocator AsyncMqttClientInternals::capsAllocator(uint32_t spiramTags) {
+  AsyncMqttClientAllocator allocator = { capsAllocate, capsRelease, reinterpret_cast<void*>(static_cast<uintptr_t>(spiramTags)) };
+  return allocator;
+}
+#endif
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <new>
+#include <utility>
+
+// What a block allocated by the client is for, see AsyncMqttClient::setAllocator()
+enum class AsyncMqttClientMemoryTag : uint8_t {
+  PARSER = 0,      // packet being parsed, decompression window
+  TOPIC = 1,       // topic buffers of received PUBLISH
+  QUEUE = 2,       // pending acks and PUBREL, submission queue, dispatch workers and their queues, duplicate filter, priority lanes, aggregation batch
+  TLS = 3,         // server fingerprints, the TLS buffers themselves belong to the TCP library
+  REASSEMBLY = 4,  // copies of the received messages handed to the dispatch workers
+  SETTINGS = 5,    // client ID, host, credentials and will
+  TRANSPORT = 6,   // send buffers and event lists of the POSIX transports
+  CLIENT = 7,      // timer wheel of a standalone client, default transport, clients of a manager
+};
+
+#define ASYNC_MQTT_MEMORY_TAGS 8
+
+// Hooks every allocation of the client goes through. release() is given the size and tag passed to allocate(),
+// allocate() returns nullptr when out of memory. Both may be called from the dispatch workers and the submitting tasks.
+struct AsyncMqttClientAllocator {
+  void* (*allocate)(size_t size, AsyncMqttClientMemoryTag tag, void* context);
+  void (*release)(void* pointer, size_t size, AsyncMqttClientMemoryTag tag, void* context);
+  void* context;
+};
+
+// Bytes allocated now and at most, number of allocations and of allocations that failed
+struct AsyncMqttClientMemoryStats {
+  uint32_t live;
+  uint32_t peak;
+  uint32_t allocations;
+  uint32_t failures;
+};
+
+namespace AsyncMqttClientInternals {
+// Fails while blocks are allocated, they must go back to the hooks that gave them
+bool setAllocator(AsyncMqttClientAllocator const &allocator);
+AsyncMqttClientAllocator heapAllocator();
+AsyncMqttClientMemoryStats memoryStats(AsyncMqttClientMemoryTag tag);
+void resetMemoryPeaks();
+const char* memoryTagName(AsyncMqttClientMemoryTag tag);
+
+constexpr uint32_t memoryTagBit(AsyncMqttClientMemoryTag tag) {
+  return 1UL << static_cast<uint8_t>(tag);
+}
+
+#ifdef ESP32
+// Tags of spiramTags (memoryTagBit() ored together) in PSRAM, falling back to internal RAM when it is full or absent, the others in internal RAM
+AsyncMqttClientAllocator capsAllocator(uint32_t spiramTags);
+#endif
+
+void* allocate(size_t size, AsyncMqttClientMemoryTag tag);
+void release(void* pointer, size_t size, AsyncMqttClientMemoryTag tag);
+
+// new and delete through the hooks, create() returns nullptr when out of memory
+template <typename T, typename... Args>
+T* create(AsyncMqttClientMemoryTag tag, Args&&... args) {
+  void* pointer = allocate(sizeof(T), tag);
+  return pointer ? new (pointer) T(std::forward<Args>(args)...) : nullptr;
+}
+
+template <typename T>
+void destroy(T* object, AsyncMqttClientMemoryTag tag) {
+  if (!object) return;
+  object->~T();
+  release(object, sizeof(T), tag);
+}
+
+template <typename T>
+T* createArray(size_t count, AsyncMqttClientMemoryTag tag) {
+  T* objects = static_cast<T*>(allocate(count * sizeof(T), tag));
+  if (objects) for (size_t i = 0; i < count; i++) new (&objects[i]) T();
+  return objects;
+}
+
+template <typename T>
+void destroyArray(T* objects, size_t count, AsyncMqttClientMemoryTag tag) {
+  if (!objects) return;
+  for (size_t i = 0; i < count; i++) objects[i].~T();
+  release(objects, count * sizeof(T), tag);
+}
+
+// Allocator of the standard containers, out of memory aborts like a failed new without exceptions
+template <typename T, AsyncMqttClientMemoryTag Tag>
+class TaggedAllocator {
+ public:
+  typedef T value_type;
+  template <typename U>
+  struct rebind {
+    typedef TaggedAllocator<U, Tag> other;
+  };
+
+  TaggedAllocator() {}
+  template <typename U>
+  TaggedAllocator(TaggedAllocator<U, Tag> const &other) { (void)other; }  // NOLINT(runtime/explicit)
+
+  T* allocate(size_t count) {
+    void* pointer = AsyncMqttClientInternals::allocate(count * sizeof(T), Tag);
+    if (!pointer) abort();
+    return static_cast<T*>(pointer);
+  }
+
+  void deallocate(T* pointer, size_t count) {
+    AsyncMqttClientInternals::release(pointer, count * sizeof(T), Tag);
+  }
+
+  template <typename U>
+  bool operator==(TaggedAllocator<U, Tag> const &other) const { (void)other; return true; }
+  template <typename U>
+  bool operator!=(TaggedAllocator<U, Tag> const &other) const { (void)other; return false; }
+};
+}  // namespace AsyncMqttClientInternals
@@ -0,0 +1,137 @@
+#include "MemoryPool.hpp"
+
+using AsyncMqttClientInternals::MemoryPool;
+using AsyncMqttClientInternals::MemoryPoolStats;
+
+MemoryPool::MemoryPool(void* arena, size_t size, std::initializer_list<PoolBlocks> blocks)
+: _classes()
+, _classCount(0)
+, _unused(0) {
+  uint8_t* position = static_cast<uint8_t*>(arena);
+  uint8_t* end = position + size;
+  size_t misalignment = reinterpret_cast<uintptr_t>(position) % ALIGNMENT;
+  if (misalignment != 0) position += size < ALIGNMENT - misalignment ? size : ALIGNMENT - misalignment;
+
+  for (PoolBlocks const &request : blocks) {
+    if (_classCount == ASYNC_MQTT_POOL_CLASSES || request.count == 0) continue;
+    size_t blockSize = request.blockSize < sizeof(FreeBlock) ? sizeof(FreeBlock) : request.blockSize;
+    blockSize = (blockSize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    size_t count = static_cast<size_t>(end - position) / blockSize;
+    if (count > request.count) count = request.count;
+    if (count == 0) continue;
+
+    // classes are kept by increasing block size, a size given twice gets two classes
+    uint8_t index = _classCount++;
+    while (index > 0 && _classes[index - 1].blockSize > blockSize) {
+      _classes[index] = _classes[index - 1];
+      index--;
+    }
+    BlockClass &blockClass = _classes[index];
+    blockClass.begin = position;
+    blockClass.end = position + count * blockSize;
+    blockClass.blockSize = blockSize;
+    blockClass.blocks = count;
+    blockClass.free = nullptr;
+    for (size_t i = count; i > 0; i--) {
+      FreeBlock* block = reinterpret_cast<FreeBlock*>(position + (i - 1) * blockSize);
+      block->next = blockClass.free;
+      blockClass.free = block;
+    }
+    blockClass.freeCount = count;
+    blockClass.minFree = count;
+    position = blockClass.end;
+  }
+  _unused = end - position;
+}
+
+void* MemoryPool::allocate(size_t size) {
+  _lockPool();
+  void* pointer = nullptr;
+  for (uint8_t i = 0; i < _classCount; i++) {
+    BlockClass &blockClass = _classes[i];
+    if (blockClass.blockSize < size || !blockClass.free) continue;
+    FreeBlock* block = blockClass.free;
+    blockClass.free = block->next;
+    if (--blockClass.freeCount < blockClass.minFree) blockClass.minFree = blockClass.freeCount;
+    pointer = block;
+    break;
+  }
+  _unlockPool();
+  return pointer;
+}
+
+void MemoryPool::release(void* pointer) {
+  if (!pointer) return;
+  _lockPool();
+  for (uint8_t i = 0; i < _classCount; i++) {
+    BlockClass &blockClass = _classes[i];
+    if (pointer < blockClass.begin || pointer >= blockClass.end) continue;
+    FreeBlock* block = static_cast<FreeBlock*>(pointer);
+    block->next = blockClass.free;
+    blockClass.free = block;
+    blockClass.freeCount++;
+    break;
+  }
+  _unlockPool();
+}
+
+bool MemoryPool::owns(void const *pointer) const {
+  for (uint8_t i = 0; i < _classCount; i++) {
+    if (pointer >= _classes[i].begin && pointer < _classes[i].end) return true;
+  }
+  return false;
+}
+
+uint8_t MemoryPool::sizes() const {
+  return _classCount;
+}
+
+MemoryPoolStats MemoryPool::stats(uint8_t index) const {
+  MemoryPoolStats stats = { 0, 0, 0, 0 };
+  if (index >= _classCount) return stats;
+  _lockPool();
+  BlockClass const &blockClass = _classes[index];
+  stats.blockSize = blockClass.blockSize;
+  stats.blocks = blockClass.blocks;
+  stats.free = blockClass.freeCount;
+  stats.minFree = blockClass.minFree;
+  _unlockPool();
+  return stats;
+}
+
+size_t MemoryPool::unused() const {
+  return _unused;
+}
+
+AsyncMqttClientAllocator MemoryPool::allocator() {
+  AsyncMqttClientAllocator allocator = { _allocate, _release, this };
+  return allocator;
+}
+
+#ifdef ESP8266
+// everything runs in the TCP task
+void MemoryPool::_lockPool() const {
+}
+
+void MemoryPool::_unlockPool() const {
+}
+#else
+void MemoryPool::_lockPool() const {
+  _lock.lock();
+}
+
+void MemoryPool::_unlockPool() const {
+  _lock.unlock();
+}
+#endif
+
+void* MemoryPool::_allocate(size_t size, AsyncMqttClientMemoryTag tag, void* pool) {
+  (void)tag;
+  return static_cast<MemoryPool*>(pool)->allocate(size);
+}
+
+void MemoryPool::_release(void* pointer, size_t size, AsyncMqttClientMemoryTag tag, void* pool) {
+  (void)size;
+  (void)tag;
+  static_cast<MemoryPool*>(pool)->release(pointer);
+}
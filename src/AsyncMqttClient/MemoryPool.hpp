@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <initializer_list>
+
+#ifndef ESP8266
+#include <mutex>
+#endif
+
+#include "Memory.hpp"
+
+// Most block sizes a MemoryPool holds
+#ifndef ASYNC_MQTT_POOL_CLASSES
+#define ASYNC_MQTT_POOL_CLASSES 8
+#endif
+
+namespace AsyncMqttClientInternals {
+struct PoolBlocks {
+  size_t blockSize;
+  size_t count;
+};
+
+// Blocks of a size, free ones now and at the fewest
+struct MemoryPoolStats {
+  size_t blockSize;
+  size_t blocks;
+  size_t free;
+  size_t minFree;
+};
+
+// Fixed-size blocks carved once from an arena handed by the caller, in a few sizes. An allocation takes a free block
+// of the smallest size that fits, of a larger size when those are all taken, and fails past that: the pool never
+// touches the heap, so it cannot fragment it. Block sizes are rounded up to ALIGNMENT.
+class MemoryPool {
+ public:
+  static const size_t ALIGNMENT = 8;
+
+  // Blocks that do not fit in the arena, or past ASYNC_MQTT_POOL_CLASSES sizes, are left out, see stats()
+  MemoryPool(void* arena, size_t size, std::initializer_list<PoolBlocks> blocks);
+
+  MemoryPool(MemoryPool const &) = delete;
+  MemoryPool& operator=(MemoryPool const &) = delete;
+
+  void* allocate(size_t size);
+  void release(void* pointer);
+  bool owns(void const *pointer) const;
+
+  uint8_t sizes() const;
+  MemoryPoolStats stats(uint8_t index) const;
+  // Arena bytes left out of the blocks
+  size_t unused() const;
+
+  // Hooks drawing every allocation of the client from this pool, for AsyncMqttClient::setAllocator()
+  AsyncMqttClientAllocator allocator();
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+  struct BlockClass {
+    uint8_t* begin;
+    uint8_t* end;
+    size_t blockSize;
+    size_t blocks;
+    FreeBlock* free;
+    size_t freeCount;
+    size_t minFree;
+  };
+
+  BlockClass _classes[ASYNC_MQTT_POOL_CLASSES];
+  uint8_t _classCount;
+  size_t _unused;
+#ifndef ESP8266
+  mutable std::mutex _lock;
+#endif
+
+  void _lockPool() const;
+  void _unlockPool() const;
+  static void* _allocate(size_t size, AsyncMqttClientMemoryTag tag, void* pool);
+  static void _release(void* pointer, size_t size, AsyncMqttClientMemoryTag tag, void* pool);
+};
+}  // namespace AsyncMqttClientInternals
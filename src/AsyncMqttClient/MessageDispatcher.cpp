@@ -0,0 +1,264 @@
+#include "MessageDispatcher.hpp"
+
+#if ASYNC_MQTT_MESSAGE_DISPATCH
+
+#ifdef ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#else
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+using AsyncMqttClientInternals::MessageDispatcher;
+
+#ifdef ESP32
+struct MessageDispatcher::Worker {
+  MessageDispatcher* dispatcher;
+  QueueHandle_t queue;
+  SemaphoreHandle_t stopped;
+};
+#else
+struct MessageDispatcher::Worker {
+  Worker() : dispatcher(nullptr), ring(nullptr), head(0), count(0) {}
+
+  MessageDispatcher* dispatcher;
+  std::mutex lock;
+  std::condition_variable readable;
+  std::condition_variable writable;
+  Message** ring;
+  uint16_t head;
+  uint16_t count;
+  std::thread thread;
+};
+#endif
+
+MessageDispatcher::MessageDispatcher()
+: _workers(nullptr)
+, _workerCount(0)
+, _depth(0)
+, _callback()
+, _overflowing(false)
+, _dispatched(0)
+, _dropped(0)
+, _stalls(0)
+, _overflows(0)
+, _queued(0)
+, _maxQueued(0)
+, _delay(0)
+, _maxDelay(0) {
+}
+
+MessageDispatcher::~MessageDispatcher() {
+  end();
+}
+
+bool MessageDispatcher::begin(uint8_t workers, uint16_t depth, OnMessageUserCallback const &callback) {
+  end();
+  if (workers == 0 || depth == 0) return false;
+
+#ifndef ESP32
+  // the rings of all workers in one block, allocated before any thread starts
+  Message** rings = static_cast<Message**>(allocate(workers * depth * sizeof(Message*), AsyncMqttClientMemoryTag::QUEUE));
+  if (!rings) return false;
+#endif
+  _workers = createArray<Worker>(workers, AsyncMqttClientMemoryTag::QUEUE);
+  if (!_workers) {
+#ifndef ESP32
+    release(rings, workers * depth * sizeof(Message*), AsyncMqttClientMemoryTag::QUEUE);
+#endif
+    return false;
+  }
+  _callback = callback;
+  _depth = depth;
+  _workerCount = workers;
+  _overflowing = false;
+  for (uint8_t i = 0; i < workers; i++) {
+    Worker* worker = &_workers[i];
+    worker->dispatcher = this;
+#ifdef ESP32
+    // out of memory for a queue or a task, the ones started so far stop again
+    worker->queue = xQueueCreate(depth, sizeof(Message*));
+    worker->stopped = worker->queue ? xSemaphoreCreateBinary() : nullptr;
+    if (!worker->stopped || xTaskCreatePinnedToCore(_task, "mqtt_dispatch", ASYNC_MQTT_DISPATCH_STACK_SIZE, worker,
+        ASYNC_MQTT_DISPATCH_PRIORITY, nullptr, ASYNC_MQTT_DISPATCH_CORE) != pdPASS) {
+      if (worker->stopped) vSemaphoreDelete(worker->stopped);
+      if (worker->queue) vQueueDelete(worker->queue);
+      _stop(i);
+      return false;
+    }
+#else
+    worker->ring = rings + i * depth;
+    worker->thread = std::thread(&MessageDispatcher::_run, this, worker);
+#endif
+  }
+  return true;
+}
+
+void MessageDispatcher::end() {
+  if (!_workers) return;
+  _stop(_workerCount);
+}
+
+void MessageDispatcher::_stop(uint8_t started) {
+  // a null message stops a worker once it handled the ones queued before it
+  for (uint8_t i = 0; i < started; i++) _push(&_workers[i], nullptr, false);
+  for (uint8_t i = 0; i < started; i++) {
+    Worker* worker = &_workers[i];
+#ifdef ESP32
+    xSemaphoreTake(worker->stopped, portMAX_DELAY);
+    vSemaphoreDelete(worker->stopped);
+    vQueueDelete(worker->queue);
+#else
+    worker->thread.join();
+#endif
+  }
+#ifndef ESP32
+  release(_workers[0].ring, _workerCount * _depth * sizeof(Message*), AsyncMqttClientMemoryTag::QUEUE);
+#endif
+  destroyArray(_workers, _workerCount, AsyncMqttClientMemoryTag::QUEUE);
+  _workers = nullptr;
+  _workerCount = 0;
+  _callback = OnMessageUserCallback();
+}
+
+bool MessageDispatcher::started() const {
+  return _workers != nullptr;
+}
+
+void MessageDispatcher::dispatch(char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+  // the chunks after an overflow would reach the handler without the start of their message
+  if (index == 0) _overflowing = false;
+  if (_overflowing) return;
+
+  size_t topicLength = strlen(topic);
+  Message* message = static_cast<Message*>(allocate(sizeof(Message) + topicLength + 1 + len, AsyncMqttClientMemoryTag::REASSEMBLY));
+  if (!message) {
+    _dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  message->properties = properties;
+  message->len = len;
+  message->index = index;
+  message->total = total;
+  message->topicLength = topicLength;
+  memcpy(message->topic(), topic, topicLength + 1);
+  if (len > 0) memcpy(message->payload(), payload, len);
+
+  // FNV-1a of the topic picks the worker
+  uint32_t hash = 2166136261UL;
+  for (size_t i = 0; i < topicLength; i++) {
+    hash ^= static_cast<uint8_t>(topic[i]);
+    hash *= 16777619UL;
+  }
+
+  // counted before the push, a worker may handle the message right away
+  uint32_t queued = _queued.fetch_add(1, std::memory_order_relaxed) + 1;
+  message->enqueued = micros();
+  switch (_push(&_workers[hash % _workerCount], message, true)) {
+    case PushResult::STALLED:
+      _stalls.fetch_add(1, std::memory_order_relaxed);
+      // fall through
+    case PushResult::QUEUED:
+      // the network task is the only one raising these
+      if (queued > _maxQueued.load(std::memory_order_relaxed)) _maxQueued.store(queued, std::memory_order_relaxed);
+      _dispatched.fetch_add(1, std::memory_order_relaxed);
+      break;
+    case PushResult::FULL:
+      _queued.fetch_sub(1, std::memory_order_relaxed);
+      _overflows.fetch_add(1, std::memory_order_relaxed);
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      _overflowing = index + len < total;
+      release(message, sizeof(Message) + topicLength + 1 + len, AsyncMqttClientMemoryTag::REASSEMBLY);
+      break;
+  }
+}
+
+AsyncMqttClientDispatchStats MessageDispatcher::stats() const {
+  AsyncMqttClientDispatchStats stats;
+  stats.dispatched = _dispatched.load(std::memory_order_relaxed);
+  stats.dropped = _dropped.load(std::memory_order_relaxed);
+  stats.stalls = _stalls.load(std::memory_order_relaxed);
+  stats.overflows = _overflows.load(std::memory_order_relaxed);
+  stats.queued = _queued.load(std::memory_order_relaxed);
+  stats.maxQueued = _maxQueued.load(std::memory_order_relaxed);
+  stats.delay = _delay.load(std::memory_order_relaxed);
+  stats.maxDelay = _maxDelay.load(std::memory_order_relaxed);
+  return stats;
+}
+
+#ifdef ESP32
+MessageDispatcher::PushResult MessageDispatcher::_push(Worker* worker, Message* message, bool bounded) {
+  if (xQueueSend(worker->queue, &message, 0) == pdTRUE) return PushResult::QUEUED;
+  TickType_t timeout = bounded ? pdMS_TO_TICKS(ASYNC_MQTT_DISPATCH_TIMEOUT) : portMAX_DELAY;
+  if (timeout == 0 || xQueueSend(worker->queue, &message, timeout) != pdTRUE) return PushResult::FULL;
+  return PushResult::STALLED;
+}
+
+MessageDispatcher::Message* MessageDispatcher::_pop(Worker* worker) {
+  Message* message = nullptr;
+  xQueueReceive(worker->queue, &message, portMAX_DELAY);
+  return message;
+}
+
+void MessageDispatcher::_task(void* worker) {
+  Worker* self = static_cast<Worker*>(worker);
+  self->dispatcher->_run(self);
+  xSemaphoreGive(self->stopped);
+  vTaskDelete(nullptr);
+}
+#else
+MessageDispatcher::PushResult MessageDispatcher::_push(Worker* worker, Message* message, bool bounded) {
+  std::unique_lock<std::mutex> guard(worker->lock);
+  bool stalled = worker->count == _depth;
+  auto room = [this, worker]() { return worker->count < _depth; };
+  if (!bounded) {
+    worker->writable.wait(guard, room);
+  } else if (!worker->writable.wait_for(guard, std::chrono::milliseconds(ASYNC_MQTT_DISPATCH_TIMEOUT), room)) {
+    return PushResult::FULL;
+  }
+  worker->ring[(worker->head + worker->count) % _depth] = message;
+  worker->count++;
+  guard.unlock();
+  worker->readable.notify_one();
+  return stalled ? PushResult::STALLED : PushResult::QUEUED;
+}
+
+MessageDispatcher::Message* MessageDispatcher::_pop(Worker* worker) {
+  std::unique_lock<std::mutex> guard(worker->lock);
+  worker->readable.wait(guard, [worker]() { return worker->count != 0; });
+  Message* message = worker->ring[worker->head];
+  worker->head = (worker->head + 1) % _depth;
+  worker->count--;
+  guard.unlock();
+  worker->writable.notify_one();
+  return message;
+}
+#endif
+
+void MessageDispatcher::_run(Worker* worker) {
+  while (Message* message = _pop(worker)) _handle(message);
+}
+
+void MessageDispatcher::_handle(Message* message) {
+  _queued.fetch_sub(1, std::memory_order_relaxed);
+
+  // smoothed with a gain of 1/8 over the messages of all workers, an update racing another one may be lost
+  uint32_t delay = micros() - message->enqueued;
+  uint32_t smoothed = _delay.load(std::memory_order_relaxed);
+  _delay.store(smoothed - smoothed / 8 + delay / 8, std::memory_order_relaxed);
+  uint32_t maxDelay = _maxDelay.load(std::memory_order_relaxed);
+  while (delay > maxDelay && !_maxDelay.compare_exchange_weak(maxDelay, delay, std::memory_order_relaxed)) {}
+
+  if (_callback) {
+    _callback(message->topic(), message->total == 0 ? nullptr : message->payload(), message->properties,
+      message->len, message->index, message->total);
+  }
+  release(message, sizeof(Message) + message->topicLength + 1 + message->len, AsyncMqttClientMemoryTag::REASSEMBLY);
+}
+
+#endif
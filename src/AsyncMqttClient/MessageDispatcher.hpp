@@ -0,0 +1,123 @@
+#pragma once
+
+#include "Arduino.h"
+#include "Callbacks.hpp"
+#include "Memory.hpp"
+
+// onMessage handlers run on worker tasks or threads instead of the network task, see setMessageDispatch()
+#ifndef ASYNC_MQTT_MESSAGE_DISPATCH
+#if defined(ESP32) || (defined(__linux__) && !defined(ESP8266))
+#define ASYNC_MQTT_MESSAGE_DISPATCH 1
+#else
+#define ASYNC_MQTT_MESSAGE_DISPATCH 0
+#endif
+#endif
+
+// FreeRTOS stack size, priority and core of the dispatch tasks
+#ifndef ASYNC_MQTT_DISPATCH_STACK_SIZE
+#define ASYNC_MQTT_DISPATCH_STACK_SIZE 4096
+#endif
+
+#ifndef ASYNC_MQTT_DISPATCH_PRIORITY
+#define ASYNC_MQTT_DISPATCH_PRIORITY 1
+#endif
+
+#ifndef ASYNC_MQTT_DISPATCH_CORE
+#define ASYNC_MQTT_DISPATCH_CORE tskNO_AFFINITY
+#endif
+
+// Milliseconds the network task waits for room in a full worker queue before dropping the message, 0 never waits
+#ifndef ASYNC_MQTT_DISPATCH_TIMEOUT
+#define ASYNC_MQTT_DISPATCH_TIMEOUT 100
+#endif
+
+#if ASYNC_MQTT_MESSAGE_DISPATCH
+
+#include <atomic>
+
+// Delays in microseconds, from the network task handing a message over to a worker picking it up.
+// Messages dropped because no memory was left to copy them, or because their worker queue stayed full.
+struct AsyncMqttClientDispatchStats {
+  uint32_t dispatched;
+  uint32_t dropped;
+  uint32_t stalls;
+  uint32_t overflows;
+  uint32_t queued;
+  uint32_t maxQueued;
+  uint32_t delay;
+  uint32_t maxDelay;
+};
+
+namespace AsyncMqttClientInternals {
+// Runs the onMessage handler on a few workers. Each topic always goes to the same worker, so the messages
+// (and the chunks of a message) of a topic keep their order while different topics are handled in parallel.
+// A worker queue holds at most depth messages, past that the network task waits for room (a stall), which holds up
+// the reading of the connection and so the broker, for at most ASYNC_MQTT_DISPATCH_TIMEOUT; then the message is dropped
+// (an overflow), with the rest of it when it comes in chunks.
+class MessageDispatcher {
+ public:
+  MessageDispatcher();
+  ~MessageDispatcher();
+
+  MessageDispatcher(MessageDispatcher const &) = delete;
+  MessageDispatcher& operator=(MessageDispatcher const &) = delete;
+
+  // The workers call a copy of callback, which stays until end(). False when the tasks could not be created
+  bool begin(uint8_t workers, uint16_t depth, OnMessageUserCallback const &callback);
+  // Waits for the queued messages to be handled
+  void end();
+  bool started() const;
+
+  // Network task, copies the message through the allocator hooks (REASSEMBLY), drops it when out of memory
+  void dispatch(char const *topic, char const *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total);
+
+  AsyncMqttClientDispatchStats stats() const;
+
+ private:
+  struct Message {
+    uint32_t enqueued;
+    AsyncMqttClientMessageProperties properties;
+    size_t len;
+    size_t index;
+    size_t total;
+    size_t topicLength;
+
+    char* topic() { return reinterpret_cast<char*>(this + 1); }
+    char* payload() { return topic() + topicLength + 1; }
+  };
+  struct Worker;
+
+  Worker* _workers;
+  uint8_t _workerCount;
+  uint16_t _depth;
+  OnMessageUserCallback _callback;
+  bool _overflowing;  // the message being dispatched in chunks lost one
+
+  std::atomic<uint32_t> _dispatched;
+  std::atomic<uint32_t> _dropped;
+  std::atomic<uint32_t> _stalls;
+  std::atomic<uint32_t> _overflows;
+  std::atomic<uint32_t> _queued;
+  std::atomic<uint32_t> _maxQueued;
+  std::atomic<uint32_t> _delay;
+  std::atomic<uint32_t> _maxDelay;
+
+  enum class PushResult : uint8_t {
+    QUEUED,
+    STALLED,  // queued after waiting for room
+    FULL
+  };
+
+  void _stop(uint8_t started);
+  // bounded: for ASYNC_MQTT_DISPATCH_TIMEOUT at most, otherwise until there is room
+  PushResult _push(Worker* worker, Message* message, bool bounded);
+  Message* _pop(Worker* worker);
+  void _run(Worker* worker);
+  void _handle(Message* message);
+#ifdef ESP32
+  static void _task(void* worker);
+#endif
+};
+}  // namespace AsyncMqttClientInternals
+
+#endif
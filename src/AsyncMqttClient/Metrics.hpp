@@ -0,0 +1,196 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "DisconnectReasons.hpp"
+#include "SubmissionQueue.hpp"
+
+// Protocol counters of each client, see AsyncMqttClient::metrics(). 0 compiles them out.
+#ifndef ASYNC_MQTT_METRICS
+#define ASYNC_MQTT_METRICS 1
+#endif
+
+// Why publish(), publishCbor() or submitPublish() returned 0
+enum class AsyncMqttClientPublishRejection : uint8_t {
+  NOT_CONNECTED = 0,
+  NO_SPACE = 1,  // the transport buffer cannot take the packet yet
+  QUEUE_CLOSED = 2,  // submitted while the connection is down
+  QUEUE_FULL = 3,  // past the depth or the entry size of the submission queue
+  COMPRESSED_TOPIC = 4,  // publishCbor() to a topic of addCompressedTopics(), whose payload it cannot compress
+  PAYLOAD_MISMATCH = 5,  // publishCbor() wrote another payload than it sized: sent cut or padded with zeros all the same
+  RATE_LIMITED = 6  // held back by the rate controller
+};
+
+#define ASYNC_MQTT_PUBLISH_REJECTIONS 7
+#define ASYNC_MQTT_DISCONNECT_REASONS 9
+
+// Counters wrap around, readers take differences between snapshots.
+// Packets and bytes (fixed header included) are indexed by control packet type, 1 (CONNECT) to 14 (DISCONNECT).
+// Disconnections are indexed by AsyncMqttClientDisconnectReason, refused connections included.
+// Ping round trips are in milliseconds.
+struct AsyncMqttClientMetrics {
+  uint32_t packetsIn[16];
+  uint32_t bytesIn[16];
+  uint32_t packetsOut[16];
+  uint32_t bytesOut[16];
+  uint32_t publishRejected[ASYNC_MQTT_PUBLISH_REJECTIONS];
+
+  uint32_t ackBacklogPeak;
+  uint32_t acksDeferred;  // sends of queued acks put off for lack of room in the transport
+  uint32_t acksDropped;  // past the ack queue of a fixed storage
+
+  uint32_t connects;
+  uint32_t disconnects[ASYNC_MQTT_DISCONNECT_REASONS];
+
+  uint32_t pings;
+  uint32_t pingTimeouts;
+  uint32_t pingRtt;
+  uint32_t maxPingRtt;
+  uint32_t totalPingRtt;
+  uint32_t pingResponses;
+
+  uint32_t unexpectedPackets;  // types a broker never sends, the connection is closed
+  uint32_t malformedLengths;  // remaining lengths over 4 bytes, the connection is closed
+  uint32_t parserOutOfMemory;
+  uint32_t decompressionErrors;  // compressed payloads found malformed, the message is dropped
+  uint32_t duplicatesDropped;  // QoS 1 redeliveries of messages already handled, see setDuplicateFilter()
+};
+
+namespace AsyncMqttClientInternals {
+#if ASYNC_MQTT_METRICS
+// Plain increments from the network task. Submissions are rejected in other tasks, those counters are atomic.
+class Metrics {
+ public:
+  Metrics() {
+    reset();
+  }
+
+  void packetIn(uint8_t type, uint32_t bytes) {
+    _counters.packetsIn[type]++;
+    _counters.bytesIn[type] += bytes;
+  }
+
+  void packetOut(uint8_t type, uint32_t bytes) {
+    _counters.packetsOut[type]++;
+    _counters.bytesOut[type] += bytes;
+  }
+
+  void publishRejected(AsyncMqttClientPublishRejection cause) {
+    _counters.publishRejected[static_cast<uint8_t>(cause)]++;
+  }
+
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+  void submissionRejected(AsyncMqttClientPublishRejection cause) {
+    if (cause == AsyncMqttClientPublishRejection::QUEUE_CLOSED) {
+      _submissionsClosed.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      _submissionsFull.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+#endif
+
+  void ackBacklog(size_t size) {
+    if (size > _counters.ackBacklogPeak) _counters.ackBacklogPeak = size;
+  }
+
+  void ackDeferred() {
+    _counters.acksDeferred++;
+  }
+
+  void ackDropped() {
+    _counters.acksDropped++;
+  }
+
+  void connected() {
+    _counters.connects++;
+  }
+
+  void disconnected(AsyncMqttClientDisconnectReason reason) {
+    if (static_cast<uint8_t>(reason) < ASYNC_MQTT_DISCONNECT_REASONS) _counters.disconnects[static_cast<uint8_t>(reason)]++;
+  }
+
+  void pingSent() {
+    _counters.pings++;
+  }
+
+  void pingTimedOut() {
+    _counters.pingTimeouts++;
+  }
+
+  void pingAnswered(uint32_t rtt) {
+    _counters.pingRtt = rtt;
+    if (rtt > _counters.maxPingRtt) _counters.maxPingRtt = rtt;
+    _counters.totalPingRtt += rtt;
+    _counters.pingResponses++;
+  }
+
+  void unexpectedPacket() {
+    _counters.unexpectedPackets++;
+  }
+
+  void malformedLength() {
+    _counters.malformedLengths++;
+  }
+
+  void parserOutOfMemory() {
+    _counters.parserOutOfMemory++;
+  }
+
+  void decompressionError() {
+    _counters.decompressionErrors++;
+  }
+
+  void duplicateDropped() {
+    _counters.duplicatesDropped++;
+  }
+
+  // a copy taken from another task may mix counters from before and after an update
+  AsyncMqttClientMetrics snapshot() const {
+    AsyncMqttClientMetrics counters = _counters;
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+    counters.publishRejected[static_cast<uint8_t>(AsyncMqttClientPublishRejection::QUEUE_CLOSED)] = _submissionsClosed.load(std::memory_order_relaxed);
+    counters.publishRejected[static_cast<uint8_t>(AsyncMqttClientPublishRejection::QUEUE_FULL)] = _submissionsFull.load(std::memory_order_relaxed);
+#endif
+    return counters;
+  }
+
+  void reset() {
+    memset(&_counters, 0, sizeof(_counters));
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+    _submissionsClosed = 0;
+    _submissionsFull = 0;
+#endif
+  }
+
+ private:
+  AsyncMqttClientMetrics _counters;
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+  std::atomic<uint32_t> _submissionsClosed;
+  std::atomic<uint32_t> _submissionsFull;
+#endif
+};
+#else
+// ASYNC_MQTT_METRICS 0, every update is optimized away
+class Metrics {
+ public:
+  void packetIn(uint8_t type, uint32_t bytes) { (void)type; (void)bytes; }
+  void packetOut(uint8_t type, uint32_t bytes) { (void)type; (void)bytes; }
+  void publishRejected(AsyncMqttClientPublishRejection cause) { (void)cause; }
+  void submissionRejected(AsyncMqttClientPublishRejection cause) { (void)cause; }
+  void ackBacklog(size_t size) { (void)size; }
+  void ackDeferred() {}
+  void ackDropped() {}
+  void connected() {}
+  void disconnected(AsyncMqttClientDisconnectReason reason) { (void)reason; }
+  void pingSent() {}
+  void pingTimedOut() {}
+  void pingAnswered(uint32_t rtt) { (void)rtt; }
+  void unexpectedPacket() {}
+  void malformedLength() {}
+  void parserOutOfMemory() {}
+  void decompressionError() {}
+  void duplicateDropped() {}
+};
+#endif
+}  // namespace AsyncMqttClientInternals
@@ -14,9 +14,9 @@ ConnAckPacket::~ConnAckPacket() {
 }
 
 void ConnAckPacket::parseVariableHeader(char* data, size_t len, size_t* currentBytePosition) {
-  char currentByte = data[(*currentBytePosition)++];
+  uint8_t currentByte = data[(*currentBytePosition)++];
   if (_bytePosition++ == 0) {
-    _sessionPresent = (currentByte << 7) >> 7;
+    _sessionPresent = currentByte & 0x01;
   } else {
     _connectReturnCode = currentByte;
     _parsingInformation->bufferState = BufferState::NONE;
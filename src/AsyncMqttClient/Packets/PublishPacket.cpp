@@ -37,12 +37,13 @@ PublishPacket::~PublishPacket() {
 }
 
 void PublishPacket::parseVariableHeader(char* data, size_t len, size_t* currentBytePosition) {
-  char currentByte = data[(*currentBytePosition)++];
+  uint8_t currentByte = data[(*currentBytePosition)++];
   if (_bytePosition == 0) {
     _topicLengthMsb = currentByte;
   } else if (_bytePosition == 1) {
     _topicLength = currentByte | _topicLengthMsb << 8;
-    if (_topicLength > _parsingInformation->maxTopicLength) {
+    // too long, or no buffer was left for the topic
+    if (_topicLength > _parsingInformation->maxTopicLength || !_parsingInformation->topicBuffer) {
       _ignore = true;
     } else {
       _parsingInformation->topicBuffer[_topicLength] = '\0';
@@ -58,7 +59,9 @@ void PublishPacket::parseVariableHeader(char* data, size_t len, size_t* currentB
     _packetIdMsb = currentByte;
   } else {
     _packetId = currentByte | _packetIdMsb << 8;
+    // an empty payload completes the packet, which is freed then
     _preparePayloadHandling(_parsingInformation->remainingLength - (_bytePosition + 1));
+    return;
   }
   _bytePosition++;
 }
@@ -27,10 +27,10 @@ class PublishPacket : public Packet {
   bool _retain;
 
   uint8_t _bytePosition;
-  char _topicLengthMsb;
+  uint8_t _topicLengthMsb;
   uint16_t _topicLength;
   bool _ignore;
-  char _packetIdMsb;
+  uint8_t _packetIdMsb;
   uint16_t _packetId;
   uint32_t _payloadLength;
   uint32_t _payloadBytesRead;
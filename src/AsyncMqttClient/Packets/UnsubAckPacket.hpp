@@ -19,7 +19,7 @@ class UnsubAckPacket : public Packet {
   OnUnsubAckInternalCallback _callback;
 
   uint8_t _bytePosition;
-  char _packetIdMsb;
+  uint8_t _packetIdMsb;
   uint16_t _packetId;
 };
 }  // namespace AsyncMqttClientInternals
@@ -5,7 +5,8 @@ enum class BufferState : uint8_t {
   NONE = 0,
   REMAINING_LENGTH = 2,
   VARIABLE_HEADER = 3,
-  PAYLOAD = 4
+  PAYLOAD = 4,
+  DISCARD = 5  // out of memory, until the connection is closed
 };
 
 struct ParsingInformation {
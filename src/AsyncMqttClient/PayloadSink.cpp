@@ -0,0 +1,138 @@
+#include "PayloadSink.hpp"
+
+#include <string.h>
+
+#include "TopicFilter.hpp"
+
+using AsyncMqttClientInternals::PayloadSink;
+
+PayloadSink::PayloadSink(SinkStorage* storage, uint8_t* buffer, size_t size)
+: _storage(storage)
+, _pages { buffer, buffer + size / 2 }
+, _pageSize(size / 2)
+, _onComplete()
+, _filter()
+, _topic()
+, _result()
+, _crc32()
+, _sha256()
+, _page(0)
+, _pageLength(0)
+, _written(0)
+, _pending(false)
+, _expectCrc32(false)
+, _expectSha256(false)
+, _expectedCrc32(0)
+, _expectedSha256() {
+}
+
+PayloadSink& PayloadSink::onComplete(OnSinkCompleteUserCallback const &callback) {
+  _onComplete = callback;
+  return *this;
+}
+
+PayloadSink& PayloadSink::expectCrc32(uint32_t crc32) {
+  _expectCrc32 = true;
+  _expectedCrc32 = crc32;
+  return *this;
+}
+
+PayloadSink& PayloadSink::expectSha256(const uint8_t sha256[32]) {
+  _expectSha256 = true;
+  memcpy(_expectedSha256, sha256, sizeof(_expectedSha256));
+  return *this;
+}
+
+bool PayloadSink::setFilter(const char* filter) {
+  return _filter.assign(filter, strlen(filter));
+}
+
+bool PayloadSink::matches(const char* topic, size_t topicLength) const {
+  return !_filter.empty() && topicMatches(_filter.c_str(), topic, topicLength);
+}
+
+void PayloadSink::begin(char const *topic, size_t total) {
+  _topic.assign(topic, strlen(topic));
+  memset(&_result, 0, sizeof(_result));
+  _result.total = total;
+  _crc32 = Crc32();
+  _sha256 = Sha256();
+  _page = 0;
+  _pageLength = 0;
+  _written = 0;
+  _pending = false;
+  if (_pageSize == 0 || !_storage->begin(topic, total)) _result.error = AsyncMqttClientSinkError::BEGIN;
+}
+
+void PayloadSink::write(const char* data, size_t length) {
+  if (length == 0) return;
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  _result.size += length;
+  _crc32.update(bytes, length);
+  _sha256.update(bytes, length);
+  // past a failure, the rest is only checked
+  if (_result.error != AsyncMqttClientSinkError::NONE) return;
+
+  while (length > 0) {
+    size_t taken = _pageSize - _pageLength < length ? _pageSize - _pageLength : length;
+    memcpy(_pages[_page] + _pageLength, bytes, taken);
+    _pageLength += taken;
+    bytes += taken;
+    length -= taken;
+    if (_pageLength == _pageSize) {
+      _flush();
+      if (_result.error != AsyncMqttClientSinkError::NONE) return;
+    }
+  }
+}
+
+void PayloadSink::end() {
+  if (_result.error == AsyncMqttClientSinkError::NONE && _pageLength > 0) _flush();
+  if (_pending && !_storage->wait() && _result.error == AsyncMqttClientSinkError::NONE) _result.error = AsyncMqttClientSinkError::WRITE;
+  _pending = false;
+
+  _result.crc32 = _crc32.value();
+  _sha256.finish(_result.sha256);
+  if (_result.error == AsyncMqttClientSinkError::NONE) {
+    if ((_expectCrc32 && _result.crc32 != _expectedCrc32) || (_expectSha256 && memcmp(_result.sha256, _expectedSha256, sizeof(_expectedSha256)) != 0)) {
+      _result.error = AsyncMqttClientSinkError::CHECKSUM;
+    }
+  }
+  _complete(_result.error);
+}
+
+void PayloadSink::abort() {
+  if (_pending) _storage->wait();
+  _pending = false;
+  _result.crc32 = _crc32.value();
+  _sha256.finish(_result.sha256);
+  _complete(_result.error == AsyncMqttClientSinkError::NONE ? AsyncMqttClientSinkError::INTERRUPTED : _result.error);
+}
+
+// the storage writes the full page while the other fills up, once it is done with the one before
+void PayloadSink::_flush() {
+  if (_pending && !_storage->wait()) {
+    _result.error = AsyncMqttClientSinkError::WRITE;
+    _pending = false;
+    return;
+  }
+  _pending = _storage->write(_pages[_page], _pageLength, _written);
+  if (!_pending) {
+    _result.error = AsyncMqttClientSinkError::WRITE;
+    return;
+  }
+  _written += _pageLength;
+  _page ^= 1;
+  _pageLength = 0;
+}
+
+void PayloadSink::_complete(AsyncMqttClientSinkError error) {
+  bool begun = _result.error != AsyncMqttClientSinkError::BEGIN;
+  _result.error = error;
+  if (begun && !_storage->end(error == AsyncMqttClientSinkError::NONE) && error == AsyncMqttClientSinkError::NONE) {
+    _result.error = AsyncMqttClientSinkError::COMMIT;
+  }
+  _expectCrc32 = false;
+  _expectSha256 = false;
+  if (_onComplete) _onComplete(_topic.c_str(), _result);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "BoundedString.hpp"
+#include "Callbacks.hpp"
+#include "Integrity.hpp"
+
+// Sinks a client can route messages to, see addPayloadSink(). Off by default, 2 compiles in room for two.
+#ifndef ASYNC_MQTT_PAYLOAD_SINKS
+#define ASYNC_MQTT_PAYLOAD_SINKS 0
+#endif
+
+// Why a message routed to a payload sink was not kept
+enum class AsyncMqttClientSinkError : uint8_t {
+  NONE = 0,
+  BEGIN = 1,        // the storage refused the message
+  WRITE = 2,        // a page could not be written
+  INTERRUPTED = 3,  // the connection was lost within the message
+  CHECKSUM = 4,     // the message does not match the expected CRC-32 or SHA-256
+  COMMIT = 5        // the storage could not keep the message
+};
+
+struct AsyncMqttClientSinkResult {
+  AsyncMqttClientSinkError error;
+  uint32_t size;  // bytes received
+  uint32_t total;  // bytes announced
+  uint32_t crc32;
+  uint8_t sha256[32];  // of the bytes received
+};
+
+namespace AsyncMqttClientInternals {
+// Where a payload sink writes a message, page by page: flash through the ESP Update class, a file on Linux
+class SinkStorage {
+ public:
+  virtual ~SinkStorage() {}
+
+  // a message of total bytes starts, false to refuse it
+  virtual bool begin(char const *topic, size_t total) = 0;
+  // A page of the message at offset, a multiple of the page size, the last page shorter. The storage may write it
+  // in the background: wait() is called before the next write() and before end(), the page is reused after it.
+  // The last page stays untouched until end().
+  virtual bool write(const uint8_t* data, size_t length, size_t offset) = 0;
+  // false if the page of the last write() failed
+  virtual bool wait() { return true; }
+  // keeps the message, or discards it
+  virtual bool end(bool commit) = 0;
+};
+
+typedef UserCallback<void(char const *topic, AsyncMqttClientSinkResult const &result)> OnSinkCompleteUserCallback;
+
+// Writes the messages of a topic filter to a storage as they arrive, instead of handing them to onMessage().
+// The buffer is split into two pages: one fills up while the storage writes the other. CRC-32 and SHA-256 are
+// computed on the way, the message is discarded when they differ from the ones expected, and the completion
+// handler is told how each message ended.
+class PayloadSink {
+ public:
+  PayloadSink(SinkStorage* storage, uint8_t* buffer, size_t size);
+
+  PayloadSink(PayloadSink const &) = delete;
+  PayloadSink& operator=(PayloadSink const &) = delete;
+
+  PayloadSink& onComplete(OnSinkCompleteUserCallback const &callback);
+  // checks of the next message only, for instance from a manifest received before it
+  PayloadSink& expectCrc32(uint32_t crc32);
+  PayloadSink& expectSha256(const uint8_t sha256[32]);
+
+  // AsyncMqttClient, network task
+  bool setFilter(const char* filter);
+  bool matches(const char* topic, size_t topicLength) const;
+  void begin(char const *topic, size_t total);
+  void write(const char* data, size_t length);
+  void end();
+  void abort();
+
+ private:
+  SinkStorage* _storage;
+  uint8_t* _pages[2];
+  size_t _pageSize;
+  OnSinkCompleteUserCallback _onComplete;
+  BoundedString _filter;
+  BoundedString _topic;
+
+  AsyncMqttClientSinkResult _result;
+  Crc32 _crc32;
+  Sha256 _sha256;
+  uint8_t _page;
+  size_t _pageLength;
+  size_t _written;
+  bool _pending;
+  bool _expectCrc32;
+  bool _expectSha256;
+  uint32_t _expectedCrc32;
+  uint8_t _expectedSha256[32];
+
+  void _flush();
+  void _complete(AsyncMqttClientSinkError error);
+};
+}  // namespace AsyncMqttClientInternals
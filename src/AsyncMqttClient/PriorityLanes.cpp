@@ -0,0 +1,170 @@
+#include "PriorityLanes.hpp"
+
+#if ASYNC_MQTT_PRIORITY_LANES
+
+#include <string.h>
+
+#include "Memory.hpp"
+#include "TopicFilter.hpp"
+
+using AsyncMqttClientInternals::LaneEntry;
+using AsyncMqttClientInternals::PriorityLanes;
+
+PriorityLanes::PriorityLanes()
+: _lanes()
+, _filters()
+, _priorities() {
+}
+
+PriorityLanes::~PriorityLanes() {
+  _release();
+}
+
+bool PriorityLanes::begin(size_t high, size_t normal, size_t bulk) {
+  _release();
+  const size_t sizes[PRIORITY_LANES] = { high, normal, bulk };
+  for (uint8_t i = 0; i < PRIORITY_LANES; i++) {
+    // entries stay aligned for their header
+    size_t size = sizes[i] / alignof(LaneEntry) * alignof(LaneEntry);
+    if (size == 0) continue;
+    _lanes[i].buffer = static_cast<uint8_t*>(allocate(size, AsyncMqttClientMemoryTag::QUEUE));
+    if (!_lanes[i].buffer) {
+      _release();
+      return false;
+    }
+    _lanes[i].size = size;
+  }
+  return true;
+}
+
+bool PriorityLanes::enabled() const {
+  for (Lane const &lane : _lanes) {
+    if (lane.buffer) return true;
+  }
+  return false;
+}
+
+bool PriorityLanes::addFilter(const char* filter, AsyncMqttClientPriority priority) {
+  for (uint8_t i = 0; i < ASYNC_MQTT_PRIORITY_FILTERS; i++) {
+    if (!_filters[i].empty()) continue;
+    _priorities[i] = priority;
+    return _filters[i].assign(filter, strlen(filter));
+  }
+  return false;
+}
+
+AsyncMqttClientPriority PriorityLanes::classify(const char* topic, size_t topicLength) const {
+  for (uint8_t i = 0; i < ASYNC_MQTT_PRIORITY_FILTERS; i++) {
+    if (_filters[i].empty()) break;
+    if (topicMatches(_filters[i].c_str(), topic, topicLength)) return _priorities[i];
+  }
+  return AsyncMqttClientPriority::NORMAL;
+}
+
+bool PriorityLanes::push(AsyncMqttClientPriority priority, uint8_t qos, bool retain, uint16_t packetId,
+  const char* topic, uint16_t topicLength, const char* payload, uint32_t payloadLength) {
+  Lane& lane = _lanes[static_cast<uint8_t>(priority)];
+  size_t needed = (sizeof(LaneEntry) + topicLength + payloadLength + alignof(LaneEntry) - 1) / alignof(LaneEntry) * alignof(LaneEntry);
+  if (lane.used + needed > lane.size) {
+    lane.rejected++;
+    return false;
+  }
+
+  // contiguous: behind the last entry, or else from the start of the buffer, the end left unused
+  if (lane.used == 0) {
+    lane.head = 0;
+    lane.tail = 0;
+  }
+  if (lane.tail >= lane.head && lane.size - lane.tail < needed) {
+    if (lane.head < needed) {
+      lane.rejected++;
+      return false;
+    }
+    if (lane.size - lane.tail >= sizeof(uint32_t)) reinterpret_cast<LaneEntry*>(lane.buffer + lane.tail)->size = 0;
+    lane.used += lane.size - lane.tail;
+    lane.tail = 0;
+  } else if (lane.tail < lane.head && lane.head - lane.tail < needed) {
+    lane.rejected++;
+    return false;
+  }
+
+  LaneEntry* entry = reinterpret_cast<LaneEntry*>(lane.buffer + lane.tail);
+  entry->size = needed;
+  entry->payloadLength = payloadLength;
+  entry->packetId = packetId;
+  entry->topicLength = topicLength;
+  entry->qos = qos;
+  entry->retain = retain;
+  char* data = reinterpret_cast<char*>(entry + 1);
+  if (topicLength > 0) memcpy(data, topic, topicLength);
+  if (payloadLength > 0) memcpy(data + topicLength, payload, payloadLength);
+
+  lane.tail += needed;
+  lane.used += needed;
+  lane.count++;
+  if (lane.used > lane.peak) lane.peak = lane.used;
+  return true;
+}
+
+LaneEntry* PriorityLanes::front(AsyncMqttClientPriority priority) {
+  Lane& lane = _lanes[static_cast<uint8_t>(priority)];
+  if (lane.count == 0) return nullptr;
+  // past the unused end of the buffer, the entries go on from its start
+  if (lane.size - lane.head < sizeof(LaneEntry) || reinterpret_cast<LaneEntry*>(lane.buffer + lane.head)->size == 0) {
+    lane.used -= lane.size - lane.head;
+    lane.head = 0;
+  }
+  return reinterpret_cast<LaneEntry*>(lane.buffer + lane.head);
+}
+
+void PriorityLanes::pop(AsyncMqttClientPriority priority) {
+  LaneEntry* entry = front(priority);
+  if (!entry) return;
+  Lane& lane = _lanes[static_cast<uint8_t>(priority)];
+  lane.head += entry->size;
+  lane.used -= entry->size;
+  lane.count--;
+}
+
+void PriorityLanes::drop(AsyncMqttClientPriority priority) {
+  if (!front(priority)) return;
+  pop(priority);
+  _lanes[static_cast<uint8_t>(priority)].tooLarge++;
+}
+
+bool PriorityLanes::waiting(AsyncMqttClientPriority priority) const {
+  for (uint8_t i = 0; i <= static_cast<uint8_t>(priority); i++) {
+    if (_lanes[i].count > 0) return true;
+  }
+  return false;
+}
+
+void PriorityLanes::clear() {
+  for (Lane &lane : _lanes) {
+    lane.head = 0;
+    lane.tail = 0;
+    lane.used = 0;
+    lane.count = 0;
+  }
+}
+
+AsyncMqttClientLaneStats PriorityLanes::stats(AsyncMqttClientPriority priority) const {
+  Lane const &lane = _lanes[static_cast<uint8_t>(priority)];
+  AsyncMqttClientLaneStats stats;
+  stats.queued = lane.count;
+  stats.bytes = lane.used;
+  stats.peakBytes = lane.peak;
+  stats.capacity = lane.size;
+  stats.rejected = lane.rejected;
+  stats.tooLarge = lane.tooLarge;
+  return stats;
+}
+
+void PriorityLanes::_release() {
+  for (Lane &lane : _lanes) {
+    if (lane.buffer) release(lane.buffer, lane.size, AsyncMqttClientMemoryTag::QUEUE);
+    lane = Lane();
+  }
+}
+
+#endif
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "BoundedString.hpp"
+
+// Outbound priority lanes, see setPriorityLanes(). Off by default, 1 compiles them in
+#ifndef ASYNC_MQTT_PRIORITY_LANES
+#define ASYNC_MQTT_PRIORITY_LANES 0
+#endif
+
+// Topic filters given a priority with addTopicPriority()
+#ifndef ASYNC_MQTT_PRIORITY_FILTERS
+#define ASYNC_MQTT_PRIORITY_FILTERS 4
+#endif
+
+// Bulk messages go out while fewer than this many bytes wait in the transport, see setBulkInFlight()
+#ifndef ASYNC_MQTT_BULK_IN_FLIGHT
+#define ASYNC_MQTT_BULK_IN_FLIGHT 2048
+#endif
+
+// The lanes of publish(), drained in this order once acks and pings are out. Topics given no priority are NORMAL
+enum class AsyncMqttClientPriority : uint8_t {
+  HIGH = 0,
+  NORMAL = 1,
+  BULK = 2
+};
+
+struct AsyncMqttClientLaneStats {
+  uint32_t queued;  // messages waiting
+  uint32_t bytes;  // of the lane's buffer in use
+  uint32_t peakBytes;
+  uint32_t capacity;
+  uint32_t rejected;  // publishes refused with the lane full
+  uint32_t tooLarge;  // dropped, larger than the transport can take at once
+};
+
+#if ASYNC_MQTT_PRIORITY_LANES
+
+namespace AsyncMqttClientInternals {
+const uint8_t PRIORITY_LANES = 3;
+
+// A queued publish, the topic then the payload follow it in the lane
+struct LaneEntry {
+  uint32_t size;  // bytes taken in the lane, 0 marks the end of the used part of the buffer
+  uint32_t payloadLength;
+  uint16_t packetId;
+  uint16_t topicLength;
+  uint8_t qos;
+  bool retain;
+
+  const char* topic() const { return reinterpret_cast<const char*>(this + 1); }
+  const char* payload() const { return topic() + topicLength; }
+};
+
+// Publishes waiting for room in the transport, one FIFO ring buffer of variable size entries per priority,
+// and the topic filters that set the priority of a topic. Network task only.
+class PriorityLanes {
+ public:
+  PriorityLanes();
+  ~PriorityLanes();
+
+  PriorityLanes(PriorityLanes const &) = delete;
+  PriorityLanes& operator=(PriorityLanes const &) = delete;
+
+  // Bytes of each lane, from the allocator hooks (QUEUE); false when out of memory, the lanes are then off.
+  // All 0 turns them off
+  bool begin(size_t high, size_t normal, size_t bulk);
+  bool enabled() const;
+  // Past ASYNC_MQTT_PRIORITY_FILTERS filters, or out of memory, false
+  bool addFilter(const char* filter, AsyncMqttClientPriority priority);
+  // of the first filter matching, NORMAL when none does
+  AsyncMqttClientPriority classify(const char* topic, size_t topicLength) const;
+
+  // false when the lane is full
+  bool push(AsyncMqttClientPriority priority, uint8_t qos, bool retain, uint16_t packetId,
+    const char* topic, uint16_t topicLength, const char* payload, uint32_t payloadLength);
+  LaneEntry* front(AsyncMqttClientPriority priority);
+  void pop(AsyncMqttClientPriority priority);
+  // pop, counted as too large
+  void drop(AsyncMqttClientPriority priority);
+  // whether this lane or one above it holds anything
+  bool waiting(AsyncMqttClientPriority priority) const;
+  void clear();
+
+  AsyncMqttClientLaneStats stats(AsyncMqttClientPriority priority) const;
+
+ private:
+  struct Lane {
+    uint8_t* buffer;
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t used;  // entries, and the unused end of the buffer when they wrap
+    uint32_t count;
+    uint32_t peak;
+    uint32_t rejected;
+    uint32_t tooLarge;
+  };
+
+  Lane _lanes[PRIORITY_LANES];
+  BoundedString _filters[ASYNC_MQTT_PRIORITY_FILTERS];
+  AsyncMqttClientPriority _priorities[ASYNC_MQTT_PRIORITY_FILTERS];
+
+  void _release();
+};
+}  // namespace AsyncMqttClientInternals
+
+#endif
@@ -0,0 +1,190 @@
+#include "RateController.hpp"
+
+#if ASYNC_MQTT_RATE_CONTROL
+
+using AsyncMqttClientInternals::RateController;
+
+// a round lasts a round trip, 200 ms until one is measured, never less than 20 ms
+static const uint32_t DEFAULT_ROUND = 200;
+static const uint32_t MIN_ROUND = 20;
+
+RateController::RateController()
+: _minimum(0)
+, _maximum(0)
+, _targetDelay(ASYNC_MQTT_RATE_TARGET_DELAY)
+, _rate(0)
+, _tokens(0)
+, _refilled(0)
+, _minRtt(0)
+, _minRttTime(0)
+, _roundMinRtt(0)
+, _scaledDelay(0)
+, _srtt(0)
+, _capacity(0)
+, _held(0)
+, _roundHeld(0)
+, _roundStart(0)
+, _roundAcked(0)
+, _roundSent(0)
+, _delayed(false)
+, _congested(false)
+, _limited(false)
+, _recovering(false)
+, _deliveryRate(0)
+, _decreases(0)
+, _increases(0) {
+}
+
+void RateController::begin(uint32_t minimum, uint32_t maximum, uint32_t targetDelay, uint32_t now) {
+  _minimum = minimum < maximum ? minimum : maximum;
+  _maximum = maximum;
+  _targetDelay = targetDelay;
+  _rate = maximum;
+  _minRtt = 0;
+  _scaledDelay = 0;
+  _srtt = 0;
+  _deliveryRate = 0;
+  _decreases = 0;
+  _increases = 0;
+  restart(now);
+}
+
+bool RateController::enabled() const {
+  return _maximum != 0;
+}
+
+void RateController::restart(uint32_t now) {
+  _tokens = 0;
+  _refilled = now;
+  _capacity = 0;
+  _held = 0;
+  _roundHeld = 0;
+  _roundStart = now;
+  _roundAcked = 0;
+  _roundSent = 0;
+  _roundMinRtt = 0;
+  _delayed = false;
+  _congested = false;
+  _limited = false;
+  _recovering = false;
+}
+
+bool RateController::permits(uint32_t now) {
+  _update(now);
+  _refill(now);
+  // a publish larger than the bucket goes once it is not in debt, and leaves it in debt
+  if (_tokens >= 0) return true;
+  _limited = true;
+  return false;
+}
+
+void RateController::sent(size_t bytes) {
+  _tokens -= static_cast<int64_t>(bytes) * 1000;
+  _roundSent += bytes;
+}
+
+void RateController::acked(size_t length, uint32_t time, size_t space, uint32_t now) {
+  if (space > _capacity) _capacity = space;
+  _held = _capacity - space;
+  _roundAcked += length;
+  // AsyncTCP measures from the last send(), POSIX from the oldest byte acknowledged: neither is a round trip to
+  // learn the least one from, both tell a queue building up
+  if (time > 0) _delay(time, now);
+  _update(now);
+}
+
+void RateController::rttSample(uint32_t rtt, uint32_t now) {
+  if (_minRtt == 0 || rtt <= _minRtt || now - _minRttTime > ASYNC_MQTT_RATE_MIN_RTT_WINDOW) {
+    _minRtt = rtt > 0 ? rtt : 1;
+    _minRttTime = now;
+  }
+  if (_roundMinRtt == 0 || rtt < _roundMinRtt) _roundMinRtt = rtt;
+  _srtt = _srtt == 0 ? rtt : (_srtt * 7 + rtt) / 8;
+  _delay(rtt, now);
+  _update(now);
+}
+
+void RateController::full(uint32_t now) {
+  _congested = true;
+  _update(now);
+}
+
+uint32_t RateController::rate() const {
+  return _rate;
+}
+
+AsyncMqttClientRateStats RateController::stats() const {
+  AsyncMqttClientRateStats stats;
+  stats.rate = _rate;
+  stats.deliveryRate = _deliveryRate;
+  stats.minRtt = _minRtt;
+  stats.queueDelay = _scaledDelay >> 3;
+  stats.decreases = _decreases;
+  stats.increases = _increases;
+  return stats;
+}
+
+void RateController::_delay(uint32_t delay, uint32_t now) {
+  (void)now;
+  if (_minRtt == 0) return;
+  uint32_t queued = delay > _minRtt ? delay - _minRtt : 0;
+  _scaledDelay += queued - (_scaledDelay >> 3);
+  if ((_scaledDelay >> 3) > _targetDelay) _delayed = true;
+}
+
+void RateController::_update(uint32_t now) {
+  uint32_t round = _srtt > MIN_ROUND ? _srtt : _srtt == 0 ? DEFAULT_ROUND : MIN_ROUND;
+  uint32_t elapsed = now - _roundStart;
+  // congestion ends the round at once, growth waits for its end
+  if (elapsed < round && (_recovering || (!_congested && !_delayed))) return;
+
+  if (elapsed >= round) {
+    _deliveryRate = static_cast<uint32_t>(static_cast<uint64_t>(_roundAcked) * 1000 / elapsed);
+    // the send buffer more than half full, and fuller by an eighth than a round ago: more goes in than out
+    if (_held > _capacity / 2 && _held > _roundHeld + _capacity / 8) _congested = true;
+    if (static_cast<uint64_t>(_roundSent) * 1000 / elapsed >= static_cast<uint64_t>(_rate) * 7 / 8) _limited = true;
+  }
+  if (_delayed) {
+    if (_held <= _capacity / 8 && _roundHeld <= _capacity / 8 && _roundMinRtt != 0) {
+      // a delay with next to nothing of ours in the send buffer is the path's: the route changed
+      _minRtt = _roundMinRtt;
+      _minRttTime = now;
+      _scaledDelay = 0;
+    } else {
+      _congested = true;
+    }
+  }
+
+  if (_recovering) {
+    // a cut shows a round trip later: the round after it neither cuts again nor grows
+    _recovering = false;
+  } else if (_congested) {
+    uint32_t base = _deliveryRate != 0 && _deliveryRate < _rate ? _deliveryRate : _rate;
+    _rate = static_cast<uint32_t>(static_cast<uint64_t>(base) * ASYNC_MQTT_RATE_DECREASE / 256);
+    if (_rate < _minimum) _rate = _minimum;
+    _decreases++;
+    _recovering = true;
+  } else if (_limited && _rate < _maximum) {
+    _rate = _maximum - _rate > ASYNC_MQTT_RATE_INCREASE ? _rate + ASYNC_MQTT_RATE_INCREASE : _maximum;
+    _increases++;
+  }
+
+  _roundStart = now;
+  _roundAcked = 0;
+  _roundSent = 0;
+  _roundHeld = _held;
+  _roundMinRtt = 0;
+  _delayed = false;
+  _congested = false;
+  _limited = false;
+}
+
+void RateController::_refill(uint32_t now) {
+  // thousandths of a byte per millisecond are bytes per second
+  _tokens += static_cast<int64_t>(_rate) * (now - _refilled);
+  _refilled = now;
+  int64_t burst = static_cast<int64_t>(_rate) * ASYNC_MQTT_RATE_BURST;
+  if (_tokens > burst) _tokens = burst;
+}
+
+#endif
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Pacing of outbound publishes to what the link carries, see setRateControl(). Off by default, 1 compiles it in
+#ifndef ASYNC_MQTT_RATE_CONTROL
+#define ASYNC_MQTT_RATE_CONTROL 0
+#endif
+
+// Queueing delay, in milliseconds above the least round trip, past which the rate is cut
+#ifndef ASYNC_MQTT_RATE_TARGET_DELAY
+#define ASYNC_MQTT_RATE_TARGET_DELAY 100
+#endif
+
+// Bytes per second the rate grows by each round trip without congestion
+#ifndef ASYNC_MQTT_RATE_INCREASE
+#define ASYNC_MQTT_RATE_INCREASE 1460
+#endif
+
+// Fraction of the rate, in 1/256, kept when it is cut
+#ifndef ASYNC_MQTT_RATE_DECREASE
+#define ASYNC_MQTT_RATE_DECREASE 180
+#endif
+
+// Milliseconds of the rate that may go out in one burst
+#ifndef ASYNC_MQTT_RATE_BURST
+#define ASYNC_MQTT_RATE_BURST 100
+#endif
+
+// Milliseconds the least round trip is remembered, a route may change
+#ifndef ASYNC_MQTT_RATE_MIN_RTT_WINDOW
+#define ASYNC_MQTT_RATE_MIN_RTT_WINDOW 30000
+#endif
+
+struct AsyncMqttClientRateStats {
+  uint32_t rate;  // bytes per second permitted
+  uint32_t deliveryRate;  // bytes per second acknowledged in the last round trip
+  uint32_t minRtt;  // least PUBACK round trip lately, 0 until known
+  uint32_t queueDelay;  // smoothed delay above it
+  uint32_t decreases;
+  uint32_t increases;
+};
+
+#if ASYNC_MQTT_RATE_CONTROL
+
+namespace AsyncMqttClientInternals {
+// Additive increase, multiplicative decrease of a permitted rate, enforced by a token bucket. The rate is cut as soon
+// as congestion shows, once per round trip: a delay above the least round trip by more than the target, a publish
+// refused for lack of room, or a send buffer more than half full and filling. A cut starts from the lower of the rate
+// and the rate the acks show, so that the queue built drains, and the round after it waits for its effect. Otherwise
+// the rate grows at the end of each round, if the pacing held something back or the round used most of the rate (an
+// application following rate() never meets the pacing). A delay while next to nothing is queued is the path's own:
+// the least round trip is taken from that round instead.
+// Network task only.
+class RateController {
+ public:
+  RateController();
+
+  // bytes per second; a maximum of 0 turns the controller off. It starts at the maximum
+  void begin(uint32_t minimum, uint32_t maximum, uint32_t targetDelay, uint32_t now);
+  bool enabled() const;
+  // a new connection: the round and the bucket start over, the rate and the least round trip are kept
+  void restart(uint32_t now);
+
+  // whether a publish may go now
+  bool permits(uint32_t now);
+  void sent(size_t bytes);
+  // the transport acknowledged length bytes that took time ms as it measures it, with space left after
+  void acked(size_t length, uint32_t time, size_t space, uint32_t now);
+  void rttSample(uint32_t rtt, uint32_t now);
+  // a publish found no room in the transport
+  void full(uint32_t now);
+
+  uint32_t rate() const;
+  AsyncMqttClientRateStats stats() const;
+
+ private:
+  uint32_t _minimum;
+  uint32_t _maximum;
+  uint32_t _targetDelay;
+  uint32_t _rate;
+  int64_t _tokens;  // in thousandths of a byte
+  uint32_t _refilled;
+  uint32_t _minRtt;
+  uint32_t _minRttTime;
+  uint32_t _roundMinRtt;
+  uint32_t _scaledDelay;  // smoothed delay above the least round trip, times 8
+  uint32_t _srtt;
+  size_t _capacity;
+  size_t _held;
+  size_t _roundHeld;
+  uint32_t _roundStart;
+  uint32_t _roundAcked;
+  uint32_t _roundSent;
+  bool _delayed;
+  bool _congested;
+  bool _limited;
+  bool _recovering;
+  uint32_t _deliveryRate;
+  uint32_t _decreases;
+  uint32_t _increases;
+
+  void _delay(uint32_t delay, uint32_t now);
+  void _update(uint32_t now);
+  void _refill(uint32_t now);
+};
+}  // namespace AsyncMqttClientInternals
+
+#endif
@@ -0,0 +1,436 @@
+#include "RetainedCache.hpp"
+
+#if ASYNC_MQTT_RETAINED_CACHE
+
+#include <string.h>
+
+#include "TopicFilter.hpp"
+
+using AsyncMqttClientInternals::RetainedCache;
+
+static const uint8_t EXPORT_MAGIC[4] = { 'A', 'M', 'R', 'C' };
+static const uint8_t EXPORT_FORMAT = 1;
+// magic, format, entry count
+static const size_t EXPORT_HEADER_SIZE = 7;
+// topic and payload lengths
+static const size_t EXPORT_ENTRY_SIZE = 6;
+
+// Each record of the data area: its size, then the table slot owning it, or one of these
+static const size_t RECORD_HEADER_SIZE = 8;
+static const uint16_t SLOT_FREE = 0xFFFF;
+static const uint16_t SLOT_PENDING = 0xFFFE;
+
+static size_t recordSize(size_t topicLength, size_t payloadLength) {
+  return (RECORD_HEADER_SIZE + topicLength + payloadLength + 3) & ~static_cast<size_t>(3);
+}
+
+// FNV-1a, never 0 (a free slot)
+static uint32_t topicHash(const char* topic, size_t topicLength) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < topicLength; i++) {
+    hash ^= static_cast<uint8_t>(topic[i]);
+    hash *= 16777619u;
+  }
+  return hash != 0 ? hash : 1;
+}
+
+static void putUint32(uint8_t* data, uint32_t value) {
+  data[0] = value;
+  data[1] = value >> 8;
+  data[2] = value >> 16;
+  data[3] = value >> 24;
+}
+
+static uint32_t getUint32(const uint8_t* data) {
+  return data[0] | data[1] << 8 | data[2] << 16 | static_cast<uint32_t>(data[3]) << 24;
+}
+
+static uint16_t recordSlot(const uint8_t* record) {
+  return record[4] | record[5] << 8;
+}
+
+static void setRecordSlot(uint8_t* record, uint16_t slot) {
+  record[4] = slot;
+  record[5] = slot >> 8;
+}
+
+static bool readFully(AsyncMqttClientInternals::CacheReader reader, void* context, uint8_t* data, size_t length) {
+  while (length > 0) {
+    size_t read = reader(data, length, context);
+    if (read == 0 || read > length) return false;
+    data += read;
+    length -= read;
+  }
+  return true;
+}
+
+RetainedCache::RetainedCache(void* buffer, size_t size, uint16_t entries)
+: _table(nullptr)
+, _mask(0)
+, _data(nullptr)
+, _dataSize(0)
+, _top(0)
+, _live(0)
+, _maxEntries(0)
+, _entries(0)
+, _stamp(0)
+, _evictions(0)
+, _rejected(0)
+, _version(0)
+, _filters()
+, _pending(false)
+, _pendingOffset(0)
+, _pendingTopicLength(0)
+, _pendingLength(0)
+, _pendingWritten(0) {
+  // a power of two of slots, at most three quarters of them used; the slot numbers stay clear of SLOT_PENDING
+  if (entries == 0 || entries > 0x6000) return;
+  size_t slots = 1;
+  while (slots * 3 < static_cast<size_t>(entries) * 4) slots <<= 1;
+
+  uintptr_t begin = (reinterpret_cast<uintptr_t>(buffer) + 3) & ~static_cast<uintptr_t>(3);
+  size_t skipped = begin - reinterpret_cast<uintptr_t>(buffer);
+  if (size < skipped + slots * sizeof(Entry)) return;
+  _table = reinterpret_cast<Entry*>(begin);
+  memset(_table, 0, slots * sizeof(Entry));
+  _mask = slots - 1;
+  _maxEntries = entries;
+  _data = reinterpret_cast<uint8_t*>(_table + slots);
+  _dataSize = (size - skipped - slots * sizeof(Entry)) & ~static_cast<size_t>(3);
+}
+
+RetainedCache& RetainedCache::addTopics(const char* filter) {
+  for (BoundedString &slot : _filters) {
+    if (!slot.empty()) continue;
+    slot.assign(filter, strlen(filter));
+    break;
+  }
+  return *this;
+}
+
+size_t RetainedCache::read(const char* topic, char* buffer, size_t size) const {
+  size_t topicLength = strlen(topic);
+  _lockCache();
+  int32_t slot = _find(topicHash(topic, topicLength), topic, topicLength);
+  size_t length = 0;
+  if (slot >= 0) {
+    Entry const &entry = _table[slot];
+    length = entry.payloadLength;
+    if (size > 0) memcpy(buffer, _data + entry.offset + RECORD_HEADER_SIZE + entry.topicLength, length < size ? length : size);
+  }
+  _unlockCache();
+  return length;
+}
+
+bool RetainedCache::contains(const char* topic) const {
+  size_t topicLength = strlen(topic);
+  _lockCache();
+  bool found = _find(topicHash(topic, topicLength), topic, topicLength) >= 0;
+  _unlockCache();
+  return found;
+}
+
+void RetainedCache::clear() {
+  _lockCache();
+  if (_table) memset(_table, 0, (_mask + 1) * sizeof(Entry));
+  _entries = 0;
+  _top = 0;
+  _live = 0;
+  _pending = false;
+  _version++;
+  _unlockCache();
+}
+
+size_t RetainedCache::entries() const {
+  return _entries;
+}
+
+size_t RetainedCache::used() const {
+  return _live;
+}
+
+size_t RetainedCache::capacity() const {
+  return _dataSize;
+}
+
+uint32_t RetainedCache::evictions() const {
+  return _evictions;
+}
+
+uint32_t RetainedCache::rejected() const {
+  return _rejected;
+}
+
+uint32_t RetainedCache::version() const {
+  return _version;
+}
+
+size_t RetainedCache::exportSize() const {
+  _lockCache();
+  size_t size = EXPORT_HEADER_SIZE;
+  for (uint32_t slot = 0; _table && slot <= _mask; slot++) {
+    if (_table[slot].hash != 0) size += EXPORT_ENTRY_SIZE + _table[slot].topicLength + _table[slot].payloadLength;
+  }
+  _unlockCache();
+  return size;
+}
+
+void RetainedCache::exportTo(CacheWriter writer, void* context) const {
+  _lockCache();
+  uint8_t header[EXPORT_HEADER_SIZE];
+  memcpy(header, EXPORT_MAGIC, sizeof(EXPORT_MAGIC));
+  header[4] = EXPORT_FORMAT;
+  header[5] = _entries;
+  header[6] = _entries >> 8;
+  writer(header, sizeof(header), context);
+
+  // records are in the order they were stored, the oldest first
+  for (size_t offset = 0; offset < _top; offset += getUint32(_data + offset)) {
+    uint16_t slot = recordSlot(_data + offset);
+    if (slot == SLOT_FREE || slot == SLOT_PENDING) continue;
+    Entry const &entry = _table[slot];
+    uint8_t lengths[EXPORT_ENTRY_SIZE];
+    lengths[0] = entry.topicLength;
+    lengths[1] = entry.topicLength >> 8;
+    putUint32(lengths + 2, entry.payloadLength);
+    writer(lengths, sizeof(lengths), context);
+    writer(_data + offset + RECORD_HEADER_SIZE, entry.topicLength + entry.payloadLength, context);
+  }
+  _unlockCache();
+}
+
+bool RetainedCache::importFrom(CacheReader reader, void* context) {
+  clear();
+  uint8_t header[EXPORT_HEADER_SIZE];
+  if (!readFully(reader, context, header, sizeof(header)) || memcmp(header, EXPORT_MAGIC, sizeof(EXPORT_MAGIC)) != 0 ||
+    header[4] != EXPORT_FORMAT) return false;
+
+  _lockCache();
+  bool valid = true;
+  for (uint16_t count = header[5] | header[6] << 8; count > 0 && valid; count--) {
+    uint8_t lengths[EXPORT_ENTRY_SIZE];
+    valid = readFully(reader, context, lengths, sizeof(lengths));
+    if (!valid) break;
+    size_t topicLength = lengths[0] | lengths[1] << 8;
+    size_t payloadLength = getUint32(lengths + 2);
+
+    if (payloadLength > 0 && _reserve(topicLength, payloadLength)) {
+      valid = readFully(reader, context, _data + _pendingOffset + RECORD_HEADER_SIZE, topicLength + payloadLength);
+      if (valid) {
+        _pendingWritten = payloadLength;
+        _commit();
+      }
+      continue;
+    }
+    // an entry too large for this cache is skipped
+    if (payloadLength > 0) _rejected++;
+    uint8_t skipped[64];
+    for (size_t left = topicLength + payloadLength; left > 0 && valid;) {
+      size_t length = left < sizeof(skipped) ? left : sizeof(skipped);
+      valid = readFully(reader, context, skipped, length);
+      left -= length;
+    }
+  }
+  _dropPending();
+  _unlockCache();
+  return valid;
+}
+
+bool RetainedCache::matches(const char* topic, size_t topicLength) const {
+  for (BoundedString const &filter : _filters) {
+    if (filter.empty()) break;
+    if (topicMatches(filter.c_str(), topic, topicLength)) return true;
+  }
+  return false;
+}
+
+void RetainedCache::begin(const char* topic, size_t total) {
+  size_t topicLength = strlen(topic);
+  _lockCache();
+  _dropPending();
+  if (total > 0 && _reserve(topicLength, total)) {
+    memcpy(_data + _pendingOffset + RECORD_HEADER_SIZE, topic, topicLength);
+    _unlockCache();
+    return;
+  }
+
+  // cleared, or too large: the value held is stale either way
+  if (total > 0) _rejected++;
+  int32_t slot = _find(topicHash(topic, topicLength), topic, topicLength);
+  if (slot >= 0) {
+    _remove(slot);
+    _version++;
+  }
+  _unlockCache();
+}
+
+void RetainedCache::write(const char* data, size_t length) {
+  if (length == 0) return;
+  _lockCache();
+  if (_pending) {
+    size_t taken = _pendingLength - _pendingWritten < length ? _pendingLength - _pendingWritten : length;
+    memcpy(_data + _pendingOffset + RECORD_HEADER_SIZE + _pendingTopicLength + _pendingWritten, data, taken);
+    _pendingWritten += taken;
+  }
+  _unlockCache();
+}
+
+void RetainedCache::end() {
+  _lockCache();
+  if (_pending) _commit();
+  _unlockCache();
+}
+
+void RetainedCache::abort() {
+  _lockCache();
+  _dropPending();
+  _unlockCache();
+}
+
+#ifdef ESP8266
+// everything runs in the TCP task
+void RetainedCache::_lockCache() const {
+}
+
+void RetainedCache::_unlockCache() const {
+}
+#else
+void RetainedCache::_lockCache() const {
+  _lock.lock();
+}
+
+void RetainedCache::_unlockCache() const {
+  _lock.unlock();
+}
+#endif
+
+int32_t RetainedCache::_find(uint32_t hash, const char* topic, size_t topicLength) const {
+  if (!_table) return -1;
+  for (uint32_t slot = hash & _mask;; slot = (slot + 1) & _mask) {
+    Entry const &entry = _table[slot];
+    if (entry.hash == 0) return -1;
+    if (entry.hash == hash && entry.topicLength == topicLength &&
+      memcmp(_data + entry.offset + RECORD_HEADER_SIZE, topic, topicLength) == 0) return slot;
+  }
+}
+
+// A pending record of the sizes at the top of the data area, the values updated longest ago make room
+bool RetainedCache::_reserve(size_t topicLength, size_t payloadLength) {
+  size_t size = recordSize(topicLength, payloadLength);
+  if (_maxEntries == 0 || size > _dataSize) return false;
+  while (_dataSize - _top < size) {
+    if (_dataSize - _live >= size) {
+      _compact();
+    } else if (!_evictOldest()) {
+      return false;
+    }
+  }
+
+  uint8_t* record = _data + _top;
+  putUint32(record, size);
+  setRecordSlot(record, SLOT_PENDING);
+  _pending = true;
+  _pendingOffset = _top;
+  _pendingTopicLength = topicLength;
+  _pendingLength = payloadLength;
+  _pendingWritten = 0;
+  _top += size;
+  _live += size;
+  return true;
+}
+
+// The pending record takes the place of the value of its topic, if complete
+void RetainedCache::_commit() {
+  if (_pendingWritten != _pendingLength) {
+    _dropPending();
+    return;
+  }
+  _pending = false;
+  uint8_t* record = _data + _pendingOffset;
+
+  const char* topic = reinterpret_cast<const char*>(record + RECORD_HEADER_SIZE);
+  uint32_t hash = topicHash(topic, _pendingTopicLength);
+  int32_t found = _find(hash, topic, _pendingTopicLength);
+  uint32_t slot;
+  if (found >= 0) {
+    slot = found;
+    uint8_t* previous = _data + _table[slot].offset;
+    setRecordSlot(previous, SLOT_FREE);
+    _live -= getUint32(previous);
+  } else {
+    if (_entries >= _maxEntries) _evictOldest();
+    for (slot = hash & _mask; _table[slot].hash != 0; slot = (slot + 1) & _mask) {
+    }
+    _table[slot].hash = hash;
+    _table[slot].topicLength = _pendingTopicLength;
+    _entries++;
+  }
+  _table[slot].offset = _pendingOffset;
+  _table[slot].payloadLength = _pendingLength;
+  _table[slot].stamp = ++_stamp;
+  setRecordSlot(record, slot);
+  _version++;
+}
+
+void RetainedCache::_dropPending() {
+  if (!_pending) return;
+  setRecordSlot(_data + _pendingOffset, SLOT_FREE);
+  _live -= recordSize(_pendingTopicLength, _pendingLength);
+  _pending = false;
+}
+
+// Backward shift deletion: the entries after it in the probe sequence move up, no tombstone is left
+void RetainedCache::_remove(uint32_t slot) {
+  uint8_t* record = _data + _table[slot].offset;
+  setRecordSlot(record, SLOT_FREE);
+  _live -= getUint32(record);
+
+  uint32_t hole = slot;
+  for (uint32_t next = (slot + 1) & _mask; _table[next].hash != 0; next = (next + 1) & _mask) {
+    uint32_t home = _table[next].hash & _mask;
+    if (((next - home) & _mask) < ((next - hole) & _mask)) continue;
+    _table[hole] = _table[next];
+    setRecordSlot(_data + _table[hole].offset, hole);
+    hole = next;
+  }
+  _table[hole].hash = 0;
+  _entries--;
+}
+
+bool RetainedCache::_evictOldest() {
+  uint32_t oldest = 0;
+  bool found = false;
+  for (uint32_t slot = 0; slot <= _mask; slot++) {
+    if (_table[slot].hash == 0) continue;
+    if (!found || _table[slot].stamp - _table[oldest].stamp > 0x80000000u) oldest = slot;
+    found = true;
+  }
+  if (!found) return false;
+  _remove(oldest);
+  _evictions++;
+  _version++;
+  return true;
+}
+
+// Live records slide down over the free ones, keeping their order
+void RetainedCache::_compact() {
+  size_t top = 0;
+  for (size_t offset = 0; offset < _top;) {
+    uint8_t* record = _data + offset;
+    size_t size = getUint32(record);
+    uint16_t slot = recordSlot(record);
+    if (slot != SLOT_FREE) {
+      if (top != offset) memmove(_data + top, record, size);
+      if (slot == SLOT_PENDING) {
+        _pendingOffset = top;
+      } else {
+        _table[slot].offset = top;
+      }
+      top += size;
+    }
+    offset += size;
+  }
+  _top = top;
+}
+
+#endif
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef ESP8266
+#include <mutex>
+#endif
+
+#include "BoundedString.hpp"
+
+// Latest payload per topic kept by the client for synchronous reads, see setRetainedCache(). Off by default, 1 compiles it in
+#ifndef ASYNC_MQTT_RETAINED_CACHE
+#define ASYNC_MQTT_RETAINED_CACHE 0
+#endif
+
+// Topic filters a RetainedCache holds
+#ifndef ASYNC_MQTT_RETAINED_CACHE_FILTERS
+#define ASYNC_MQTT_RETAINED_CACHE_FILTERS 4
+#endif
+
+#if ASYNC_MQTT_RETAINED_CACHE
+
+namespace AsyncMqttClientInternals {
+typedef void (*CacheWriter)(const uint8_t* data, size_t length, void* context);
+// Reads up to length bytes, returns how many were read
+typedef size_t (*CacheReader)(uint8_t* data, size_t length, void* context);
+
+// The latest payload of each topic matching its filters, in a buffer handed by the caller: an open addressing table
+// of the topics, hashed, then the topics and payloads packed behind it. A new value takes the place of the previous one
+// once complete, an empty payload (a cleared retained message) removes the topic, and when the buffer or the table is
+// full the values updated longest ago make room. Fed by the network task; read from any task.
+class RetainedCache {
+ public:
+  // entries bounds the topics held; the table takes 20 bytes per slot out of the buffer, a power of two of slots
+  // at least 4/3 of entries
+  RetainedCache(void* buffer, size_t size, uint16_t entries);
+
+  RetainedCache(RetainedCache const &) = delete;
+  RetainedCache& operator=(RetainedCache const &) = delete;
+
+  // Past ASYNC_MQTT_RETAINED_CACHE_FILTERS filters, or out of memory, the filter is ignored
+  RetainedCache& addTopics(const char* filter);
+
+  // Copies up to size bytes of the payload of topic into buffer; the length of the payload, 0 when not cached
+  size_t read(const char* topic, char* buffer, size_t size) const;
+  bool contains(const char* topic) const;
+  void clear();
+
+  size_t entries() const;
+  // bytes of topics and payloads held, out of capacity()
+  size_t used() const;
+  size_t capacity() const;
+  // values dropped to make room, and values larger than the cache
+  uint32_t evictions() const;
+  uint32_t rejected() const;
+  // changes with every value stored or removed, to know when to save the cache again
+  uint32_t version() const;
+
+  // Persistence: "AMRC", the format version and the entry count, then the topics and payloads, oldest first
+  size_t exportSize() const;
+  void exportTo(CacheWriter writer, void* context) const;
+  // Replaces the content, false if the data is not an export (what was read until then is kept)
+  bool importFrom(CacheReader reader, void* context);
+
+  // AsyncMqttClient, network task
+  bool matches(const char* topic, size_t topicLength) const;
+  void begin(const char* topic, size_t total);
+  void write(const char* data, size_t length);
+  void end();
+  void abort();
+
+ private:
+  struct Entry {
+    uint32_t hash;  // 0 for a free slot
+    uint32_t offset;
+    uint32_t payloadLength;
+    uint32_t stamp;
+    uint16_t topicLength;
+  };
+
+  Entry* _table;
+  uint32_t _mask;
+  uint8_t* _data;
+  size_t _dataSize;
+  size_t _top;
+  size_t _live;
+  uint16_t _maxEntries;
+  uint16_t _entries;
+  uint32_t _stamp;
+  uint32_t _evictions;
+  uint32_t _rejected;
+  uint32_t _version;
+  BoundedString _filters[ASYNC_MQTT_RETAINED_CACHE_FILTERS];
+
+  bool _pending;
+  uint32_t _pendingOffset;
+  uint16_t _pendingTopicLength;
+  uint32_t _pendingLength;
+  uint32_t _pendingWritten;
+
+#ifndef ESP8266
+  mutable std::mutex _lock;
+#endif
+
+  void _lockCache() const;
+  void _unlockCache() const;
+  int32_t _find(uint32_t hash, const char* topic, size_t topicLength) const;
+  bool _reserve(size_t topicLength, size_t payloadLength);
+  void _commit();
+  void _dropPending();
+  void _remove(uint32_t slot);
+  bool _evictOldest();
+  void _compact();
+};
+}  // namespace AsyncMqttClientInternals
+
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+// Lower bound of the retransmission timeout derived from RTT samples, in milliseconds
+#ifndef ASYNC_MQTT_MIN_RTO
+#define ASYNC_MQTT_MIN_RTO 200
+#endif
+
+namespace AsyncMqttClientInternals {
+// Smoothed RTT and RTT variance, as in RFC 6298, with the usual fixed point scaling
+class RttEstimator {
+ public:
+  RttEstimator()
+  : _scaledSrtt(0)
+  , _scaledRttVar(0)
+  , _valid(false) {}
+
+  void sample(uint32_t rtt) {
+    if (!_valid) {
+      _scaledSrtt = rtt << 3;
+      _scaledRttVar = rtt << 1;
+      _valid = true;
+      return;
+    }
+
+    int32_t error = static_cast<int32_t>(rtt) - static_cast<int32_t>(_scaledSrtt >> 3);
+    _scaledSrtt += error;
+    if (error < 0) error = -error;
+    error -= static_cast<int32_t>(_scaledRttVar >> 2);
+    _scaledRttVar += error;
+  }
+
+  void reset() {
+    _scaledSrtt = 0;
+    _scaledRttVar = 0;
+    _valid = false;
+  }
+
+  bool valid() const { return _valid; }
+  uint32_t smoothed() const { return _scaledSrtt >> 3; }
+  uint32_t variance() const { return _scaledRttVar >> 2; }
+
+  uint32_t rto() const {
+    uint32_t rto = (_scaledSrtt >> 3) + _scaledRttVar;
+    return rto < ASYNC_MQTT_MIN_RTO ? ASYNC_MQTT_MIN_RTO : rto;
+  }
+
+ private:
+  uint32_t _scaledSrtt;
+  uint32_t _scaledRttVar;
+  bool _valid;
+};
+}  // namespace AsyncMqttClientInternals
@@ -0,0 +1,115 @@
+#include "FileSinkStorage.hpp"
+
+#if defined(__linux__) && !defined(ESP32) && !defined(ESP8266)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+using AsyncMqttClientInternals::FileSinkStorage;
+
+FileSinkStorage::FileSinkStorage(const char* path)
+: _path()
+, _temporaryPath()
+, _fd(-1)
+, _thread()
+, _mutex()
+, _condition()
+, _data(nullptr)
+, _length(0)
+, _offset(0)
+, _busy(false)
+, _failed(false)
+, _stopping(false) {
+  _path.assign(path, strlen(path));
+  char temporaryPath[256];
+  int length = snprintf(temporaryPath, sizeof(temporaryPath), "%s.part", path);
+  if (length > 0 && static_cast<size_t>(length) < sizeof(temporaryPath)) _temporaryPath.assign(temporaryPath, length);
+  _thread = std::thread(&FileSinkStorage::_run, this);
+}
+
+FileSinkStorage::~FileSinkStorage() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _condition.notify_all();
+  _thread.join();
+  if (_fd >= 0) {
+    ::close(_fd);
+    unlink(_temporaryPath.c_str());
+  }
+}
+
+bool FileSinkStorage::begin(char const *topic, size_t total) {
+  (void)topic;
+  (void)total;
+  if (_temporaryPath.empty()) return false;
+  if (_fd >= 0) ::close(_fd);
+  _fd = open(_temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  _failed = false;
+  return _fd >= 0;
+}
+
+bool FileSinkStorage::write(const uint8_t* data, size_t length, size_t offset) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _data = data;
+    _length = length;
+    _offset = offset;
+    _busy = true;
+  }
+  _condition.notify_all();
+  return true;
+}
+
+bool FileSinkStorage::wait() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _condition.wait(lock, [this]() { return !_busy; });
+  return !_failed;
+}
+
+bool FileSinkStorage::end(bool commit) {
+  wait();
+  if (_fd < 0) return false;
+  bool kept = commit && !_failed && fsync(_fd) == 0;
+  ::close(_fd);
+  _fd = -1;
+  if (kept) kept = rename(_temporaryPath.c_str(), _path.c_str()) == 0;
+  if (!kept) unlink(_temporaryPath.c_str());
+  return kept;
+}
+
+void FileSinkStorage::_run() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (true) {
+    _condition.wait(lock, [this]() { return _busy || _stopping; });
+    if (_stopping) return;
+    const uint8_t* data = _data;
+    size_t length = _length;
+    off_t offset = _offset;
+    lock.unlock();
+
+    bool written = true;
+    while (length > 0) {
+      ssize_t result = pwrite(_fd, data, length, offset);
+      if (result < 0 && errno == EINTR) continue;
+      if (result <= 0) {
+        written = false;
+        break;
+      }
+      data += result;
+      length -= result;
+      offset += result;
+    }
+
+    lock.lock();
+    if (!written) _failed = true;
+    _busy = false;
+    _condition.notify_all();
+  }
+}
+
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+
+#if defined(__linux__) && !defined(ESP32) && !defined(ESP8266)
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "../BoundedString.hpp"
+#include "../PayloadSink.hpp"
+
+namespace AsyncMqttClientInternals {
+// Writes each message to a file, on a thread of its own so the network thread goes on filling the other page.
+// The message goes to a temporary file renamed over the path once complete, a discarded one is removed.
+class FileSinkStorage : public SinkStorage {
+ public:
+  explicit FileSinkStorage(const char* path);
+  ~FileSinkStorage();
+
+  FileSinkStorage(FileSinkStorage const &) = delete;
+  FileSinkStorage& operator=(FileSinkStorage const &) = delete;
+
+  bool begin(char const *topic, size_t total);
+  bool write(const uint8_t* data, size_t length, size_t offset);
+  bool wait();
+  bool end(bool commit);
+
+ private:
+  BoundedString _path;
+  BoundedString _temporaryPath;
+  int _fd;
+
+  std::thread _thread;
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  const uint8_t* _data;
+  size_t _length;
+  size_t _offset;
+  bool _busy;
+  bool _failed;
+  bool _stopping;
+
+  void _run();
+};
+}  // namespace AsyncMqttClientInternals
+
+#endif
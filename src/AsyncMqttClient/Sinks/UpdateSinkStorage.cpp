@@ -0,0 +1,43 @@
+#include "UpdateSinkStorage.hpp"
+
+#if defined(ESP32) || defined(ESP8266)
+
+#ifdef ESP32
+#include <Update.h>
+#else
+#include <Updater.h>
+#endif
+
+using AsyncMqttClientInternals::UpdateSinkStorage;
+
+UpdateSinkStorage::UpdateSinkStorage()
+: _total(0)
+, _last(nullptr)
+, _lastLength(0) {
+}
+
+bool UpdateSinkStorage::begin(char const *topic, size_t total) {
+  (void)topic;
+  _total = total;
+  _last = nullptr;
+  _lastLength = 0;
+  return Update.begin(total);
+}
+
+bool UpdateSinkStorage::write(const uint8_t* data, size_t length, size_t offset) {
+  if (offset + length == _total) {
+    _last = data;
+    _lastLength = length;
+    return true;
+  }
+  return Update.write(const_cast<uint8_t*>(data), length) == length;
+}
+
+bool UpdateSinkStorage::end(bool commit) {
+  if (commit && _last) commit = Update.write(const_cast<uint8_t*>(_last), _lastLength) == _lastLength;
+  _last = nullptr;
+  // short of its size, the update is aborted
+  return Update.end(false) && commit;
+}
+
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+
+#if defined(ESP32) || defined(ESP8266)
+
+#include "../PayloadSink.hpp"
+
+namespace AsyncMqttClientInternals {
+// Writes each message to the OTA partition through the Update class of the core, for firmware delivered over MQTT:
+// a kept message is the firmware booted on the next restart. The last page is held back until the message
+// is complete and checked, so a message discarded after its last byte leaves the update unfinished, and aborted.
+class UpdateSinkStorage : public SinkStorage {
+ public:
+  UpdateSinkStorage();
+
+  bool begin(char const *topic, size_t total);
+  bool write(const uint8_t* data, size_t length, size_t offset);
+  bool end(bool commit);
+
+ private:
+  size_t _total;
+  const uint8_t* _last;
+  size_t _lastLength;
+};
+}  // namespace AsyncMqttClientInternals
+
+#endif
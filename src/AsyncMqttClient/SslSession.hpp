@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+
+// Set when the TCP library can hand out and take back TLS sessions (AsyncClient::getSSLSession / setSSLSession).
+// No AsyncTCP or ESPAsyncTCP release does so far: this is for a TCP library patched to add them
+#ifndef ASYNC_TCP_SSL_SESSION_REUSE
+#define ASYNC_TCP_SSL_SESSION_REUSE 0
+#endif
+
+// Keep the TLS session of a connection and offer it again on the next one, through Transport::sslSession() and
+// Transport::setSslSession(), which transports whose TLS stack can resume sessions implement
+#ifndef ASYNC_MQTT_SSL_SESSION_RESUMPTION
+#define ASYNC_MQTT_SSL_SESSION_RESUMPTION ASYNC_TCP_SSL_SESSION_REUSE
+#endif
+
+// Room for an opaque TLS session (axTLS session ID, or BearSSL session parameters)
+#ifndef ASYNC_MQTT_SSL_SESSION_SIZE
+#define ASYNC_MQTT_SSL_SESSION_SIZE 96
+#endif
+
+#if ASYNC_TCP_SSL_ENABLED
+// Largest TLS max_fragment_length to request, 0 disables the negotiation
+#ifndef ASYNC_MQTT_SSL_MAX_FRAGMENT_LENGTH
+#define ASYNC_MQTT_SSL_MAX_FRAGMENT_LENGTH 4096
+#endif
+// RFC 6066 defines 512, 1024, 2048 and 4096
+static_assert(ASYNC_MQTT_SSL_MAX_FRAGMENT_LENGTH <= 4096, "ASYNC_MQTT_SSL_MAX_FRAGMENT_LENGTH is past the largest TLS fragment length");
+#endif
+
+#if ASYNC_TCP_SSL_ENABLED || ASYNC_MQTT_SSL_SESSION_RESUMPTION
+struct AsyncMqttClientSslStats {
+  uint32_t handshakes;
+  uint32_t resumed;
+  uint32_t lastHandshakeTime;
+  uint32_t totalHandshakeTime;
+  uint16_t fragmentLength;
+  uint32_t connectionHeap;
+};
+#endif
+
+namespace AsyncMqttClientInternals {
+#if ASYNC_MQTT_SSL_SESSION_RESUMPTION
+static_assert(ASYNC_MQTT_SSL_SESSION_SIZE <= 0xFFFF, "ASYNC_MQTT_SSL_SESSION_SIZE does not fit the length of a session");
+
+struct SslSession {
+  uint8_t data[ASYNC_MQTT_SSL_SESSION_SIZE];
+  uint16_t length;
+};
+#endif
+
+#if ASYNC_TCP_SSL_ENABLED
+enum class SslFragmentSupport : uint8_t {
+  UNKNOWN = 0,
+  PROBE_FAILED = 1,
+  SUPPORTED = 2,
+  UNSUPPORTED = 3
+};
+#endif
+}  // namespace AsyncMqttClientInternals
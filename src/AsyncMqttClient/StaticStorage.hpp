@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <type_traits>
+
+#include "Storage.hpp"
+#include "TimerWheel.hpp"
+#include "Transports/DefaultTransport.hpp"
+#include "Packets/ConnAckPacket.hpp"
+#include "Packets/PingRespPacket.hpp"
+#include "Packets/SubAckPacket.hpp"
+#include "Packets/UnsubAckPacket.hpp"
+#include "Packets/PublishPacket.hpp"
+#include "Packets/PubRelPacket.hpp"
+#include "Packets/PubAckPacket.hpp"
+#include "Packets/PubRecPacket.hpp"
+#include "Packets/PubCompPacket.hpp"
+
+namespace AsyncMqttClientInternals {
+// Room for the packet being parsed, whichever its type
+union PacketStorage {
+  void* pointer;
+  long long integer;  // NOLINT(runtime/int)
+  double real;
+  char connAck[sizeof(ConnAckPacket)];
+  char pingResp[sizeof(PingRespPacket)];
+  char subAck[sizeof(SubAckPacket)];
+  char unsubAck[sizeof(UnsubAckPacket)];
+  char publish[sizeof(PublishPacket)];
+  char pubRel[sizeof(PubRelPacket)];
+  char pubAck[sizeof(PubAckPacket)];
+  char pubRec[sizeof(PubRecPacket)];
+  char pubComp[sizeof(PubCompPacket)];
+};
+
+// What a client uses in place of the heap, see AsyncMqttClientT. String capacities exclude the terminating zero.
+struct ClientStorage {
+  TimerWheel* timerWheel;
+  void* defaultTransport;  // room for one, constructed only for a client without a transport
+  PacketStorage* packet;
+  char* topicBuffer;
+  uint16_t maxTopicLength;
+  PendingAck* acks;
+  size_t ackDepth;
+  PendingPubRel* pubRels;
+  size_t pubRelDepth;
+  char* clientId;
+  size_t clientIdCapacity;
+  char* host;
+  size_t hostCapacity;
+  char* username;
+  size_t usernameCapacity;
+  char* password;
+  size_t passwordCapacity;
+  char* willTopic;
+  size_t willTopicCapacity;
+  char* willPayload;
+  size_t willPayloadCapacity;
+};
+
+// Storage of an AsyncMqttClientT, a base class constructed before the client
+template <typename Config>
+class StaticClientStorage {
+ protected:
+  static_assert(Config::ACK_QUEUE_DEPTH > 0, "ACK_QUEUE_DEPTH must be at least 1");
+  static_assert(Config::INFLIGHT_WINDOW > 0, "INFLIGHT_WINDOW must be at least 1");
+
+  ClientStorage _storage() {
+    ClientStorage storage;
+    storage.timerWheel = &_timerWheelStorage;
+    storage.defaultTransport = &_defaultTransportStorage;
+    storage.packet = &_packetStorage;
+    storage.topicBuffer = _topicBufferStorage;
+    storage.maxTopicLength = Config::MAX_TOPIC_LENGTH;
+    storage.acks = _ackStorage;
+    storage.ackDepth = Config::ACK_QUEUE_DEPTH;
+    storage.pubRels = _pubRelStorage;
+    storage.pubRelDepth = Config::INFLIGHT_WINDOW;
+    storage.clientId = _clientIdStorage;
+    storage.clientIdCapacity = Config::MAX_CLIENT_ID_LENGTH;
+    storage.host = _hostStorage;
+    storage.hostCapacity = Config::MAX_HOST_LENGTH;
+    storage.username = _usernameStorage;
+    storage.usernameCapacity = Config::MAX_USERNAME_LENGTH;
+    storage.password = _passwordStorage;
+    storage.passwordCapacity = Config::MAX_PASSWORD_LENGTH;
+    storage.willTopic = _willTopicStorage;
+    storage.willTopicCapacity = Config::MAX_WILL_TOPIC_LENGTH;
+    storage.willPayload = _willPayloadStorage;
+    storage.willPayloadCapacity = Config::MAX_WILL_PAYLOAD_LENGTH;
+    return storage;
+  }
+
+ private:
+  TimerWheel _timerWheelStorage;
+  typename std::aligned_storage<sizeof(DefaultTransport), alignof(DefaultTransport)>::type _defaultTransportStorage;
+  PacketStorage _packetStorage;
+  char _topicBufferStorage[Config::MAX_TOPIC_LENGTH + 1];
+  PendingAck _ackStorage[Config::ACK_QUEUE_DEPTH];
+  PendingPubRel _pubRelStorage[Config::INFLIGHT_WINDOW];
+  char _clientIdStorage[Config::MAX_CLIENT_ID_LENGTH + 1];
+  char _hostStorage[Config::MAX_HOST_LENGTH + 1];
+  char _usernameStorage[Config::MAX_USERNAME_LENGTH + 1];
+  char _passwordStorage[Config::MAX_PASSWORD_LENGTH + 1];
+  char _willTopicStorage[Config::MAX_WILL_TOPIC_LENGTH + 1];
+  char _willPayloadStorage[Config::MAX_WILL_PAYLOAD_LENGTH + 1];
+};
+}  // namespace AsyncMqttClientInternals
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Memory.hpp"
+
 namespace AsyncMqttClientInternals {
 struct PendingPubRel {
   uint16_t packetId;
@@ -10,4 +16,66 @@ struct PendingAck {
   uint8_t headerFlag;
   uint16_t packetId;
 };
+
+// List of plain records. Grows through the allocator hooks (QUEUE) and gives its memory back once empty,
+// or lives in a fixed array handed with setStorage(). push() fails once full, or out of memory.
+template <typename T>
+class PendingList {
+ public:
+  PendingList() : _items(nullptr), _size(0), _capacity(0), _fixed(false) {}
+  ~PendingList() { if (!_fixed) _release(); }
+
+  PendingList(PendingList const &) = delete;
+  PendingList& operator=(PendingList const &) = delete;
+
+  void setStorage(T* items, size_t capacity) {
+    if (!_fixed) _release();
+    _items = items;
+    _size = 0;
+    _capacity = capacity;
+    _fixed = true;
+  }
+
+  size_t size() const { return _size; }
+  bool full() const { return _fixed && _size == _capacity; }
+  T const &operator[](size_t index) const { return _items[index]; }
+  T const *begin() const { return _items; }
+  T const *end() const { return _items + _size; }
+
+  bool push(T const &item) {
+    if (_size == _capacity) {
+      if (_fixed) return false;
+      size_t capacity = _capacity == 0 ? 4 : _capacity * 2;
+      T* items = static_cast<T*>(allocate(capacity * sizeof(T), AsyncMqttClientMemoryTag::QUEUE));
+      if (!items) return false;
+      if (_size != 0) memcpy(items, _items, _size * sizeof(T));
+      _release();
+      _items = items;
+      _capacity = capacity;
+    }
+    _items[_size++] = item;
+    return true;
+  }
+
+  void erase(size_t index) {
+    memmove(_items + index, _items + index + 1, (_size - index - 1) * sizeof(T));
+    if (--_size == 0) clear();
+  }
+
+  void clear() {
+    _size = 0;
+    if (_fixed) return;
+    _release();
+    _items = nullptr;
+    _capacity = 0;
+  }
+
+ private:
+  T* _items;
+  size_t _size;
+  size_t _capacity;
+  bool _fixed;
+
+  void _release() { AsyncMqttClientInternals::release(_items, _capacity * sizeof(T), AsyncMqttClientMemoryTag::QUEUE); }
+};
 }  // namespace AsyncMqttClientInternals
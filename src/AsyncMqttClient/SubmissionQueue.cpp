@@ -0,0 +1,116 @@
+#include "SubmissionQueue.hpp"
+#include "Memory.hpp"
+
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+
+#include <new>
+
+using AsyncMqttClientInternals::SubmissionQueue;
+using AsyncMqttClientInternals::Submission;
+using AsyncMqttClientInternals::SubmissionType;
+
+SubmissionQueue::SubmissionQueue()
+: _slots(nullptr)
+, _slotSize(0)
+, _mask(0)
+, _entrySize(0)
+, _tail(0)
+, _head(0) {
+}
+
+SubmissionQueue::~SubmissionQueue() {
+  if (!_slots) return;
+  for (uint32_t i = 0; i <= _mask; i++) _slot(i)->~Slot();
+  release(_slots, (_mask + 1) * _slotSize, AsyncMqttClientMemoryTag::QUEUE);
+}
+
+bool SubmissionQueue::allocate(size_t depth, size_t entrySize) {
+  if (_slots || depth == 0) return false;
+
+  uint32_t slots = 1;
+  while (slots < depth) slots <<= 1;
+  _slotSize = (sizeof(Slot) + entrySize + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot);
+  _slots = static_cast<uint8_t*>(AsyncMqttClientInternals::allocate(slots * _slotSize, AsyncMqttClientMemoryTag::QUEUE));
+  if (!_slots) return false;
+  _mask = slots - 1;
+  _entrySize = entrySize;
+  // the sequence of a slot is the position it can be written at, plus one once written
+  for (uint32_t i = 0; i < slots; i++) {
+    Slot* slot = new (_slot(i)) Slot();
+    slot->sequence.store(i, std::memory_order_relaxed);
+  }
+  _tail.store(0, std::memory_order_relaxed);
+  _head = 0;
+  return true;
+}
+
+bool SubmissionQueue::allocated() const {
+  return _slots != nullptr;
+}
+
+size_t SubmissionQueue::depth() const {
+  return _slots ? _mask + 1 : 0;
+}
+
+size_t SubmissionQueue::entrySize() const {
+  return _entrySize;
+}
+
+bool SubmissionQueue::push(SubmissionType type, uint8_t qos, bool retain, uint16_t packetId,
+  const char* topic, uint16_t topicLength, const char* payload, uint32_t payloadLength) {
+  if (!_slots || static_cast<size_t>(topicLength) + payloadLength > _entrySize) return false;
+
+  // claim a position, the slot at it must have been read a whole lap ago
+  Slot* slot;
+  uint32_t position = _tail.load(std::memory_order_relaxed);
+  for (;;) {
+    slot = _slot(position);
+    int32_t lag = static_cast<int32_t>(slot->sequence.load(std::memory_order_acquire) - position);
+    if (lag == 0) {
+      if (_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+    } else if (lag < 0) {
+      return false;
+    } else {
+      position = _tail.load(std::memory_order_relaxed);
+    }
+  }
+
+  Submission& submission = slot->submission;
+  submission.type = type;
+  submission.qos = qos;
+  submission.retain = retain;
+  submission.packetId = packetId;
+  submission.topicLength = topicLength;
+  submission.payloadLength = payloadLength;
+  char* data = reinterpret_cast<char*>(&submission + 1);
+  if (topicLength > 0) memcpy(data, topic, topicLength);
+  if (payloadLength > 0) memcpy(data + topicLength, payload, payloadLength);
+
+  // publish the slot to the consumer
+  slot->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+Submission* SubmissionQueue::front() {
+  if (!_slots) return nullptr;
+  Slot* slot = _slot(_head);
+  if (slot->sequence.load(std::memory_order_acquire) != _head + 1) return nullptr;
+  return &slot->submission;
+}
+
+void SubmissionQueue::pop() {
+  Slot* slot = _slot(_head);
+  // hand the slot back to the producers, for the next lap
+  slot->sequence.store(_head + _mask + 1, std::memory_order_release);
+  _head++;
+}
+
+void SubmissionQueue::clear() {
+  while (front()) pop();
+}
+
+SubmissionQueue::Slot* SubmissionQueue::_slot(uint32_t position) const {
+  return reinterpret_cast<Slot*>(_slots + (position & _mask) * _slotSize);
+}
+
+#endif
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Thread safe submissions (submitPublish, submitSubscribe, submitUnsubscribe), where publishers run on other tasks or cores
+#ifndef ASYNC_MQTT_SUBMISSION_QUEUE
+#if defined(ESP32) || (defined(__linux__) && !defined(ESP8266))
+#define ASYNC_MQTT_SUBMISSION_QUEUE 1
+#else
+#define ASYNC_MQTT_SUBMISSION_QUEUE 0
+#endif
+#endif
+
+#if ASYNC_MQTT_SUBMISSION_QUEUE
+
+#include <atomic>
+
+namespace AsyncMqttClientInternals {
+enum class SubmissionType : uint8_t {
+  PUBLISH,
+  SUBSCRIBE,
+  UNSUBSCRIBE
+};
+
+// A queued packet, the topic then the payload follow it in the slot
+struct Submission {
+  SubmissionType type;
+  uint8_t qos;
+  bool retain;
+  uint16_t packetId;
+  uint16_t topicLength;
+  uint32_t payloadLength;
+
+  const char* topic() const { return reinterpret_cast<const char*>(this + 1); }
+  const char* payload() const { return topic() + topicLength; }
+};
+
+// Bounded multi-producer single-consumer queue of fixed size slots, allocated once (D. Vyukov's bounded queue).
+// Any thread pushes without locking, a full queue or an entry larger than a slot is refused;
+// only the network task reads, with front() and pop().
+class SubmissionQueue {
+ public:
+  SubmissionQueue();
+  ~SubmissionQueue();
+
+  SubmissionQueue(SubmissionQueue const &) = delete;
+  SubmissionQueue& operator=(SubmissionQueue const &) = delete;
+
+  // Before any producer runs: depth is rounded up to a power of two, entrySize bounds topic plus payload.
+  // The slots come from the allocator hooks (QUEUE), false when already allocated or out of memory
+  bool allocate(size_t depth, size_t entrySize);
+  bool allocated() const;
+  size_t depth() const;
+  size_t entrySize() const;
+
+  // Producers
+  bool push(SubmissionType type, uint8_t qos, bool retain, uint16_t packetId,
+    const char* topic, uint16_t topicLength, const char* payload, uint32_t payloadLength);
+
+  // Consumer
+  Submission* front();
+  void pop();
+  void clear();
+
+ private:
+  struct Slot {
+    std::atomic<uint32_t> sequence;
+    Submission submission;
+  };
+
+  uint8_t* _slots;
+  size_t _slotSize;
+  uint32_t _mask;
+  size_t _entrySize;
+  std::atomic<uint32_t> _tail;
+  uint32_t _head;
+
+  Slot* _slot(uint32_t position) const;
+};
+}  // namespace AsyncMqttClientInternals
+
+#endif
@@ -0,0 +1,201 @@
+#include "TimerWheel.hpp"
+
+using AsyncMqttClientInternals::Timer;
+using AsyncMqttClientInternals::TimerWheel;
+
+Timer::Timer()
+: _next(nullptr)
+, _pprev(nullptr)
+, _expiry(0) {
+}
+
+Timer::Timer(OnTimerInternalCallback const &callback)
+: _next(nullptr)
+, _pprev(nullptr)
+, _expiry(0)
+, _callback(callback) {
+}
+
+Timer::~Timer() {
+  _unlink();
+}
+
+void Timer::setCallback(OnTimerInternalCallback const &callback) {
+  _callback = callback;
+}
+
+bool Timer::armed() const {
+  return _pprev != nullptr;
+}
+
+void Timer::_unlink() {
+  if (!_pprev) return;
+  *_pprev = _next;
+  if (_next) _next->_pprev = _pprev;
+  _next = nullptr;
+  _pprev = nullptr;
+}
+
+TimerWheel::TimerWheel(ClockFunction clock)
+: _clock(clock ? clock : _defaultClock)
+, _tickTime(0)
+, _currentTick(0)
+, _occupied(0) {
+  memset(_slots, 0, sizeof(_slots));
+  _tickTime = _clock();
+}
+
+TimerWheel::~TimerWheel() {
+  clear();
+}
+
+uint32_t TimerWheel::_defaultClock() {
+  return millis();
+}
+
+void TimerWheel::setClock(ClockFunction clock) {
+  // Pending timers keep their remaining ticks, only the time base moves
+  _clock = clock ? clock : _defaultClock;
+  _tickTime = _clock();
+}
+
+uint32_t TimerWheel::now() const {
+  return _clock();
+}
+
+void TimerWheel::schedule(Timer* timer, uint32_t delay) {
+  timer->_unlink();
+
+  // Round up, so a timer never fires before its delay has fully elapsed
+  uint32_t ticks = ((_clock() - _tickTime) + delay + (1UL << TICK_SHIFT) - 1) >> TICK_SHIFT;
+  if (ticks == 0) ticks = 1;
+  timer->_expiry = _currentTick + ticks;
+  _insert(timer);
+}
+
+void TimerWheel::cancel(Timer* timer) {
+  timer->_unlink();
+}
+
+void TimerWheel::advance() {
+  uint32_t ticks = (_clock() - _tickTime) >> TICK_SHIFT;
+  if (ticks == 0) return;
+
+  if (ticks >= RANGE) {
+    _tickTime += ticks << TICK_SHIFT;
+    _rebase(ticks);
+    return;
+  }
+
+  while (ticks > 0) {
+    // Only jump as far as the next level 0 wrap, where upper levels may cascade
+    uint32_t step = SLOTS - (_currentTick & SLOT_MASK);
+    if (step > ticks) step = ticks;
+
+    uint32_t offset = 1;
+    for (; offset < step; offset++) {
+      if (_occupied & (1 << ((_currentTick + offset) & SLOT_MASK))) break;
+    }
+    // Keep the time base in step, timers re-armed from a callback are relative to this tick
+    _currentTick += offset;
+    _tickTime += offset << TICK_SHIFT;
+    ticks -= offset;
+
+    for (uint8_t level = 1; level < LEVELS; level++) {
+      if (_currentTick & ((1UL << (level * LEVEL_BITS)) - 1)) break;
+      _cascade(level);
+    }
+    _expire(_currentTick & SLOT_MASK);
+  }
+}
+
+void TimerWheel::clear() {
+  for (uint8_t level = 0; level < LEVELS; level++) {
+    for (uint8_t slot = 0; slot < SLOTS; slot++) {
+      while (_slots[level][slot]) _slots[level][slot]->_unlink();
+    }
+  }
+  _occupied = 0;
+}
+
+void TimerWheel::_insert(Timer* timer) {
+  int32_t delta = static_cast<int32_t>(timer->_expiry - _currentTick);
+  uint32_t slotTick = timer->_expiry;
+  if (delta < 0) {
+    delta = 0;
+    slotTick = _currentTick;
+  } else if (static_cast<uint32_t>(delta) >= RANGE) {
+    // Out of range, park it in the farthest slot and re-evaluate when it cascades
+    delta = RANGE - 1;
+    slotTick = _currentTick + delta;
+  }
+
+  uint8_t level = 0;
+  while (level < LEVELS - 1 && static_cast<uint32_t>(delta) >= (1UL << ((level + 1) * LEVEL_BITS))) level++;
+
+  uint8_t slot = (slotTick >> (level * LEVEL_BITS)) & SLOT_MASK;
+  Timer** head = &_slots[level][slot];
+  timer->_next = *head;
+  if (timer->_next) timer->_next->_pprev = &timer->_next;
+  timer->_pprev = head;
+  *head = timer;
+
+  if (level == 0) _occupied |= 1 << slot;
+}
+
+void TimerWheel::_cascade(uint8_t level) {
+  uint8_t slot = (_currentTick >> (level * LEVEL_BITS)) & SLOT_MASK;
+  Timer* pending = _slots[level][slot];
+  if (!pending) return;
+
+  _slots[level][slot] = nullptr;
+  pending->_pprev = &pending;
+  while (pending) {
+    Timer* timer = pending;
+    timer->_unlink();
+    _insert(timer);
+  }
+}
+
+void TimerWheel::_expire(uint8_t slot) {
+  Timer* pending = _slots[0][slot];
+  _slots[0][slot] = nullptr;
+  _occupied &= ~(1 << slot);
+  if (!pending) return;
+
+  // Detach the slot first, callbacks are free to re-arm or cancel any timer
+  pending->_pprev = &pending;
+  while (pending) {
+    Timer* timer = pending;
+    timer->_unlink();
+    if (timer->_callback) timer->_callback();
+  }
+}
+
+void TimerWheel::_rebase(uint32_t ticks) {
+  // The clock jumped past the whole wheel, collect everything and start over
+  Timer* pending = nullptr;
+  for (uint8_t level = 0; level < LEVELS; level++) {
+    for (uint8_t slot = 0; slot < SLOTS; slot++) {
+      while (Timer* timer = _slots[level][slot]) {
+        timer->_unlink();
+        timer->_next = pending;
+        if (pending) pending->_pprev = &timer->_next;
+        timer->_pprev = &pending;
+        pending = timer;
+      }
+    }
+  }
+  _occupied = 0;
+  _currentTick += ticks;
+
+  while (pending) {
+    Timer* timer = pending;
+    timer->_unlink();
+    if (static_cast<int32_t>(timer->_expiry - _currentTick) <= 0) {
+      if (timer->_callback) timer->_callback();
+    } else {
+      _insert(timer);
+    }
+  }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Arduino.h"
+#include "Callbacks.hpp"
+
+// Each tick of the wheel covers (1 << ASYNC_MQTT_TIMER_TICK_SHIFT) milliseconds
+#ifndef ASYNC_MQTT_TIMER_TICK_SHIFT
+#define ASYNC_MQTT_TIMER_TICK_SHIFT 6
+#endif
+
+namespace AsyncMqttClientInternals {
+typedef uint32_t (*ClockFunction)();
+
+class Timer {
+ public:
+  Timer();
+  explicit Timer(OnTimerInternalCallback const &callback);
+  ~Timer();
+
+  Timer(Timer const &) = delete;
+  Timer& operator=(Timer const &) = delete;
+
+  void setCallback(OnTimerInternalCallback const &callback);
+  bool armed() const;
+
+ private:
+  friend class TimerWheel;
+
+  Timer* _next;
+  Timer** _pprev;
+  uint32_t _expiry;
+  OnTimerInternalCallback _callback;
+
+  void _unlink();
+};
+
+class TimerWheel {
+ public:
+  explicit TimerWheel(ClockFunction clock = nullptr);
+  ~TimerWheel();
+
+  TimerWheel(TimerWheel const &) = delete;
+  TimerWheel& operator=(TimerWheel const &) = delete;
+
+  void setClock(ClockFunction clock);
+  uint32_t now() const;
+
+  void schedule(Timer* timer, uint32_t delay);
+  void cancel(Timer* timer);
+  void advance();
+  void clear();
+
+ private:
+  static const uint8_t TICK_SHIFT = ASYNC_MQTT_TIMER_TICK_SHIFT;
+  static const uint8_t LEVEL_BITS = 4;
+  static const uint8_t LEVELS = 4;
+  static const uint8_t SLOTS = 1 << LEVEL_BITS;
+  static const uint8_t SLOT_MASK = SLOTS - 1;
+  static const uint32_t RANGE = 1UL << (LEVEL_BITS * LEVELS);
+
+  ClockFunction _clock;
+  uint32_t _tickTime;
+  uint32_t _currentTick;
+  uint16_t _occupied;
+  Timer* _slots[LEVELS][SLOTS];
+
+  static uint32_t _defaultClock();
+
+  void _insert(Timer* timer);
+  void _cascade(uint8_t level);
+  void _expire(uint8_t slot);
+  void _rebase(uint32_t ticks);
+};
+}  // namespace AsyncMqttClientInternals
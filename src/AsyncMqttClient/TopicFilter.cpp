@@ -0,0 +1,29 @@
+#include "TopicFilter.hpp"
+
+bool AsyncMqttClientInternals::topicMatches(const char* filter, const char* topic, size_t topicLength) {
+  if (topicLength > 0 && topic[0] == '$' && (filter[0] == '+' || filter[0] == '#')) return false;
+
+  size_t position = 0;
+  while (*filter) {
+    if (filter[0] == '#') return filter[1] == '\0';
+    if (filter[0] == '+') {
+      while (position < topicLength && topic[position] != '/') position++;
+      filter++;
+    } else {
+      // the levels of the filter and of the topic end together
+      while (*filter && *filter != '/') {
+        if (position == topicLength || topic[position] != *filter) return false;
+        position++;
+        filter++;
+      }
+      if (position < topicLength && topic[position] != '/') return false;
+    }
+
+    if (*filter == '\0') return position == topicLength;
+    // "a/#" matches "a" as well
+    if (position == topicLength) return filter[1] == '#' && filter[2] == '\0';
+    filter++;
+    position++;
+  }
+  return position == topicLength;
+}
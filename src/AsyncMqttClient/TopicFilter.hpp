@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace AsyncMqttClientInternals {
+// Whether a topic matches a subscription filter, "+" standing for one level and a trailing "#" for any number of them,
+// none included. Topics starting with "$" are matched by wildcards from their second level on only, as a broker does.
+bool topicMatches(const char* filter, const char* topic, size_t topicLength);
+}  // namespace AsyncMqttClientInternals
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Arduino.h"
+
+namespace AsyncMqttClientInternals {
+class TransportListener {
+ public:
+  virtual ~TransportListener() {}
+
+  virtual void onTransportConnect() = 0;
+  virtual void onTransportDisconnect() = 0;
+  virtual void onTransportError(int8_t error) = 0;
+  virtual void onTransportTimeout(uint32_t time) = 0;
+  virtual void onTransportAck(size_t len, uint32_t time) = 0;
+  virtual void onTransportData(char* data, size_t len) = 0;
+  virtual void onTransportPoll() = 0;
+};
+
+// Byte stream to the broker, with the semantics of AsyncClient:
+// add() queues at most space() bytes, send() pushes them out, and close() reports the disconnection synchronously
+class Transport {
+ public:
+  Transport() : _listener(nullptr) {}
+  virtual ~Transport() {}
+
+  void setListener(TransportListener* listener) { _listener = listener; }
+
+  virtual bool connect(IPAddress ip, uint16_t port, bool secure) = 0;
+  virtual bool connect(const char* host, uint16_t port, bool secure) = 0;
+  virtual void close(bool now) = 0;
+
+  virtual size_t space() = 0;
+  virtual size_t add(const char* data, size_t size) = 0;
+  virtual bool send() = 0;
+
+  // From any thread: have the listener polled soon, in the context the transport reports its events from.
+  // Without a way to do so, the next regular poll or ack does it.
+  virtual void wake() {}
+
+  // TLS session resumption, for transports whose TLS stack can: the session of the connection once it is up, copied
+  // into data, its length or 0 when there is none or it does not fit; and the session to offer on the next connect()
+  virtual size_t sslSession(uint8_t* data, size_t capacity) {
+    (void)data;
+    (void)capacity;
+    return 0;
+  }
+  virtual void setSslSession(const uint8_t* data, size_t length) {
+    (void)data;
+    (void)length;
+  }
+
+ protected:
+  TransportListener* _listener;
+};
+}  // namespace AsyncMqttClientInternals
@@ -0,0 +1,131 @@
+#include "AsyncTcpTransport.hpp"
+
+#if defined(ESP32) || defined(ESP8266)
+
+#if ASYNC_MQTT_ASYNC_TCP_WAKE
+#include <lwip/priv/tcp_priv.h>
+#include <lwip/priv/tcpip_priv.h>
+#include <lwip/tcpip.h>
+#endif
+
+using AsyncMqttClientInternals::AsyncTcpTransport;
+
+AsyncTcpTransport::AsyncTcpTransport()
+#if ASYNC_MQTT_ASYNC_TCP_WAKE
+: _wakePending(false)
+#endif
+{
+  _client.onConnect([](void* obj, AsyncClient* c) {
+      AsyncTcpTransport* transport = static_cast<AsyncTcpTransport*>(obj);
+      if (transport->_listener) transport->_listener->onTransportConnect();
+    }, this);
+  _client.onDisconnect([](void* obj, AsyncClient* c) {
+      AsyncTcpTransport* transport = static_cast<AsyncTcpTransport*>(obj);
+      if (transport->_listener) transport->_listener->onTransportDisconnect();
+    }, this);
+  _client.onError([](void* obj, AsyncClient* c, err_t error) {
+      AsyncTcpTransport* transport = static_cast<AsyncTcpTransport*>(obj);
+      if (transport->_listener) transport->_listener->onTransportError(error);
+    }, this);
+  _client.onTimeout([](void* obj, AsyncClient* c, uint32_t time) {
+      AsyncTcpTransport* transport = static_cast<AsyncTcpTransport*>(obj);
+      if (transport->_listener) transport->_listener->onTransportTimeout(time);
+    }, this);
+  _client.onAck([](void* obj, AsyncClient* c, size_t len, uint32_t time) {
+      AsyncTcpTransport* transport = static_cast<AsyncTcpTransport*>(obj);
+      if (transport->_listener) transport->_listener->onTransportAck(len, time);
+    }, this);
+  _client.onData([](void* obj, AsyncClient* c, void* data, size_t len) {
+      AsyncTcpTransport* transport = static_cast<AsyncTcpTransport*>(obj);
+      if (transport->_listener) transport->_listener->onTransportData(static_cast<char*>(data), len);
+    }, this);
+  _client.onPoll([](void* obj, AsyncClient* c) {
+      AsyncTcpTransport* transport = static_cast<AsyncTcpTransport*>(obj);
+      if (transport->_listener) transport->_listener->onTransportPoll();
+    }, this);
+}
+
+AsyncTcpTransport::~AsyncTcpTransport() {
+#if ASYNC_MQTT_ASYNC_TCP_WAKE
+  // the lwIP thread runs its messages in order: once an empty call went through, a queued _wakeUp() has run
+  if (_wakePending.load(std::memory_order_acquire)) {
+    struct tcpip_api_call_data call;
+    tcpip_api_call([](struct tcpip_api_call_data* call) -> err_t {
+        (void)call;
+        return ERR_OK;
+      }, &call);
+  }
+#endif
+}
+
+bool AsyncTcpTransport::connect(IPAddress ip, uint16_t port, bool secure) {
+#if ASYNC_TCP_SSL_ENABLED
+  return _client.connect(ip, port, secure);
+#else
+  (void)secure;
+  return _client.connect(ip, port);
+#endif
+}
+
+bool AsyncTcpTransport::connect(const char* host, uint16_t port, bool secure) {
+#if ASYNC_TCP_SSL_ENABLED
+  return _client.connect(host, port, secure);
+#else
+  (void)secure;
+  return _client.connect(host, port);
+#endif
+}
+
+void AsyncTcpTransport::close(bool now) {
+  _client.close(now);
+}
+
+size_t AsyncTcpTransport::space() {
+  return _client.space();
+}
+
+size_t AsyncTcpTransport::add(const char* data, size_t size) {
+  return _client.add(data, size);
+}
+
+bool AsyncTcpTransport::send() {
+  return _client.send();
+}
+
+#if ASYNC_MQTT_ASYNC_TCP_WAKE
+void AsyncTcpTransport::wake() {
+  // AsyncTCP reports its events from its own task, fed by the lwIP thread: a poll of the connection raised in the
+  // lwIP thread reaches the listener through the same queue as the regular ones. One at a time.
+  if (_wakePending.exchange(true, std::memory_order_acq_rel)) return;
+  if (tcpip_callback(_wakeUp, this) != ERR_OK) _wakePending.store(false, std::memory_order_release);
+}
+
+void AsyncTcpTransport::_wakeUp(void* arg) {
+  AsyncTcpTransport* transport = static_cast<AsyncTcpTransport*>(arg);
+  // only a connection lwIP still has: AsyncTCP forgets a closed one from its own task, later
+  tcp_pcb* pcb = transport->_client.pcb();
+  for (tcp_pcb* active = tcp_active_pcbs; pcb && active; active = active->next) {
+    if (active == pcb) {
+      if (pcb->poll) pcb->poll(pcb->callback_arg, pcb);
+      break;
+    }
+  }
+  transport->_wakePending.store(false, std::memory_order_release);
+}
+#endif
+
+#if ASYNC_TCP_SSL_ENABLED && ASYNC_TCP_SSL_SESSION_REUSE
+size_t AsyncTcpTransport::sslSession(uint8_t* data, size_t capacity) {
+  return _client.getSSLSession(data, capacity);
+}
+
+void AsyncTcpTransport::setSslSession(const uint8_t* data, size_t length) {
+  _client.setSSLSession(data, length);
+}
+#endif
+
+AsyncClient& AsyncTcpTransport::client() {
+  return _client;
+}
+
+#endif
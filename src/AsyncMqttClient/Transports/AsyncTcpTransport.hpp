@@ -0,0 +1,63 @@
+#pragma once
+
+#if defined(ESP32) || defined(ESP8266)
+
+#include "Arduino.h"
+#ifdef ESP32
+#include <atomic>
+
+#include <AsyncTCP.h>
+#include <lwip/init.h>
+#else
+#include <ESPAsyncTCP.h>
+#endif
+#include "../SslSession.hpp"
+#include "../Transport.hpp"
+
+// wake() raises a poll of the connection in the lwIP thread. Neither lwIP nor AsyncTCP has a public way to do it: it walks
+// lwIP's private list of active connections and calls the poll callback AsyncTCP sets on them, so it is only on for the
+// lwIP 2.1 (ESP-IDF 4 and 5) and AsyncTCP (up to 3.x) it was written against. At 0 submissions wait for the next poll or ack
+#ifndef ASYNC_MQTT_ASYNC_TCP_WAKE
+#if defined(ESP32) && LWIP_VERSION_MAJOR == 2 && LWIP_VERSION_MINOR == 1 && \
+    (!defined(ASYNCTCP_VERSION_MAJOR) || ASYNCTCP_VERSION_MAJOR <= 3)
+#define ASYNC_MQTT_ASYNC_TCP_WAKE 1
+#else
+#define ASYNC_MQTT_ASYNC_TCP_WAKE 0
+#endif
+#endif
+
+namespace AsyncMqttClientInternals {
+class AsyncTcpTransport : public Transport {
+ public:
+  AsyncTcpTransport();
+  ~AsyncTcpTransport();
+
+  bool connect(IPAddress ip, uint16_t port, bool secure);
+  bool connect(const char* host, uint16_t port, bool secure);
+  void close(bool now);
+
+  size_t space();
+  size_t add(const char* data, size_t size);
+  bool send();
+#if ASYNC_MQTT_ASYNC_TCP_WAKE
+  void wake();
+#endif
+#if ASYNC_TCP_SSL_ENABLED && ASYNC_TCP_SSL_SESSION_REUSE
+  size_t sslSession(uint8_t* data, size_t capacity);
+  void setSslSession(const uint8_t* data, size_t length);
+#endif
+
+  AsyncClient& client();
+
+ private:
+  AsyncClient _client;
+#if ASYNC_MQTT_ASYNC_TCP_WAKE
+  // a wake() queued to the lwIP thread and not run yet
+  std::atomic<bool> _wakePending;
+
+  static void _wakeUp(void* arg);
+#endif
+};
+}  // namespace AsyncMqttClientInternals
+
+#endif
@@ -0,0 +1,91 @@
+#include "CaptureTransport.hpp"
+
+using AsyncMqttClientInternals::CaptureDirection;
+using AsyncMqttClientInternals::CaptureTransport;
+
+static uint32_t defaultCaptureClock() {
+  return micros();
+}
+
+CaptureTransport::CaptureTransport(Transport* transport, FrameCapture* capture, ClockFunction clock)
+: _transport(transport)
+, _capture(capture)
+, _clock(clock ? clock : defaultCaptureClock) {
+  _transport->setListener(this);
+}
+
+CaptureTransport::~CaptureTransport() {
+  _transport->setListener(nullptr);
+}
+
+bool CaptureTransport::connect(IPAddress ip, uint16_t port, bool secure) {
+  return _transport->connect(ip, port, secure);
+}
+
+bool CaptureTransport::connect(const char* host, uint16_t port, bool secure) {
+  return _transport->connect(host, port, secure);
+}
+
+void CaptureTransport::close(bool now) {
+  _transport->close(now);
+}
+
+size_t CaptureTransport::space() {
+  return _transport->space();
+}
+
+size_t CaptureTransport::add(const char* data, size_t size) {
+  size_t added = _transport->add(data, size);
+  if (added == 0) return 0;
+  if (!_capture->recording()) _capture->begin(CaptureDirection::OUTBOUND, _clock());
+  _capture->append(data, added);
+  return added;
+}
+
+bool CaptureTransport::send() {
+  _capture->end();
+  return _transport->send();
+}
+
+void CaptureTransport::wake() {
+  _transport->wake();
+}
+
+size_t CaptureTransport::sslSession(uint8_t* data, size_t capacity) {
+  return _transport->sslSession(data, capacity);
+}
+
+void CaptureTransport::setSslSession(const uint8_t* data, size_t length) {
+  _transport->setSslSession(data, length);
+}
+
+void CaptureTransport::onTransportConnect() {
+  _capture->record(CaptureDirection::CONNECTED, _clock(), nullptr, 0);
+  if (_listener) _listener->onTransportConnect();
+}
+
+void CaptureTransport::onTransportDisconnect() {
+  _capture->record(CaptureDirection::DISCONNECTED, _clock(), nullptr, 0);
+  if (_listener) _listener->onTransportDisconnect();
+}
+
+void CaptureTransport::onTransportError(int8_t error) {
+  if (_listener) _listener->onTransportError(error);
+}
+
+void CaptureTransport::onTransportTimeout(uint32_t time) {
+  if (_listener) _listener->onTransportTimeout(time);
+}
+
+void CaptureTransport::onTransportAck(size_t len, uint32_t time) {
+  if (_listener) _listener->onTransportAck(len, time);
+}
+
+void CaptureTransport::onTransportData(char* data, size_t len) {
+  _capture->record(CaptureDirection::INBOUND, _clock(), data, len);
+  if (_listener) _listener->onTransportData(data, len);
+}
+
+void CaptureTransport::onTransportPoll() {
+  if (_listener) _listener->onTransportPoll();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Arduino.h"
+#include "../Transport.hpp"
+#include "../TimerWheel.hpp"
+#include "../FrameCapture.hpp"
+
+namespace AsyncMqttClientInternals {
+// Records what goes through another transport into a FrameCapture: each inbound segment as delivered, each outbound
+// frame from the first add() to its send(), and the connections and disconnections. Timestamps come from the clock,
+// in microseconds, micros() by default.
+class CaptureTransport : public Transport, private TransportListener {
+ public:
+  CaptureTransport(Transport* transport, FrameCapture* capture, ClockFunction clock = nullptr);
+  ~CaptureTransport();
+
+  CaptureTransport(CaptureTransport const &) = delete;
+  CaptureTransport& operator=(CaptureTransport const &) = delete;
+
+  bool connect(IPAddress ip, uint16_t port, bool secure);
+  bool connect(const char* host, uint16_t port, bool secure);
+  void close(bool now);
+
+  size_t space();
+  size_t add(const char* data, size_t size);
+  bool send();
+  void wake();
+  size_t sslSession(uint8_t* data, size_t capacity);
+  void setSslSession(const uint8_t* data, size_t length);
+
+ private:
+  Transport* _transport;
+  FrameCapture* _capture;
+  ClockFunction _clock;
+
+  void onTransportConnect();
+  void onTransportDisconnect();
+  void onTransportError(int8_t error);
+  void onTransportTimeout(uint32_t time);
+  void onTransportAck(size_t len, uint32_t time);
+  void onTransportData(char* data, size_t len);
+  void onTransportPoll();
+};
+}  // namespace AsyncMqttClientInternals
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "AsyncTcpTransport.hpp"
+#include "PosixTcpTransport.hpp"
+
+namespace AsyncMqttClientInternals {
+// What a client constructed without a transport connects through
+#if defined(ESP32) || defined(ESP8266)
+typedef AsyncTcpTransport DefaultTransport;
+#else
+typedef PosixTcpTransport DefaultTransport;
+#endif
+}  // namespace AsyncMqttClientInternals
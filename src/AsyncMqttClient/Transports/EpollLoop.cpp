@@ -0,0 +1,237 @@
+#include "EpollLoop.hpp"
+
+#if defined(__linux__) && !defined(ESP32) && !defined(ESP8266)
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+using AsyncMqttClientInternals::EpollLoop;
+using AsyncMqttClientInternals::PosixTcpTransport;
+
+EpollLoop::EpollLoop()
+: _epollFd(epoll_create1(EPOLL_CLOEXEC))
+, _wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+, _transports()
+, _acks()
+, _events(static_cast<struct epoll_event*>(allocate(ASYNC_MQTT_EPOLL_EVENTS * sizeof(struct epoll_event), AsyncMqttClientMemoryTag::TRANSPORT)))
+, _eventCount(0)
+, _eventIndex(0)
+, _pollCursor(0)
+, _pollCredit(0)
+, _pollTime(millis())
+, _wakeList(nullptr)
+, _woken(nullptr) {
+  if (_epollFd >= 0 && _wakeFd >= 0) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = this;
+    epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeFd, &event);
+  }
+}
+
+EpollLoop::~EpollLoop() {
+  for (PosixTcpTransport* transport : _transports) {
+    transport->_loop = nullptr;
+    transport->_watchedFd = -1;
+    transport->_ackQueued = false;
+    transport->_wakePending = false;
+  }
+  if (_epollFd >= 0) ::close(_epollFd);
+  if (_wakeFd >= 0) ::close(_wakeFd);
+  release(_events, ASYNC_MQTT_EPOLL_EVENTS * sizeof(struct epoll_event), AsyncMqttClientMemoryTag::TRANSPORT);
+}
+
+bool EpollLoop::add(PosixTcpTransport* transport) {
+  if (_epollFd < 0 || !_events) return false;
+  if (transport->_loop) return transport->_loop == this;
+
+  transport->_loop = this;
+  transport->_watchedFd = -1;
+  transport->_ackQueued = false;
+  _transports.push_back(transport);
+  _update(transport);
+  return true;
+}
+
+void EpollLoop::remove(PosixTcpTransport* transport) {
+  if (transport->_loop != this) return;
+
+  if (transport->_watchedFd >= 0) epoll_ctl(_epollFd, EPOLL_CTL_DEL, transport->_watchedFd, nullptr);
+  transport->_loop = nullptr;
+  transport->_watchedFd = -1;
+  transport->_ackQueued = false;
+
+  for (size_t i = 0; i < _transports.size(); i++) {
+    if (_transports[i] != transport) continue;
+    _transports.erase(_transports.begin() + i);
+    if (i < _pollCursor) _pollCursor--;
+    break;
+  }
+  // entries of the pending acks and of the current batch are only cleared, both are being walked
+  for (PosixTcpTransport*& pending : _acks) {
+    if (pending == transport) pending = nullptr;
+  }
+  for (int i = _eventIndex + 1; i < _eventCount; i++) {
+    if (_events[i].data.ptr == transport) _events[i].data.ptr = nullptr;
+  }
+
+  if (!transport->_wakePending.load(std::memory_order_acquire)) return;
+  // unlink it from the woken transports being walked, or else from the list producers push to
+  PosixTcpTransport** link = &_woken;
+  while (*link && *link != transport) link = &(*link)->_wakeNext;
+  if (*link) {
+    *link = transport->_wakeNext;
+  } else {
+    PosixTcpTransport* woken = _wakeList.exchange(nullptr, std::memory_order_acquire);
+    while (woken) {
+      PosixTcpTransport* next = woken->_wakeNext;
+      if (woken != transport) _pushWake(woken);
+      woken = next;
+    }
+  }
+  transport->_wakePending = false;
+}
+
+size_t EpollLoop::size() const {
+  return _transports.size();
+}
+
+void EpollLoop::loop(int timeout) {
+  _reportAcks();
+
+  int untilPoll = _untilPoll();
+  if (untilPoll >= 0 && (timeout < 0 || untilPoll < timeout)) timeout = untilPoll;
+  if (!_acks.empty()) timeout = 0;
+
+  _eventCount = epoll_wait(_epollFd, _events, ASYNC_MQTT_EPOLL_EVENTS, timeout);
+  for (_eventIndex = 0; _eventIndex < _eventCount; _eventIndex++) {
+    if (_events[_eventIndex].data.ptr == this) {
+      _wakeUp();
+      continue;
+    }
+    PosixTcpTransport* transport = static_cast<PosixTcpTransport*>(_events[_eventIndex].data.ptr);
+    if (!transport) continue;
+    uint32_t events = _events[_eventIndex].events;
+    transport->handleIo(events & EPOLLIN, events & EPOLLOUT, events & (EPOLLERR | EPOLLHUP));
+  }
+  _eventCount = 0;
+  _eventIndex = 0;
+
+  _poll();
+  _reportAcks();
+}
+
+void EpollLoop::_update(PosixTcpTransport* transport) {
+  bool write = transport->_fd >= 0 && (transport->_connecting || transport->_sendTail != transport->_sendHead);
+
+  if (transport->_fd != transport->_watchedFd) {
+    // a closed descriptor leaves the epoll set by itself
+    transport->_watchedFd = -1;
+    if (transport->_fd >= 0) {
+      struct epoll_event event;
+      event.events = EPOLLIN | (write ? EPOLLOUT : 0);
+      event.data.ptr = transport;
+      if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, transport->_fd, &event) == 0) {
+        transport->_watchedFd = transport->_fd;
+        transport->_watchedWrite = write;
+      }
+    }
+  } else if (transport->_fd >= 0 && write != transport->_watchedWrite) {
+    struct epoll_event event;
+    event.events = EPOLLIN | (write ? EPOLLOUT : 0);
+    event.data.ptr = transport;
+    epoll_ctl(_epollFd, EPOLL_CTL_MOD, transport->_fd, &event);
+    transport->_watchedWrite = write;
+  }
+
+  // acks are reported from the loop, never from within send(), without waking up on EPOLLOUT for them
+  if (transport->_unreportedAck != 0 && !transport->_ackQueued) {
+    transport->_ackQueued = true;
+    _acks.push_back(transport);
+  }
+}
+
+void EpollLoop::_wake(PosixTcpTransport* transport) {
+  // any thread: a transport is in the list once until woken, the first one in the list rings the loop
+  if (transport->_wakePending.exchange(true, std::memory_order_acq_rel)) return;
+  if (!_pushWake(transport)) return;
+  uint64_t one = 1;
+  ssize_t written = ::write(_wakeFd, &one, sizeof(one));
+  (void)written;
+}
+
+bool EpollLoop::_pushWake(PosixTcpTransport* transport) {
+  PosixTcpTransport* head = _wakeList.load(std::memory_order_relaxed);
+  do {
+    transport->_wakeNext = head;
+  } while (!_wakeList.compare_exchange_weak(head, transport, std::memory_order_release, std::memory_order_relaxed));
+  return head == nullptr;
+}
+
+void EpollLoop::_wakeUp() {
+  // reset the counter before taking the list: whoever pushes onto the emptied list rings again
+  uint64_t count;
+  ssize_t readBytes = ::read(_wakeFd, &count, sizeof(count));
+  (void)readBytes;
+
+  _woken = _wakeList.exchange(nullptr, std::memory_order_acquire);
+  while (_woken) {
+    PosixTcpTransport* transport = _woken;
+    _woken = transport->_wakeNext;
+    transport->_wakePending.store(false, std::memory_order_release);
+    transport->handlePoll();
+  }
+}
+
+void EpollLoop::_reportAcks() {
+  // only the acks queued so far, a listener sending from onAck queues the next ones
+  size_t count = _acks.size();
+  for (size_t i = 0; i < count; i++) {
+    PosixTcpTransport* transport = _acks[i];
+    if (!transport) continue;
+    _acks[i] = nullptr;
+    transport->_ackQueued = false;
+    transport->_reportAck();
+  }
+  _acks.erase(_acks.begin(), _acks.begin() + count);
+}
+
+void EpollLoop::_poll() {
+  uint32_t now = millis();
+  size_t count = _transports.size();
+  if (count == 0) {
+    _pollCredit = 0;
+    _pollTime = now;
+    return;
+  }
+
+  // every transport is polled once per interval, a slice at a time
+  _pollCredit += static_cast<uint64_t>(now - _pollTime) * count;
+  _pollTime = now;
+  size_t due = _pollCredit / ASYNC_MQTT_POSIX_POLL_INTERVAL;
+  if (due == 0) return;
+  if (due >= count) {
+    due = count;
+    _pollCredit = 0;
+  } else {
+    _pollCredit -= static_cast<uint64_t>(due) * ASYNC_MQTT_POSIX_POLL_INTERVAL;
+  }
+
+  for (; due > 0 && !_transports.empty(); due--) {
+    if (_pollCursor >= _transports.size()) _pollCursor = 0;
+    _transports[_pollCursor++]->handlePoll();
+  }
+}
+
+int EpollLoop::_untilPoll() const {
+  size_t count = _transports.size();
+  if (count == 0) return -1;
+
+  uint64_t missing = _pollCredit < ASYNC_MQTT_POSIX_POLL_INTERVAL ? ASYNC_MQTT_POSIX_POLL_INTERVAL - _pollCredit : 0;
+  uint32_t elapsed = millis() - _pollTime;
+  uint64_t wait = (missing + count - 1) / count;
+  return wait > elapsed ? static_cast<int>(wait - elapsed) : 0;
+}
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#if defined(__linux__) && !defined(ESP32) && !defined(ESP8266)
+
+#include <atomic>
+#include <vector>
+
+#include "PosixTcpTransport.hpp"
+#include "../Memory.hpp"
+
+// Socket events fetched per epoll_wait call
+#ifndef ASYNC_MQTT_EPOLL_EVENTS
+#define ASYNC_MQTT_EPOLL_EVENTS 256
+#endif
+
+struct epoll_event;
+
+namespace AsyncMqttClientInternals {
+// Drives any number of PosixTcpTransport from one thread, for running many clients in a process.
+// Poll events are spread over the interval instead of hitting every connection at once.
+class EpollLoop {
+  friend class PosixTcpTransport;
+
+ public:
+  EpollLoop();
+  ~EpollLoop();
+
+  EpollLoop(EpollLoop const &) = delete;
+  EpollLoop& operator=(EpollLoop const &) = delete;
+
+  // False when the loop could not be set up (out of descriptors or memory)
+  bool add(PosixTcpTransport* transport);
+  void remove(PosixTcpTransport* transport);
+  size_t size() const;
+
+  // Waits at most timeout milliseconds for socket events, then dispatches them, the due polls and the acks
+  void loop(int timeout);
+
+ private:
+  int _epollFd;
+  int _wakeFd;
+  std::vector<PosixTcpTransport*, TaggedAllocator<PosixTcpTransport*, AsyncMqttClientMemoryTag::TRANSPORT>> _transports;
+  std::vector<PosixTcpTransport*, TaggedAllocator<PosixTcpTransport*, AsyncMqttClientMemoryTag::TRANSPORT>> _acks;
+  struct epoll_event* _events;
+  int _eventCount;
+  int _eventIndex;
+  size_t _pollCursor;
+  uint64_t _pollCredit;
+  uint32_t _pollTime;
+  std::atomic<PosixTcpTransport*> _wakeList;
+  PosixTcpTransport* _woken;
+
+  void _update(PosixTcpTransport* transport);
+  void _wake(PosixTcpTransport* transport);
+  bool _pushWake(PosixTcpTransport* transport);
+  void _wakeUp();
+  void _reportAcks();
+  void _poll();
+  int _untilPoll() const;
+};
+}  // namespace AsyncMqttClientInternals
+
+#endif
@@ -0,0 +1,96 @@
+#include "LoopbackTransport.hpp"
+
+using AsyncMqttClientInternals::LoopbackTransport;
+
+LoopbackTransport::LoopbackTransport(size_t capacity)
+: _buffer(new char[capacity])
+, _capacity(capacity)
+, _length(0)
+, _connected(false)
+, _autoAcknowledge(false) {
+}
+
+LoopbackTransport::~LoopbackTransport() {
+  delete[] _buffer;
+}
+
+bool LoopbackTransport::connect(IPAddress ip, uint16_t port, bool secure) {
+  (void)ip;
+  return connect(static_cast<const char*>(nullptr), port, secure);
+}
+
+bool LoopbackTransport::connect(const char* host, uint16_t port, bool secure) {
+  (void)host;
+  (void)port;
+  (void)secure;
+  if (_connected) return false;
+
+  _connected = true;
+  _length = 0;
+  if (_listener) _listener->onTransportConnect();
+  return true;
+}
+
+void LoopbackTransport::close(bool now) {
+  (void)now;
+  if (!_connected) return;
+
+  // the outbound data stays readable until the next connect, e.g. a final DISCONNECT
+  _connected = false;
+  if (_listener) _listener->onTransportDisconnect();
+}
+
+size_t LoopbackTransport::space() {
+  return _connected ? _capacity - _length : 0;
+}
+
+size_t LoopbackTransport::add(const char* data, size_t size) {
+  if (size > space()) size = space();
+  memcpy(_buffer + _length, data, size);
+  _length += size;
+  return size;
+}
+
+bool LoopbackTransport::send() {
+  if (!_connected) return false;
+  if (_autoAcknowledge) acknowledge(_length);
+  return true;
+}
+
+bool LoopbackTransport::connected() const {
+  return _connected;
+}
+
+void LoopbackTransport::deliver(const char* data, size_t len) {
+  // the parser never writes into the received data
+  if (_connected && _listener) _listener->onTransportData(const_cast<char*>(data), len);
+}
+
+void LoopbackTransport::poll() {
+  if (_connected && _listener) _listener->onTransportPoll();
+}
+
+void LoopbackTransport::hangUp() {
+  close(true);
+}
+
+const char* LoopbackTransport::outbound() const {
+  return _buffer;
+}
+
+size_t LoopbackTransport::outboundLength() const {
+  return _length;
+}
+
+void LoopbackTransport::acknowledge(size_t len, uint32_t time) {
+  if (len > _length) len = _length;
+  if (len == 0) return;
+
+  memmove(_buffer, _buffer + len, _length - len);
+  _length -= len;
+  if (_listener) _listener->onTransportAck(len, time);
+}
+
+void LoopbackTransport::setAutoAcknowledge(bool autoAcknowledge) {
+  _autoAcknowledge = autoAcknowledge;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Arduino.h"
+#include "../Transport.hpp"
+
+namespace AsyncMqttClientInternals {
+// In-memory transport, the test or benchmark code plays the broker:
+// it reads what the client sent with outbound(), acknowledges it, and feeds the answers with deliver()
+class LoopbackTransport : public Transport {
+ public:
+  explicit LoopbackTransport(size_t capacity = 5744);
+  ~LoopbackTransport();
+
+  LoopbackTransport(LoopbackTransport const &) = delete;
+  LoopbackTransport& operator=(LoopbackTransport const &) = delete;
+
+  bool connect(IPAddress ip, uint16_t port, bool secure);
+  bool connect(const char* host, uint16_t port, bool secure);
+  void close(bool now);
+
+  size_t space();
+  size_t add(const char* data, size_t size);
+  bool send();
+
+  // Broker side
+  bool connected() const;
+  void deliver(const char* data, size_t len);
+  void poll();
+  void hangUp();
+
+  const char* outbound() const;
+  size_t outboundLength() const;
+  // time: what the transport would report the bytes took, 0 for nothing
+  void acknowledge(size_t len, uint32_t time = 0);
+  void setAutoAcknowledge(bool autoAcknowledge);
+
+ private:
+  char* _buffer;
+  size_t _capacity;
+  size_t _length;
+  bool _connected;
+  bool _autoAcknowledge;
+};
+}  // namespace AsyncMqttClientInternals
@@ -0,0 +1,294 @@
+#include "PosixTcpTransport.hpp"
+#include "EpollLoop.hpp"
+
+#if defined(__linux__) && !defined(ESP32) && !defined(ESP8266)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+using AsyncMqttClientInternals::PosixTcpTransport;
+using AsyncMqttClientInternals::EpollLoop;
+
+PosixTcpTransport::PosixTcpTransport()
+: _fd(-1)
+, _lastError(0)
+, _loop(nullptr)
+, _watchedFd(-1)
+, _watchedWrite(false)
+, _ackQueued(false)
+, _connecting(false)
+, _sendBuffer(nullptr)
+, _sendHead(0)
+, _sendTail(0)
+, _unreportedAck(0)
+, _ackStart(0)
+, _lastPoll(0)
+, _wakeFd(-1)
+, _wakePending(false)
+, _wakeNext(nullptr) {
+}
+
+PosixTcpTransport::~PosixTcpTransport() {
+  if (_loop) _loop->remove(this);
+  if (_fd >= 0) ::close(_fd);
+  if (_wakeFd >= 0) ::close(_wakeFd);
+  release(_sendBuffer, ASYNC_MQTT_POSIX_SEND_BUFFER, AsyncMqttClientMemoryTag::TRANSPORT);
+}
+
+bool PosixTcpTransport::connect(IPAddress ip, uint16_t port, bool secure) {
+  if (_fd >= 0 || secure) return false;
+
+  // allocated on first use, an unused default transport costs no buffer
+  if (!_sendBuffer) _sendBuffer = static_cast<char*>(allocate(ASYNC_MQTT_POSIX_SEND_BUFFER, AsyncMqttClientMemoryTag::TRANSPORT));
+  if (!_sendBuffer) {
+    _lastError = ENOMEM;
+    return false;
+  }
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  uint8_t* addressBytes = reinterpret_cast<uint8_t*>(&address.sin_addr.s_addr);
+  for (uint8_t i = 0; i < 4; i++) addressBytes[i] = ip[i];
+
+  _fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (_fd < 0) {
+    _lastError = errno;
+    return false;
+  }
+  int noDelay = 1;
+  setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+  if (::connect(_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 && errno != EINPROGRESS) {
+    _lastError = errno;
+    ::close(_fd);
+    _fd = -1;
+    return false;
+  }
+
+  // completion is reported once the socket becomes writable, even when it connected right away
+  _connecting = true;
+  _sendHead = _sendTail = 0;
+  _unreportedAck = 0;
+  _lastPoll = millis();
+  _notifyLoop();
+  return true;
+}
+
+bool PosixTcpTransport::connect(const char* host, uint16_t port, bool secure) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo* result = nullptr;
+  if (getaddrinfo(host, nullptr, &hints, &result) != 0 || !result) return false;
+
+  const uint8_t* addressBytes = reinterpret_cast<const uint8_t*>(
+    &reinterpret_cast<struct sockaddr_in*>(result->ai_addr)->sin_addr.s_addr);
+  IPAddress ip(addressBytes[0], addressBytes[1], addressBytes[2], addressBytes[3]);
+  freeaddrinfo(result);
+
+  return connect(ip, port, secure);
+}
+
+void PosixTcpTransport::close(bool now) {
+  if (_fd < 0) return;
+
+  if (!now && !_connecting) _flush();
+  if (_fd < 0) return;
+
+  ::close(_fd);
+  _fd = -1;
+  _connecting = false;
+  _sendHead = _sendTail = 0;
+  _unreportedAck = 0;
+  _notifyLoop();
+  if (_listener) _listener->onTransportDisconnect();
+}
+
+size_t PosixTcpTransport::space() {
+  if (_fd < 0 || _connecting) return 0;
+  return ASYNC_MQTT_POSIX_SEND_BUFFER - (_sendTail - _sendHead);
+}
+
+size_t PosixTcpTransport::add(const char* data, size_t size) {
+  if (size > space()) size = space();
+  if (size == 0) return 0;
+
+  if (_sendTail + size > ASYNC_MQTT_POSIX_SEND_BUFFER) {
+    memmove(_sendBuffer, _sendBuffer + _sendHead, _sendTail - _sendHead);
+    _sendTail -= _sendHead;
+    _sendHead = 0;
+  }
+  memcpy(_sendBuffer + _sendTail, data, size);
+  _sendTail += size;
+  return size;
+}
+
+bool PosixTcpTransport::send() {
+  if (_fd < 0 || _connecting) return false;
+  _flush();
+  return true;
+}
+
+void PosixTcpTransport::wake() {
+  if (_loop) {
+    _loop->_wake(this);
+    return;
+  }
+  // the descriptor only exists once loop() ran, until then there is nothing to wake up
+  int wakeFd = _wakeFd.load(std::memory_order_acquire);
+  if (wakeFd < 0) return;
+  uint64_t one = 1;
+  ssize_t written = ::write(wakeFd, &one, sizeof(one));
+  (void)written;
+}
+
+int PosixTcpTransport::fd() const {
+  return _fd;
+}
+
+int PosixTcpTransport::lastError() const {
+  return _lastError;
+}
+
+bool PosixTcpTransport::wantsWrite() const {
+  return _fd >= 0 && (_connecting || _sendTail != _sendHead || _unreportedAck != 0);
+}
+
+void PosixTcpTransport::handleIo(bool readable, bool writable, bool failed) {
+  if (_fd < 0) return;
+
+  if (_connecting) {
+    if (!writable && !failed) return;
+
+    int error = 0;
+    socklen_t errorLength = sizeof(error);
+    getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &errorLength);
+    if (error != 0) {
+      _fail(error);
+      return;
+    }
+    // a stale event of a previous socket with the same descriptor may land here, make sure
+    struct sockaddr_in peer;
+    socklen_t peerLength = sizeof(peer);
+    if (getpeername(_fd, reinterpret_cast<struct sockaddr*>(&peer), &peerLength) != 0) return;
+
+    _connecting = false;
+    _notifyLoop();
+    if (_listener) _listener->onTransportConnect();
+    if (_fd < 0) return;
+  }
+
+  if (readable || failed) {
+    // one chunk per event, so that many connections sharing a loop are served fairly
+    char buffer[ASYNC_MQTT_POSIX_RECEIVE_CHUNK];
+    ssize_t received = ::recv(_fd, buffer, sizeof(buffer), 0);
+    if (received > 0) {
+      if (_listener) _listener->onTransportData(buffer, received);
+      if (_fd < 0) return;
+    } else if (received == 0) {
+      close(true);
+      return;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      _fail(errno);
+      return;
+    }
+  }
+
+  if (writable) {
+    _flush();
+    if (_fd >= 0) _reportAck();
+  }
+}
+
+void PosixTcpTransport::handlePoll() {
+  _lastPoll = millis();
+  if (_fd < 0 || _connecting) return;
+  _reportAck();
+  if (_fd >= 0 && _listener) _listener->onTransportPoll();
+}
+
+void PosixTcpTransport::loop(int timeout) {
+  if (_fd < 0) {
+    ::poll(nullptr, 0, timeout);
+    return;
+  }
+
+  int32_t untilPoll = ASYNC_MQTT_POSIX_POLL_INTERVAL - static_cast<int32_t>(millis() - _lastPoll);
+  if (untilPoll < 0) untilPoll = 0;
+  if (timeout < 0 || timeout > untilPoll) timeout = untilPoll;
+
+  if (_wakeFd.load(std::memory_order_relaxed) < 0) {
+    _wakeFd.store(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), std::memory_order_release);
+  }
+
+  struct pollfd descriptors[2];
+  descriptors[0].fd = _fd;
+  descriptors[0].events = POLLIN | (wantsWrite() ? POLLOUT : 0);
+  descriptors[0].revents = 0;
+  descriptors[1].fd = _wakeFd.load(std::memory_order_relaxed);
+  descriptors[1].events = POLLIN;
+  descriptors[1].revents = 0;
+  if (::poll(descriptors, 2, timeout) > 0) {
+    short events = descriptors[0].revents;
+    handleIo(events & POLLIN, events & POLLOUT, events & (POLLERR | POLLHUP));
+  }
+
+  // a wake up is an early poll
+  bool woken = false;
+  if (descriptors[1].revents & POLLIN) {
+    uint64_t count;
+    woken = ::read(descriptors[1].fd, &count, sizeof(count)) == sizeof(count);
+  }
+  if (woken || millis() - _lastPoll >= ASYNC_MQTT_POSIX_POLL_INTERVAL) handlePoll();
+}
+
+void PosixTcpTransport::_flush() {
+  while (_sendHead != _sendTail) {
+    ssize_t sent = ::send(_fd, _sendBuffer + _sendHead, _sendTail - _sendHead, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent > 0) {
+      if (_unreportedAck == 0) _ackStart = millis();
+      _sendHead += sent;
+      _unreportedAck += sent;
+    } else if (sent < 0 && errno == EINTR) {
+      continue;
+    } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else {
+      _fail(sent < 0 ? errno : EPIPE);
+      return;
+    }
+  }
+  if (_sendHead == _sendTail) _sendHead = _sendTail = 0;
+  _notifyLoop();
+}
+
+void PosixTcpTransport::_reportAck() {
+  // like lwIP, acks are never reported from within send()
+  if (_unreportedAck == 0) return;
+  size_t acked = _unreportedAck;
+  _unreportedAck = 0;
+  if (_listener) _listener->onTransportAck(acked, millis() - _ackStart);
+}
+
+void PosixTcpTransport::_fail(int error) {
+  _lastError = error;
+  if (_listener) _listener->onTransportError(-1);
+  close(true);
+}
+
+void PosixTcpTransport::_notifyLoop() {
+  if (_loop) _loop->_update(this);
+}
+
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+
+#if defined(__linux__) && !defined(ESP32) && !defined(ESP8266)
+
+#include <atomic>
+
+#include "Arduino.h"
+#include "../Memory.hpp"
+#include "../Transport.hpp"
+
+// Bytes that can be queued before space() reports the socket as full, like the lwIP send buffer
+#ifndef ASYNC_MQTT_POSIX_SEND_BUFFER
+#define ASYNC_MQTT_POSIX_SEND_BUFFER 5744
+#endif
+
+// Largest chunk handed to onData at once, one TCP segment by default
+#ifndef ASYNC_MQTT_POSIX_RECEIVE_CHUNK
+#define ASYNC_MQTT_POSIX_RECEIVE_CHUNK 1460
+#endif
+
+// Interval of the poll event, in milliseconds, as AsyncTCP does
+#ifndef ASYNC_MQTT_POSIX_POLL_INTERVAL
+#define ASYNC_MQTT_POSIX_POLL_INTERVAL 500
+#endif
+
+namespace AsyncMqttClientInternals {
+class EpollLoop;
+
+class PosixTcpTransport : public Transport {
+  friend class EpollLoop;
+
+ public:
+  PosixTcpTransport();
+  ~PosixTcpTransport();
+
+  PosixTcpTransport(PosixTcpTransport const &) = delete;
+  PosixTcpTransport& operator=(PosixTcpTransport const &) = delete;
+
+  bool connect(IPAddress ip, uint16_t port, bool secure);
+  bool connect(const char* host, uint16_t port, bool secure);
+  void close(bool now);
+
+  size_t space();
+  size_t add(const char* data, size_t size);
+  bool send();
+  void wake();
+
+  // Event loop side
+  int fd() const;
+  int lastError() const;
+  bool wantsWrite() const;
+  void handleIo(bool readable, bool writable, bool failed);
+  void handlePoll();
+
+  // Minimal driver for a single connection, waits at most timeout milliseconds for socket events
+  void loop(int timeout);
+
+ private:
+  int _fd;
+  int _lastError;
+  EpollLoop* _loop;
+  int _watchedFd;
+  bool _watchedWrite;
+  bool _ackQueued;
+  bool _connecting;
+  char* _sendBuffer;
+  size_t _sendHead;
+  size_t _sendTail;
+  size_t _unreportedAck;
+  uint32_t _ackStart;
+  uint32_t _lastPoll;
+  std::atomic<int> _wakeFd;
+  std::atomic<bool> _wakePending;
+  PosixTcpTransport* _wakeNext;
+
+  void _flush();
+  void _reportAck();
+  void _fail(int error);
+  void _notifyLoop();
+};
+}  // namespace AsyncMqttClientInternals
+
+#endif
@@ -0,0 +1,93 @@
+#include "AsyncMqttClientManager.hpp"
+
+AsyncMqttClientManager::AsyncMqttClientManager()
+: _timerWheel()
+, _clients()
+, _freeTopicBuffers()
+, _topicBuffers(0)
+, _maxTopicLength(ASYNC_MQTT_MANAGER_MAX_TOPIC_LENGTH)
+, _polling(false) {
+}
+
+AsyncMqttClientManager::~AsyncMqttClientManager() {
+  for (AsyncMqttClient* client : _clients) AsyncMqttClientInternals::destroy(client, AsyncMqttClientMemoryTag::CLIENT);
+  _clients.clear();
+  for (char* buffer : _freeTopicBuffers) AsyncMqttClientInternals::release(buffer, _maxTopicLength + 1, AsyncMqttClientMemoryTag::TOPIC);
+}
+
+AsyncMqttClient& AsyncMqttClientManager::addClient(AsyncMqttClientInternals::Transport* transport) {
+  // a client must be handed out, out of memory aborts like a failed new without exceptions
+  void* storage = AsyncMqttClientInternals::allocate(sizeof(AsyncMqttClient), AsyncMqttClientMemoryTag::CLIENT);
+  if (!storage) abort();
+  AsyncMqttClient* client = new (storage) AsyncMqttClient(transport, this);
+  _clients.push_back(client);
+  _stagger();
+  return *client;
+}
+
+void AsyncMqttClientManager::removeClient(AsyncMqttClient& client) {
+  for (size_t i = 0; i < _clients.size(); i++) {
+    if (_clients[i] != &client) continue;
+    _clients.erase(_clients.begin() + i);
+    AsyncMqttClientInternals::destroy(&client, AsyncMqttClientMemoryTag::CLIENT);
+    _stagger();
+    return;
+  }
+}
+
+size_t AsyncMqttClientManager::size() const {
+  return _clients.size();
+}
+
+AsyncMqttClient& AsyncMqttClientManager::client(size_t index) {
+  return *_clients[index];
+}
+
+AsyncMqttClientManager& AsyncMqttClientManager::setMaxTopicLength(uint16_t maxTopicLength) {
+  // buffers of the old size may be lent, only resize an idle pool
+  if (_freeTopicBuffers.size() != _topicBuffers) return *this;
+
+  for (char* buffer : _freeTopicBuffers) AsyncMqttClientInternals::release(buffer, _maxTopicLength + 1, AsyncMqttClientMemoryTag::TOPIC);
+  _freeTopicBuffers.clear();
+  _topicBuffers = 0;
+  _maxTopicLength = maxTopicLength;
+  for (AsyncMqttClient* client : _clients) client->_parsingInformation.maxTopicLength = maxTopicLength;
+  return *this;
+}
+
+AsyncMqttClientManager& AsyncMqttClientManager::setClock(AsyncMqttClientInternals::ClockFunction clock) {
+  _timerWheel.setClock(clock);
+  return *this;
+}
+
+void AsyncMqttClientManager::poll() {
+  if (_polling) return;
+  _polling = true;
+
+  // fire due keepalive and ping timeout timers of every client, then send their acks
+  _timerWheel.advance();
+  for (size_t i = 0; i < _clients.size(); i++) _clients[i]->_service();
+
+  _polling = false;
+}
+
+char* AsyncMqttClientManager::_acquireTopicBuffer() {
+  if (_freeTopicBuffers.empty()) {
+    // out of memory, the PUBLISH is ignored
+    char* buffer = static_cast<char*>(AsyncMqttClientInternals::allocate(_maxTopicLength + 1, AsyncMqttClientMemoryTag::TOPIC));
+    if (buffer) _topicBuffers++;
+    return buffer;
+  }
+  char* buffer = _freeTopicBuffers.back();
+  _freeTopicBuffers.pop_back();
+  return buffer;
+}
+
+void AsyncMqttClientManager::_releaseTopicBuffer(char* buffer) {
+  _freeTopicBuffers.push_back(buffer);
+}
+
+void AsyncMqttClientManager::_stagger() {
+  // spread the keepalive phases evenly over the clients
+  for (size_t i = 0; i < _clients.size(); i++) _clients[i]->_keepAlivePhase = i * 256 / _clients.size();
+}
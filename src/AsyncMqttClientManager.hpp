@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include "AsyncMqttClient.hpp"
+
+// Largest topic the pooled buffers of a manager hold, for all of its clients
+#ifndef ASYNC_MQTT_MANAGER_MAX_TOPIC_LENGTH
+#define ASYNC_MQTT_MANAGER_MAX_TOPIC_LENGTH 128
+#endif
+
+// Several clients (e.g. a local and a cloud broker) sharing one timer wheel, one pool of topic buffers
+// and one poll. A topic buffer is only lent while a PUBLISH is being parsed, so the pool holds as many
+// buffers as PUBLISH packets are ever parsed at the same time, usually one.
+class AsyncMqttClientManager {
+  friend class AsyncMqttClient;
+
+ public:
+  AsyncMqttClientManager();
+  ~AsyncMqttClientManager();
+
+  AsyncMqttClientManager(AsyncMqttClientManager const &) = delete;
+  AsyncMqttClientManager& operator=(AsyncMqttClientManager const &) = delete;
+
+  AsyncMqttClient& addClient(AsyncMqttClientInternals::Transport* transport = nullptr);
+  void removeClient(AsyncMqttClient& client);
+  size_t size() const;
+  AsyncMqttClient& client(size_t index);
+
+  AsyncMqttClientManager& setMaxTopicLength(uint16_t maxTopicLength);
+  AsyncMqttClientManager& setClock(AsyncMqttClientInternals::ClockFunction clock);
+
+  void poll();
+
+ private:
+  AsyncMqttClientInternals::TimerWheel _timerWheel;
+  std::vector<AsyncMqttClient*, AsyncMqttClientInternals::TaggedAllocator<AsyncMqttClient*, AsyncMqttClientMemoryTag::CLIENT>> _clients;
+  std::vector<char*, AsyncMqttClientInternals::TaggedAllocator<char*, AsyncMqttClientMemoryTag::TOPIC>> _freeTopicBuffers;
+  size_t _topicBuffers;
+  uint16_t _maxTopicLength;
+  bool _polling;
+
+  char* _acquireTopicBuffer();
+  void _releaseTopicBuffer(char* buffer);
+  void _stagger();
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "AsyncMqttClient.hpp"
+
+// Capacities of an AsyncMqttClientT, fixed at compile time. Derive from it to change some of them:
+//   struct SensorConfig : AsyncMqttClientStaticConfig { static const uint16_t MAX_TOPIC_LENGTH = 48; };
+// String lengths exclude the terminating zero.
+struct AsyncMqttClientStaticConfig {
+  // received topics, a longer one is ignored as with setMaxTopicLength()
+  static const uint16_t MAX_TOPIC_LENGTH = 128;
+  // PUBACK, PUBREC, PUBREL and PUBCOMP waiting for room in the transport
+  static const uint16_t ACK_QUEUE_DEPTH = 8;
+  // received QoS 2 messages waiting for their PUBREL
+  static const uint16_t INFLIGHT_WINDOW = 8;
+  static const uint16_t MAX_CLIENT_ID_LENGTH = 23;
+  static const uint16_t MAX_HOST_LENGTH = 64;
+  static const uint16_t MAX_USERNAME_LENGTH = 32;
+  static const uint16_t MAX_PASSWORD_LENGTH = 64;
+  static const uint16_t MAX_WILL_TOPIC_LENGTH = 64;
+  static const uint16_t MAX_WILL_PAYLOAD_LENGTH = 64;
+};
+
+// Selects the plain AsyncMqttClient, which allocates as needed
+struct AsyncMqttClientDynamicConfig {};
+
+// Client holding everything it needs in the object: nothing is allocated by the client itself,
+// from construction on. A setting longer than its capacity is refused and leaves the setting empty.
+template <typename Config = AsyncMqttClientDynamicConfig>
+class AsyncMqttClientT : private AsyncMqttClientInternals::StaticClientStorage<Config>, public AsyncMqttClient {
+ public:
+  AsyncMqttClientT()
+  : AsyncMqttClientT(nullptr) {
+  }
+
+  explicit AsyncMqttClientT(AsyncMqttClientInternals::Transport* transport)
+  : AsyncMqttClientInternals::StaticClientStorage<Config>()
+  , AsyncMqttClient(transport, AsyncMqttClientInternals::StaticClientStorage<Config>::_storage()) {
+  }
+};
+
+template <>
+class AsyncMqttClientT<AsyncMqttClientDynamicConfig> : public AsyncMqttClient {
+ public:
+  AsyncMqttClientT()
+  : AsyncMqttClient() {
+  }
+
+  explicit AsyncMqttClientT(AsyncMqttClientInternals::Transport* transport)
+  : AsyncMqttClient(transport) {
+  }
+};